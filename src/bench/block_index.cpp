@@ -0,0 +1,76 @@
+// Copyright (c) 2020 The Merge Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <chain.h>
+#include <random.h>
+#include <uint256.h>
+#include <validation.h>
+
+#include <memory>
+#include <vector>
+
+// Building the block index as loading it at startup does: an entry per stored
+// header, linked to its parent, with the skip pointers built in height order.
+// The entries come from the block manager's arena, or from one allocation each
+// as they did before.
+
+static const int BLOCK_INDEX_BENCH_BLOCKS = 200000;
+
+static std::vector<uint256> BlockIndexBenchHashes()
+{
+    FastRandomContext rand(true);
+    std::vector<uint256> hashes;
+    hashes.reserve(BLOCK_INDEX_BENCH_BLOCKS);
+    for (int i = 0; i < BLOCK_INDEX_BENCH_BLOCKS; ++i) {
+        hashes.push_back(rand.rand256());
+    }
+    return hashes;
+}
+
+static void LinkBlockIndex(CBlockIndex* pindex, CBlockIndex* pprev, int nHeight)
+{
+    pindex->pprev = pprev;
+    pindex->nHeight = nHeight;
+    pindex->nTime = nHeight * 64;
+    if (pprev) pindex->BuildSkip();
+}
+
+static void BlockIndexLoadArena(benchmark::State& state)
+{
+    const std::vector<uint256> hashes = BlockIndexBenchHashes();
+    LOCK(cs_main);
+    while (state.KeepRunning()) {
+        BlockManager blockman;
+        CBlockIndex* pprev = nullptr;
+        for (int i = 0; i < BLOCK_INDEX_BENCH_BLOCKS; ++i) {
+            CBlockIndex* pindex = blockman.InsertBlockIndex(hashes[i]);
+            LinkBlockIndex(pindex, pprev, i);
+            pprev = pindex;
+        }
+        assert(pprev->GetAncestor(1000)->GetBlockHash() == hashes[1000]);
+        blockman.Unload();
+    }
+}
+
+static void BlockIndexLoadHeap(benchmark::State& state)
+{
+    const std::vector<uint256> hashes = BlockIndexBenchHashes();
+    while (state.KeepRunning()) {
+        BlockMap block_index;
+        std::vector<std::unique_ptr<CBlockIndex>> entries;
+        CBlockIndex* pprev = nullptr;
+        for (int i = 0; i < BLOCK_INDEX_BENCH_BLOCKS; ++i) {
+            entries.emplace_back(new CBlockIndex());
+            CBlockIndex* pindex = entries.back().get();
+            pindex->phashBlock = &block_index.emplace(hashes[i], pindex).first->first;
+            LinkBlockIndex(pindex, pprev, i);
+            pprev = pindex;
+        }
+        assert(pprev->GetAncestor(1000)->GetBlockHash() == hashes[1000]);
+    }
+}
+
+BENCHMARK(BlockIndexLoadArena, 10);
+BENCHMARK(BlockIndexLoadHeap, 10);
@@ -0,0 +1,81 @@
+// Copyright (c) 2020 The Merge Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <bench/data.h>
+
+#include <chainparams.h>
+#include <flatfile.h>
+#include <protocol.h>
+#include <streams.h>
+#include <validation.h>
+
+// Reading one stored block, as serving it to a peer or an RPC client does,
+// with the cached pread reader and with the FILE* that each read used to open.
+
+//! Store the benchmark block in a block file of its own, returning its position
+static FlatFilePos WriteBenchBlock(int nFile)
+{
+    CDataStream stream(benchmark::data::block413567, SER_NETWORK, PROTOCOL_VERSION);
+    CBlock block;
+    stream >> block;
+
+    FlatFilePos pos(nFile, 0);
+    CAutoFile fileout(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
+    assert(!fileout.IsNull());
+    fileout << Params().MessageStart() << (unsigned int)::GetSerializeSize(block, fileout.GetVersion());
+    pos.nPos = 8;
+    fileout << block;
+    return pos;
+}
+
+static void ReadBlockFromDiskPread(benchmark::State& state)
+{
+    const FlatFilePos pos = WriteBenchBlock(9990);
+    while (state.KeepRunning()) {
+        CBlock block;
+        bool read = ReadBlockFromDisk(block, pos, Params().GetConsensus());
+        assert(read);
+    }
+}
+
+static void ReadBlockFromDiskStdio(benchmark::State& state)
+{
+    const FlatFilePos pos = WriteBenchBlock(9991);
+    while (state.KeepRunning()) {
+        CBlock block;
+        CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+        assert(!filein.IsNull());
+        filein >> block;
+    }
+}
+
+static void ReadRawBlockFromDiskPread(benchmark::State& state)
+{
+    const FlatFilePos pos = WriteBenchBlock(9992);
+    while (state.KeepRunning()) {
+        std::vector<uint8_t> block;
+        bool read = ReadRawBlockFromDisk(block, pos, Params().MessageStart());
+        assert(read);
+    }
+}
+
+static void ReadRawBlockFromDiskStdio(benchmark::State& state)
+{
+    const FlatFilePos pos = WriteBenchBlock(9993);
+    while (state.KeepRunning()) {
+        CAutoFile filein(OpenBlockFile(FlatFilePos(pos.nFile, pos.nPos - 8), true), SER_DISK, CLIENT_VERSION);
+        assert(!filein.IsNull());
+        CMessageHeader::MessageStartChars blk_start;
+        unsigned int blk_size;
+        filein >> blk_start >> blk_size;
+        std::vector<uint8_t> block(blk_size);
+        filein.read((char*)block.data(), blk_size);
+    }
+}
+
+BENCHMARK(ReadBlockFromDiskPread, 150);
+BENCHMARK(ReadBlockFromDiskStdio, 150);
+BENCHMARK(ReadRawBlockFromDiskPread, 3000);
+BENCHMARK(ReadRawBlockFromDiskStdio, 3000);
@@ -3,11 +3,13 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <bench/bench.h>
+#include <arith_uint256.h>
 #include <coins.h>
 #include <policy/policy.h>
 #include <script/signingprovider.h>
 #include <test/util/transaction_utils.h>
 
+#include <unordered_map>
 #include <vector>
 
 // Microbenchmark for simple accesses to a CCoinsViewCache database. Note from
@@ -50,3 +52,46 @@ static void CCoinsCaching(benchmark::State& state)
 }
 
 BENCHMARK(CCoinsCaching, 170 * 1000);
+
+// Fill a coins map as a block's worth of cache misses would, look every entry
+// up, and empty it again as a flush does, with the map's nodes allocated from
+// the pool or one malloc each.
+static const uint32_t COINS_MAP_ENTRIES = 20000;
+
+template <typename Map>
+static void FillCoinsMap(Map& map)
+{
+    for (uint32_t i = 0; i < COINS_MAP_ENTRIES; ++i) {
+        COutPoint outpoint(ArithToUint256(arith_uint256(i / 4)), i % 4);
+        CCoinsCacheEntry& entry = map[outpoint];
+        entry.coin.out.nValue = i;
+        entry.coin.out.scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, i & 0xff) << OP_EQUALVERIFY << OP_CHECKSIG;
+        entry.coin.nHeight = 1;
+        entry.flags = CCoinsCacheEntry::DIRTY;
+    }
+    CAmount total = 0;
+    for (uint32_t i = 0; i < COINS_MAP_ENTRIES; ++i) {
+        total += map.find(COutPoint(ArithToUint256(arith_uint256(i / 4)), i % 4))->second.coin.out.nValue;
+    }
+    assert(total == CAmount(COINS_MAP_ENTRIES) * (COINS_MAP_ENTRIES - 1) / 2);
+}
+
+static void CCoinsMapPool(benchmark::State& state)
+{
+    while (state.KeepRunning()) {
+        CCoinsMapMemoryResource resource;
+        CCoinsMap map(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &resource);
+        FillCoinsMap(map);
+    }
+}
+
+static void CCoinsMapMalloc(benchmark::State& state)
+{
+    while (state.KeepRunning()) {
+        std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> map;
+        FillCoinsMap(map);
+    }
+}
+
+BENCHMARK(CCoinsMapPool, 100);
+BENCHMARK(CCoinsMapMalloc, 100);
@@ -5,6 +5,7 @@
 #include <bench/bench.h>
 #include <util/system.h>
 #include <checkqueue.h>
+#include <crypto/sha256.h>
 #include <prevector.h>
 #include <vector>
 #include <boost/thread/thread.hpp>
@@ -59,3 +60,75 @@ static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
     tg.join_all();
 }
 BENCHMARK(CCheckQueueSpeedPrevectorJob, 1400);
+
+static const size_t JOIN_BLOCKS = 16;
+static const size_t JOIN_BLOCK_CHECKS = 200;
+static const int JOIN_CHECK_ROUNDS = 50;
+static const int JOIN_SLOW_CHECK_ROUNDS = 1000;
+static const int JOIN_CONNECT_ROUNDS = 2000;
+
+// A stand-in for a script check, with the occasional expensive one that
+// holds up the join at the end of its block.
+struct HashJob {
+    int nRounds;
+    HashJob() : nRounds(0) {}
+    explicit HashJob(int nRoundsIn) : nRounds(nRoundsIn) {}
+    bool operator()()
+    {
+        unsigned char buf[CSHA256::OUTPUT_SIZE] = {};
+        for (int i = 0; i < nRounds; ++i) {
+            CSHA256().Write(buf, sizeof(buf)).Finalize(buf);
+        }
+        return true;
+    }
+    void swap(HashJob& x) { std::swap(nRounds, x.nRounds); }
+};
+
+// Connects JOIN_BLOCKS blocks, each with some serial work on the calling
+// thread followed by its checks, waiting for the checks of every nWindow
+// blocks together. With nWindow = 1 the check threads sit idle during the
+// serial work and the tail of each join; the difference to the windowed
+// runs at the same thread count is the utilization lost to that.
+static void CCheckQueueJoin(benchmark::State& state, int nThreads, size_t nWindow)
+{
+    CCheckQueue<HashJob> queue {QUEUE_BATCH_SIZE};
+    boost::thread_group tg;
+    // The calling thread takes part in the checks while it waits
+    for (int x = 1; x < nThreads; ++x) {
+       tg.create_thread([&]{queue.Thread();});
+    }
+    FastRandomContext insecure_rand(true);
+    std::vector<std::vector<HashJob>> vBlocks(JOIN_BLOCKS);
+    for (auto& vChecks : vBlocks) {
+        for (size_t x = 0; x < JOIN_BLOCK_CHECKS; ++x) {
+            vChecks.emplace_back(insecure_rand.randrange(100) == 0 ? JOIN_SLOW_CHECK_ROUNDS : JOIN_CHECK_ROUNDS);
+        }
+    }
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < JOIN_BLOCKS; i += nWindow) {
+            CCheckQueueControl<HashJob> control(&queue);
+            for (size_t j = i; j < std::min(i + nWindow, JOIN_BLOCKS); ++j) {
+                HashJob connect(JOIN_CONNECT_ROUNDS);
+                connect();
+                std::vector<HashJob> vChecks(vBlocks[j]);
+                control.Add(vChecks);
+            }
+            control.Wait();
+        }
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+static void CCheckQueueBlockJoin8(benchmark::State& state) { CCheckQueueJoin(state, 8, 1); }
+static void CCheckQueueBlockJoin16(benchmark::State& state) { CCheckQueueJoin(state, 16, 1); }
+static void CCheckQueueBlockJoin32(benchmark::State& state) { CCheckQueueJoin(state, 32, 1); }
+static void CCheckQueueWindowJoin8(benchmark::State& state) { CCheckQueueJoin(state, 8, JOIN_BLOCKS); }
+static void CCheckQueueWindowJoin16(benchmark::State& state) { CCheckQueueJoin(state, 16, JOIN_BLOCKS); }
+static void CCheckQueueWindowJoin32(benchmark::State& state) { CCheckQueueJoin(state, 32, JOIN_BLOCKS); }
+BENCHMARK(CCheckQueueBlockJoin8, 20);
+BENCHMARK(CCheckQueueBlockJoin16, 20);
+BENCHMARK(CCheckQueueBlockJoin32, 20);
+BENCHMARK(CCheckQueueWindowJoin8, 20);
+BENCHMARK(CCheckQueueWindowJoin16, 20);
+BENCHMARK(CCheckQueueWindowJoin32, 20);
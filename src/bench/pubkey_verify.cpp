@@ -0,0 +1,72 @@
+// Copyright (c) 2020 The Merge Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <key.h>
+#include <pubkey.h>
+#include <random.h>
+#include <uint256.h>
+
+#include <assert.h>
+#include <vector>
+
+//! Enough keys that every verification misses the parsed key cache
+static const size_t VERIFY_COLD_KEYS = 4 * MAX_PARSED_PUBKEYS;
+static const size_t VERIFY_HOT_SIGNATURES = 64;
+
+namespace {
+
+struct SignedHash {
+    CPubKey pubkey;
+    uint256 hash;
+    std::vector<unsigned char> sig;
+};
+
+std::vector<SignedHash> MakeSignedHashes(size_t nKeys, size_t nSignatures)
+{
+    FastRandomContext rand(true);
+    std::vector<CKey> keys(nKeys);
+    for (CKey& key : keys) {
+        const std::vector<unsigned char> secret = rand.randbytes(32);
+        key.Set(secret.begin(), secret.end(), true);
+    }
+    std::vector<SignedHash> signatures(nSignatures);
+    for (size_t i = 0; i < nSignatures; ++i) {
+        const CKey& key = keys[i % nKeys];
+        signatures[i].pubkey = key.GetPubKey();
+        signatures[i].hash = rand.rand256();
+        bool ok = key.Sign(signatures[i].hash, signatures[i].sig);
+        assert(ok);
+    }
+    return signatures;
+}
+
+} // namespace
+
+// Signatures by a single key, as a staker's or spork key's.
+static void VerifyPubKeyHot(benchmark::State& state)
+{
+    static const std::vector<SignedHash> signatures = MakeSignedHashes(1, VERIFY_HOT_SIGNATURES);
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        const SignedHash& signature = signatures[i++ % signatures.size()];
+        bool ok = signature.pubkey.Verify(signature.hash, signature.sig);
+        assert(ok);
+    }
+}
+
+// Signatures by keys that are each seen once in a while, as in transactions.
+static void VerifyPubKeyCold(benchmark::State& state)
+{
+    static const std::vector<SignedHash> signatures = MakeSignedHashes(VERIFY_COLD_KEYS, VERIFY_COLD_KEYS);
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        const SignedHash& signature = signatures[i++ % signatures.size()];
+        bool ok = signature.pubkey.Verify(signature.hash, signature.sig);
+        assert(ok);
+    }
+}
+
+BENCHMARK(VerifyPubKeyHot, 20000);
+BENCHMARK(VerifyPubKeyCold, 20000);
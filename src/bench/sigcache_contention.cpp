@@ -0,0 +1,71 @@
+// Copyright (c) 2020 The Merge Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <random.h>
+#include <script/sigcache.h>
+#include <uint256.h>
+
+#include <thread>
+#include <vector>
+
+static const size_t CONTENTION_CACHE_BYTES = 32 << 20;
+static const size_t CONTENTION_ENTRIES = 1 << 16;
+static const size_t CONTENTION_OPS_PER_THREAD = 20000;
+
+// Each thread looks up entries that are mostly in the cache, and inserts one
+// for every ten lookups, as script check threads do while mempool acceptance
+// adds new signatures. A single shard is the cache behind one lock.
+static void SigCacheContention(benchmark::State& state, size_t nShards, int nThreads)
+{
+    ShardedCuckooCache cache(nShards);
+    cache.setup_bytes(CONTENTION_CACHE_BYTES);
+    FastRandomContext rand(true);
+    std::vector<uint256> entries(CONTENTION_ENTRIES);
+    for (size_t i = 0; i < entries.size(); ++i) {
+        entries[i] = rand.rand256();
+        if (i % 10 != 0) cache.insert(entries[i]);
+    }
+    while (state.KeepRunning()) {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < nThreads; ++t) {
+            threads.emplace_back([&cache, &entries, t] {
+                size_t i = t * CONTENTION_OPS_PER_THREAD;
+                for (size_t n = 0; n < CONTENTION_OPS_PER_THREAD; ++n, ++i) {
+                    const uint256& entry = entries[i % entries.size()];
+                    if (n % 10 == 0) {
+                        cache.insert(entry);
+                    } else {
+                        cache.contains(entry, false);
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+}
+
+static void SigCacheContentionSingle1(benchmark::State& state) { SigCacheContention(state, 1, 1); }
+static void SigCacheContentionSingle4(benchmark::State& state) { SigCacheContention(state, 1, 4); }
+static void SigCacheContentionSingle8(benchmark::State& state) { SigCacheContention(state, 1, 8); }
+static void SigCacheContentionSingle16(benchmark::State& state) { SigCacheContention(state, 1, 16); }
+static void SigCacheContentionSingle32(benchmark::State& state) { SigCacheContention(state, 1, 32); }
+static void SigCacheContentionSharded1(benchmark::State& state) { SigCacheContention(state, SIG_CACHE_SHARDS, 1); }
+static void SigCacheContentionSharded4(benchmark::State& state) { SigCacheContention(state, SIG_CACHE_SHARDS, 4); }
+static void SigCacheContentionSharded8(benchmark::State& state) { SigCacheContention(state, SIG_CACHE_SHARDS, 8); }
+static void SigCacheContentionSharded16(benchmark::State& state) { SigCacheContention(state, SIG_CACHE_SHARDS, 16); }
+static void SigCacheContentionSharded32(benchmark::State& state) { SigCacheContention(state, SIG_CACHE_SHARDS, 32); }
+
+BENCHMARK(SigCacheContentionSingle1, 50);
+BENCHMARK(SigCacheContentionSingle4, 20);
+BENCHMARK(SigCacheContentionSingle8, 10);
+BENCHMARK(SigCacheContentionSingle16, 5);
+BENCHMARK(SigCacheContentionSingle32, 2);
+BENCHMARK(SigCacheContentionSharded1, 50);
+BENCHMARK(SigCacheContentionSharded4, 20);
+BENCHMARK(SigCacheContentionSharded8, 10);
+BENCHMARK(SigCacheContentionSharded16, 5);
+BENCHMARK(SigCacheContentionSharded32, 2);
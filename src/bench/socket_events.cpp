@@ -0,0 +1,160 @@
+// Copyright (c) 2020 The Merge Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <compat.h>
+
+#ifndef WIN32
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
+#ifdef USE_POLL
+#include <poll.h>
+#endif
+
+#include <assert.h>
+#include <vector>
+
+#ifndef WIN32
+namespace {
+
+/**
+ * A set of idle connected sockets, as the socket handler sees them with every
+ * peer connected: only one of them has data waiting to be read.
+ */
+class SocketSet
+{
+public:
+    std::vector<int> sockets;
+
+    explicit SocketSet(size_t nSockets)
+    {
+        // Both ends of every pair stay open, so twice the fds are needed
+        struct rlimit limit;
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < 2 * nSockets + 64) {
+            limit.rlim_cur = std::min<rlim_t>(limit.rlim_max, 2 * nSockets + 64);
+            setrlimit(RLIMIT_NOFILE, &limit);
+        }
+        for (size_t i = 0; i < nSockets; ++i) {
+            int fds[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) break;
+            sockets.push_back(fds[0]);
+            m_peers.push_back(fds[1]);
+        }
+        if (!IsComplete(nSockets)) return;
+        char c = 0;
+        if (write(m_peers.back(), &c, 1) != 1) m_peers.clear();
+    }
+
+    ~SocketSet()
+    {
+        for (int fd : sockets) close(fd);
+        for (int fd : m_peers) close(fd);
+    }
+
+    //! Whether the process had enough file descriptors for the whole set.
+    bool IsComplete(size_t nSockets) const { return sockets.size() == nSockets && m_peers.size() == nSockets; }
+
+private:
+    std::vector<int> m_peers;
+};
+
+} // namespace
+
+static void SocketEventsSelect(benchmark::State& state, size_t nSockets)
+{
+    SocketSet set(nSockets);
+    if (!set.IsComplete(nSockets) || set.sockets.back() >= FD_SETSIZE) {
+        while (state.KeepRunning()) {}
+        return;
+    }
+    while (state.KeepRunning()) {
+        fd_set fdsetRecv;
+        FD_ZERO(&fdsetRecv);
+        int hSocketMax = 0;
+        for (int fd : set.sockets) {
+            FD_SET(fd, &fdsetRecv);
+            hSocketMax = std::max(hSocketMax, fd);
+        }
+        struct timeval timeout = {0, 0};
+        int nReady = select(hSocketMax + 1, &fdsetRecv, nullptr, nullptr, &timeout);
+        assert(nReady == 1);
+    }
+}
+
+#ifdef USE_POLL
+static void SocketEventsPoll(benchmark::State& state, size_t nSockets)
+{
+    SocketSet set(nSockets);
+    if (!set.IsComplete(nSockets)) {
+        while (state.KeepRunning()) {}
+        return;
+    }
+    while (state.KeepRunning()) {
+        std::vector<struct pollfd> vpollfds;
+        vpollfds.reserve(set.sockets.size());
+        for (int fd : set.sockets) {
+            vpollfds.emplace_back();
+            vpollfds.back().fd = fd;
+            vpollfds.back().events = POLLIN;
+        }
+        int nReady = poll(vpollfds.data(), vpollfds.size(), 0);
+        assert(nReady == 1);
+    }
+}
+#endif
+
+#ifdef USE_EPOLL
+static void SocketEventsEpoll(benchmark::State& state, size_t nSockets)
+{
+    SocketSet set(nSockets);
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (!set.IsComplete(nSockets) || epoll_fd == -1) {
+        while (state.KeepRunning()) {}
+        if (epoll_fd != -1) close(epoll_fd);
+        return;
+    }
+    // Registration happens once per connection, outside of the loop
+    for (int fd : set.sockets) {
+        struct epoll_event event;
+        event.data.fd = fd;
+        event.events = EPOLLIN;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    }
+    struct epoll_event events[64];
+    while (state.KeepRunning()) {
+        int nReady = epoll_wait(epoll_fd, events, 64, 0);
+        assert(nReady == 1);
+    }
+    close(epoll_fd);
+}
+#endif
+
+static void SocketEventsSelect125(benchmark::State& state) { SocketEventsSelect(state, 125); }
+static void SocketEventsSelect1000(benchmark::State& state) { SocketEventsSelect(state, 1000); }
+BENCHMARK(SocketEventsSelect125, 20 * 1000);
+BENCHMARK(SocketEventsSelect1000, 2 * 1000);
+
+#ifdef USE_POLL
+static void SocketEventsPoll125(benchmark::State& state) { SocketEventsPoll(state, 125); }
+static void SocketEventsPoll1000(benchmark::State& state) { SocketEventsPoll(state, 1000); }
+static void SocketEventsPoll5000(benchmark::State& state) { SocketEventsPoll(state, 5000); }
+BENCHMARK(SocketEventsPoll125, 20 * 1000);
+BENCHMARK(SocketEventsPoll1000, 2 * 1000);
+BENCHMARK(SocketEventsPoll5000, 500);
+#endif
+
+#ifdef USE_EPOLL
+static void SocketEventsEpoll125(benchmark::State& state) { SocketEventsEpoll(state, 125); }
+static void SocketEventsEpoll1000(benchmark::State& state) { SocketEventsEpoll(state, 1000); }
+static void SocketEventsEpoll5000(benchmark::State& state) { SocketEventsEpoll(state, 5000); }
+BENCHMARK(SocketEventsEpoll125, 200 * 1000);
+BENCHMARK(SocketEventsEpoll1000, 200 * 1000);
+BENCHMARK(SocketEventsEpoll5000, 200 * 1000);
+#endif
+#endif // WIN32
@@ -0,0 +1,224 @@
+// Copyright (c) 2020 The Merge Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <arith_uint256.h>
+#include <bench/bench.h>
+#include <chain.h>
+#include <chainparams.h>
+#include <pos/cache.h>
+#include <pos/kernel.h>
+#include <primitives/block.h>
+#include <primitives/transaction.h>
+#include <random.h>
+#include <streams.h>
+#include <util/system.h>
+#include <validation.h>
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const int STAKE_CHAIN_LENGTH = 2000;
+static const size_t STAKE_CANDIDATES = 256;
+//! Far below any real staking difficulty, so each search covers the whole drift window.
+static const unsigned int STAKE_BENCH_BITS = 0x1b00ffff;
+
+namespace {
+
+struct StakeCandidate {
+    CBlock blockFrom;
+    CTransactionRef txPrev;
+    COutPoint prevout;
+};
+
+/**
+ * Synthetic staking chain on top of the regtest genesis block, using the main
+ * network staking parameters. Every block generates a stake modifier, and the
+ * candidates' coins are all mature at the time of the search. The modifier
+ * cache hits and misses of the run are printed to stderr when it ends.
+ */
+class StakeSimulation
+{
+public:
+    std::vector<StakeCandidate> candidates;
+    unsigned int nTimeTx;
+    unsigned int nHashDrift;
+
+    explicit StakeSimulation(const std::string& name) : m_name(name)
+    {
+        SelectParams(CBaseChainParams::MAIN);
+        nHashDrift = Params().GetConsensus().nMaxHashDrift;
+
+        LOCK(cs_main);
+        FastRandomContext rand(true);
+        m_genesis = ::ChainActive().Tip();
+        CBlockIndex* pprev = m_genesis;
+        std::vector<CBlock> blocks;
+        for (int i = 1; i <= STAKE_CHAIN_LENGTH; ++i) {
+            CBlock block;
+            block.nVersion = 4;
+            block.hashPrevBlock = pprev->GetBlockHash();
+            block.nTime = m_genesis->nTime + i * MODIFIER_INTERVAL;
+            block.nBits = STAKE_BENCH_BITS;
+            block.nNonce = i;
+            m_index.emplace_back(new CBlockIndex(block));
+            CBlockIndex* pindex = m_index.back().get();
+            pindex->phashBlock = &::BlockIndex().emplace(block.GetHash(), pindex).first->first;
+            pindex->pprev = pprev;
+            pindex->nHeight = i;
+            pindex->SetStakeModifier(rand.rand64() | 1, true);
+            blocks.push_back(block);
+            pprev = pindex;
+        }
+        ::ChainActive().SetTip(pprev);
+        nTimeTx = pprev->nTime + MODIFIER_INTERVAL;
+
+        // Leave enough blocks after each candidate for the modifier selection interval
+        const int nMaxHeight = STAKE_CHAIN_LENGTH - std::max<int>(GetStakeModifierSelectionInterval(), Params().GetConsensus().nMinStakeAge) / MODIFIER_INTERVAL - 1;
+        assert(nMaxHeight > 0);
+        for (size_t i = 0; i < STAKE_CANDIDATES; ++i) {
+            CMutableTransaction tx;
+            tx.vout.emplace_back(1 + rand.randrange(1000 * COIN), CScript());
+            tx.nLockTime = i;
+            StakeCandidate candidate;
+            candidate.blockFrom = blocks[rand.randrange(nMaxHeight)];
+            candidate.txPrev = MakeTransactionRef(std::move(tx));
+            candidate.prevout = COutPoint(candidate.txPrev->GetHash(), 0);
+            candidates.push_back(std::move(candidate));
+        }
+        InitSmartstakeCache();
+    }
+
+    ~StakeSimulation()
+    {
+        CountCache();
+        if (m_cache_hits + m_cache_misses > 0) {
+            tfm::format(std::cerr, "%s: modifier cache %d hits, %d misses (%.1f%% hit rate)\n", m_name, m_cache_hits, m_cache_misses,
+                100.0 * m_cache_hits / (m_cache_hits + m_cache_misses));
+        }
+        InitSmartstakeCache();
+        LOCK(cs_main);
+        ::ChainActive().SetTip(m_genesis);
+        for (const auto& pindex : m_index) {
+            const uint256 hash = pindex->GetBlockHash();
+            ::BlockIndex().erase(hash);
+        }
+        SelectParams(CBaseChainParams::REGTEST);
+    }
+
+    bool Search(const StakeCandidate& candidate) const
+    {
+        unsigned int nTime = nTimeTx;
+        uint256 hashProofOfStake;
+        return CheckStakeKernelHash(STAKE_BENCH_BITS, candidate.blockFrom, candidate.txPrev, candidate.prevout, nTime, nHashDrift, false, hashProofOfStake);
+    }
+
+    //! Drop every cached modifier, keeping the hit and miss counts so far.
+    void FlushCache()
+    {
+        CountCache();
+        InitSmartstakeCache();
+    }
+
+private:
+    const std::string m_name;
+    int64_t m_cache_hits{0};
+    int64_t m_cache_misses{0};
+
+    void CountCache()
+    {
+        m_cache_hits += cacheHit.exchange(0);
+        m_cache_misses += cacheMiss.exchange(0);
+    }
+
+    CBlockIndex* m_genesis;
+    std::vector<std::unique_ptr<CBlockIndex>> m_index;
+};
+
+} // namespace
+
+// Modifier lookups once every candidate's modifier is cached.
+static void StakeModifierCached(benchmark::State& state)
+{
+    StakeSimulation sim(state.m_name);
+    size_t i = 0;
+    uint64_t nStakeModifier;
+    int nStakeModifierHeight;
+    int64_t nStakeModifierTime;
+    while (state.KeepRunning()) {
+        const StakeCandidate& candidate = sim.candidates[i++ % sim.candidates.size()];
+        bool ok = GetSmartstakeModifier(candidate.blockFrom.GetHash(), nStakeModifier, nStakeModifierHeight, nStakeModifierTime);
+        assert(ok);
+    }
+}
+
+// Modifier lookups that always walk the chain, as after a cache flush.
+static void StakeModifierUncached(benchmark::State& state)
+{
+    StakeSimulation sim(state.m_name);
+    size_t i = 0;
+    uint64_t nStakeModifier;
+    int nStakeModifierHeight;
+    int64_t nStakeModifierTime;
+    while (state.KeepRunning()) {
+        const StakeCandidate& candidate = sim.candidates[i++ % sim.candidates.size()];
+        sim.FlushCache();
+        bool ok = GetSmartstakeModifier(candidate.blockFrom.GetHash(), nStakeModifier, nStakeModifierHeight, nStakeModifierTime);
+        assert(ok);
+    }
+}
+
+// A single kernel hash and target comparison.
+static void StakeKernelHash(benchmark::State& state)
+{
+    StakeSimulation sim(state.m_name);
+    arith_uint256 bnTargetPerCoinDay;
+    bnTargetPerCoinDay.SetCompact(STAKE_BENCH_BITS);
+    const uint256 target = ArithToUint256(bnTargetPerCoinDay);
+    CDataStream ss(SER_GETHASH, 0);
+    ss << FastRandomContext(true).rand64();
+    const StakeCandidate& candidate = sim.candidates.front();
+    unsigned int nTime = sim.nTimeTx;
+    while (state.KeepRunning()) {
+        uint256 hashProofOfStake = stakeHash(nTime++, ss, candidate.prevout.n, candidate.prevout.hash, candidate.blockFrom.nTime);
+        stakeTargetHit(hashProofOfStake, candidate.txPrev->vout[0].nValue, target);
+    }
+}
+
+// A full CheckStakeKernelHash search over the drift window of one candidate.
+static void StakeKernelSearch(benchmark::State& state)
+{
+    StakeSimulation sim(state.m_name);
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        sim.Search(sim.candidates[i++ % sim.candidates.size()]);
+    }
+}
+
+// Searches over every candidate, spread across -stakethreads threads.
+static void StakeKernelSearchThreads(benchmark::State& state)
+{
+    StakeSimulation sim(state.m_name);
+    const int nThreads = std::max<int64_t>(gArgs.GetArg("-stakethreads", GetNumCores()), 1);
+    while (state.KeepRunning()) {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < nThreads; ++t) {
+            threads.emplace_back([&sim, t, nThreads] {
+                for (size_t i = t; i < sim.candidates.size(); i += nThreads) {
+                    sim.Search(sim.candidates[i]);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+}
+
+BENCHMARK(StakeModifierCached, 200 * 1000);
+BENCHMARK(StakeModifierUncached, 20 * 1000);
+BENCHMARK(StakeKernelHash, 1000 * 1000);
+BENCHMARK(StakeKernelSearch, 20 * 1000);
+BENCHMARK(StakeKernelSearchThreads, 100);
@@ -18,13 +18,19 @@
 
 CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID) :
         nonce(GetRand(std::numeric_limits<uint64_t>::max())),
-        shorttxids(block.vtx.size() - 1), prefilledtxn(1), header(block) {
+        header(block), vchBlockSig(block.vchBlockSig) {
     FillShortTxIDSelector();
     //TODO: Use our mempool prior to block acceptance to predictively fill more than just the coinbase
-    prefilledtxn[0] = {0, block.vtx[0]};
-    for (size_t i = 1; i < block.vtx.size(); i++) {
+    // The coinstake is never in the receiver's mempool, so it is always prefilled too
+    const size_t nPrefilled = block.IsProofOfStake() ? 2 : 1;
+    prefilledtxn.resize(nPrefilled);
+    shorttxids.resize(block.vtx.size() - nPrefilled);
+    for (size_t i = 0; i < nPrefilled; i++) {
+        prefilledtxn[i] = {0, block.vtx[i]};
+    }
+    for (size_t i = nPrefilled; i < block.vtx.size(); i++) {
         const CTransaction& tx = *block.vtx[i];
-        shorttxids[i - 1] = GetShortID(fUseWTXID ? tx.GetWitnessHash() : tx.GetHash());
+        shorttxids[i - nPrefilled] = GetShortID(fUseWTXID ? tx.GetWitnessHash() : tx.GetHash());
     }
 }
 
@@ -74,6 +80,12 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
     }
     prefilled_count = cmpctblock.prefilledtxn.size();
 
+    // A proof-of-stake block rebuilt without its signature can never be accepted,
+    // so fetch the full block right away instead of after a getblocktxn round trip
+    if (txn_available.size() > 1 && txn_available[1] && txn_available[1]->IsCoinStake() && cmpctblock.vchBlockSig.empty())
+        return READ_STATUS_FAILED;
+    vchBlockSig = cmpctblock.vchBlockSig;
+
     // Calculate map of txids -> positions and check mempool to see what we have (or don't)
     // Because well-formed cmpctblock messages will have a (relatively) uniform distribution
     // of short IDs, any highly-uneven distribution of elements can be safely treated as a
@@ -189,13 +201,20 @@ ReadStatus PartiallyDownloadedBlock::FillBlock(CBlock& block, const std::vector<
             block.vtx[i] = std::move(txn_available[i]);
     }
 
+    if (block.IsProofOfStake())
+        block.vchBlockSig = std::move(vchBlockSig);
+
     // Make sure we can't call FillBlock again.
     header.SetNull();
     txn_available.clear();
+    vchBlockSig.clear();
 
     if (vtx_missing.size() != tx_missing_offset)
         return READ_STATUS_INVALID;
 
+    if (block.IsProofOfStake() && block.vchBlockSig.empty())
+        return READ_STATUS_FAILED; // Sent by a peer that cannot relay the signature
+
     BlockValidationState state;
     if (!CheckBlock(block, state, Params().GetConsensus())) {
         // TODO: We really want to just check merkle tree manually here,
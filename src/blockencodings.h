@@ -10,6 +10,13 @@
 
 class CTxMemPool;
 
+//! SENDCMPCT version by which a peer announces that its cmpctblock messages carry
+//! the proof-of-stake block signature. It does not select a transaction encoding.
+static const uint64_t CMPCTBLOCK_VERSION_BLOCKSIG = 3;
+
+//! Stream version flag selecting the cmpctblock encoding with the block signature
+static const int SERIALIZE_CMPCTBLOCK_BLOCKSIG = 0x20000000;
+
 // Transaction compression schemes for compact block relay can be introduced by writing
 // an actual formatter here.
 using TransactionCompression = DefaultFormatter;
@@ -100,6 +107,7 @@ public:
     static constexpr int SHORTTXIDS_LENGTH = 6;
 
     CBlockHeader header;
+    std::vector<unsigned char> vchBlockSig;
 
     // Dummy for deserialization
     CBlockHeaderAndShortTxIDs() {}
@@ -113,6 +121,9 @@ public:
     SERIALIZE_METHODS(CBlockHeaderAndShortTxIDs, obj)
     {
         READWRITE(obj.header, obj.nonce, Using<VectorFormatter<CustomUintFormatter<SHORTTXIDS_LENGTH>>>(obj.shorttxids), obj.prefilledtxn);
+        if (s.GetVersion() & SERIALIZE_CMPCTBLOCK_BLOCKSIG) {
+            READWRITE(obj.vchBlockSig);
+        }
         if (ser_action.ForRead()) {
             if (obj.BlockTxCount() > std::numeric_limits<uint16_t>::max()) {
                 throw std::ios_base::failure("indexes overflowed 16 bits");
@@ -127,6 +138,7 @@ protected:
     std::vector<CTransactionRef> txn_available;
     size_t prefilled_count = 0, mempool_count = 0, extra_count = 0;
     const CTxMemPool* pool;
+    std::vector<unsigned char> vchBlockSig;
 public:
     CBlockHeader header;
     explicit PartiallyDownloadedBlock(CTxMemPool* poolIn) : pool(poolIn) {}
@@ -0,0 +1,159 @@
+// Copyright (c) 2020 The Merge Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockpipeline.h>
+
+#include <blocksignature.h>
+#include <chainparams.h>
+#include <consensus/validation.h>
+#include <primitives/block.h>
+#include <util/system.h>
+#include <util/time.h>
+#include <validation.h>
+
+std::unique_ptr<CBlockPipeline> g_block_pipeline;
+
+CBlockPipeline::CBlockPipeline(const CChainParams& chainparams, int nCheckThreads)
+    : m_chainparams(chainparams), m_check_threads(nCheckThreads), m_start_time(GetTimeMicros()),
+      m_interrupt(false), m_checking(0), m_connecting(false)
+{
+    for (int i = 0; i < m_check_threads; ++i) {
+        m_threads.emplace_back(&TraceThread<std::function<void()> >, "blockchk", std::function<void()>(std::bind(&CBlockPipeline::ThreadCheck, this)));
+    }
+    m_threads.emplace_back(&TraceThread<std::function<void()> >, "blockconn", std::function<void()>(std::bind(&CBlockPipeline::ThreadConnect, this)));
+}
+
+CBlockPipeline::~CBlockPipeline()
+{
+    Interrupt();
+    Stop();
+}
+
+bool CBlockPipeline::Submit(const std::shared_ptr<const CBlock>& pblock, const uint256& hash, bool fForceProcessing, Callback callback)
+{
+    std::shared_ptr<Entry> entry = std::make_shared<Entry>();
+    entry->pblock = pblock;
+    entry->hash = hash;
+    entry->fForceProcessing = fForceProcessing;
+    entry->callback = std::move(callback);
+    entry->fChecked = false;
+
+    WAIT_LOCK(m_mutex, lock);
+    m_cond.wait(lock, [this]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return m_interrupt || m_blocks.size() < MAX_PIPELINE_BLOCKS; });
+    if (m_interrupt) return false;
+    m_blocks.push_back(entry);
+    m_to_check.push_back(entry);
+    ++m_queued_hashes[hash];
+    m_cond.notify_all();
+    return true;
+}
+
+bool CBlockPipeline::IsQueued(const uint256& hash) const
+{
+    LOCK(m_mutex);
+    return m_queued_hashes.count(hash);
+}
+
+CBlockPipelineStats CBlockPipeline::GetStats() const
+{
+    CBlockPipelineStats stats;
+    stats.nCheckThreads = m_check_threads;
+    {
+        LOCK(m_mutex);
+        stats.nCheckQueued = m_to_check.size();
+        stats.nChecking = m_checking;
+        stats.nConnectQueued = m_blocks.size() - m_to_check.size() - m_checking;
+        stats.fConnecting = m_connecting;
+    }
+    stats.nBlocksChecked = m_blocks_checked;
+    stats.nBlocksConnected = m_blocks_connected;
+    stats.nCheckMicros = m_check_micros;
+    stats.nConnectMicros = m_connect_micros;
+    stats.nConnectStallMicros = m_connect_stall_micros;
+    stats.nUptimeMicros = GetTimeMicros() - m_start_time;
+    return stats;
+}
+
+void CBlockPipeline::Interrupt()
+{
+    LOCK(m_mutex);
+    m_interrupt = true;
+    m_cond.notify_all();
+}
+
+void CBlockPipeline::Stop()
+{
+    for (std::thread& thread : m_threads) {
+        if (thread.joinable()) thread.join();
+    }
+    m_threads.clear();
+
+    // Blocks still queued are dropped: they will be requested again
+    LOCK(m_mutex);
+    m_blocks.clear();
+    m_to_check.clear();
+    m_queued_hashes.clear();
+}
+
+void CBlockPipeline::ThreadCheck()
+{
+    while (true) {
+        std::shared_ptr<Entry> entry;
+        {
+            WAIT_LOCK(m_mutex, lock);
+            m_cond.wait(lock, [this]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return m_interrupt || !m_to_check.empty(); });
+            if (m_interrupt) return;
+            entry = m_to_check.front();
+            m_to_check.pop_front();
+            ++m_checking;
+        }
+
+        // Failures are not acted on here: ProcessNewBlock runs the checks
+        // again for a block that did not pass them, and reports the result.
+        const int64_t nTimeStart = GetTimeMicros();
+        BlockValidationState state;
+        if (CheckBlockSignature(*entry->pblock)) {
+            CheckBlock(*entry->pblock, state, m_chainparams.GetConsensus());
+        }
+        m_check_micros += GetTimeMicros() - nTimeStart;
+        ++m_blocks_checked;
+
+        LOCK(m_mutex);
+        entry->fChecked = true;
+        --m_checking;
+        m_cond.notify_all();
+    }
+}
+
+void CBlockPipeline::ThreadConnect()
+{
+    while (true) {
+        std::shared_ptr<Entry> entry;
+        {
+            WAIT_LOCK(m_mutex, lock);
+            // Waiting on a block that is still being checked is a stall,
+            // waiting on an empty pipeline is not
+            const bool fStalled = !m_blocks.empty();
+            const int64_t nTimeWait = GetTimeMicros();
+            m_cond.wait(lock, [this]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return m_interrupt || (!m_blocks.empty() && m_blocks.front()->fChecked); });
+            if (m_interrupt) return;
+            if (fStalled) m_connect_stall_micros += GetTimeMicros() - nTimeWait;
+            entry = m_blocks.front();
+            m_blocks.pop_front();
+            m_connecting = true;
+        }
+
+        const int64_t nTimeStart = GetTimeMicros();
+        bool fNewBlock = false;
+        ProcessNewBlock(m_chainparams, entry->pblock, entry->fForceProcessing, &fNewBlock);
+        if (entry->callback) entry->callback(fNewBlock);
+        m_connect_micros += GetTimeMicros() - nTimeStart;
+        ++m_blocks_connected;
+
+        LOCK(m_mutex);
+        if (--m_queued_hashes[entry->hash] == 0) m_queued_hashes.erase(entry->hash);
+        m_connecting = false;
+        m_cond.notify_all();
+    }
+}
@@ -0,0 +1,126 @@
+// Copyright (c) 2020 The Merge Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKPIPELINE_H
+#define BITCOIN_BLOCKPIPELINE_H
+
+#include <sync.h>
+#include <uint256.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+
+class CBlock;
+class CChainParams;
+
+/** Default for -blockcheckthreads, threads running context-free block checks during IBD (0 = disabled) */
+static const int DEFAULT_BLOCK_CHECK_THREADS = 0;
+/** Maximum number of block check threads */
+static const int MAX_BLOCK_CHECK_THREADS = 16;
+/** Maximum number of blocks in the pipeline before submitting a block waits for room */
+static const size_t MAX_PIPELINE_BLOCKS = 128;
+
+class CBlockPipelineStats
+{
+public:
+    int nCheckThreads;
+    //! Blocks waiting for a check thread
+    size_t nCheckQueued;
+    //! Blocks being checked
+    size_t nChecking;
+    //! Checked blocks waiting for the connect thread
+    size_t nConnectQueued;
+    //! Whether the connect thread is processing a block
+    bool fConnecting;
+    uint64_t nBlocksChecked;
+    uint64_t nBlocksConnected;
+    //! Time spent by all check threads, in microseconds
+    int64_t nCheckMicros;
+    //! Time spent in ProcessNewBlock by the connect thread, in microseconds
+    int64_t nConnectMicros;
+    //! Time the connect thread waited for the oldest block's checks, in microseconds
+    int64_t nConnectStallMicros;
+    //! Time since the pipeline was started, in microseconds
+    int64_t nUptimeMicros;
+};
+
+/**
+ * Staged processing of the blocks downloaded during initial block download.
+ *
+ * The context-free checks of a block (block signature, header hash, merkle
+ * root and transaction checks) run on a pool of check threads as soon as it
+ * is submitted. A single connect thread passes blocks to ProcessNewBlock in
+ * the order they were submitted, once their checks have completed, which
+ * leaves only contextual validation and connection on its critical path.
+ *
+ * A block is owned by the pipeline from Submit() until it is connected: the
+ * check threads may set CBlock::fChecked without cs_main because nothing else
+ * refers to the block in the meantime.
+ */
+class CBlockPipeline
+{
+public:
+    //! Called on the connect thread with the result of ProcessNewBlock
+    typedef std::function<void(bool fNewBlock)> Callback;
+
+    CBlockPipeline(const CChainParams& chainparams, int nCheckThreads);
+    ~CBlockPipeline();
+
+    /**
+     * Queue a block for checking and connection. Waits while the pipeline is
+     * full. Returns false, without queueing the block, once interrupted.
+     */
+    bool Submit(const std::shared_ptr<const CBlock>& pblock, const uint256& hash, bool fForceProcessing, Callback callback);
+    //! Whether a block with this hash is in the pipeline, and so need not be downloaded again
+    bool IsQueued(const uint256& hash) const;
+    CBlockPipelineStats GetStats() const;
+
+    void Interrupt();
+    void Stop();
+
+private:
+    struct Entry {
+        std::shared_ptr<const CBlock> pblock;
+        uint256 hash;
+        bool fForceProcessing;
+        Callback callback;
+        bool fChecked;
+    };
+
+    void ThreadCheck();
+    void ThreadConnect();
+
+    const CChainParams& m_chainparams;
+    const int m_check_threads;
+    const int64_t m_start_time;
+
+    mutable Mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_interrupt GUARDED_BY(m_mutex);
+    //! All blocks in the pipeline, in connection order
+    std::deque<std::shared_ptr<Entry>> m_blocks GUARDED_BY(m_mutex);
+    //! Blocks waiting for a check thread
+    std::deque<std::shared_ptr<Entry>> m_to_check GUARDED_BY(m_mutex);
+    std::map<uint256, int> m_queued_hashes GUARDED_BY(m_mutex);
+    size_t m_checking GUARDED_BY(m_mutex);
+    bool m_connecting GUARDED_BY(m_mutex);
+
+    std::atomic<uint64_t> m_blocks_checked{0};
+    std::atomic<uint64_t> m_blocks_connected{0};
+    std::atomic<int64_t> m_check_micros{0};
+    std::atomic<int64_t> m_connect_micros{0};
+    std::atomic<int64_t> m_connect_stall_micros{0};
+
+    std::vector<std::thread> m_threads;
+};
+
+extern std::unique_ptr<CBlockPipeline> g_block_pipeline;
+
+#endif // BITCOIN_BLOCKPIPELINE_H
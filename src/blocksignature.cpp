@@ -4,6 +4,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <blocksignature.h>
+#include <script/sigcache.h>
 #include <script/signingprovider.h>
 #include <validation.h>
 
@@ -44,13 +45,22 @@ bool SignBlock(CBlock& block, const SigningProvider& keystore)
     if (!keystore.GetKey(keyID, key))
         return error("%s: failed to get key from keystore", __func__);
 
-    if (!key.Sign(block.GetHash(), block.vchBlockSig))
+    const uint256 hashBlock = block.GetHash();
+    if (!key.Sign(hashBlock, block.vchBlockSig))
         return error("%s: failed to sign block hash with key", __func__);
 
+    // CKey::Sign does not verify the signature it produces. Verify it here,
+    // outside of cs_main, so that processing our own block finds it in the
+    // cache instead of verifying it again.
+    const CPubKey pubkey = key.GetPubKey();
+    if (!pubkey.Verify(hashBlock, block.vchBlockSig))
+        return error("%s: failed to verify the block signature", __func__);
+    AddToSignatureCache(pubkey, hashBlock, block.vchBlockSig);
+
     return true;
 }
 
-bool CheckBlockSignature(const CBlock& block)
+bool CheckBlockSignature(const CBlock& block, bool fCacheStore)
 {
     if (block.IsProofOfWork())
         return block.vchBlockSig.empty();
@@ -72,6 +82,6 @@ bool CheckBlockSignature(const CBlock& block)
     if (!pubkey.IsValid())
         return error("%s: invalid pubkey %s", __func__, HexStr(pubkey));
 
-    return pubkey.Verify(block.GetHash(), block.vchBlockSig);
+    return CachingVerifySignature(pubkey, block.GetHash(), block.vchBlockSig, fCacheStore);
 }
 
@@ -11,6 +11,12 @@
 #include <script/signingprovider.h>
 
 bool SignBlock(CBlock& block, const SigningProvider& keystore);
-bool CheckBlockSignature(const CBlock& block);
+/**
+ * Check the signature of a proof-of-stake block against the key of its
+ * coinstake output. Results are looked up in and, with fCacheStore, added to
+ * the signature cache, so a block seen again (compact block reconstruction,
+ * re-requests during a reorg) is not verified twice.
+ */
+bool CheckBlockSignature(const CBlock& block, bool fCacheStore = true);
 
 #endif // BLOCKSIGNATURE_H
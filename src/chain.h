@@ -134,6 +134,11 @@ enum BlockStatus: uint32_t {
     BLOCK_FAILED_MASK        =   BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
 
     BLOCK_OPT_WITNESS       =   128, //!< block data in blk*.data was received with a witness-enforcing client
+
+    //! At or below the base of a UTXO set snapshot loaded with loadtxoutset. Such a block counts as
+    //! BLOCK_VALID_TRANSACTIONS so that the chain can be built on it, but it was neither downloaded nor
+    //! validated, and its data is usually not available.
+    BLOCK_ASSUMED_VALID     =   256,
 };
 
 /** The block chain is a tree shaped structure starting with the
@@ -208,6 +213,7 @@ public:
         BLOCK_PROOF_OF_STAKE = (1 << 0), // is proof-of-stake block
         BLOCK_STAKE_ENTROPY = (1 << 1),  // entropy bit for stake modifier
         BLOCK_STAKE_MODIFIER = (1 << 2), // regenerated stake modifier
+        BLOCK_PROOF_HASH = (1 << 3),     // hashProofOfStake is known and stored on disk
     };
 
     CBlockIndex()
@@ -369,6 +375,13 @@ public:
         nStakeModifier = nModifier;
         if (fGeneratedStakeModifier)
             nFlags |= BLOCK_STAKE_MODIFIER;
+        else
+            nFlags &= ~BLOCK_STAKE_MODIFIER;
+    }
+
+    void SetProofOfStakeHash(const uint256& hashProof) {
+        hashProofOfStake = hashProof;
+        nFlags |= BLOCK_PROOF_HASH;
     }
 
     arith_uint256 GetBlockTrust() const;
@@ -433,6 +446,10 @@ public:
         READWRITE(obj.nTime);
         READWRITE(obj.nBits);
         READWRITE(obj.nNonce);
+
+        // Appended after the header so that records written without it remain
+        // readable, and older versions simply ignore the trailing bytes.
+        if (obj.nFlags & BLOCK_PROOF_HASH) READWRITE(obj.hashProofOfStake);
     }
 
     uint256 GetBlockHash() const
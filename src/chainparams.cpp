@@ -171,6 +171,9 @@ public:
             /* nTxCount */ 1461516,
             /* dTxRate  */ 0.0323599884537105,
         };
+
+        m_assumeutxo_data = MapAssumeutxo{
+        };
     }
 };
 
@@ -264,6 +267,9 @@ public:
             /* nTxCount */ 13483,
             /* dTxRate  */ 0.08523187013249722,
         };
+
+        m_assumeutxo_data = MapAssumeutxo{
+        };
     }
 };
 
@@ -330,6 +336,9 @@ public:
         chainTxData = ChainTxData{
         };
 
+        m_assumeutxo_data = MapAssumeutxo{
+        };
+
         base58Prefixes[PUBKEY_ADDRESS] = std::vector<unsigned char>(1,111);
         base58Prefixes[SCRIPT_ADDRESS] = std::vector<unsigned char>(1,196);
         base58Prefixes[SECRET_KEY] =     std::vector<unsigned char>(1,239);
@@ -393,6 +402,26 @@ void CRegTestParams::UpdateActivationParametersFromArgs(const ArgsManager& args)
     }
 }
 
+void CChainParams::UpdateAssumeutxoFromArgs(const ArgsManager& args)
+{
+    for (const std::string& strSnapshot : args.GetArgs("-assumeutxo")) {
+        std::vector<std::string> vSnapshotParams;
+        boost::split(vSnapshotParams, strSnapshot, boost::is_any_of(":"));
+        if (vSnapshotParams.size() != 2) {
+            throw std::runtime_error("Assumeutxo parameters malformed, expecting height:hash");
+        }
+        int32_t nHeight;
+        if (!ParseInt32(vSnapshotParams[0], &nHeight) || nHeight <= 0) {
+            throw std::runtime_error(strprintf("Invalid assumeutxo height (%s)", vSnapshotParams[0]));
+        }
+        if (vSnapshotParams[1].size() != 64 || !IsHex(vSnapshotParams[1])) {
+            throw std::runtime_error(strprintf("Invalid assumeutxo hash (%s)", vSnapshotParams[1]));
+        }
+        m_assumeutxo_data[nHeight] = uint256S(vSnapshotParams[1]);
+        LogPrintf("Accepting UTXO set snapshots at height %d with hash %s\n", nHeight, vSnapshotParams[1]);
+    }
+}
+
 static std::unique_ptr<const CChainParams> globalChainParams;
 
 const CChainParams &Params() {
@@ -402,13 +431,17 @@ const CChainParams &Params() {
 
 std::unique_ptr<const CChainParams> CreateChainParams(const std::string& chain)
 {
+    std::unique_ptr<CChainParams> params;
     if (chain == CBaseChainParams::MAIN)
-        return std::unique_ptr<CChainParams>(new CMainParams());
+        params.reset(new CMainParams());
     else if (chain == CBaseChainParams::TESTNET)
-        return std::unique_ptr<CChainParams>(new CTestNetParams());
+        params.reset(new CTestNetParams());
     else if (chain == CBaseChainParams::REGTEST)
-        return std::unique_ptr<CChainParams>(new CRegTestParams(gArgs));
-    throw std::runtime_error(strprintf("%s: Unknown chain %s.", __func__, chain));
+        params.reset(new CRegTestParams(gArgs));
+    else
+        throw std::runtime_error(strprintf("%s: Unknown chain %s.", __func__, chain));
+    params->UpdateAssumeutxoFromArgs(gArgs);
+    return std::move(params);
 }
 
 void SelectParams(const std::string& network)
@@ -14,6 +14,8 @@
 #include <memory>
 #include <vector>
 
+class ArgsManager;
+
 struct SeedSpec6 {
     uint8_t addr[16];
     uint16_t port;
@@ -25,6 +27,12 @@ struct CCheckpointData {
     MapCheckpoints mapCheckpoints;
 };
 
+/**
+ * Hashes of UTXO set snapshots known to be valid, by the height of their base
+ * block. A snapshot's hash is reported by dumptxoutset. See loadtxoutset.
+ */
+typedef std::map<int, uint256> MapAssumeutxo;
+
 /**
  * Holds various statistics on transactions within a chain. Used to estimate
  * verification progress during chain sync.
@@ -86,6 +94,9 @@ public:
     const std::vector<SeedSpec6>& FixedSeeds() const { return vFixedSeeds; }
     const CCheckpointData& Checkpoints() const { return checkpointData; }
     const ChainTxData& TxData() const { return chainTxData; }
+    const MapAssumeutxo& Assumeutxo() const { return m_assumeutxo_data; }
+    /** Add the snapshot hashes given with -assumeutxo=<height>:<hash> to the built-in ones */
+    void UpdateAssumeutxoFromArgs(const ArgsManager& args);
     int FulfilledRequestExpireTime() const { return nFulfilledRequestExpireTime; }
     std::string SporkKey() const { return strSporkKey; }
 
@@ -110,6 +121,7 @@ protected:
     bool m_is_mockable_chain;
     CCheckpointData checkpointData;
     ChainTxData chainTxData;
+    MapAssumeutxo m_assumeutxo_data;
     int nFulfilledRequestExpireTime;
     std::string strSporkKey;
 };
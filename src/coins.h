@@ -12,6 +12,7 @@
 #include <crypto/siphash.h>
 #include <memusage.h>
 #include <serialize.h>
+#include <support/allocators/pool.h>
 #include <uint256.h>
 
 #include <assert.h>
@@ -98,6 +99,38 @@ public:
     }
 };
 
+/**
+ * Encoding of an unspent Coin in the chainstate database.
+ *
+ * Serialized format:
+ * - VARINT((coinbase ? 1 : 0) | (coinstake ? 2 : 0) | (height << 2))
+ * - the non-spent CTxOut (via WitnessTxOutCompression)
+ *
+ * Unlike Coin's own serialization, kept for undo data and UTXO snapshots, the
+ * coinstake flag needs no byte of its own and witness v0 outputs are stored
+ * as special scripts.
+ */
+struct CoinDBFormatter
+{
+    template<typename Stream>
+    void Ser(Stream& s, const Coin& coin) {
+        assert(!coin.IsSpent());
+        uint64_t code = uint64_t{coin.nHeight} * 4 + (coin.fCoinStake ? 2 : 0) + coin.fCoinBase;
+        s << VARINT(code);
+        s << Using<WitnessTxOutCompression>(coin.out);
+    }
+
+    template<typename Stream>
+    void Unser(Stream& s, Coin& coin) {
+        uint64_t code = 0;
+        s >> VARINT(code);
+        coin.nHeight = code >> 2;
+        coin.fCoinStake = (code >> 1) & 1;
+        coin.fCoinBase = code & 1;
+        s >> Using<WitnessTxOutCompression>(coin.out);
+    }
+};
+
 class SaltedOutpointHasher
 {
 private:
@@ -144,7 +177,16 @@ struct CCoinsCacheEntry
     explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0) {}
 };
 
-typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
+/**
+ * Cache entries are allocated from a PoolResource rather than one malloc each.
+ * The largest block must fit a node of the map, with or without a cached hash.
+ */
+typedef PoolAllocator<std::pair<const COutPoint, CCoinsCacheEntry>,
+                      sizeof(std::pair<const COutPoint, CCoinsCacheEntry>) + sizeof(void*) * 4,
+                      alignof(void*)>
+    CCoinsMapAllocator;
+typedef CCoinsMapAllocator::ResourceType CCoinsMapMemoryResource;
+typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher, std::equal_to<COutPoint>, CCoinsMapAllocator> CCoinsMap;
 
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor
@@ -231,6 +273,8 @@ protected:
      * declared as "const".
      */
     mutable uint256 hashBlock;
+    //! Backs the entries of cacheCoins, so must be declared before it
+    mutable CCoinsMapMemoryResource m_cache_coins_memory_resource;
     mutable CCoinsMap cacheCoins;
 
     /* Cached dynamic memory usage for the inner Coin objects. */
@@ -279,6 +323,13 @@ public:
      */
     void AddCoin(const COutPoint& outpoint, Coin&& coin, bool potential_overwrite);
 
+    /**
+     * Cache an unspent coin that was read from the backing view elsewhere, as
+     * if it had been fetched through this cache. Nothing is changed if the
+     * outpoint is already cached.
+     */
+    void AddFetchedCoin(const COutPoint& outpoint, Coin&& coin);
+
     /**
      * Spend a coin. Pass moveto in order to get the deleted data.
      * If no unspent output exists for the passed outpoint, this call
@@ -302,6 +353,9 @@ public:
     //! Calculate the size of the cache (in number of transaction outputs)
     unsigned int GetCacheSize() const;
 
+    //! Append the outpoints of the unspent coins in the cache to outpoints
+    void GetUnspentOutpoints(std::vector<COutPoint>& outpoints) const;
+
     //! Calculate the size of the cache (in bytes)
     size_t DynamicMemoryUsage() const;
 
@@ -324,6 +378,12 @@ private:
      * memory usage.
      */
     CCoinsMap::iterator FetchCoin(const COutPoint &outpoint) const;
+
+    /**
+     * Give the memory of the emptied cache back to the system. Erasing the
+     * entries only returns their blocks to the pool.
+     */
+    void ReallocateCache();
 };
 
 //! Utility function to add all of a transaction's outputs to a cache.
@@ -96,7 +96,7 @@ typedef char* sockopt_arg_type;
 #endif
 
 bool static inline IsSelectableSocket(const SOCKET& s) {
-#if defined(USE_POLL) || defined(WIN32)
+#if defined(USE_EPOLL) || defined(USE_POLL) || defined(WIN32)
     return true;
 #else
     return (s < FD_SETSIZE);
@@ -52,7 +52,25 @@ static bool IsToPubKey(const CScript& script, CPubKey &pubkey)
     return false;
 }
 
-bool CompressScript(const CScript& script, std::vector<unsigned char> &out)
+static bool IsToWitnessKeyHash(const CScript& script, uint160& hash)
+{
+    if (script.size() == 22 && script[0] == OP_0 && script[1] == 20) {
+        memcpy(hash.begin(), &script[2], 20);
+        return true;
+    }
+    return false;
+}
+
+static bool IsToWitnessScriptHash(const CScript& script, uint256& hash)
+{
+    if (script.size() == 34 && script[0] == OP_0 && script[1] == 32) {
+        memcpy(hash.begin(), &script[2], 32);
+        return true;
+    }
+    return false;
+}
+
+bool CompressScript(const CScript& script, std::vector<unsigned char> &out, unsigned int nSpecialScripts)
 {
     CKeyID keyID;
     if (IsToKeyID(script, keyID)) {
@@ -80,14 +98,29 @@ bool CompressScript(const CScript& script, std::vector<unsigned char> &out)
             return true;
         }
     }
+    if (nSpecialScripts < SPECIAL_SCRIPTS_WITNESS) return false;
+    uint160 witness_keyhash;
+    if (IsToWitnessKeyHash(script, witness_keyhash)) {
+        out.resize(21);
+        out[0] = 0x06;
+        memcpy(&out[1], witness_keyhash.begin(), 20);
+        return true;
+    }
+    uint256 witness_scripthash;
+    if (IsToWitnessScriptHash(script, witness_scripthash)) {
+        out.resize(33);
+        out[0] = 0x07;
+        memcpy(&out[1], witness_scripthash.begin(), 32);
+        return true;
+    }
     return false;
 }
 
 unsigned int GetSpecialScriptSize(unsigned int nSize)
 {
-    if (nSize == 0 || nSize == 1)
+    if (nSize == 0 || nSize == 1 || nSize == 6)
         return 20;
-    if (nSize == 2 || nSize == 3 || nSize == 4 || nSize == 5)
+    if (nSize == 2 || nSize == 3 || nSize == 4 || nSize == 5 || nSize == 7)
         return 32;
     return 0;
 }
@@ -120,7 +153,7 @@ bool DecompressScript(CScript& script, unsigned int nSize, const std::vector<uns
         script[34] = OP_CHECKSIG;
         return true;
     case 0x04:
-    case 0x05:
+    case 0x05: {
         unsigned char vch[33] = {};
         vch[0] = nSize - 2;
         memcpy(&vch[1], in.data(), 32);
@@ -134,6 +167,19 @@ bool DecompressScript(CScript& script, unsigned int nSize, const std::vector<uns
         script[66] = OP_CHECKSIG;
         return true;
     }
+    case 0x06:
+        script.resize(22);
+        script[0] = OP_0;
+        script[1] = 20;
+        memcpy(&script[2], in.data(), 20);
+        return true;
+    case 0x07:
+        script.resize(34);
+        script[0] = OP_0;
+        script[1] = 32;
+        memcpy(&script[2], in.data(), 32);
+        return true;
+    }
     return false;
 }
 
@@ -11,7 +11,12 @@
 #include <serialize.h>
 #include <span.h>
 
-bool CompressScript(const CScript& script, std::vector<unsigned char> &out);
+/** Number of special script kinds in the original encoding, kept by undo data */
+static const unsigned int SPECIAL_SCRIPTS_BASE = 6;
+/** Number of special script kinds including witness v0 outputs, used by the chainstate database */
+static const unsigned int SPECIAL_SCRIPTS_WITNESS = 8;
+
+bool CompressScript(const CScript& script, std::vector<unsigned char> &out, unsigned int nSpecialScripts = SPECIAL_SCRIPTS_BASE);
 unsigned int GetSpecialScriptSize(unsigned int nSize);
 bool DecompressScript(CScript& script, unsigned int nSize, const std::vector<unsigned char> &out);
 
@@ -35,24 +40,24 @@ uint64_t DecompressAmount(uint64_t nAmount);
  *  * Pay to pubkey hash (encoded as 21 bytes)
  *  * Pay to script hash (encoded as 21 bytes)
  *  * Pay to pubkey starting with 0x02, 0x03 or 0x04 (encoded as 33 bytes)
+ *  With SPECIAL_SCRIPTS_WITNESS, 2 more are defined:
+ *  * Pay to witness v0 pubkey hash (encoded as 21 bytes)
+ *  * Pay to witness v0 script hash (encoded as 33 bytes)
  *
  *  Other scripts up to 121 bytes require 1 byte + script length. Above
  *  that, scripts up to 16505 bytes require 2 bytes + script length.
+ *  As script lengths are offset by the number of special cases, the two
+ *  encodings are not compatible.
  */
-struct ScriptCompression
+template <unsigned int SPECIAL_SCRIPTS>
+struct BasicScriptCompression
 {
-    /**
-     * make this static for now (there are only 6 special scripts defined)
-     * this can potentially be extended together with a new nVersion for
-     * transactions, in which case this value becomes dependent on nVersion
-     * and nHeight of the enclosing transaction.
-     */
-    static const unsigned int nSpecialScripts = 6;
+    static const unsigned int nSpecialScripts = SPECIAL_SCRIPTS;
 
     template<typename Stream>
     void Ser(Stream &s, const CScript& script) {
         std::vector<unsigned char> compr;
-        if (CompressScript(script, compr)) {
+        if (CompressScript(script, compr, nSpecialScripts)) {
             s << MakeSpan(compr);
             return;
         }
@@ -97,10 +102,17 @@ struct AmountCompression
     }
 };
 
+typedef BasicScriptCompression<SPECIAL_SCRIPTS_BASE> ScriptCompression;
+typedef BasicScriptCompression<SPECIAL_SCRIPTS_WITNESS> WitnessScriptCompression;
+
 /** wrapper for CTxOut that provides a more compact serialization */
-struct TxOutCompression
+template <typename ScriptFormatter>
+struct BasicTxOutCompression
 {
-    FORMATTER_METHODS(CTxOut, obj) { READWRITE(Using<AmountCompression>(obj.nValue), Using<ScriptCompression>(obj.scriptPubKey)); }
+    FORMATTER_METHODS(CTxOut, obj) { READWRITE(Using<AmountCompression>(obj.nValue), Using<ScriptFormatter>(obj.scriptPubKey)); }
 };
 
+typedef BasicTxOutCompression<ScriptCompression> TxOutCompression;
+typedef BasicTxOutCompression<WitnessScriptCompression> WitnessTxOutCompression;
+
 #endif // BITCOIN_COMPRESSOR_H
@@ -0,0 +1,179 @@
+// Copyright (c) 2020 The Merge Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <crypto/muhash.h>
+
+#include <crypto/chacha20.h>
+#include <crypto/common.h>
+#include <crypto/sha256.h>
+
+#include <limits>
+
+namespace {
+
+typedef unsigned __int128 double_limb_t;
+
+/** 2^3072 - p */
+constexpr uint64_t MAX_PRIME_DIFF = 1103717;
+
+/** Add a to the number in limbs, returning the carry out of the top limb */
+uint64_t AddSmall(uint64_t* limbs, int n, uint64_t a)
+{
+    for (int i = 0; i < n && a; ++i) {
+        limbs[i] += a;
+        a = limbs[i] < a;
+    }
+    return a;
+}
+
+} // namespace
+
+constexpr size_t Num3072::BYTE_SIZE;
+constexpr int Num3072::LIMBS;
+
+Num3072::Num3072(const unsigned char (&data)[BYTE_SIZE])
+{
+    for (int i = 0; i < LIMBS; ++i) {
+        limbs[i] = ReadLE64(data + 8 * i);
+    }
+}
+
+void Num3072::SetToOne()
+{
+    limbs[0] = 1;
+    for (int i = 1; i < LIMBS; ++i) {
+        limbs[i] = 0;
+    }
+}
+
+bool Num3072::IsOverflow() const
+{
+    if (limbs[0] <= std::numeric_limits<uint64_t>::max() - MAX_PRIME_DIFF) return false;
+    for (int i = 1; i < LIMBS; ++i) {
+        if (limbs[i] != std::numeric_limits<uint64_t>::max()) return false;
+    }
+    return true;
+}
+
+void Num3072::FullReduce()
+{
+    // Subtracting p is adding 2^3072 - p and dropping the carry
+    if (IsOverflow()) AddSmall(limbs, LIMBS, MAX_PRIME_DIFF);
+}
+
+void Num3072::Multiply(const Num3072& a)
+{
+    uint64_t product[2 * LIMBS] = {0};
+    for (int i = 0; i < LIMBS; ++i) {
+        uint64_t carry = 0;
+        for (int j = 0; j < LIMBS; ++j) {
+            const double_limb_t t = (double_limb_t)limbs[i] * a.limbs[j] + product[i + j] + carry;
+            product[i + j] = (uint64_t)t;
+            carry = (uint64_t)(t >> 64);
+        }
+        product[i + LIMBS] = carry;
+    }
+
+    // 2^3072 is 2^3072 - p modulo p, so the high half folds into the low
+    // half multiplied by that small difference.
+    uint64_t carry = 0;
+    for (int i = 0; i < LIMBS; ++i) {
+        const double_limb_t t = (double_limb_t)product[i + LIMBS] * MAX_PRIME_DIFF + product[i] + carry;
+        limbs[i] = (uint64_t)t;
+        carry = (uint64_t)(t >> 64);
+    }
+    while (carry) {
+        carry = AddSmall(limbs, LIMBS, carry * MAX_PRIME_DIFF);
+    }
+    FullReduce();
+}
+
+Num3072 Num3072::GetInverse() const
+{
+    // By Fermat's little theorem, the inverse is this to the power p - 2. The
+    // exponent is raised four bits at a time, from the most significant.
+    uint64_t exponent[LIMBS];
+    exponent[0] = 0 - MAX_PRIME_DIFF - 2;
+    for (int i = 1; i < LIMBS; ++i) {
+        exponent[i] = std::numeric_limits<uint64_t>::max();
+    }
+
+    Num3072 powers[16];
+    for (int i = 1; i < 16; ++i) {
+        powers[i] = powers[i - 1];
+        powers[i].Multiply(*this);
+    }
+
+    Num3072 out;
+    for (int i = LIMBS * 64 - 4; i >= 0; i -= 4) {
+        for (int j = 0; j < 4; ++j) {
+            out.Multiply(out);
+        }
+        const int window = (exponent[i / 64] >> (i % 64)) & 0xf;
+        if (window) out.Multiply(powers[window]);
+    }
+    return out;
+}
+
+void Num3072::Divide(const Num3072& a)
+{
+    Multiply(a.GetInverse());
+}
+
+void Num3072::ToBytes(unsigned char (&out)[BYTE_SIZE]) const
+{
+    for (int i = 0; i < LIMBS; ++i) {
+        WriteLE64(out + 8 * i, limbs[i]);
+    }
+}
+
+Num3072 MuHash3072::ToNum3072(Span<const unsigned char> in)
+{
+    unsigned char hashed_in[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(in.data(), in.size()).Finalize(hashed_in);
+    unsigned char tmp[Num3072::BYTE_SIZE];
+    ChaCha20(hashed_in, sizeof(hashed_in)).Keystream(tmp, Num3072::BYTE_SIZE);
+    return Num3072(tmp);
+}
+
+MuHash3072::MuHash3072(Span<const unsigned char> in) noexcept
+{
+    m_numerator = ToNum3072(in);
+}
+
+MuHash3072& MuHash3072::Insert(Span<const unsigned char> in) noexcept
+{
+    m_numerator.Multiply(ToNum3072(in));
+    return *this;
+}
+
+MuHash3072& MuHash3072::Remove(Span<const unsigned char> in) noexcept
+{
+    m_denominator.Multiply(ToNum3072(in));
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator*=(const MuHash3072& mul) noexcept
+{
+    m_numerator.Multiply(mul.m_numerator);
+    m_denominator.Multiply(mul.m_denominator);
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator/=(const MuHash3072& div) noexcept
+{
+    m_numerator.Multiply(div.m_denominator);
+    m_denominator.Multiply(div.m_numerator);
+    return *this;
+}
+
+void MuHash3072::Finalize(uint256& out) noexcept
+{
+    m_numerator.Divide(m_denominator);
+    m_denominator.SetToOne();
+
+    unsigned char data[Num3072::BYTE_SIZE];
+    m_numerator.ToBytes(data);
+    CSHA256().Write(data, sizeof(data)).Finalize(out.begin());
+}
@@ -0,0 +1,97 @@
+// Copyright (c) 2020 The Merge Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#include <serialize.h>
+#include <span.h>
+#include <uint256.h>
+
+#include <stdint.h>
+
+/** An integer modulo the prime 2^3072 - 1103717, stored in little-endian 64-bit limbs */
+class Num3072
+{
+public:
+    static constexpr size_t BYTE_SIZE = 384;
+    static constexpr int LIMBS = 48;
+
+private:
+    uint64_t limbs[LIMBS];
+
+    //! Whether the value is p or more, and needs a final subtraction
+    bool IsOverflow() const;
+    void FullReduce();
+
+public:
+    //! Interpret 384 little-endian bytes as a number
+    explicit Num3072(const unsigned char (&data)[BYTE_SIZE]);
+    Num3072() { SetToOne(); }
+
+    void SetToOne();
+    void Multiply(const Num3072& a);
+    //! Multiply by the inverse of a, which must not be zero
+    void Divide(const Num3072& a);
+    Num3072 GetInverse() const;
+    void ToBytes(unsigned char (&out)[BYTE_SIZE]) const;
+
+    SERIALIZE_METHODS(Num3072, obj)
+    {
+        for (auto& limb : obj.limbs) {
+            READWRITE(limb);
+        }
+    }
+};
+
+/**
+ * A hash of a set of byte strings, which can be updated as elements are added
+ * to or removed from the set, in any order.
+ *
+ * Each element is hashed to a number modulo a 3072-bit prime. The set hash
+ * is the product of the numbers of the elements added, divided by that of the
+ * elements removed, and then hashed with SHA256. The product and the divisor
+ * are kept apart, so that only Finalize() needs a modular inversion, which is
+ * by far the most expensive operation.
+ *
+ * Two MuHash3072 objects can be combined with *= and /=, so the changes to a
+ * set can be collected separately, for instance per block, and applied later.
+ *
+ * See https://cseweb.ucsd.edu/~mihir/papers/inchash.pdf for the construction
+ * and its security.
+ */
+class MuHash3072
+{
+private:
+    Num3072 m_numerator;
+    Num3072 m_denominator;
+
+    Num3072 ToNum3072(Span<const unsigned char> in);
+
+public:
+    /** The hash of the empty set */
+    MuHash3072() noexcept {}
+
+    /** The hash of the set containing only in */
+    explicit MuHash3072(Span<const unsigned char> in) noexcept;
+
+    MuHash3072& Insert(Span<const unsigned char> in) noexcept;
+    MuHash3072& Remove(Span<const unsigned char> in) noexcept;
+
+    /** Add the elements of another set */
+    MuHash3072& operator*=(const MuHash3072& mul) noexcept;
+    /** Remove the elements of another set */
+    MuHash3072& operator/=(const MuHash3072& div) noexcept;
+
+    /** Compute the 256-bit hash of the set. This also normalizes the state. */
+    void Finalize(uint256& out) noexcept;
+
+    SERIALIZE_METHODS(MuHash3072, obj)
+    {
+        READWRITE(obj.m_numerator);
+        READWRITE(obj.m_denominator);
+    }
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
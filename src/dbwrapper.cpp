@@ -6,6 +6,7 @@
 
 #include <memory>
 #include <random.h>
+#include <sync.h>
 
 #include <leveldb/cache.h>
 #include <leveldb/env.h>
@@ -13,6 +14,8 @@
 #include <memenv.h>
 #include <stdint.h>
 #include <algorithm>
+#include <set>
+#include <sstream>
 
 class CBitcoinLevelDBLogger : public leveldb::Logger {
 public:
@@ -97,12 +100,15 @@ static void SetMaxOpenFiles(leveldb::Options *options) {
              options->max_open_files, default_open_files);
 }
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+static leveldb::Options GetOptions(size_t nCacheSize, const DBProfile& profile)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
+    const size_t block_cache_size = nCacheSize * profile.block_cache_percent / 100;
+    options.block_cache = leveldb::NewLRUCache(block_cache_size);
+    options.write_buffer_size = (nCacheSize - block_cache_size) / 2; // up to two write buffers may be held in memory simultaneously
+    options.block_size = profile.block_size;
+    options.max_file_size = profile.max_file_size;
+    options.filter_policy = profile.bloom_bits > 0 ? leveldb::NewBloomFilterPolicy(profile.bloom_bits) : nullptr;
     options.compression = leveldb::kNoCompression;
     options.info_log = new CBitcoinLevelDBLogger();
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
@@ -114,15 +120,21 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate)
-    : m_name{path.stem().string()}
+namespace {
+//! Every open database, for GetLevelDBStats
+Mutex g_dbwrappers_mutex;
+std::set<const CDBWrapper*> g_dbwrappers GUARDED_BY(g_dbwrappers_mutex);
+} // namespace
+
+CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate, const DBProfile& profile)
+    : m_name{path.stem().string()}, m_path{path}, m_profile{profile}, m_cache_size{nCacheSize}
 {
     penv = nullptr;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(nCacheSize, profile);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -164,10 +176,16 @@ CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bo
     }
 
     LogPrintf("Using obfuscation key for %s: %s\n", path.string(), HexStr(obfuscate_key));
+
+    LogPrint(BCLog::LEVELDB, "LevelDB profile for %s: %s, block cache %d%% of %.1fMiB, block size %u, bloom bits %d, file size %u\n",
+             path.string(), m_profile.name, m_profile.block_cache_percent, nCacheSize * (1.0 / 1024 / 1024),
+             m_profile.block_size, m_profile.bloom_bits, m_profile.max_file_size);
+    WITH_LOCK(g_dbwrappers_mutex, g_dbwrappers.insert(this));
 }
 
 CDBWrapper::~CDBWrapper()
 {
+    WITH_LOCK(g_dbwrappers_mutex, g_dbwrappers.erase(this));
     delete pdb;
     pdb = nullptr;
     delete options.filter_policy;
@@ -206,6 +224,46 @@ size_t CDBWrapper::DynamicMemoryUsage() const {
     return stoul(memory);
 }
 
+LevelDBStats CDBWrapper::GetStats() const
+{
+    LevelDBStats stats;
+    stats.path = m_path.string();
+    stats.profile = m_profile;
+    stats.cache_size = m_cache_size;
+    stats.memory_usage = DynamicMemoryUsage();
+    pdb->GetProperty("leveldb.stats", &stats.stats);
+
+    // LevelDB reports the file count of each level until it runs out of levels
+    std::string files;
+    for (int level = 0; pdb->GetProperty("leveldb.num-files-at-level" + std::to_string(level), &files); ++level) {
+        LevelDBLevelStats level_stats{level, std::stoi(files), 0, 0, 0, 0};
+        stats.levels.push_back(level_stats);
+    }
+    // The stats table has a row, after three header lines, for every level
+    // with files or compactions: level, files, size, compaction time, read, written
+    std::istringstream lines(stats.stats);
+    std::string line;
+    for (int header = 0; header < 3 && std::getline(lines, line); ++header) {}
+    while (std::getline(lines, line)) {
+        LevelDBLevelStats row;
+        if (sscanf(line.c_str(), "%d %d %lf %lf %lf %lf", &row.level, &row.files, &row.size_mb,
+                   &row.compaction_seconds, &row.compaction_read_mb, &row.compaction_written_mb) != 6) continue;
+        if (row.level < 0 || (size_t)row.level >= stats.levels.size()) continue;
+        stats.levels[row.level] = row;
+    }
+    return stats;
+}
+
+std::vector<LevelDBStats> GetLevelDBStats()
+{
+    std::vector<LevelDBStats> ret;
+    LOCK(g_dbwrappers_mutex);
+    for (const CDBWrapper* dbw : g_dbwrappers) {
+        ret.push_back(dbw->GetStats());
+    }
+    return ret;
+}
+
 // Prefixed with null character to avoid collisions with other keys
 //
 // We must use a string constructor which specifies length so that we copy
@@ -15,9 +15,73 @@
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
 
+#include <string>
+#include <vector>
+
 static const size_t DBWRAPPER_PREALLOC_KEY_SIZE = 64;
 static const size_t DBWRAPPER_PREALLOC_VALUE_SIZE = 1024;
 
+/**
+ * LevelDB settings suited to the workload of one database, chosen by the user
+ * of CDBWrapper. The size of the cache itself is passed separately.
+ *
+ * LevelDB's level 0 compaction triggers are compile time constants, so the
+ * compaction behaviour is tuned through the write buffer share of the cache,
+ * which sets how often level 0 files are made, and the table file size, which
+ * sets how much each compaction rewrites.
+ */
+struct DBProfile {
+    //! Name shown in the statistics
+    const char* name;
+    //! Share of the cache used as block cache, in percent. The rest is split between the two write buffers LevelDB may hold.
+    int block_cache_percent;
+    //! Uncompressed size of the data blocks in table files, in bytes
+    size_t block_size;
+    //! Bits per key of the bloom filter, 0 for no filter
+    int bloom_bits;
+    //! Size of the table files, in bytes
+    size_t max_file_size;
+};
+
+//! The settings every database used before profiles: fine for small databases
+static const DBProfile DB_PROFILE_DEFAULT{"default", 50, 4 << 10, 10, 2 << 20};
+//! UTXO set: point lookups of small values, including many misses, and large
+//! batches on every flush. The coins cache above it makes a block cache of
+//! little use, so most of the memory goes to absorbing the flushes, and large
+//! table files keep several GB of coins within the open file limit.
+static const DBProfile DB_PROFILE_CHAINSTATE{"chainstate", 25, 4 << 10, 10, 32 << 20};
+//! Block index: read in full at startup, then small, rare updates
+static const DBProfile DB_PROFILE_BLOCK_INDEX{"blockindex", 50, 16 << 10, 10, 2 << 20};
+//! Transaction index: lookups by txid, mostly for transactions that exist, and
+//! appends during sync
+static const DBProfile DB_PROFILE_TXINDEX{"txindex", 50, 4 << 10, 10, 32 << 20};
+//! Block filter index: lookups and range scans by height, which a bloom filter does not help
+static const DBProfile DB_PROFILE_BLOCK_FILTER_INDEX{"blockfilterindex", 75, 16 << 10, 0, 8 << 20};
+//! Coin statistics index: small records looked up by height
+static const DBProfile DB_PROFILE_COIN_STATS_INDEX{"coinstatsindex", 75, 16 << 10, 0, 8 << 20};
+
+struct LevelDBLevelStats {
+    int level;
+    int files;
+    double size_mb;
+    double compaction_seconds;
+    double compaction_read_mb;
+    double compaction_written_mb;
+};
+
+struct LevelDBStats {
+    std::string path;
+    DBProfile profile;
+    size_t cache_size;
+    size_t memory_usage;
+    std::vector<LevelDBLevelStats> levels;
+    //! The raw leveldb.stats property
+    std::string stats;
+};
+
+//! Statistics of every open database
+std::vector<LevelDBStats> GetLevelDBStats();
+
 class dbwrapper_error : public std::runtime_error
 {
 public:
@@ -200,6 +264,15 @@ private:
     //! the name of this database
     std::string m_name;
 
+    //! where this database is stored
+    fs::path m_path;
+
+    //! settings this database was opened with
+    DBProfile m_profile;
+
+    //! cache size this database was opened with
+    size_t m_cache_size;
+
     //! a key used for optional XOR-obfuscation of the database
     std::vector<unsigned char> obfuscate_key;
 
@@ -219,8 +292,9 @@ public:
      * @param[in] fWipe       If true, remove all existing data.
      * @param[in] obfuscate   If true, store data obfuscated via simple XOR. If false, XOR
      *                        with a zero'd byte array.
+     * @param[in] profile     LevelDB settings for the workload of this database.
      */
-    CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false);
+    CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false, const DBProfile& profile = DB_PROFILE_DEFAULT);
     ~CDBWrapper();
 
     CDBWrapper(const CDBWrapper&) = delete;
@@ -292,6 +366,8 @@ public:
     // Get an estimate of LevelDB memory usage (in bytes).
     size_t DynamicMemoryUsage() const;
 
+    LevelDBStats GetStats() const;
+
     // not available for LevelDB; provide for compatibility with BDB
     bool Flush()
     {
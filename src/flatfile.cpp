@@ -3,6 +3,8 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <atomic>
+#include <cerrno>
 #include <stdexcept>
 
 #include <flatfile.h>
@@ -10,6 +12,11 @@
 #include <tinyformat.h>
 #include <util/system.h>
 
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 FlatFileSeq::FlatFileSeq(fs::path dir, const char* prefix, size_t chunk_size) :
     m_dir(std::move(dir)),
     m_prefix(prefix),
@@ -96,3 +103,142 @@ bool FlatFileSeq::Flush(const FlatFilePos& pos, bool finalize)
     fclose(file);
     return true;
 }
+
+/** An open file of a FlatFileReader */
+class FlatFileReader::File
+{
+public:
+#ifdef WIN32
+    // Without pread, reads of one file are serialized on a FILE*
+    explicit File(const fs::path& path) : m_file(fsbridge::fopen(path, "rb")) {}
+    ~File() { if (m_file) fclose(m_file); }
+    bool IsOpen() const { return m_file != nullptr; }
+
+    bool Read(unsigned int nPos, void* buf, size_t len)
+    {
+        LOCK(m_mutex);
+        return fseek(m_file, nPos, SEEK_SET) == 0 && fread(buf, 1, len, m_file) == len;
+    }
+
+    void ReadAhead(unsigned int nPos, size_t len) {}
+
+private:
+    Mutex m_mutex;
+    FILE* m_file;
+#else
+    explicit File(const fs::path& path) : m_fd(open(path.string().c_str(), O_RDONLY)) {}
+    ~File() { if (m_fd != -1) close(m_fd); }
+    bool IsOpen() const { return m_fd != -1; }
+
+    bool Read(unsigned int nPos, void* buf, size_t len)
+    {
+        char* p = static_cast<char*>(buf);
+        off_t offset = nPos;
+        while (len > 0) {
+            ssize_t n = pread(m_fd, p, len, offset);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            offset += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    void ReadAhead(unsigned int nPos, size_t len)
+    {
+#ifdef POSIX_FADV_WILLNEED
+        // A scan asks at every block: skip until it is halfway through the
+        // range asked for last time, then only ask for what follows that range.
+        // Concurrent scans of one file only make this a worse hint.
+        const uint64_t last_start = m_read_ahead_start.load();
+        const uint64_t last_end = m_read_ahead_end.load();
+        if (nPos >= last_start && nPos < last_start + (last_end - last_start) / 2) return;
+        const uint64_t from = nPos >= last_start && nPos < last_end ? last_end : nPos;
+        const uint64_t end = (uint64_t)nPos + len;
+        m_read_ahead_start = nPos;
+        m_read_ahead_end = end;
+        if (end > from) posix_fadvise(m_fd, from, end - from, POSIX_FADV_WILLNEED);
+#endif
+    }
+
+private:
+    int m_fd;
+    //! The range last asked to be read ahead
+    std::atomic<uint64_t> m_read_ahead_start{0};
+    std::atomic<uint64_t> m_read_ahead_end{0};
+#endif
+};
+
+FlatFileReader::FlatFileReader(size_t max_open_files) : m_max_open_files(max_open_files)
+{
+    if (max_open_files == 0) {
+        throw std::invalid_argument("max_open_files must be positive");
+    }
+}
+
+std::shared_ptr<FlatFileReader::File> FlatFileReader::GetFile(const FlatFileSeq& seq, const FlatFilePos& pos)
+{
+    if (pos.IsNull()) {
+        return nullptr;
+    }
+    const fs::path path = seq.FileName(pos);
+    const std::string key = path.string();
+    {
+        LOCK(m_mutex);
+        for (auto it = m_files.begin(); it != m_files.end(); ++it) {
+            if (it->first == key) {
+                m_files.splice(m_files.begin(), m_files, it);
+                return it->second;
+            }
+        }
+    }
+
+    std::shared_ptr<File> file = std::make_shared<File>(path);
+    if (!file->IsOpen()) {
+        LogPrintf("Unable to open file %s\n", key);
+        return nullptr;
+    }
+
+    LOCK(m_mutex);
+    // Another thread may have opened the file in the meantime; either copy will do
+    m_files.emplace_front(key, file);
+    while (m_files.size() > m_max_open_files) {
+        m_files.pop_back();
+    }
+    return file;
+}
+
+bool FlatFileReader::Read(const FlatFileSeq& seq, const FlatFilePos& pos, void* buf, size_t len)
+{
+    std::shared_ptr<File> file = GetFile(seq, pos);
+    if (!file) {
+        return false;
+    }
+    if (!file->Read(pos.nPos, buf, len)) {
+        LogPrintf("Unable to read %u bytes at position %u of %s\n", len, pos.nPos, seq.FileName(pos).string());
+        return false;
+    }
+    return true;
+}
+
+void FlatFileReader::ReadAhead(const FlatFileSeq& seq, const FlatFilePos& pos, size_t len)
+{
+    std::shared_ptr<File> file = GetFile(seq, pos);
+    if (file) {
+        file->ReadAhead(pos.nPos, len);
+    }
+}
+
+void FlatFileReader::Close(const FlatFileSeq& seq, const FlatFilePos& pos)
+{
+    const std::string key = seq.FileName(pos).string();
+    LOCK(m_mutex);
+    m_files.remove_if([&key](const std::pair<std::string, std::shared_ptr<File>>& file) { return file.first == key; });
+}
+
+void FlatFileReader::CloseAll()
+{
+    LOCK(m_mutex);
+    m_files.clear();
+}
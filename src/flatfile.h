@@ -6,10 +6,14 @@
 #ifndef BITCOIN_FLATFILE_H
 #define BITCOIN_FLATFILE_H
 
+#include <list>
+#include <memory>
 #include <string>
+#include <utility>
 
 #include <fs.h>
 #include <serialize.h>
+#include <sync.h>
 
 struct FlatFilePos
 {
@@ -93,4 +97,49 @@ public:
     bool Flush(const FlatFilePos& pos, bool finalize = false);
 };
 
+/**
+ * Reads the files of FlatFileSeqs at given positions with pread, keeping a
+ * bounded number of them open between reads, least recently used first to be
+ * closed. This avoids the open, seek and buffered reads of a FILE* for every
+ * block read, and can be used from several threads at once.
+ *
+ * A file must be closed with Close() before it is deleted, or it stays
+ * readable through this reader and its space is not freed.
+ */
+class FlatFileReader
+{
+public:
+    explicit FlatFileReader(size_t max_open_files);
+
+    FlatFileReader(const FlatFileReader&) = delete;
+    FlatFileReader& operator=(const FlatFileReader&) = delete;
+
+    /** Read exactly len bytes at the given position. Returns false on errors and short reads. */
+    bool Read(const FlatFileSeq& seq, const FlatFilePos& pos, void* buf, size_t len);
+
+    /**
+     * Ask the operating system to start reading the given range into its cache,
+     * without waiting for it, as sequential scans read it next. Does nothing
+     * where this is not supported.
+     */
+    void ReadAhead(const FlatFileSeq& seq, const FlatFilePos& pos, size_t len);
+
+    /** Close the file at the given position, if it is open. */
+    void Close(const FlatFileSeq& seq, const FlatFilePos& pos);
+
+    /** Close all files. */
+    void CloseAll();
+
+private:
+    class File;
+
+    std::shared_ptr<File> GetFile(const FlatFileSeq& seq, const FlatFilePos& pos);
+
+    const size_t m_max_open_files;
+    Mutex m_mutex;
+    //! Open files, most recently used first. A file is only closed once the
+    //! last reader holding it is done.
+    std::list<std::pair<std::string, std::shared_ptr<File>>> m_files GUARDED_BY(m_mutex);
+};
+
 #endif // BITCOIN_FLATFILE_H
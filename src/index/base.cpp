@@ -8,6 +8,7 @@
 #include <tinyformat.h>
 #include <ui_interface.h>
 #include <util/system.h>
+#include <util/workqueue.h>
 #include <validation.h>
 #include <warnings.h>
 
@@ -15,6 +16,7 @@ constexpr char DB_BEST_BLOCK = 'B';
 
 constexpr int64_t SYNC_LOG_INTERVAL = 30; // seconds
 constexpr int64_t SYNC_LOCATOR_WRITE_INTERVAL = 30; // seconds
+constexpr size_t SYNC_BLOCKS_PER_THREAD = 8;
 
 template<typename... Args>
 static void FatalError(const char* fmt, const Args&... args)
@@ -28,8 +30,8 @@ static void FatalError(const char* fmt, const Args&... args)
     StartShutdown();
 }
 
-BaseIndex::DB::DB(const fs::path& path, size_t n_cache_size, bool f_memory, bool f_wipe, bool f_obfuscate) :
-    CDBWrapper(path, n_cache_size, f_memory, f_wipe, f_obfuscate)
+BaseIndex::DB::DB(const fs::path& path, size_t n_cache_size, bool f_memory, bool f_wipe, bool f_obfuscate, const DBProfile& profile) :
+    CDBWrapper(path, n_cache_size, f_memory, f_wipe, f_obfuscate, profile)
 {}
 
 bool BaseIndex::DB::ReadBestBlock(CBlockLocator& locator) const
@@ -85,12 +87,54 @@ static const CBlockIndex* NextSyncBlock(const CBlockIndex* pindex_prev) EXCLUSIV
     return ::ChainActive().Next(::ChainActive().FindFork(pindex_prev));
 }
 
+/** Blocks below a loaded UTXO set snapshot were never downloaded and have nothing to index */
+static bool IsSkippedBlock(const CBlockIndex* pindex)
+{
+    return (pindex->nStatus & BLOCK_ASSUMED_VALID) && !(pindex->nStatus & BLOCK_HAVE_DATA);
+}
+
+/** The best block to index from once pindex is connected, skipping the blocks below a snapshot base */
+static const CBlockIndex* SkipSnapshotBlocks(const CBlockIndex* best_block_index, const CBlockIndex* pindex)
+{
+    if (best_block_index && pindex && IsSkippedBlock(pindex) &&
+        pindex->GetAncestor(best_block_index->nHeight) == best_block_index) {
+        return pindex;
+    }
+    return best_block_index;
+}
+
+namespace {
+/** A block read and prepared ahead of being written to the index */
+struct SyncBlock
+{
+    const CBlockIndex* pindex;
+    CBlock block;
+    std::unique_ptr<BaseIndex::BlockData> data;
+    bool fRead{false};
+    bool fPrepared{false};
+
+    explicit SyncBlock(const CBlockIndex* pindexIn = nullptr) : pindex(pindexIn) {}
+};
+} // namespace
+
 void BaseIndex::ThreadSync()
 {
     const CBlockIndex* pindex = m_best_block_index.load();
     if (!m_synced) {
         auto& consensus_params = Params().GetConsensus();
 
+        // Blocks are read and prepared by the worker threads, up to
+        // SYNC_BLOCKS_PER_THREAD per thread ahead of the one being written.
+        const int threads = std::max(1, std::min(g_reindex_threads, MAX_REINDEX_THREADS));
+        const size_t max_queued = threads * SYNC_BLOCKS_PER_THREAD;
+        OrderedWorkQueue<SyncBlock> queue(strprintf("%s.prep", GetName()), threads, [this, &consensus_params](SyncBlock& sync_block) {
+            ReadAheadBlockFromDisk(sync_block.pindex);
+            sync_block.fRead = ReadBlockFromDisk(sync_block.block, sync_block.pindex, consensus_params);
+            sync_block.fPrepared = sync_block.fRead && PrepareBlock(sync_block.block, sync_block.pindex, sync_block.data);
+        });
+        // The last block queued, which is pindex when the queue is empty
+        const CBlockIndex* pindex_queued = pindex;
+
         int64_t last_log_time = 0;
         int64_t last_locator_write_time = 0;
         while (true) {
@@ -105,22 +149,52 @@ void BaseIndex::ThreadSync()
 
             {
                 LOCK(cs_main);
-                const CBlockIndex* pindex_next = NextSyncBlock(pindex);
-                if (!pindex_next) {
-                    m_best_block_index = pindex;
-                    m_synced = true;
-                    // No need to handle errors in Commit. See rationale above.
-                    Commit();
-                    break;
+                while (queue.Size() < max_queued) {
+                    const CBlockIndex* pindex_next = NextSyncBlock(pindex_queued);
+                    // At the tip, or after a reorg, write what is queued first
+                    if (!pindex_next || pindex_next->pprev != pindex_queued) break;
+                    // Skipped once everything queued is written
+                    if (IsSkippedBlock(pindex_next)) break;
+                    queue.Push(SyncBlock(pindex_next));
+                    pindex_queued = pindex_next;
                 }
-                if (pindex_next->pprev != pindex && !Rewind(pindex, pindex_next->pprev)) {
-                    FatalError("%s: Failed to rewind index %s to a previous chain tip",
-                               __func__, GetName());
-                    return;
+                if (queue.Size() == 0) {
+                    const CBlockIndex* pindex_next = NextSyncBlock(pindex);
+                    if (!pindex_next) {
+                        m_best_block_index = pindex;
+                        m_synced = true;
+                        // No need to handle errors in Commit. See rationale above.
+                        Commit();
+                        break;
+                    }
+                    if (pindex_next->pprev != pindex && !Rewind(pindex, pindex_next->pprev)) {
+                        FatalError("%s: Failed to rewind index %s to a previous chain tip",
+                                   __func__, GetName());
+                        return;
+                    }
+                    if (pindex_next->pprev == pindex && IsSkippedBlock(pindex_next)) {
+                        pindex = pindex_queued = pindex_next;
+                        continue;
+                    }
+                    pindex = pindex_queued = pindex_next->pprev;
+                    continue;
                 }
-                pindex = pindex_next;
             }
 
+            SyncBlock sync_block;
+            queue.Pop(sync_block);
+            if (!sync_block.fRead) {
+                FatalError("%s: Failed to read block %s from disk",
+                           __func__, sync_block.pindex->GetBlockHash().ToString());
+                return;
+            }
+            if (!sync_block.fPrepared || !WriteBlock(sync_block.block, sync_block.pindex, sync_block.data.get())) {
+                FatalError("%s: Failed to write block %s to index database",
+                           __func__, sync_block.pindex->GetBlockHash().ToString());
+                return;
+            }
+            pindex = sync_block.pindex;
+
             int64_t current_time = GetTime();
             if (last_log_time + SYNC_LOG_INTERVAL < current_time) {
                 LogPrintf("Syncing %s with block chain from height %d\n",
@@ -134,18 +208,6 @@ void BaseIndex::ThreadSync()
                 // No need to handle errors in Commit. See rationale above.
                 Commit();
             }
-
-            CBlock block;
-            if (!ReadBlockFromDisk(block, pindex, consensus_params)) {
-                FatalError("%s: Failed to read block %s from disk",
-                           __func__, pindex->GetBlockHash().ToString());
-                return;
-            }
-            if (!WriteBlock(block, pindex)) {
-                FatalError("%s: Failed to write block %s to index database",
-                           __func__, pindex->GetBlockHash().ToString());
-                return;
-            }
         }
     }
 
@@ -194,7 +256,8 @@ void BaseIndex::BlockConnected(const std::shared_ptr<const CBlock>& block, const
         return;
     }
 
-    const CBlockIndex* best_block_index = m_best_block_index.load();
+    const CBlockIndex* best_block_index = SkipSnapshotBlocks(m_best_block_index.load(), pindex->pprev);
+    m_best_block_index = best_block_index;
     if (!best_block_index) {
         if (pindex->nHeight != 0) {
             FatalError("%s: First block connected is not the genesis block (height=%d)",
@@ -221,7 +284,8 @@ void BaseIndex::BlockConnected(const std::shared_ptr<const CBlock>& block, const
         }
     }
 
-    if (WriteBlock(*block, pindex)) {
+    std::unique_ptr<BlockData> data;
+    if (PrepareBlock(*block, pindex, data) && WriteBlock(*block, pindex, data.get())) {
         m_best_block_index = pindex;
     } else {
         FatalError("%s: Failed to write block %s to index",
@@ -254,7 +318,8 @@ void BaseIndex::ChainStateFlushed(const CBlockLocator& locator)
     // there is a reorg and the blocks on the stale branch are in the ValidationInterface queue
     // backlog even after the sync thread has caught up to the new chain tip. In this unlikely
     // event, log a warning and let the queue clear.
-    const CBlockIndex* best_block_index = m_best_block_index.load();
+    const CBlockIndex* best_block_index = SkipSnapshotBlocks(m_best_block_index.load(), locator_tip_index);
+    m_best_block_index = best_block_index;
     if (best_block_index->GetAncestor(locator_tip_index->nHeight) != locator_tip_index) {
         LogPrintf("%s: WARNING: Locator contains block (hash=%s) not on known best " /* Continued */
                   "chain (tip=%s); not writing index locator\n",
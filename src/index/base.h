@@ -11,6 +11,8 @@
 #include <threadinterrupt.h>
 #include <validationinterface.h>
 
+#include <memory>
+
 class CBlockIndex;
 
 /**
@@ -20,12 +22,19 @@ class CBlockIndex;
  */
 class BaseIndex : public CValidationInterface
 {
+public:
+    /// Index data computed from a block by PrepareBlock, for WriteBlock to store.
+    struct BlockData {
+        virtual ~BlockData() {}
+    };
+
 protected:
     class DB : public CDBWrapper
     {
     public:
         DB(const fs::path& path, size_t n_cache_size,
-           bool f_memory = false, bool f_wipe = false, bool f_obfuscate = false);
+           bool f_memory = false, bool f_wipe = false, bool f_obfuscate = false,
+           const DBProfile& profile = DB_PROFILE_DEFAULT);
 
         /// Read block locator of the chain that the txindex is in sync with.
         bool ReadBestBlock(CBlockLocator& locator) const;
@@ -71,8 +80,15 @@ protected:
     /// Initialize internal state from the database and block index.
     virtual bool Init();
 
-    /// Write update index entries for a newly connected block.
-    virtual bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) { return true; }
+    /// Compute what WriteBlock needs from a block without changing the index
+    /// state. While catching up, this is called on several worker threads
+    /// ahead of WriteBlock, in no particular order, so the expensive part of
+    /// indexing a block belongs here.
+    virtual bool PrepareBlock(const CBlock& block, const CBlockIndex* pindex, std::unique_ptr<BlockData>& data) const { return true; }
+
+    /// Write update index entries for a newly connected block, with the data
+    /// returned by PrepareBlock for it. Blocks are written in chain order.
+    virtual bool WriteBlock(const CBlock& block, const CBlockIndex* pindex, const BlockData* data) { return true; }
 
     /// Virtual method called internally by Commit that can be overridden to atomically
     /// commit more index state.
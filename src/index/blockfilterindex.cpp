@@ -107,7 +107,7 @@ BlockFilterIndex::BlockFilterIndex(BlockFilterType filter_type,
     fs::create_directories(path);
 
     m_name = filter_name + " block filter index";
-    m_db = MakeUnique<BaseIndex::DB>(path / "db", n_cache_size, f_memory, f_wipe);
+    m_db = MakeUnique<BaseIndex::DB>(path / "db", n_cache_size, f_memory, f_wipe, false, DB_PROFILE_BLOCK_FILTER_INDEX);
     m_filter_fileseq = MakeUnique<FlatFileSeq>(std::move(path), "fltr", FLTR_FILE_CHUNK_SIZE);
 }
 
@@ -212,16 +212,32 @@ size_t BlockFilterIndex::WriteFilterToDisk(FlatFilePos& pos, const BlockFilter&
     return data_size;
 }
 
-bool BlockFilterIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+namespace {
+struct FilterData : public BaseIndex::BlockData
+{
+    BlockFilter filter;
+};
+} // namespace
+
+bool BlockFilterIndex::PrepareBlock(const CBlock& block, const CBlockIndex* pindex, std::unique_ptr<BlockData>& data) const
 {
     CBlockUndo block_undo;
+    if (pindex->nHeight > 0 && !UndoReadFromDisk(block_undo, pindex)) {
+        return false;
+    }
+
+    std::unique_ptr<FilterData> filter_data = MakeUnique<FilterData>();
+    filter_data->filter = BlockFilter(m_filter_type, block, block_undo);
+    data = std::move(filter_data);
+    return true;
+}
+
+bool BlockFilterIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex, const BlockData* data)
+{
+    const BlockFilter& filter = static_cast<const FilterData*>(data)->filter;
     uint256 prev_header;
 
     if (pindex->nHeight > 0) {
-        if (!UndoReadFromDisk(block_undo, pindex)) {
-            return false;
-        }
-
         std::pair<uint256, DBVal> read_out;
         if (!m_db->Read(DBHeightKey(pindex->nHeight - 1), read_out)) {
             return false;
@@ -236,8 +252,6 @@ bool BlockFilterIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex
         prev_header = read_out.second.header;
     }
 
-    BlockFilter filter(m_filter_type, block, block_undo);
-
     size_t bytes_written = WriteFilterToDisk(m_next_filter_pos, filter);
     if (bytes_written == 0) return false;
 
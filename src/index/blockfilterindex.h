@@ -35,7 +35,9 @@ protected:
 
     bool CommitInternal(CDBBatch& batch) override;
 
-    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) override;
+    bool PrepareBlock(const CBlock& block, const CBlockIndex* pindex, std::unique_ptr<BlockData>& data) const override;
+
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex, const BlockData* data) override;
 
     bool Rewind(const CBlockIndex* current_tip, const CBlockIndex* new_tip) override;
 
@@ -0,0 +1,360 @@
+// Copyright (c) 2020 The Merge Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <coins.h>
+#include <index/coinstatsindex.h>
+#include <undo.h>
+#include <util/system.h>
+#include <validation.h>
+
+/* The index database stores the statistics of the UTXO set as of each block.
+ * Like in the block filter index, those belonging to blocks on the active
+ * chain are indexed by height, and those of blocks that have been reorganized
+ * out of the active chain are indexed by block hash.
+ *
+ * The running totals and the MuHash3072 of the UTXO set as of the best block,
+ * from which the index continues, are stored under DB_MUHASH. They are written
+ * together with the best block locator.
+ */
+constexpr char DB_BLOCK_HASH = 's';
+constexpr char DB_BLOCK_HEIGHT = 't';
+constexpr char DB_MUHASH = 'M';
+
+std::unique_ptr<CoinStatsIndex> g_coin_stats_index;
+
+namespace {
+
+struct DBVal {
+    uint256 muhash;
+    uint64_t transaction_output_count;
+    uint64_t bogo_size;
+    CAmount total_amount;
+
+    SERIALIZE_METHODS(DBVal, obj)
+    {
+        READWRITE(obj.muhash);
+        READWRITE(obj.transaction_output_count);
+        READWRITE(obj.bogo_size);
+        READWRITE(obj.total_amount);
+    }
+};
+
+struct DBHeightKey {
+    int height;
+
+    explicit DBHeightKey(int height_in) : height(height_in) {}
+
+    template <typename Stream>
+    void Serialize(Stream& s) const
+    {
+        ser_writedata8(s, DB_BLOCK_HEIGHT);
+        ser_writedata32be(s, height);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s)
+    {
+        char prefix = ser_readdata8(s);
+        if (prefix != DB_BLOCK_HEIGHT) {
+            throw std::ios_base::failure("Invalid format for coinstatsindex DB height key");
+        }
+        height = ser_readdata32be(s);
+    }
+};
+
+struct DBHashKey {
+    uint256 hash;
+
+    explicit DBHashKey(const uint256& hash_in) : hash(hash_in) {}
+
+    SERIALIZE_METHODS(DBHashKey, obj)
+    {
+        char prefix = DB_BLOCK_HASH;
+        READWRITE(prefix);
+        if (prefix != DB_BLOCK_HASH) {
+            throw std::ios_base::failure("Invalid format for coinstatsindex DB hash key");
+        }
+
+        READWRITE(obj.hash);
+    }
+};
+
+/** The running state of the index as of its best block */
+struct DBState {
+    MuHash3072 muhash;
+    uint64_t transaction_output_count{0};
+    uint64_t bogo_size{0};
+    CAmount total_amount{0};
+
+    SERIALIZE_METHODS(DBState, obj)
+    {
+        READWRITE(obj.muhash);
+        READWRITE(obj.transaction_output_count);
+        READWRITE(obj.bogo_size);
+        READWRITE(obj.total_amount);
+    }
+};
+
+/** The change a block makes to the UTXO set: the coins it creates are in the
+ *  numerator of the MuHash3072 and those it spends in the denominator. */
+struct StatsDelta : public BaseIndex::BlockData
+{
+    MuHash3072 muhash;
+    int64_t transaction_output_count{0};
+    int64_t bogo_size{0};
+    CAmount total_amount{0};
+};
+
+} // namespace
+
+CoinStatsIndex::CoinStatsIndex(size_t n_cache_size, bool f_memory, bool f_wipe)
+{
+    fs::path path = GetDataDir() / "indexes" / "coinstats";
+    fs::create_directories(path);
+
+    m_db = MakeUnique<BaseIndex::DB>(path / "db", n_cache_size, f_memory, f_wipe, false, DB_PROFILE_COIN_STATS_INDEX);
+}
+
+bool CoinStatsIndex::Init()
+{
+    DBState state;
+    if (!m_db->Read(DB_MUHASH, state)) {
+        // Check that the cause of the read failure is that the key does not exist. Any other errors
+        // indicate database corruption or a disk failure, and starting the index would cause
+        // further corruption.
+        if (m_db->Exists(DB_MUHASH)) {
+            return error("%s: Cannot read current %s state; index may be corrupted",
+                         __func__, GetName());
+        }
+    }
+    m_muhash = state.muhash;
+    m_transaction_output_count = state.transaction_output_count;
+    m_bogo_size = state.bogo_size;
+    m_total_amount = state.total_amount;
+    return BaseIndex::Init();
+}
+
+bool CoinStatsIndex::CommitInternal(CDBBatch& batch)
+{
+    DBState state;
+    state.muhash = m_muhash;
+    state.transaction_output_count = m_transaction_output_count;
+    state.bogo_size = m_bogo_size;
+    state.total_amount = m_total_amount;
+    batch.Write(DB_MUHASH, state);
+    return BaseIndex::CommitInternal(batch);
+}
+
+bool CoinStatsIndex::PrepareBlock(const CBlock& block, const CBlockIndex* pindex, std::unique_ptr<BlockData>& data) const
+{
+    std::unique_ptr<StatsDelta> delta = MakeUnique<StatsDelta>();
+
+    // The outputs of the genesis block are not added to the UTXO set
+    if (pindex->nHeight > 0) {
+        CBlockUndo block_undo;
+        if (!UndoReadFromDisk(block_undo, pindex)) {
+            return false;
+        }
+        if (block_undo.vtxundo.size() + 1 != block.vtx.size()) {
+            return error("%s: undo data of block %s does not match its transactions",
+                         __func__, pindex->GetBlockHash().ToString());
+        }
+
+        for (size_t i = 0; i < block.vtx.size(); ++i) {
+            const CTransaction& tx = *block.vtx[i];
+            for (size_t j = 0; j < tx.vout.size(); ++j) {
+                // Like CCoinsViewCache::AddCoin, leave out outputs that can never be spent
+                if (tx.vout[j].scriptPubKey.IsUnspendable()) continue;
+                const Coin coin(tx.vout[j], pindex->nHeight, tx.IsCoinBase(), tx.IsCoinStake());
+                ApplyCoinHash(delta->muhash, COutPoint(tx.GetHash(), j), coin);
+                delta->transaction_output_count++;
+                delta->bogo_size += GetBogoSize(coin);
+                delta->total_amount += coin.out.nValue;
+            }
+
+            if (tx.IsCoinBase()) continue;
+            const CTxUndo& tx_undo = block_undo.vtxundo[i - 1];
+            if (tx_undo.vprevout.size() != tx.vin.size()) {
+                return error("%s: undo data of transaction %s does not match its inputs",
+                             __func__, tx.GetHash().ToString());
+            }
+            for (size_t j = 0; j < tx.vin.size(); ++j) {
+                const Coin& coin = tx_undo.vprevout[j];
+                RemoveCoinHash(delta->muhash, tx.vin[j].prevout, coin);
+                delta->transaction_output_count--;
+                delta->bogo_size -= GetBogoSize(coin);
+                delta->total_amount -= coin.out.nValue;
+            }
+        }
+    }
+
+    data = std::move(delta);
+    return true;
+}
+
+bool CoinStatsIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex, const BlockData* data)
+{
+    const StatsDelta& delta = *static_cast<const StatsDelta*>(data);
+
+    if (pindex->nHeight > 0) {
+        std::pair<uint256, DBVal> read_out;
+        if (!m_db->Read(DBHeightKey(pindex->nHeight - 1), read_out)) {
+            return false;
+        }
+
+        uint256 expected_block_hash = pindex->pprev->GetBlockHash();
+        if (read_out.first != expected_block_hash) {
+            return error("%s: previous block statistics belong to unexpected block %s; expected %s",
+                         __func__, read_out.first.ToString(), expected_block_hash.ToString());
+        }
+    }
+
+    MuHash3072 muhash = m_muhash;
+    muhash *= delta.muhash;
+
+    std::pair<uint256, DBVal> value;
+    value.first = pindex->GetBlockHash();
+    // Finalizing also folds the divisor into the running hash, which is kept
+    // that way
+    muhash.Finalize(value.second.muhash);
+    value.second.transaction_output_count = m_transaction_output_count + delta.transaction_output_count;
+    value.second.bogo_size = m_bogo_size + delta.bogo_size;
+    value.second.total_amount = m_total_amount + delta.total_amount;
+
+    if (!m_db->Write(DBHeightKey(pindex->nHeight), value)) {
+        return false;
+    }
+
+    m_muhash = muhash;
+    m_transaction_output_count = value.second.transaction_output_count;
+    m_bogo_size = value.second.bogo_size;
+    m_total_amount = value.second.total_amount;
+    return true;
+}
+
+static bool CopyHeightIndexToHashIndex(CDBIterator& db_it, CDBBatch& batch,
+                                       const std::string& index_name,
+                                       int start_height, int stop_height)
+{
+    DBHeightKey key(start_height);
+    db_it.Seek(key);
+
+    for (int height = start_height; height <= stop_height; ++height) {
+        if (!db_it.GetKey(key) || key.height != height) {
+            return error("%s: unexpected key in %s: expected (%c, %d)",
+                         __func__, index_name, DB_BLOCK_HEIGHT, height);
+        }
+
+        std::pair<uint256, DBVal> value;
+        if (!db_it.GetValue(value)) {
+            return error("%s: unable to read value in %s at key (%c, %d)",
+                         __func__, index_name, DB_BLOCK_HEIGHT, height);
+        }
+
+        batch.Write(DBHashKey(value.first), std::move(value.second));
+
+        db_it.Next();
+    }
+    return true;
+}
+
+static bool LookUpOne(const CDBWrapper& db, const CBlockIndex* block_index, DBVal& result)
+{
+    // First check if the result is stored under the height index and the value there matches the
+    // block hash. This should be the case if the block is on the active chain.
+    std::pair<uint256, DBVal> read_out;
+    if (!db.Read(DBHeightKey(block_index->nHeight), read_out)) {
+        return false;
+    }
+    if (read_out.first == block_index->GetBlockHash()) {
+        result = std::move(read_out.second);
+        return true;
+    }
+
+    // If value at the height index corresponds to an different block, the result will be stored in
+    // the hash index.
+    return db.Read(DBHashKey(block_index->GetBlockHash()), result);
+}
+
+bool CoinStatsIndex::Rewind(const CBlockIndex* current_tip, const CBlockIndex* new_tip)
+{
+    assert(current_tip->GetAncestor(new_tip->nHeight) == new_tip);
+
+    CDBBatch batch(*m_db);
+    std::unique_ptr<CDBIterator> db_it(m_db->NewIterator());
+
+    // During a reorg, we need to copy all statistics for blocks that are getting disconnected from
+    // the height index to the hash index so we can still find them when the height index entries
+    // are overwritten.
+    if (!CopyHeightIndexToHashIndex(*db_it, batch, GetName(), new_tip->nHeight, current_tip->nHeight)) {
+        return false;
+    }
+    if (!m_db->WriteBatch(batch)) return false;
+
+    // Take the changes of the disconnected blocks back out of the running
+    // state, which is then committed with the new best block.
+    MuHash3072 muhash = m_muhash;
+    uint64_t transaction_output_count = m_transaction_output_count;
+    uint64_t bogo_size = m_bogo_size;
+    CAmount total_amount = m_total_amount;
+    const Consensus::Params& consensus_params = Params().GetConsensus();
+    for (const CBlockIndex* pindex = current_tip; pindex != new_tip; pindex = pindex->pprev) {
+        CBlock block;
+        std::unique_ptr<BlockData> data;
+        if (!ReadBlockFromDisk(block, pindex, consensus_params) || !PrepareBlock(block, pindex, data)) {
+            return error("%s: failed to read block %s to rewind %s",
+                         __func__, pindex->GetBlockHash().ToString(), GetName());
+        }
+        const StatsDelta& delta = *static_cast<const StatsDelta*>(data.get());
+        muhash /= delta.muhash;
+        transaction_output_count -= delta.transaction_output_count;
+        bogo_size -= delta.bogo_size;
+        total_amount -= delta.total_amount;
+    }
+
+    DBVal expected;
+    if (!LookUpOne(*m_db, new_tip, expected)) {
+        return error("%s: unable to read statistics of block %s in %s",
+                     __func__, new_tip->GetBlockHash().ToString(), GetName());
+    }
+    if (expected.transaction_output_count != transaction_output_count ||
+        expected.bogo_size != bogo_size || expected.total_amount != total_amount) {
+        return error("%s: %s state after rewinding does not match the statistics of block %s",
+                     __func__, GetName(), new_tip->GetBlockHash().ToString());
+    }
+
+    std::swap(m_muhash, muhash);
+    std::swap(m_transaction_output_count, transaction_output_count);
+    std::swap(m_bogo_size, bogo_size);
+    std::swap(m_total_amount, total_amount);
+    if (!BaseIndex::Rewind(current_tip, new_tip)) {
+        // The state of current_tip is still the committed one
+        m_muhash = muhash;
+        m_transaction_output_count = transaction_output_count;
+        m_bogo_size = bogo_size;
+        m_total_amount = total_amount;
+        return false;
+    }
+    return true;
+}
+
+bool CoinStatsIndex::LookUpStats(const CBlockIndex* block_index, CCoinsStats& coins_stats) const
+{
+    DBVal entry;
+    if (!LookUpOne(*m_db, block_index, entry)) {
+        return false;
+    }
+
+    coins_stats = CCoinsStats();
+    coins_stats.nHeight = block_index->nHeight;
+    coins_stats.hashBlock = block_index->GetBlockHash();
+    coins_stats.hashSerialized = entry.muhash;
+    coins_stats.nTransactionOutputs = entry.transaction_output_count;
+    coins_stats.coins_count = entry.transaction_output_count;
+    coins_stats.nBogoSize = entry.bogo_size;
+    coins_stats.nTotalAmount = entry.total_amount;
+    coins_stats.index_used = true;
+    return true;
+}
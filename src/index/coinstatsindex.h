@@ -0,0 +1,59 @@
+// Copyright (c) 2020 The Merge Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_COINSTATSINDEX_H
+#define BITCOIN_INDEX_COINSTATSINDEX_H
+
+#include <amount.h>
+#include <chain.h>
+#include <crypto/muhash.h>
+#include <index/base.h>
+#include <node/coinstats.h>
+
+static const bool DEFAULT_COINSTATSINDEX = false;
+
+/**
+ * CoinStatsIndex keeps statistics about the UTXO set as of every block of the
+ * chain: the number of coins, their total amount, their bogosize and a
+ * MuHash3072 of the set. The totals are updated with the coins each block
+ * creates and spends, the latter read from its undo data, so the statistics
+ * at any height can be looked up without scanning the chainstate.
+ */
+class CoinStatsIndex final : public BaseIndex
+{
+private:
+    std::unique_ptr<BaseIndex::DB> m_db;
+
+    MuHash3072 m_muhash;
+    uint64_t m_transaction_output_count{0};
+    uint64_t m_bogo_size{0};
+    CAmount m_total_amount{0};
+
+protected:
+    bool Init() override;
+
+    bool CommitInternal(CDBBatch& batch) override;
+
+    bool PrepareBlock(const CBlock& block, const CBlockIndex* pindex, std::unique_ptr<BlockData>& data) const override;
+
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex, const BlockData* data) override;
+
+    bool Rewind(const CBlockIndex* current_tip, const CBlockIndex* new_tip) override;
+
+    BaseIndex::DB& GetDB() const override { return *m_db; }
+
+    const char* GetName() const override { return "coinstatsindex"; }
+
+public:
+    /** Constructs the index, which becomes available to be queried. */
+    explicit CoinStatsIndex(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+
+    /** Get the statistics of the UTXO set as of a block. Returns false if the block is not indexed yet. */
+    bool LookUpStats(const CBlockIndex* block_index, CCoinsStats& coins_stats) const;
+};
+
+/** The global UTXO set statistics index. May be null. */
+extern std::unique_ptr<CoinStatsIndex> g_coin_stats_index;
+
+#endif // BITCOIN_INDEX_COINSTATSINDEX_H
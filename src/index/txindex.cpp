@@ -44,7 +44,7 @@ public:
 };
 
 TxIndex::DB::DB(size_t n_cache_size, bool f_memory, bool f_wipe) :
-    BaseIndex::DB(GetDataDir() / "indexes" / "txindex", n_cache_size, f_memory, f_wipe)
+    BaseIndex::DB(GetDataDir() / "indexes" / "txindex", n_cache_size, f_memory, f_wipe, false, DB_PROFILE_TXINDEX)
 {}
 
 bool TxIndex::DB::ReadTxPos(const uint256 &txid, CDiskTxPos& pos) const
@@ -219,19 +219,33 @@ bool TxIndex::Init()
     return BaseIndex::Init();
 }
 
-bool TxIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+namespace {
+struct TxPositions : public BaseIndex::BlockData
+{
+    std::vector<std::pair<uint256, CDiskTxPos>> vPos;
+};
+} // namespace
+
+bool TxIndex::PrepareBlock(const CBlock& block, const CBlockIndex* pindex, std::unique_ptr<BlockData>& data) const
 {
     // Exclude genesis block transaction because outputs are not spendable.
     if (pindex->nHeight == 0) return true;
 
+    std::unique_ptr<TxPositions> positions = MakeUnique<TxPositions>();
     CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
-    std::vector<std::pair<uint256, CDiskTxPos>> vPos;
-    vPos.reserve(block.vtx.size());
+    positions->vPos.reserve(block.vtx.size());
     for (const auto& tx : block.vtx) {
-        vPos.emplace_back(tx->GetHash(), pos);
+        positions->vPos.emplace_back(tx->GetHash(), pos);
         pos.nTxOffset += ::GetSerializeSize(*tx, CLIENT_VERSION);
     }
-    return m_db->WriteTxs(vPos);
+    data = std::move(positions);
+    return true;
+}
+
+bool TxIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex, const BlockData* data)
+{
+    if (!data) return true;
+    return m_db->WriteTxs(static_cast<const TxPositions*>(data)->vPos);
 }
 
 BaseIndex::DB& TxIndex::GetDB() const { return *m_db; }
@@ -51,7 +51,9 @@ protected:
     /// Override base class init to migrate from old database.
     bool Init() override;
 
-    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) override;
+    bool PrepareBlock(const CBlock& block, const CBlockIndex* pindex, std::unique_ptr<BlockData>& data) const override;
+
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex, const BlockData* data) override;
 
     BaseIndex::DB& GetDB() const override;
 
@@ -15,6 +15,7 @@
 #include <amount.h>
 #include <banman.h>
 #include <blockfilter.h>
+#include <blockpipeline.h>
 #include <chain.h>
 #include <chainparams.h>
 #include <compat/sanity.h>
@@ -25,6 +26,7 @@
 #include <httprpc.h>
 #include <httpserver.h>
 #include <index/blockfilterindex.h>
+#include <index/coinstatsindex.h>
 #include <index/txindex.h>
 #include <interfaces/chain.h>
 #include <key.h>
@@ -110,7 +112,8 @@ static const bool DEFAULT_STOPAFTERBLOCKIMPORT = false;
 // anyway.
 #define MIN_CORE_FILEDESCRIPTORS 0
 #else
-#define MIN_CORE_FILEDESCRIPTORS 150
+// Leave room for the block and undo files FlatFileReader keeps open
+#define MIN_CORE_FILEDESCRIPTORS (150 + (int)MAX_BLOCK_READER_FILES)
 #endif
 
 static const char* FEE_ESTIMATES_FILENAME="fee_estimates.dat";
@@ -181,9 +184,15 @@ void Interrupt(NodeContext& node)
     InterruptMapPort();
     if (node.connman)
         node.connman->Interrupt();
+    if (g_block_pipeline) {
+        g_block_pipeline->Interrupt();
+    }
     if (g_txindex) {
         g_txindex->Interrupt();
     }
+    if (g_coin_stats_index) {
+        g_coin_stats_index->Interrupt();
+    }
     ForEachBlockFilterIndex([](BlockFilterIndex& index) { index.Interrupt(); });
 }
 
@@ -224,6 +233,9 @@ void Shutdown(NodeContext& node)
     //
     // Thus the implicit locking order requirement is: (1) cs_main, (2) g_cs_orphans, (3) cs_vNodes.
     if (node.connman) node.connman->Stop();
+    // Stopped after the message handlers, which submit to it, and before the
+    // chainstate is flushed.
+    if (g_block_pipeline) g_block_pipeline->Stop();
 
     StopTorControl();
 
@@ -235,6 +247,7 @@ void Shutdown(NodeContext& node)
 
     // After the threads that potentially access these pointers have been stopped,
     // destruct and reset all to nullptr.
+    g_block_pipeline.reset();
     node.peer_logic.reset();
     node.connman.reset();
     node.banman.reset();
@@ -243,6 +256,11 @@ void Shutdown(NodeContext& node)
         DumpMempool(::mempool);
     }
 
+    // Before the final flush, which empties the coins cache
+    if (g_chainstate && gArgs.GetBoolArg("-persistcoinscache", DEFAULT_PERSIST_COINS_CACHE)) {
+        DumpCoinsCache(*g_chainstate);
+    }
+
     DumpMasternodes();
     DumpMasternodePayments();
 
@@ -278,6 +296,10 @@ void Shutdown(NodeContext& node)
         g_txindex->Stop();
         g_txindex.reset();
     }
+    if (g_coin_stats_index) {
+        g_coin_stats_index->Stop();
+        g_coin_stats_index.reset();
+    }
     ForEachBlockFilterIndex([](BlockFilterIndex& index) { index.Stop(); });
     DestroyAllBlockFilterIndexes();
 
@@ -397,13 +419,16 @@ void SetupServerArgs()
 #if HAVE_SYSTEM
     gArgs.AddArg("-alertnotify=<cmd>", "Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)", ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
 #endif
+    gArgs.AddArg("-assumeutxo=<height>:<hash>", "Accept a UTXO set snapshot whose base block is at <height> if its hash, as reported by dumptxoutset, is <hash> (see loadtxoutset). Can be specified multiple times", ArgsManager::ALLOW_ANY | ArgsManager::DEBUG_ONLY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-assumevalid=<hex>", strprintf("If this block is in the chain assume that it and its ancestors are valid and potentially skip their script verification (0 to verify all, default: %s, testnet: %s)", defaultChainParams->GetConsensus().defaultAssumeValid.GetHex(), testnetChainParams->GetConsensus().defaultAssumeValid.GetHex()), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-blocksdir=<dir>", "Specify directory to hold blocks subdirectory for *.dat files (default: <datadir>)", ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
 #if HAVE_SYSTEM
     gArgs.AddArg("-blocknotify=<cmd>", "Execute command when the best block changes (%s in cmd is replaced by block hash)", ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
 #endif
+    gArgs.AddArg("-blockcheckthreads=<n>", strprintf("Set the number of threads running context-free checks on blocks downloaded during initial block download, ahead of connecting them (0 to %d, 0 = check on the message handler thread, default: %d)", MAX_BLOCK_CHECK_THREADS, DEFAULT_BLOCK_CHECK_THREADS), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-blockreconstructionextratxn=<n>", strprintf("Extra transactions to keep in memory for compact block reconstructions (default: %u)", DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-blocksonly", strprintf("Whether to reject transactions from network peers. Automatic broadcast and rebroadcast of any transactions from inbound peers is disabled, unless '-whitelistforcerelay' is '1', in which case whitelisted peers' transactions will be relayed. RPC transactions are not affected. (default: %u)", DEFAULT_BLOCKSONLY), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-coinstatsindex", strprintf("Maintain statistics of the UTXO set as of every block, used by the gettxoutsetinfo rpc call (default: %u)", DEFAULT_COINSTATSINDEX), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-conf=<file>", strprintf("Specify configuration file. Relative paths will be prefixed by datadir location. (default: %s)", BITCOIN_CONF_FILENAME), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-datadir=<dir>", "Specify data directory", ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-dbbatchsize", strprintf("Maximum database write batch size in bytes (default: %u)", nDefaultDbBatchSize), ArgsManager::ALLOW_ANY | ArgsManager::DEBUG_ONLY, OptionsCategory::OPTIONS);
@@ -418,6 +443,7 @@ void SetupServerArgs()
     gArgs.AddArg("-minimumchainwork=<hex>", strprintf("Minimum work assumed to exist on a valid chain in hex (default: %s, testnet: %s)", defaultChainParams->GetConsensus().nMinimumChainWork.GetHex(), testnetChainParams->GetConsensus().nMinimumChainWork.GetHex()), ArgsManager::ALLOW_ANY | ArgsManager::DEBUG_ONLY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-par=<n>", strprintf("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)",
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-persistcoinscache", strprintf("Whether to save the outpoints of the cached coins on shutdown and load the coins into the cache on restart (default: %u)", DEFAULT_PERSIST_COINS_CACHE), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-persistmempool", strprintf("Whether to save the mempool on shutdown and load on restart (default: %u)", DEFAULT_PERSIST_MEMPOOL), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-pid=<file>", strprintf("Specify pid file. Relative paths will be prefixed by a net-specific datadir location. (default: %s)", BITCOIN_PID_FILENAME), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-prune=<n>", strprintf("Reduce storage requirements by enabling pruning (deleting) of old blocks. This allows the pruneblockchain RPC to be called to delete specific blocks, and enables automatic pruning of old blocks if a target size in MiB is provided. This mode is incompatible with -txindex and -rescan. "
@@ -425,6 +451,8 @@ void SetupServerArgs()
             "(default: 0 = disable pruning blocks, 1 = allow manual pruning via RPC, >=%u = automatically prune block files to stay under the specified target size in MiB)", MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-reindex", "Rebuild chain state and block index from the blk*.dat files on disk", ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-reindex-chainstate", "Rebuild chain state from the currently indexed blocks. When in pruning mode or if blocks on disk might be corrupted, use full -reindex instead.", ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-reindexthreads=<n>", strprintf("Set the number of threads reading and preparing blocks for each index catching up with the block chain, and reading block files during -reindex. During -reindex, at most %d block files are read ahead of the one being imported, and held in memory, so no more than %d of these threads are used (1 to %d, default: %d)", REINDEX_FILES_AHEAD, REINDEX_FILES_AHEAD, MAX_REINDEX_THREADS, DEFAULT_REINDEX_THREADS), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-scriptcheckwindow=<n>", strprintf("During initial block download, wait for the script checks of up to <n> consecutive blocks together instead of after every block, keeping the script verification threads busy. If any check fails, the blocks are connected again one at a time (0 to %d, 0 = disabled, default: %d)", MAX_SCRIPT_CHECK_WINDOW, DEFAULT_SCRIPT_CHECK_WINDOW), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
 #ifndef WIN32
     gArgs.AddArg("-sysperms", "Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)", ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
 #else
@@ -454,6 +482,7 @@ void SetupServerArgs()
     gArgs.AddArg("-maxsendbuffer=<n>", strprintf("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)", DEFAULT_MAXSENDBUFFER), ArgsManager::ALLOW_ANY, OptionsCategory::CONNECTION);
     gArgs.AddArg("-maxtimeadjustment", strprintf("Maximum allowed median peer time offset adjustment. Local perspective of time may be influenced by peers forward or backward by this amount. (default: %u seconds)", DEFAULT_MAX_TIME_ADJUSTMENT), ArgsManager::ALLOW_ANY, OptionsCategory::CONNECTION);
     gArgs.AddArg("-maxuploadtarget=<n>", strprintf("Tries to keep outbound traffic under the given target (in MiB per 24h), 0 = no limit (default: %d)", DEFAULT_MAX_UPLOAD_TARGET), ArgsManager::ALLOW_ANY, OptionsCategory::CONNECTION);
+    gArgs.AddArg("-msghandthreads=<n>", strprintf("Number of threads processing peer messages, each peer is handled by one of them (1 to %d, default: %d)", MAX_MESSAGE_HANDLER_THREADS, DEFAULT_MESSAGE_HANDLER_THREADS), ArgsManager::ALLOW_ANY, OptionsCategory::CONNECTION);
     gArgs.AddArg("-onion=<ip:port>", "Use separate SOCKS5 proxy to reach peers via Tor hidden services, set -noonion to disable (default: -proxy)", ArgsManager::ALLOW_ANY, OptionsCategory::CONNECTION);
     gArgs.AddArg("-onlynet=<net>", "Make outgoing connections only through network <net> (ipv4, ipv6 or onion). Incoming connections are not affected by this option. This option can be specified multiple times to allow multiple networks.", ArgsManager::ALLOW_ANY, OptionsCategory::CONNECTION);
     gArgs.AddArg("-peerbloomfilters", strprintf("Support filtering of blocks and transaction with bloom filters (default: %u)", DEFAULT_PEERBLOOMFILTERS), ArgsManager::ALLOW_ANY, OptionsCategory::CONNECTION);
@@ -545,6 +574,7 @@ void SetupServerArgs()
     gArgs.AddArg("-maxsigcachesize=<n>", strprintf("Limit sum of signature cache and script execution cache sizes to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE), ArgsManager::ALLOW_ANY | ArgsManager::DEBUG_ONLY, OptionsCategory::DEBUG_TEST);
     gArgs.AddArg("-maxtipage=<n>", strprintf("Maximum tip age in seconds to consider node in initial block download (default: %u)", DEFAULT_MAX_TIP_AGE), ArgsManager::ALLOW_ANY | ArgsManager::DEBUG_ONLY, OptionsCategory::DEBUG_TEST);
     gArgs.AddArg("-printpriority", strprintf("Log transaction fee per kB when mining blocks (default: %u)", DEFAULT_PRINTPRIORITY), ArgsManager::ALLOW_ANY | ArgsManager::DEBUG_ONLY, OptionsCategory::DEBUG_TEST);
+    gArgs.AddArg("-paranoidstaking", strprintf("Run full block validity tests on locally minted proof-of-stake blocks before submitting them (default: %u)", DEFAULT_PARANOID_STAKING), ArgsManager::ALLOW_ANY | ArgsManager::DEBUG_ONLY, OptionsCategory::DEBUG_TEST);
     gArgs.AddArg("-printtoconsole", "Send trace/debug info to console (default: 1 when no -daemon. To disable logging to file, set -nodebuglogfile)", ArgsManager::ALLOW_ANY, OptionsCategory::DEBUG_TEST);
     gArgs.AddArg("-shrinkdebugfile", "Shrink debug.log file on client startup (default: 1 when no -debug)", ArgsManager::ALLOW_ANY, OptionsCategory::DEBUG_TEST);
     gArgs.AddArg("-uacomment=<cmt>", "Append comment to the user agent string", ArgsManager::ALLOW_ANY, OptionsCategory::DEBUG_TEST);
@@ -713,17 +743,9 @@ static void ThreadImport(std::vector<fs::path> vImportFiles)
 
     // -reindex
     if (fReindex) {
-        int nFile = 0;
-        while (true) {
-            FlatFilePos pos(nFile, 0);
-            if (!fs::exists(GetBlockPosFilename(pos)))
-                break; // No block files left to reindex
-            FILE *file = OpenBlockFile(pos, true);
-            if (!file)
-                break; // This error is logged in OpenBlockFile
-            LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
-            LoadExternalBlockFile(chainparams, file, &pos);
-            nFile++;
+        if (!LoadBlockFiles(chainparams)) {
+            LogPrintf("Shutdown requested. Exit %s\n", __func__);
+            return;
         }
         pblocktree->WriteReindexing(false);
         fReindex = false;
@@ -757,6 +779,9 @@ static void ThreadImport(std::vector<fs::path> vImportFiles)
         return;
     }
     } // End scope of CImportingNow
+    if (gArgs.GetBoolArg("-persistcoinscache", DEFAULT_PERSIST_COINS_CACHE)) {
+        LoadCoinsCache(::ChainstateActive());
+    }
     if (gArgs.GetArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
         LoadMempool(::mempool);
     }
@@ -1283,10 +1308,13 @@ bool AppInitMain(NodeContext& node)
     LogPrintf("Script verification uses %d additional threads\n", script_threads);
     if (script_threads >= 1) {
         g_parallel_script_checks = true;
+        g_script_check_window = std::max(0, std::min<int>(gArgs.GetArg("-scriptcheckwindow", DEFAULT_SCRIPT_CHECK_WINDOW), MAX_SCRIPT_CHECK_WINDOW));
         for (int i = 0; i < script_threads; ++i) {
             threadGroup.create_thread([i]() { return ThreadScriptCheck(i); });
+            threadGroup.create_thread([i]() { return ThreadCoinsPrefetch(i); });
         }
     }
+    g_reindex_threads = std::max(1, std::min<int>(gArgs.GetArg("-reindexthreads", DEFAULT_REINDEX_THREADS), MAX_REINDEX_THREADS));
 
     assert(!node.scheduler);
     node.scheduler = MakeUnique<CScheduler>();
@@ -1583,6 +1611,20 @@ bool AppInitMain(NodeContext& node)
                         "", CClientUIInterface::MSG_ERROR);
                 });
 
+                // A snapshot that was not loaded completely leaves a chainstate
+                // with only part of the coins. The block tree is wiped with -reindex.
+                bool loading_snapshot = false;
+                pblocktree->ReadFlag("loadingtxoutset", loading_snapshot);
+                if (loading_snapshot) {
+                    strLoadError = _("Loading a UTXO set snapshot was interrupted. You need to rebuild the database using -reindex.").translated;
+                    break;
+                }
+
+                if (::ChainstateActive().CoinsDB().GetVersion() > CHAINSTATE_VERSION) {
+                    strLoadError = _("The chainstate database format is too new for this version. You need to rebuild the database using -reindex-chainstate.").translated;
+                    break;
+                }
+
                 // If necessary, upgrade from older database format.
                 // This is a no-op if we cleared the coinsviewdb with -reindex or -reindex-chainstate
                 if (!::ChainstateActive().CoinsDB().Upgrade()) {
@@ -1693,6 +1735,15 @@ bool AppInitMain(NodeContext& node)
     fFeeEstimatesInitialized = true;
 
     // ********************************************************* Step 8: start indexers
+    bool fAssumedValidChain;
+    {
+        LOCK(cs_main);
+        fAssumedValidChain = ::ChainActive().Height() > 0 && (::ChainActive()[1]->nStatus & BLOCK_ASSUMED_VALID);
+    }
+    // The blocks below a loaded UTXO set snapshot have no data, and these indexes can't skip them
+    if (fAssumedValidChain && (!g_enabled_filter_types.empty() || gArgs.GetBoolArg("-coinstatsindex", DEFAULT_COINSTATSINDEX))) {
+        return InitError(_("A UTXO set snapshot was loaded, which is incompatible with -coinstatsindex and -blockfilterindex").translated);
+    }
     if (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
         g_txindex = MakeUnique<TxIndex>(nTxIndexCache, false, fReindex);
         g_txindex->Start();
@@ -1703,6 +1754,12 @@ bool AppInitMain(NodeContext& node)
         GetBlockFilterIndex(filter_type)->Start();
     }
 
+    if (gArgs.GetBoolArg("-coinstatsindex", DEFAULT_COINSTATSINDEX)) {
+        // The index holds one small record per block and needs little cache
+        g_coin_stats_index = MakeUnique<CoinStatsIndex>(/* cache size */ 0, false, fReindex);
+        g_coin_stats_index->Start();
+    }
+
     // ********************************************************* Step 9: load wallet
     for (const auto& client : node.chain_clients) {
         if (!client->load()) {
@@ -1864,6 +1921,10 @@ bool AppInitMain(NodeContext& node)
         LOCK(cs_main);
         LogPrintf("block tree size = %u\n", ::BlockIndex().size());
         chain_active_height = ::ChainActive().Height();
+        // The blocks below a loaded UTXO set snapshot were never downloaded, so they can't be served
+        if (fAssumedValidChain) {
+            nLocalServices = ServiceFlags(nLocalServices & ~NODE_NETWORK);
+        }
     }
     LogPrintf("nBestHeight = %d\n", chain_active_height);
 
@@ -1890,6 +1951,7 @@ bool AppInitMain(NodeContext& node)
     connOptions.m_msgproc = node.peer_logic.get();
     connOptions.nSendBufferMaxSize = 1000*gArgs.GetArg("-maxsendbuffer", DEFAULT_MAXSENDBUFFER);
     connOptions.nReceiveFloodSize = 1000*gArgs.GetArg("-maxreceivebuffer", DEFAULT_MAXRECEIVEBUFFER);
+    connOptions.nMessageHandlerThreads = gArgs.GetArg("-msghandthreads", DEFAULT_MESSAGE_HANDLER_THREADS);
     connOptions.m_added_nodes = gArgs.GetArgs("-addnode");
 
     connOptions.nMaxOutboundTimeframe = nMaxOutboundTimeframe;
@@ -1927,6 +1989,12 @@ bool AppInitMain(NodeContext& node)
             connOptions.m_specified_outgoing = connect;
         }
     }
+    const int block_check_threads = std::min<int>(gArgs.GetArg("-blockcheckthreads", DEFAULT_BLOCK_CHECK_THREADS), MAX_BLOCK_CHECK_THREADS);
+    if (block_check_threads > 0) {
+        LogPrintf("Initial block download uses %d block check threads\n", block_check_threads);
+        g_block_pipeline = MakeUnique<CBlockPipeline>(chainparams, block_check_threads);
+    }
+
     if (!node.connman->Start(*node.scheduler, connOptions)) {
         return false;
     }
@@ -178,7 +178,7 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
         bool fStakeFound = false;
         if (nSearchTime >= m_last_coin_stake_search_time) {
             unsigned int nTxNewTime = 0;
-            if (stake.CreateCoinStake(pblock->nBits, coinstakeTx, nTxNewTime)) {
+            if (stake.CreateCoinStake(pblock->nBits, coinstakeTx, nTxNewTime, pblocktemplate->hashProofOfStake)) {
                 pblock->nTime = nTxNewTime;
                 coinbaseTx.vout[0].SetEmpty();
                 pblock->vtx[1] = MakeTransactionRef(std::move(coinstakeTx));
@@ -209,9 +209,13 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     pblock->nNonce         = 0;
     pblocktemplate->vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(*pblock->vtx[0]);
 
-    BlockValidationState state;
-    if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
-        throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, state.ToString()));
+    // A proof-of-stake template is not final yet: the miner still changes the
+    // coinbase and signs it, and ProcessNewBlock validates the result anyway.
+    if (!fProofOfStake || gArgs.GetBoolArg("-paranoidstaking", DEFAULT_PARANOID_STAKING)) {
+        BlockValidationState state;
+        if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
+            throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, state.ToString()));
+        }
     }
     int64_t nTime2 = GetTimeMicros();
 
@@ -544,6 +548,14 @@ void static BitcoinMiner(const CChainParams& chainparams, CConnman& connman, CWa
                     MilliSleep(1000);
                     continue;
                 }
+
+                // Don't search the same tip again until its hash drift window has moved on
+                int64_t nHashedTime = 0;
+                if (pwallet->GetBlockHashedTime(::ChainActive().Tip()->GetBlockHash(), nHashedTime) &&
+                    GetTime() - nHashedTime < std::max<int64_t>(stake.nHashInterval, 1)) {
+                    MilliSleep(1000);
+                    continue;
+                }
             }
 
             //
@@ -569,18 +581,24 @@ void static BitcoinMiner(const CChainParams& chainparams, CConnman& connman, CWa
             //Sign block
             if (fProofOfStake) {
                 LogPrintf("CPUMiner : proof-of-stake block found %s \n", pblock->GetHash().ToString().c_str());
-                LegacyScriptPubKeyMan* spk_man = pwallet->GetLegacyScriptPubKeyMan();
-                if (!SignBlock(*pblock, *spk_man)) {
+                if (!SignBlock(*pblock, pwallet->GetStakingKeys())) {
                     LogPrintf("BitcoinMiner(): Signing new block failed \n");
                     throw std::runtime_error(strprintf("%s: SignBlock failed", __func__));
                 }
                 LogPrintf("CPUMiner : proof-of-stake block was signed %s \n", pblock->GetHash().ToString().c_str());
+                AddLocalStakeProof(pblock->GetHash(), pblocktemplate->hashProofOfStake);
             }
 
-            // check if block is valid
-            BlockValidationState state;
-            if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
-                throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, state.ToString()));
+            // check if block is valid; locally minted proof-of-stake blocks are
+            // fully validated once, by ProcessNewBlock, unless -paranoidstaking
+            if (!fProofOfStake || gArgs.GetBoolArg("-paranoidstaking", DEFAULT_PARANOID_STAKING)) {
+                LOCK(cs_main);
+                if (pindexPrev != ::ChainActive().Tip())
+                    continue;
+                BlockValidationState state;
+                if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
+                    throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, state.ToString()));
+                }
             }
 
             // process proof of stake block
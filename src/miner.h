@@ -25,6 +25,8 @@ class CWallet;
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Default for -paranoidstaking: run TestBlockValidity on locally minted proof-of-stake blocks */
+static const bool DEFAULT_PARANOID_STAKING = false;
 
 extern int64_t nLastCoinStakeSearchInterval;
 
@@ -34,6 +36,8 @@ struct CBlockTemplate
     std::vector<CAmount> vTxFees;
     std::vector<int64_t> vTxSigOpsCost;
     std::vector<unsigned char> vchCoinbaseCommitment;
+    //! Kernel hash found while building the coinstake (proof-of-stake templates only)
+    uint256 hashProofOfStake;
 };
 
 // Container for tracking updates to ancestor feerate as we include (parent)
@@ -23,6 +23,13 @@
 # error "Bitcoin cannot be compiled without assertions."
 #endif
 
+/**
+ * The masternode managers are not safe to use from several message handler
+ * threads at once, so their message processing is serialized on this lock.
+ * Must be taken before cs_main.
+ */
+static RecursiveMutex cs_mn_processing;
+
 int ActiveProtocol()
 {
     return PROTOCOL_VERSION;
@@ -30,6 +37,15 @@ int ActiveProtocol()
 
 bool AlreadyHaveMasternodeTypes(const CInv& inv, const CTxMemPool& mempool)
 {
+    // Called with cs_main held, so this must not wait for another thread
+    // processing a masternode message. Report the item as new instead; the
+    // duplicate is dropped by the seen maps once it arrives.
+    TRY_LOCK(cs_mn_processing, lockMasternodes);
+    if (!lockMasternodes) {
+        return inv.type != MSG_SPORK && inv.type != MSG_MASTERNODE_WINNER &&
+               inv.type != MSG_MASTERNODE_ANNOUNCE && inv.type != MSG_MASTERNODE_PING;
+    }
+
     switch (inv.type)
     {
         case MSG_SPORK:
@@ -57,6 +73,11 @@ void ProcessGetDataMasternodeTypes(CNode* pfrom, const CChainParams& chainparams
 {
     const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
 
+    // See AlreadyHaveMasternodeTypes
+    TRY_LOCK(cs_mn_processing, lockMasternodes);
+    if (!lockMasternodes)
+        return;
+
     if (!push && inv.type == MSG_SPORK) {
         if(mapSporks.count(inv.hash)) {
             connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::SPORK, mapSporks[inv.hash]));
@@ -98,6 +119,7 @@ bool ProcessMessageMasternodeTypes(CNode* pfrom, const std::string& msg_type, CD
     }
 
     if (found) {
+        LOCK(cs_mn_processing);
         mnodeman.ProcessMessage(pfrom, msg_type, vRecv, *connman);
         masternodePayments.ProcessMessageMasternodePayments(pfrom, msg_type, vRecv, *connman);
         sporkManager.ProcessSpork(pfrom, msg_type, vRecv, *connman);
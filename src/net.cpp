@@ -33,7 +33,9 @@
 #include <fcntl.h>
 #endif
 
-#ifdef USE_POLL
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#elif defined(USE_POLL)
 #include <poll.h>
 #endif
 
@@ -80,6 +82,11 @@ enum BindFlags {
 // The sleep time needs to be small to avoid new sockets stalling
 static const uint64_t SELECT_TIMEOUT_MILLISECONDS = 50;
 
+#ifdef USE_EPOLL
+/** Maximum number of socket events handled per epoll_wait; the rest are returned by the next call */
+static const int MAX_EPOLL_EVENTS = 1024;
+#endif
+
 const std::string NET_MESSAGE_COMMAND_OTHER = "*other*";
 
 static const uint64_t RANDOMIZER_ID_NETGROUP = 0x6c0edd8036ef4036ULL; // SHA256("netgroup")[0:8]
@@ -670,13 +677,15 @@ int V1TransportDeserializer::readData(const char *pch, unsigned int nBytes)
     unsigned int nRemaining = hdr.nMessageSize - nDataPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
-    if (vRecv.size() < nDataPos + nCopy) {
-        // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
+    if (nDataPos == 0 && vRecv.capacity() == 0) {
+        vRecv = CDataStream(g_recv_buffer_pool.Get(hdr.nMessageSize), vRecv.GetType(), vRecv.GetVersion());
     }
 
+    // Append rather than allocating the announced size up front, so a peer
+    // cannot make us reserve memory for data it never sends. The checksum is
+    // computed as the payload arrives.
     hasher.Write((const unsigned char*)pch, nCopy);
-    memcpy(&vRecv[nDataPos], pch, nCopy);
+    vRecv.write(pch, nCopy);
     nDataPos += nCopy;
 
     return nCopy;
@@ -723,6 +732,70 @@ CNetMessage V1TransportDeserializer::GetMessage(const CMessageHeader::MessageSta
     return msg;
 }
 
+CNetMessage::~CNetMessage()
+{
+    g_recv_buffer_pool.Put(m_recv.release());
+}
+
+CRecvBufferPool g_recv_buffer_pool(MAX_POOLED_RECV_BUFFERS, MAX_POOLED_RECV_BYTES);
+
+CSerializeData CRecvBufferPool::Get(size_t nSize)
+{
+    LOCK(cs);
+    if (vBuffers.empty()) {
+        nMisses++;
+        return CSerializeData();
+    }
+    // Smallest buffer that fits, or the largest one if none does
+    size_t nBest = 0;
+    for (size_t i = 1; i < vBuffers.size(); i++) {
+        const size_t nCapacity = vBuffers[i].capacity();
+        const size_t nBestCapacity = vBuffers[nBest].capacity();
+        if (nBestCapacity >= nSize ? (nCapacity >= nSize && nCapacity < nBestCapacity) : nCapacity > nBestCapacity) {
+            nBest = i;
+        }
+    }
+    CSerializeData buf;
+    buf.swap(vBuffers[nBest]);
+    if (nBest != vBuffers.size() - 1) {
+        vBuffers[nBest].swap(vBuffers.back());
+    }
+    vBuffers.pop_back();
+    nBytes -= buf.capacity();
+    if (buf.capacity() >= nSize) {
+        nHits++;
+    } else {
+        nMisses++;
+    }
+    return buf;
+}
+
+void CRecvBufferPool::Put(CSerializeData&& buf)
+{
+    if (buf.capacity() == 0)
+        return;
+    LOCK(cs);
+    if (vBuffers.size() >= nMaxBuffers || nBytes + buf.capacity() > nMaxBytes) {
+        nDropped++;
+        return;
+    }
+    buf.clear();
+    nBytes += buf.capacity();
+    vBuffers.push_back(std::move(buf));
+}
+
+CRecvBufferPool::Stats CRecvBufferPool::GetStats() const
+{
+    LOCK(cs);
+    Stats stats;
+    stats.nHits = nHits;
+    stats.nMisses = nMisses;
+    stats.nDropped = nDropped;
+    stats.nBuffers = vBuffers.size();
+    stats.nBytes = nBytes;
+    return stats;
+}
+
 void V1TransportSerializer::prepareForTransport(CSerializedNetMsg& msg, std::vector<unsigned char>& header) {
     // create dbl-sha256 checksum
     uint256 hash = Hash(msg.data.begin(), msg.data.end());
@@ -1056,6 +1129,7 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
+        RegisterSocketEvents(hSocket, true);
     }
 
     // We received a new connection, harvest entropy from the time (and our peer count)
@@ -1218,7 +1292,77 @@ bool CConnman::GenerateSelectSet(std::set<SOCKET> &recv_set, std::set<SOCKET> &s
     return !recv_set.empty() || !send_set.empty() || !error_set.empty();
 }
 
-#ifdef USE_POLL
+#ifdef USE_EPOLL
+void CConnman::RegisterSocketEvents(SOCKET hSocket, bool fEdgeTriggered)
+{
+    if (m_epoll_fd == -1)
+        return;
+
+    // Peer sockets are registered once, for both directions and edge-triggered,
+    // so nothing has to be rebuilt per iteration. Listen sockets stay
+    // level-triggered as AcceptConnection accepts a single connection per call.
+    struct epoll_event event;
+    event.data.fd = hSocket;
+    event.events = fEdgeTriggered ? (EPOLLIN | EPOLLOUT | EPOLLET) : EPOLLIN;
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, hSocket, &event) != 0) {
+        LogPrintf("%s: epoll_ctl failed for socket %d: %s\n", __func__, hSocket, NetworkErrorString(WSAGetLastError()));
+    }
+}
+
+void CConnman::WakeSocketHandler()
+{
+    if (m_wakeup_pipe[1] == -1 || m_wakeup_pending.exchange(true))
+        return;
+    char buf{0};
+    if (write(m_wakeup_pipe[1], &buf, sizeof(buf)) != 1) {
+        m_wakeup_pending = false;
+    }
+}
+
+void CConnman::SocketEvents(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set)
+{
+    if (m_epoll_fd == -1) {
+        interruptNet.sleep_for(std::chrono::milliseconds(SELECT_TIMEOUT_MILLISECONDS));
+        return;
+    }
+
+    // An edge-triggered socket is only reported again once new data arrives, so
+    // sockets that were not drained last time are serviced without waiting for it.
+    bool fMoreData = false;
+    for (const auto& pending : m_epoll_recv_pending) {
+        recv_set.insert(pending.first);
+        fMoreData |= pending.second;
+    }
+    m_epoll_recv_pending.clear();
+
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    int nEvents = epoll_wait(m_epoll_fd, events, MAX_EPOLL_EVENTS, fMoreData ? 0 : SELECT_TIMEOUT_MILLISECONDS);
+
+    if (interruptNet) return;
+
+    if (nEvents < 0) {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEINTR) {
+            LogPrintf("socket epoll error %s\n", NetworkErrorString(nErr));
+            interruptNet.sleep_for(std::chrono::milliseconds(SELECT_TIMEOUT_MILLISECONDS));
+        }
+        return;
+    }
+
+    for (int i = 0; i < nEvents; i++) {
+        SOCKET hSocket = events[i].data.fd;
+        if (hSocket == (SOCKET)m_wakeup_pipe[0]) {
+            char buf[128];
+            while (read(m_wakeup_pipe[0], buf, sizeof(buf)) > 0) {}
+            m_wakeup_pending = false;
+            continue;
+        }
+        if (events[i].events & EPOLLIN)               recv_set.insert(hSocket);
+        if (events[i].events & EPOLLOUT)              send_set.insert(hSocket);
+        if (events[i].events & (EPOLLERR | EPOLLHUP)) error_set.insert(hSocket);
+    }
+}
+#elif defined(USE_POLL)
 void CConnman::SocketEvents(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set)
 {
     std::set<SOCKET> recv_select_set, send_select_set, error_select_set;
@@ -1336,6 +1480,12 @@ void CConnman::SocketEvents(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_s
 }
 #endif
 
+#ifndef USE_EPOLL
+void CConnman::RegisterSocketEvents(SOCKET hSocket, bool fEdgeTriggered) {}
+
+void CConnman::WakeSocketHandler() {}
+#endif
+
 void CConnman::SocketHandler()
 {
     std::set<SOCKET> recv_set, send_set, error_set;
@@ -1375,14 +1525,36 @@ void CConnman::SocketHandler()
         bool recvSet = false;
         bool sendSet = false;
         bool errorSet = false;
+#ifdef USE_EPOLL
+        SOCKET hSocket;
+#endif
         {
             LOCK(pnode->cs_hSocket);
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
+#ifdef USE_EPOLL
+            hSocket = pnode->hSocket;
+#endif
             recvSet = recv_set.count(pnode->hSocket) > 0;
             sendSet = send_set.count(pnode->hSocket) > 0;
             errorSet = error_set.count(pnode->hSocket) > 0;
         }
+#ifdef USE_EPOLL
+        // The event set is not filtered up front like GenerateSelectSet does:
+        // hold off reading from paused peers and peers we still have to send
+        // to, and remember their socket is readable.
+        if (recvSet && !errorSet) {
+            bool fSendPending;
+            {
+                LOCK(pnode->cs_vSend);
+                fSendPending = !pnode->vSendMsg.empty();
+            }
+            if (pnode->fPauseRecv || fSendPending) {
+                m_epoll_recv_pending.emplace(hSocket, false);
+                recvSet = false;
+            }
+        }
+#endif
         if (recvSet || errorSet)
         {
             // typical socket buffer is 8K-64K
@@ -1396,6 +1568,11 @@ void CConnman::SocketHandler()
             }
             if (nBytes > 0)
             {
+#ifdef USE_EPOLL
+                // A full buffer means the socket may not be drained yet
+                if (nBytes == sizeof(pchBuf))
+                    m_epoll_recv_pending[hSocket] = true;
+#endif
                 bool notify = false;
                 if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
                     pnode->CloseSocketDisconnect();
@@ -1414,7 +1591,7 @@ void CConnman::SocketHandler()
                         pnode->nProcessQueueSize += nSizeAdded;
                         pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
                     }
-                    WakeMessageHandler();
+                    WakeMessageHandler(pnode);
                 }
             }
             else if (nBytes == 0)
@@ -1449,6 +1626,12 @@ void CConnman::SocketHandler()
             if (nBytes) {
                 RecordBytesSent(nBytes);
             }
+#ifdef USE_EPOLL
+            // Reads held back for this send can go ahead without waiting for a new event
+            auto it = m_epoll_recv_pending.find(hSocket);
+            if (it != m_epoll_recv_pending.end() && pnode->vSendMsg.empty() && !pnode->fPauseRecv)
+                it->second = true;
+#endif
         }
 
         InactivityCheck(pnode);
@@ -1470,13 +1653,49 @@ void CConnman::ThreadSocketHandler()
     }
 }
 
+CConnman::MessageHandler::MessageHandler()
+{
+    for (auto& bucket : vLatency) {
+        bucket = 0;
+    }
+}
+
+void CConnman::MessageHandler::RecordTurn(int64_t nMicros)
+{
+    int nBucket = 0;
+    for (int64_t nLimit = 100; nBucket < MESSAGE_HANDLER_LATENCY_BUCKETS - 1 && nMicros >= nLimit; nLimit *= 10) {
+        nBucket++;
+    }
+    vLatency[nBucket]++;
+    nTurns++;
+    nBusyMicros += nMicros;
+}
+
+size_t CConnman::GetMessageHandlerIndex(const CNode* pnode) const
+{
+    return pnode->GetId() % nMessageHandlerThreads;
+}
+
 void CConnman::WakeMessageHandler()
 {
+    for (int i = 0; i < nMessageHandlerThreads; i++) {
+        MessageHandler& handler = *m_msg_handlers[i];
+        {
+            LOCK(handler.mutexMsgProc);
+            handler.fMsgProcWake = true;
+        }
+        handler.condMsgProc.notify_one();
+    }
+}
+
+void CConnman::WakeMessageHandler(const CNode* pnode)
+{
+    MessageHandler& handler = *m_msg_handlers[GetMessageHandlerIndex(pnode)];
     {
-        std::lock_guard<std::mutex> lock(mutexMsgProc);
-        fMsgProcWake = true;
+        LOCK(handler.mutexMsgProc);
+        handler.fMsgProcWake = true;
     }
-    condMsgProc.notify_one();
+    handler.condMsgProc.notify_one();
 }
 
 
@@ -2072,6 +2291,11 @@ void CConnman::OpenNetworkConnection(const CAddress& addrConnect, bool fCountFai
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
+        // Only register the socket once the node is in vNodes. SocketHandler
+        // copies vNodes after waiting for events, so an edge-triggered event
+        // can't be consumed before the node it belongs to is serviced.
+        LOCK(pnode->cs_hSocket);
+        RegisterSocketEvents(pnode->hSocket, true);
     }
 }
 
@@ -2079,15 +2303,18 @@ void CConnman::OpenMasternodeConnection(const CAddress &addrConnect) {
     OpenNetworkConnection(addrConnect, false, nullptr, nullptr, false, false, false, false, true);
 }
 
-void CConnman::ThreadMessageHandler()
+void CConnman::ThreadMessageHandler(size_t nHandler)
 {
+    MessageHandler& handler = *m_msg_handlers[nHandler];
     while (!flagInterruptMsgProc)
     {
         std::vector<CNode*> vNodesCopy;
         {
             LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            for (CNode* pnode : vNodesCopy) {
+            for (CNode* pnode : vNodes) {
+                if (GetMessageHandlerIndex(pnode) != nHandler)
+                    continue;
+                vNodesCopy.push_back(pnode);
                 pnode->AddRef();
             }
         }
@@ -2099,6 +2326,8 @@ void CConnman::ThreadMessageHandler()
             if (pnode->fDisconnect)
                 continue;
 
+            const int64_t nTurnStart = GetTimeMicros();
+
             // Receive messages
             bool fMoreNodeWork = m_msgproc->ProcessMessages(pnode, flagInterruptMsgProc);
             fMoreWork |= (fMoreNodeWork && !pnode->fPauseSend);
@@ -2110,6 +2339,8 @@ void CConnman::ThreadMessageHandler()
                 m_msgproc->SendMessages(pnode);
             }
 
+            handler.RecordTurn(GetTimeMicros() - nTurnStart);
+
             if (flagInterruptMsgProc)
                 return;
         }
@@ -2120,11 +2351,11 @@ void CConnman::ThreadMessageHandler()
                 pnode->Release();
         }
 
-        WAIT_LOCK(mutexMsgProc, lock);
+        WAIT_LOCK(handler.mutexMsgProc, lock);
         if (!fMoreWork) {
-            condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [this] { return fMsgProcWake; });
+            handler.condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [&handler]() EXCLUSIVE_LOCKS_REQUIRED(handler.mutexMsgProc) { return handler.fMsgProcWake; });
         }
-        fMsgProcWake = false;
+        handler.fMsgProcWake = false;
     }
 }
 
@@ -2197,6 +2428,7 @@ bool CConnman::BindListenPort(const CService& addrBind, std::string& strError, N
     }
 
     vhListenSocket.push_back(ListenSocket(hListenSocket, permissions));
+    RegisterSocketEvents(hListenSocket, false);
 
     if (addrBind.IsRoutable() && fDiscover && (permissions & PF_NOBAN) == 0)
         AddLocal(addrBind, LOCAL_BIND);
@@ -2272,6 +2504,12 @@ CConnman::CConnman(uint64_t nSeed0In, uint64_t nSeed1In) : nSeed0(nSeed0In), nSe
 {
     SetTryNewOutboundPeer(false);
 
+    // Handlers are never destroyed while the CConnman exists, so they can be
+    // woken from any thread; only the first nMessageHandlerThreads are started.
+    for (int i = 0; i < MAX_MESSAGE_HANDLER_THREADS; i++) {
+        m_msg_handlers.push_back(MakeUnique<MessageHandler>());
+    }
+
     Options connOptions;
     Init(connOptions);
 }
@@ -2329,6 +2567,20 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
         nMaxOutboundCycleStartTime = 0;
     }
 
+#ifdef USE_EPOLL
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epoll_fd == -1 || pipe2(m_wakeup_pipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+        LogPrintf("Failed to set up epoll: %s\n", NetworkErrorString(WSAGetLastError()));
+        if (clientInterface) {
+            clientInterface->ThreadSafeMessageBox(
+                _("Failed to set up the network event loop.").translated,
+                "", CClientUIInterface::MSG_ERROR);
+        }
+        return false;
+    }
+    RegisterSocketEvents(m_wakeup_pipe[0], false);
+#endif
+
     if (fListen && !InitBinds(connOptions.vBinds, connOptions.vWhiteBinds)) {
         if (clientInterface) {
             clientInterface->ThreadSafeMessageBox(
@@ -2383,9 +2635,9 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
     interruptNet.reset();
     flagInterruptMsgProc = false;
 
-    {
-        LOCK(mutexMsgProc);
-        fMsgProcWake = false;
+    for (const auto& handler : m_msg_handlers) {
+        LOCK(handler->mutexMsgProc);
+        handler->fMsgProcWake = false;
     }
 
     // Send and receive from sockets, accept connections
@@ -2414,7 +2666,11 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
         threadOpenConnections = std::thread(&TraceThread<std::function<void()> >, "opencon", std::function<void()>(std::bind(&CConnman::ThreadOpenConnections, this, connOptions.m_specified_outgoing)));
 
     // Process messages
-    threadMessageHandler = std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this)));
+    for (int i = 0; i < nMessageHandlerThreads; i++) {
+        MessageHandler& handler = *m_msg_handlers[i];
+        handler.strThreadName = nMessageHandlerThreads == 1 ? "msghand" : strprintf("msghand.%d", i);
+        handler.thread = std::thread(&TraceThread<std::function<void()> >, handler.strThreadName.c_str(), std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this, i)));
+    }
 
     // Dump network addresses
     scheduler.scheduleEvery([this] { DumpAddresses(); }, DUMP_PEERS_INTERVAL);
@@ -2439,13 +2695,17 @@ static CNetCleanup instance_of_cnetcleanup;
 
 void CConnman::Interrupt()
 {
-    {
-        std::lock_guard<std::mutex> lock(mutexMsgProc);
-        flagInterruptMsgProc = true;
+    flagInterruptMsgProc = true;
+    for (const auto& handler : m_msg_handlers) {
+        // Taking the lock makes sure the thread is either waiting or will see the flag
+        {
+            LOCK(handler->mutexMsgProc);
+        }
+        handler->condMsgProc.notify_all();
     }
-    condMsgProc.notify_all();
 
     interruptNet();
+    WakeSocketHandler();
     InterruptSocks5(true);
 
     if (semOutbound) {
@@ -2469,8 +2729,10 @@ void CConnman::Interrupt()
 
 void CConnman::Stop()
 {
-    if (threadMessageHandler.joinable())
-        threadMessageHandler.join();
+    for (const auto& handler : m_msg_handlers) {
+        if (handler->thread.joinable())
+            handler->thread.join();
+    }
     if (threadOpenMasternodeConnections.joinable())
         threadOpenMasternodeConnections.join();
     if (threadOpenConnections.joinable())
@@ -2507,6 +2769,13 @@ void CConnman::Stop()
     vNodes.clear();
     vNodesDisconnected.clear();
     vhListenSocket.clear();
+#ifdef USE_EPOLL
+    if (m_epoll_fd != -1) close(m_epoll_fd);
+    if (m_wakeup_pipe[0] != -1) close(m_wakeup_pipe[0]);
+    if (m_wakeup_pipe[1] != -1) close(m_wakeup_pipe[1]);
+    m_epoll_fd = m_wakeup_pipe[0] = m_wakeup_pipe[1] = -1;
+    m_epoll_recv_pending.clear();
+#endif
     semOutbound.reset();
     semMasternodeOutbound.reset();
     semAddnode.reset();
@@ -2604,6 +2873,32 @@ void CConnman::GetNodeStats(std::vector<CNodeStats>& vstats)
     }
 }
 
+void CConnman::GetMessageHandlerStats(std::vector<CMessageHandlerStats>& vstats)
+{
+    vstats.clear();
+    vstats.resize(nMessageHandlerThreads);
+    for (size_t i = 0; i < vstats.size(); i++) {
+        const MessageHandler& handler = *m_msg_handlers[i];
+        CMessageHandlerStats& stats = vstats[i];
+        stats.nPeers = 0;
+        stats.nQueuedMessages = 0;
+        stats.nQueuedBytes = 0;
+        stats.nTurns = handler.nTurns;
+        stats.nBusyMicros = handler.nBusyMicros;
+        for (const auto& bucket : handler.vLatency) {
+            stats.vLatency.push_back(bucket);
+        }
+    }
+    LOCK(cs_vNodes);
+    for (CNode* pnode : vNodes) {
+        CMessageHandlerStats& stats = vstats[GetMessageHandlerIndex(pnode)];
+        stats.nPeers++;
+        LOCK(pnode->cs_vProcessMsg);
+        stats.nQueuedMessages += pnode->vProcessMsg.size();
+        stats.nQueuedBytes += pnode->nProcessQueueSize;
+    }
+}
+
 bool CConnman::DisconnectNode(const std::string& strNode)
 {
     LOCK(cs_vNodes);
@@ -2767,6 +3062,12 @@ ServiceFlags CConnman::GetLocalServices() const
     return nLocalServices;
 }
 
+void CConnman::RemoveLocalServices(ServiceFlags services)
+{
+    ServiceFlags current = nLocalServices;
+    while (!nLocalServices.compare_exchange_weak(current, ServiceFlags(current & ~services))) {}
+}
+
 void CConnman::SetBestHeight(int height)
 {
     nBestHeight.store(height, std::memory_order_release);
@@ -90,6 +90,16 @@ static const int64_t DEFAULT_PEER_CONNECT_TIMEOUT = 60;
 static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
+/** -msghandthreads default */
+static const int DEFAULT_MESSAGE_HANDLER_THREADS = 1;
+/** Maximum number of message handler threads */
+static const int MAX_MESSAGE_HANDLER_THREADS = 16;
+/**
+ * Number of buckets in the message handler latency histograms. Bucket i counts
+ * peer turns that took less than 10^(i+2) microseconds (100us, 1ms, ... 1s),
+ * the last one counts everything slower.
+ */
+static const int MESSAGE_HANDLER_LATENCY_BUCKETS = 6;
 
 typedef int64_t NodeId;
 
@@ -102,6 +112,7 @@ struct AddedNodeInfo
 };
 
 class CNodeStats;
+class CMessageHandlerStats;
 class CClientUIInterface;
 
 struct CSerializedNetMsg
@@ -143,6 +154,7 @@ public:
         int nMaxAddnode = 0;
         int nMaxFeeler = 0;
         int nBestHeight = 0;
+        int nMessageHandlerThreads = DEFAULT_MESSAGE_HANDLER_THREADS;
         CClientUIInterface* uiInterface = nullptr;
         NetEventsInterface* m_msgproc = nullptr;
         BanMan* m_banman = nullptr;
@@ -177,6 +189,7 @@ public:
         nSendBufferMaxSize = connOptions.nSendBufferMaxSize;
         nReceiveFloodSize = connOptions.nReceiveFloodSize;
         m_peer_connect_timeout = connOptions.m_peer_connect_timeout;
+        nMessageHandlerThreads = std::max(1, std::min(connOptions.nMessageHandlerThreads, MAX_MESSAGE_HANDLER_THREADS));
         {
             LOCK(cs_totalBytesSent);
             nMaxOutboundTimeframe = connOptions.nMaxOutboundTimeframe;
@@ -307,6 +320,7 @@ public:
 
     size_t GetNodeCount(NumConnections num);
     void GetNodeStats(std::vector<CNodeStats>& vstats);
+    void GetMessageHandlerStats(std::vector<CMessageHandlerStats>& vstats);
     bool DisconnectNode(const std::string& node);
     bool DisconnectNode(const CSubNet& subnet);
     bool DisconnectNode(const CNetAddr& addr);
@@ -319,6 +333,9 @@ public:
     //! which is used to advertise which services we are offering
     //! that peer during `net_processing.cpp:PushNodeVersion()`.
     ServiceFlags GetLocalServices() const;
+    //! Stop offering services to new peers, such as NODE_NETWORK once the
+    //! blocks below a loaded UTXO set snapshot turn out to be missing.
+    void RemoveLocalServices(ServiceFlags services);
 
     //!set the max outbound target in bytes
     void SetMaxOutboundTarget(uint64_t limit);
@@ -352,7 +369,12 @@ public:
 
     unsigned int GetReceiveFloodSize() const;
 
+    /** Wake up every message handler thread. */
     void WakeMessageHandler();
+    /** Wake up the message handler thread that pnode is assigned to. */
+    void WakeMessageHandler(const CNode* pnode);
+    /** Interrupt the socket handler's wait for socket events (no-op unless built with epoll). */
+    void WakeSocketHandler();
 
     /** Attempts to obfuscate tx time through exponentially distributed emitting.
         Works assuming that a single interval is used.
@@ -389,13 +411,14 @@ private:
     void AddOneShot(const std::string& strDest);
     void ProcessOneShot();
     void ThreadOpenConnections(std::vector<std::string> connect);
-    void ThreadMessageHandler();
+    void ThreadMessageHandler(size_t nHandler);
     void AcceptConnection(const ListenSocket& hListenSocket);
     void DisconnectNodes();
     void NotifyNumConnectionsChanged();
     void InactivityCheck(CNode *pnode);
     bool GenerateSelectSet(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set);
     void SocketEvents(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set);
+    void RegisterSocketEvents(SOCKET hSocket, bool fEdgeTriggered);
     void SocketHandler();
     void ThreadSocketHandler();
     void ThreadDNSAddressSeed();
@@ -471,12 +494,13 @@ private:
      * connection (in ConnectNode()) under a member also called
      * nLocalServices.
      *
-     * This data is not marked const, but after being set it should not
-     * change. See the note in CNode::nLocalServices documentation.
+     * This data is not marked const, but after being set it should only
+     * change through RemoveLocalServices(). See the note in
+     * CNode::nLocalServices documentation.
      *
      * \sa CNode::nLocalServices
      */
-    ServiceFlags nLocalServices;
+    std::atomic<ServiceFlags> nLocalServices;
     std::unique_ptr<CSemaphore> semMasternodeOutbound;
     std::unique_ptr<CSemaphore> semOutbound;
     std::unique_ptr<CSemaphore> semAddnode;
@@ -501,21 +525,56 @@ private:
     /** SipHasher seeds for deterministic randomness */
     const uint64_t nSeed0, nSeed1;
 
-    /** flag for waking the message processor. */
-    bool fMsgProcWake;
+    /**
+     * A message handler thread. Every peer is processed by a single handler,
+     * picked by its id, so messages from one peer are still handled in order.
+     */
+    struct MessageHandler
+    {
+        std::thread thread;
+        std::string strThreadName;
+
+        /** flag for waking the message processor. */
+        bool fMsgProcWake GUARDED_BY(mutexMsgProc){false};
+        std::condition_variable condMsgProc;
+        Mutex mutexMsgProc;
+
+        /** Number of peers processed, and the time spent on them */
+        std::atomic<uint64_t> nTurns{0};
+        std::atomic<int64_t> nBusyMicros{0};
+        std::atomic<uint64_t> vLatency[MESSAGE_HANDLER_LATENCY_BUCKETS];
+
+        MessageHandler();
+        void RecordTurn(int64_t nMicros);
+    };
 
-    std::condition_variable condMsgProc;
-    Mutex mutexMsgProc;
+    size_t GetMessageHandlerIndex(const CNode* pnode) const;
+
+    std::atomic<int> nMessageHandlerThreads{DEFAULT_MESSAGE_HANDLER_THREADS};
+    std::vector<std::unique_ptr<MessageHandler>> m_msg_handlers;
     std::atomic<bool> flagInterruptMsgProc{false};
 
     CThreadInterrupt interruptNet;
 
+#ifdef USE_EPOLL
+    /** epoll instance with every peer (edge-triggered) and listen socket registered */
+    int m_epoll_fd{-1};
+    /** Self-pipe waking up epoll_wait; written at most once per wakeup */
+    int m_wakeup_pipe[2]{-1, -1};
+    std::atomic<bool> m_wakeup_pending{false};
+    /**
+     * Peer sockets whose last readable edge was not consumed by a short read,
+     * mapped to whether more data is likely to be queued. Only used by the
+     * socket handler thread.
+     */
+    std::map<SOCKET, bool> m_epoll_recv_pending;
+#endif
+
     std::thread threadDNSAddressSeed;
     std::thread threadSocketHandler;
     std::thread threadOpenAddedConnections;
     std::thread threadOpenConnections;
     std::thread threadOpenMasternodeConnections;
-    std::thread threadMessageHandler;
 
     /** flag for deciding to connect to an extra outbound peer,
      *  in excess of m_max_outbound_full_relay
@@ -653,7 +712,65 @@ public:
     uint32_t m_mapped_as;
 };
 
+class CMessageHandlerStats
+{
+public:
+    int nPeers;
+    size_t nQueuedMessages;
+    size_t nQueuedBytes;
+    uint64_t nTurns;
+    int64_t nBusyMicros;
+    std::vector<uint64_t> vLatency;
+};
+
+
+
+/**
+ * Free list of message payload buffers. The transport deserializers take their
+ * receive buffer from here and processed messages give it back, so the receive
+ * path does not allocate, grow and clear a new buffer for every message.
+ */
+class CRecvBufferPool
+{
+public:
+    struct Stats
+    {
+        uint64_t nHits;         //!< buffers handed out that were large enough for the message
+        uint64_t nMisses;       //!< buffers that had to be allocated or grown
+        uint64_t nDropped;      //!< buffers given back while the pool was full
+        size_t nBuffers;        //!< buffers currently pooled
+        size_t nBytes;          //!< capacity of the pooled buffers
+    };
+
+    CRecvBufferPool(size_t nMaxBuffersIn, size_t nMaxBytesIn) : nMaxBuffers(nMaxBuffersIn), nMaxBytes(nMaxBytesIn) {}
+
+    /** Take an empty buffer, preferably one that can hold nSize bytes without growing. */
+    CSerializeData Get(size_t nSize);
+    /**
+     * Give a buffer back; its contents are discarded. A pooled buffer is
+     * cleared but not wiped, so the peer data it held stays in memory until
+     * the buffer is reused. A dropped buffer is wiped when it is freed.
+     */
+    void Put(CSerializeData&& buf);
+    Stats GetStats() const;
+
+private:
+    const size_t nMaxBuffers;
+    const size_t nMaxBytes;
+    mutable Mutex cs;
+    std::vector<CSerializeData> vBuffers GUARDED_BY(cs);
+    size_t nBytes GUARDED_BY(cs){0};
+    uint64_t nHits GUARDED_BY(cs){0};
+    uint64_t nMisses GUARDED_BY(cs){0};
+    uint64_t nDropped GUARDED_BY(cs){0};
+};
+
+/** Maximum number of pooled receive buffers */
+static const size_t MAX_POOLED_RECV_BUFFERS = 64;
+/** Maximum total capacity of the pooled receive buffers */
+static const size_t MAX_POOLED_RECV_BYTES = 16 * 1000 * 1000;
 
+extern CRecvBufferPool g_recv_buffer_pool;
 
 /** Transport protocol agnostic message container.
  * Ideally it should only contain receive time, payload,
@@ -671,6 +788,10 @@ public:
     std::string m_command;
 
     CNetMessage(CDataStream&& recv_in) : m_recv(std::move(recv_in)) {}
+    CNetMessage(CNetMessage&&) = default;
+    CNetMessage& operator=(CNetMessage&&) = default;
+    /** Returns the payload buffer to g_recv_buffer_pool */
+    ~CNetMessage();
 
     void SetVersion(int nVersionIn)
     {
@@ -843,7 +964,10 @@ public:
     std::atomic<int> nStartingHeight{-1};
 
     // flood relay
-    std::vector<CAddress> vAddrToSend;
+    // Addresses are pushed from other peers' message handler threads, so
+    // both vAddrToSend and the m_addr_known filter are guarded by cs_vAddrToSend.
+    Mutex cs_vAddrToSend;
+    std::vector<CAddress> vAddrToSend GUARDED_BY(cs_vAddrToSend);
     const std::unique_ptr<CRollingBloomFilter> m_addr_known;
     bool fGetAddr{false};
     std::chrono::microseconds m_next_addr_send GUARDED_BY(cs_sendProcessing){0};
@@ -997,18 +1121,20 @@ public:
 
 
 
-    void AddAddressKnown(const CAddress& _addr)
+    void AddAddressKnown(const CAddress& _addr) LOCKS_EXCLUDED(cs_vAddrToSend)
     {
         assert(m_addr_known);
+        LOCK(cs_vAddrToSend);
         m_addr_known->insert(_addr.GetKey());
     }
 
-    void PushAddress(const CAddress& _addr, FastRandomContext &insecure_rand)
+    void PushAddress(const CAddress& _addr, FastRandomContext &insecure_rand) LOCKS_EXCLUDED(cs_vAddrToSend)
     {
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
         assert(m_addr_known);
+        LOCK(cs_vAddrToSend);
         if (_addr.IsValid() && !m_addr_known->contains(_addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand.randrange(vAddrToSend.size())] = _addr;
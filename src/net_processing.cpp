@@ -9,6 +9,7 @@
 #include <addrman.h>
 #include <banman.h>
 #include <blockencodings.h>
+#include <blockpipeline.h>
 #include <chainparams.h>
 #include <consensus/validation.h>
 #include <hash.h>
@@ -82,6 +83,8 @@ static_assert(INBOUND_PEER_TX_DELAY >= MAX_GETDATA_RANDOM_DELAY,
 "To preserve security, MAX_GETDATA_RANDOM_DELAY should not exceed INBOUND_PEER_DELAY");
 /** Limit to avoid sending big packets. Not used in processing incoming GETDATA for compatibility */
 static const unsigned int MAX_GETDATA_SZ = 1000;
+/** Maximum total size of the recently served raw blocks kept in memory */
+static const size_t MAX_RAW_BLOCK_CACHE_SIZE = 16 * 1000 * 1000;
 
 
 struct COrphanTx {
@@ -260,6 +263,8 @@ struct CNodeState {
      * otherwise: whether this peer sends non-witnesses in cmpctblocks/blocktxns.
      */
     bool fSupportsDesiredCmpctVersion;
+    //! Whether this peer sends and accepts the proof-of-stake block signature in cmpctblocks
+    bool fWantsCmpctBlockSig;
 
     /** State used to enforce CHAIN_SYNC_TIMEOUT
       * Only in effect for outbound, non-manual, full-relay connections, with
@@ -385,6 +390,7 @@ struct CNodeState {
         fHaveWitness = false;
         fWantsCmpctWitness = false;
         fSupportsDesiredCmpctVersion = false;
+        fWantsCmpctBlockSig = false;
         m_chain_sync = { 0, nullptr, false, false };
         m_last_block_announcement = 0;
     }
@@ -546,6 +552,10 @@ static void MaybeSetPeerAsAnnouncingHeaderAndIDs(NodeId nodeid, CConnman* connma
         // Never ask from peers who can't provide witnesses.
         return;
     }
+    if (!nodestate->fWantsCmpctBlockSig && ::ChainActive().Height() >= Params().GetConsensus().LastPoWBlock()) {
+        // Nor for proof-of-stake blocks from peers who can't provide their signature.
+        return;
+    }
     if (nodestate->fProvidesHeaderAndIDs) {
         for (std::list<NodeId>::iterator it = lNodesAnnouncingHeaderAndIDs.begin(); it != lNodesAnnouncingHeaderAndIDs.end(); it++) {
             if (*it == nodeid) {
@@ -664,6 +674,9 @@ static void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vec
             if (pindex->nStatus & BLOCK_HAVE_DATA || ::ChainActive().Contains(pindex)) {
                 if (pindex->HaveTxsDownloaded())
                     state->pindexLastCommonBlock = pindex;
+            } else if (g_block_pipeline && g_block_pipeline->IsQueued(pindex->GetBlockHash())) {
+                // The block is downloaded, and waiting in the block pipeline.
+                continue;
             } else if (mapBlocksInFlight.count(pindex->GetBlockHash()) == 0) {
                 // The block is not already downloaded, and not yet in flight.
                 if (pindex->nHeight > nWindowEnd) {
@@ -1189,6 +1202,67 @@ void PeerLogicValidation::BlockDisconnected(const std::shared_ptr<const CBlock>
     g_recent_confirmed_transactions->reset();
 }
 
+namespace {
+/**
+ * Recently served blocks, as stored on disk. Blocks don't change, so peers
+ * downloading the same range are served without reading the block again, and
+ * without deserializing it at all where the on-disk format is what they asked
+ * for.
+ */
+class RawBlockCache
+{
+public:
+    /** Whether a block has witness data; only determined when a peer asks for a block without it */
+    enum class Witness { UNKNOWN, NONE, PRESENT };
+
+    bool Get(const uint256& hash, std::shared_ptr<const std::vector<uint8_t>>& data, Witness& witness)
+    {
+        LOCK(m_mutex);
+        auto it = m_index.find(hash);
+        if (it == m_index.end())
+            return false;
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+        data = it->second->data;
+        witness = it->second->witness;
+        return true;
+    }
+
+    void Put(const uint256& hash, std::shared_ptr<const std::vector<uint8_t>> data, Witness witness)
+    {
+        if (data->size() > MAX_RAW_BLOCK_CACHE_SIZE)
+            return;
+        LOCK(m_mutex);
+        auto it = m_index.find(hash);
+        if (it != m_index.end()) {
+            it->second->witness = witness;
+            return;
+        }
+        m_entries.push_front(Entry{hash, std::move(data), witness});
+        m_index.emplace(hash, m_entries.begin());
+        m_size += m_entries.front().data->size();
+        while (m_size > MAX_RAW_BLOCK_CACHE_SIZE) {
+            m_size -= m_entries.back().data->size();
+            m_index.erase(m_entries.back().hash);
+            m_entries.pop_back();
+        }
+    }
+
+private:
+    struct Entry {
+        uint256 hash;
+        std::shared_ptr<const std::vector<uint8_t>> data;
+        Witness witness;
+    };
+
+    Mutex m_mutex;
+    std::list<Entry> m_entries GUARDED_BY(m_mutex);
+    std::map<uint256, std::list<Entry>::iterator> m_index GUARDED_BY(m_mutex);
+    size_t m_size GUARDED_BY(m_mutex){0};
+};
+
+RawBlockCache g_raw_block_cache;
+} // namespace
+
 // All of the following cache a recent block, and are protected by cs_most_recent_block
 static RecursiveMutex cs_most_recent_block;
 static std::shared_ptr<const CBlock> most_recent_block GUARDED_BY(cs_most_recent_block);
@@ -1222,7 +1296,7 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
         fWitnessesPresentInMostRecentCompactBlock = fWitnessEnabled;
     }
 
-    connman->ForEachNode([this, &pcmpctblock, pindex, &msgMaker, fWitnessEnabled, &hashBlock](CNode* pnode) {
+    connman->ForEachNode([this, &pcmpctblock, &pblock, pindex, &msgMaker, fWitnessEnabled, &hashBlock](CNode* pnode) {
         AssertLockHeld(cs_main);
 
         // TODO: Avoid the repeated-serialization here
@@ -1233,11 +1307,13 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
         // If the peer has, or we announced to them the previous block already,
         // but we don't think they have this one, go ahead and announce it
         if (state.fPreferHeaderAndIDs && (!fWitnessEnabled || state.fWantsCmpctWitness) &&
+                (!pblock->IsProofOfStake() || state.fWantsCmpctBlockSig) &&
                 !PeerHasHeader(&state, pindex) && PeerHasHeader(&state, pindex->pprev)) {
 
             LogPrint(BCLog::NET, "%s sending header-and-ids %s to peer=%d\n", "PeerLogicValidation::NewPoWValidBlock",
                     hashBlock.ToString(), pnode->GetId());
-            connman->PushMessage(pnode, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+            int nSendFlags = state.fWantsCmpctBlockSig ? SERIALIZE_CMPCTBLOCK_BLOCKSIG : 0;
+            connman->PushMessage(pnode, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *pcmpctblock));
             state.pindexBestHeaderSent = pindex;
         }
     });
@@ -1474,15 +1550,36 @@ void static ProcessGetBlockData(CNode* pfrom, const CChainParams& chainparams, c
         std::shared_ptr<const CBlock> pblock;
         if (a_recent_block && a_recent_block->GetHash() == pindex->GetBlockHash()) {
             pblock = a_recent_block;
-        } else if (inv.type == MSG_WITNESS_BLOCK) {
-            // Fast-path: in this case it is possible to serve the block directly from disk,
-            // as the network format matches the format on disk
-            std::vector<uint8_t> block_data;
-            if (!ReadRawBlockFromDisk(block_data, pindex, chainparams.MessageStart())) {
-                assert(!"cannot load block from disk");
+        } else if (inv.type == MSG_WITNESS_BLOCK || inv.type == MSG_BLOCK) {
+            // Fast-path: serve the block as stored on disk. That is the
+            // witness serialization, which for a block without witness data
+            // is also what a MSG_BLOCK request asks for.
+            std::shared_ptr<const std::vector<uint8_t>> block_data;
+            RawBlockCache::Witness witness = RawBlockCache::Witness::UNKNOWN;
+            if (!g_raw_block_cache.Get(pindex->GetBlockHash(), block_data, witness)) {
+                std::shared_ptr<std::vector<uint8_t>> block_read = std::make_shared<std::vector<uint8_t>>();
+                if (!ReadRawBlockFromDisk(*block_read, pindex, chainparams.MessageStart())) {
+                    assert(!"cannot load block from disk");
+                }
+                block_data = std::move(block_read);
+            }
+            if (inv.type == MSG_BLOCK && witness != RawBlockCache::Witness::NONE) {
+                std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
+                VectorReader(SER_NETWORK, PROTOCOL_VERSION, *block_data, 0) >> *pblockRead;
+                if (witness == RawBlockCache::Witness::UNKNOWN) {
+                    const bool fHasWitness = std::any_of(pblockRead->vtx.begin(), pblockRead->vtx.end(), [](const CTransactionRef& tx) { return tx->HasWitness(); });
+                    witness = fHasWitness ? RawBlockCache::Witness::PRESENT : RawBlockCache::Witness::NONE;
+                }
+                // The witness data has to be stripped, send it the slow way
+                if (witness == RawBlockCache::Witness::PRESENT) {
+                    pblock = pblockRead;
+                }
             }
-            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, MakeSpan(block_data)));
+            g_raw_block_cache.Put(pindex->GetBlockHash(), block_data, witness);
             // Don't set pblock as we've sent the block
+            if (!pblock) {
+                connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, MakeSpan(*block_data)));
+            }
         } else {
             // Send block from disk
             std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
@@ -1529,6 +1626,8 @@ void static ProcessGetBlockData(CNode* pfrom, const CChainParams& chainparams, c
                 // instead we respond with the full, non-compact block.
                 bool fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
                 int nSendFlags = fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
+                if (State(pfrom->GetId())->fWantsCmpctBlockSig)
+                    nSendFlags |= SERIALIZE_CMPCTBLOCK_BLOCKSIG;
                 if (CanDirectFetch(consensusParams) && pindex->nHeight >= ::ChainActive().Height() - MAX_CMPCTBLOCK_DEPTH) {
                     if ((fPeerWantsWitness || !fWitnessesPresentInARecentCompactBlock) && a_recent_compact_block && a_recent_compact_block->header.GetHash() == pindex->GetBlockHash()) {
                         connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *a_recent_compact_block));
@@ -1810,7 +1909,8 @@ bool static ProcessHeadersMessage(CNode* pfrom, CConnman* connman, CTxMemPool& m
                             pindexLast->GetBlockHash().ToString(), pindexLast->nHeight);
                 }
                 if (vGetData.size() > 0) {
-                    if (nodestate->fSupportsDesiredCmpctVersion && vGetData.size() == 1 && mapBlocksInFlight.size() == 1 && pindexLast->pprev->IsValid(BLOCK_VALID_CHAIN)) {
+                    if (nodestate->fSupportsDesiredCmpctVersion && vGetData.size() == 1 && mapBlocksInFlight.size() == 1 && pindexLast->pprev->IsValid(BLOCK_VALID_CHAIN) &&
+                            (nodestate->fWantsCmpctBlockSig || pindexLast->nHeight <= chainparams.GetConsensus().LastPoWBlock())) {
                         // In any case, we want to download using a compact block, not a regular one
                         vGetData[0] = CInv(MSG_CMPCT_BLOCK, vGetData[0].hash);
                     }
@@ -2160,6 +2260,8 @@ bool ProcessMessage(CNode* pfrom, const std::string& msg_type, CDataStream& vRec
                 connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::SENDCMPCT, fAnnounceUsingCMPCTBLOCK, nCMPCTBLOCKVersion));
             nCMPCTBLOCKVersion = 1;
             connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::SENDCMPCT, fAnnounceUsingCMPCTBLOCK, nCMPCTBLOCKVersion));
+            // Tell our peer we send and accept cmpctblocks carrying the block signature
+            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::SENDCMPCT, fAnnounceUsingCMPCTBLOCK, CMPCTBLOCK_VERSION_BLOCKSIG));
         }
         pfrom->fSuccessfullyConnected = true;
         return true;
@@ -2252,6 +2354,9 @@ bool ProcessMessage(CNode* pfrom, const std::string& msg_type, CDataStream& vRec
                 else
                     State(pfrom->GetId())->fSupportsDesiredCmpctVersion = (nCMPCTBLOCKVersion == 1);
             }
+        } else if (nCMPCTBLOCKVersion == CMPCTBLOCK_VERSION_BLOCKSIG) {
+            LOCK(cs_main);
+            State(pfrom->GetId())->fWantsCmpctBlockSig = true;
         }
         return true;
     }
@@ -2677,6 +2782,11 @@ bool ProcessMessage(CNode* pfrom, const std::string& msg_type, CDataStream& vRec
             return true;
         }
 
+        {
+            LOCK(cs_main);
+            if (State(pfrom->GetId())->fWantsCmpctBlockSig)
+                vRecv.SetVersion(vRecv.GetVersion() | SERIALIZE_CMPCTBLOCK_BLOCKSIG);
+        }
         CBlockHeaderAndShortTxIDs cmpctblock;
         vRecv >> cmpctblock;
 
@@ -3023,6 +3133,24 @@ bool ProcessMessage(CNode* pfrom, const std::string& msg_type, CDataStream& vRec
             // cs_main in ProcessNewBlock is fine.
             mapBlockSource.emplace(hash, std::make_pair(pfrom->GetId(), true));
         }
+        // During IBD, leave the block to the pipeline so this thread can move
+        // on while the block is checked and connected. If the pipeline is
+        // being interrupted it does not take the block, so process it here.
+        if (g_block_pipeline && ::ChainstateActive().IsInitialBlockDownload()) {
+            const NodeId nodeid = pfrom->GetId();
+            const bool fQueued = g_block_pipeline->Submit(pblock, hash, forceProcessing, [connman, nodeid, hash](bool fNewBlock) {
+                if (fNewBlock) {
+                    connman->ForNode(nodeid, [](CNode* pnode) {
+                        pnode->nLastBlockTime = GetTime();
+                        return true;
+                    });
+                } else {
+                    LOCK(cs_main);
+                    mapBlockSource.erase(hash);
+                }
+            });
+            if (fQueued) return true;
+        }
         bool fNewBlock = false;
         ProcessNewBlock(chainparams, pblock, forceProcessing, &fNewBlock);
         if (fNewBlock) {
@@ -3057,7 +3185,7 @@ bool ProcessMessage(CNode* pfrom, const std::string& msg_type, CDataStream& vRec
         }
         pfrom->fSentAddr = true;
 
-        pfrom->vAddrToSend.clear();
+        WITH_LOCK(pfrom->cs_vAddrToSend, pfrom->vAddrToSend.clear());
         std::vector<CAddress> vAddr = connman->GetAddresses();
         FastRandomContext insecure_rand;
         for (const CAddress &addr : vAddr) {
@@ -3345,8 +3473,11 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
         // Just take one message
         msgs.splice(msgs.begin(), pfrom->vProcessMsg, pfrom->vProcessMsg.begin());
         pfrom->nProcessQueueSize -= msgs.front().m_raw_message_size;
+        const bool fWasPaused = pfrom->fPauseRecv;
         pfrom->fPauseRecv = pfrom->nProcessQueueSize > connman->GetReceiveFloodSize();
         fMoreWork = !pfrom->vProcessMsg.empty();
+        if (fWasPaused && !pfrom->fPauseRecv)
+            connman->WakeSocketHandler();
     }
     CNetMessage& msg(msgs.front());
 
@@ -3619,6 +3750,7 @@ bool PeerLogicValidation::SendMessages(CNode* pto)
         //
         if (pto->IsAddrRelayPeer() && pto->m_next_addr_send < current_time) {
             pto->m_next_addr_send = PoissonNextSend(current_time, AVG_ADDRESS_BROADCAST_INTERVAL);
+            LOCK(pto->cs_vAddrToSend);
             std::vector<CAddress> vAddr;
             vAddr.reserve(pto->vAddrToSend.size());
             assert(pto->m_addr_known);
@@ -6,46 +6,108 @@
 #include <node/coinstats.h>
 
 #include <coins.h>
+#include <crypto/muhash.h>
 #include <hash.h>
 #include <serialize.h>
+#include <streams.h>
 #include <validation.h>
 #include <uint256.h>
 #include <util/system.h>
 
 #include <map>
 
-static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+uint64_t GetBogoSize(const Coin& coin)
+{
+    return 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
+           2 /* scriptPubKey len */ + coin.out.scriptPubKey.size() /* scriptPubKey */;
+}
+
+//! The serialization of a coin that is hashed into the MuHash3072 of the UTXO set
+static void TxOutSer(CDataStream& ss, const COutPoint& outpoint, const Coin& coin)
+{
+    ss << outpoint;
+    ss << static_cast<uint32_t>(coin.nHeight * 4 + (coin.fCoinStake ? 2 : 0) + coin.fCoinBase);
+    ss << coin.out;
+}
+
+void ApplyCoinHash(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin)
+{
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    TxOutSer(ss, outpoint, coin);
+    muhash.Insert(Span<const unsigned char>((const unsigned char*)ss.data(), ss.size()));
+}
+
+void RemoveCoinHash(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin)
+{
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    TxOutSer(ss, outpoint, coin);
+    muhash.Remove(Span<const unsigned char>((const unsigned char*)ss.data(), ss.size()));
+}
+
+static void ApplyHash(CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
 {
-    assert(!outputs.empty());
     ss << hash;
     ss << VARINT(outputs.begin()->second.nHeight * 2 + outputs.begin()->second.fCoinBase ? 1u : 0u);
-    stats.nTransactions++;
     for (const auto& output : outputs) {
         ss << VARINT(output.first + 1);
         ss << output.second.out.scriptPubKey;
         ss << VARINT_MODE(output.second.out.nValue, VarIntMode::NONNEGATIVE_SIGNED);
+    }
+    ss << VARINT(0u);
+}
+
+static void ApplyHash(MuHash3072& muhash, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+{
+    for (const auto& output : outputs) {
+        ApplyCoinHash(muhash, COutPoint(hash, output.first), output.second);
+    }
+}
+
+static void ApplyHash(std::nullptr_t, const uint256& hash, const std::map<uint32_t, Coin>& outputs) {}
+
+template <typename T>
+static void ApplyStats(CCoinsStats& stats, T& hash_obj, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+{
+    assert(!outputs.empty());
+    stats.nTransactions++;
+    for (const auto& output : outputs) {
         stats.nTransactionOutputs++;
         stats.nTotalAmount += output.second.out.nValue;
-        stats.nBogoSize += 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
-                           2 /* scriptPubKey len */ + output.second.out.scriptPubKey.size() /* scriptPubKey */;
+        stats.nBogoSize += GetBogoSize(output.second);
     }
-    ss << VARINT(0u);
+    ApplyHash(hash_obj, hash, outputs);
 }
 
-//! Calculate statistics about the unspent transaction output set
-bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
+static void PrepareHash(CHashWriter& ss, const CCoinsStats& stats)
+{
+    ss << stats.hashBlock;
+}
+static void PrepareHash(MuHash3072& muhash, const CCoinsStats& stats) {}
+static void PrepareHash(std::nullptr_t, const CCoinsStats& stats) {}
+
+static void FinalizeHash(CHashWriter& ss, CCoinsStats& stats)
+{
+    stats.hashSerialized = ss.GetHash();
+}
+static void FinalizeHash(MuHash3072& muhash, CCoinsStats& stats)
+{
+    muhash.Finalize(stats.hashSerialized);
+}
+static void FinalizeHash(std::nullptr_t, CCoinsStats& stats) {}
+
+template <typename T>
+static bool GetUTXOStats(CCoinsView* view, CCoinsStats& stats, T hash_obj)
 {
     stats = CCoinsStats();
     std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
     assert(pcursor);
 
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
     stats.hashBlock = pcursor->GetBestBlock();
     {
         LOCK(cs_main);
         stats.nHeight = LookupBlockIndex(stats.hashBlock)->nHeight;
     }
-    ss << stats.hashBlock;
+    PrepareHash(hash_obj, stats);
     uint256 prevkey;
     std::map<uint32_t, Coin> outputs;
     while (pcursor->Valid()) {
@@ -53,7 +115,7 @@ bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
         Coin coin;
         if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
             if (!outputs.empty() && key.hash != prevkey) {
-                ApplyStats(stats, ss, prevkey, outputs);
+                ApplyStats(stats, hash_obj, prevkey, outputs);
                 outputs.clear();
             }
             prevkey = key.hash;
@@ -65,9 +127,28 @@ bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
         pcursor->Next();
     }
     if (!outputs.empty()) {
-        ApplyStats(stats, ss, prevkey, outputs);
+        ApplyStats(stats, hash_obj, prevkey, outputs);
     }
-    stats.hashSerialized = ss.GetHash();
+    FinalizeHash(hash_obj, stats);
     stats.nDiskSize = view->EstimateSize();
     return true;
 }
+
+//! Calculate statistics about the unspent transaction output set
+bool GetUTXOStats(CCoinsView* view, CCoinsStats& stats, CoinStatsHashType hash_type)
+{
+    switch (hash_type) {
+    case CoinStatsHashType::HASH_SERIALIZED: {
+        CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+        return GetUTXOStats(view, stats, ss);
+    }
+    case CoinStatsHashType::MUHASH: {
+        MuHash3072 muhash;
+        return GetUTXOStats(view, stats, muhash);
+    }
+    case CoinStatsHashType::NONE: {
+        return GetUTXOStats(view, stats, nullptr);
+    }
+    } // no default case, so the compiler can warn about missing cases
+    assert(false);
+}
@@ -12,6 +12,15 @@
 #include <cstdint>
 
 class CCoinsView;
+class Coin;
+class COutPoint;
+class MuHash3072;
+
+enum class CoinStatsHashType {
+    HASH_SERIALIZED,
+    MUHASH,
+    NONE,
+};
 
 struct CCoinsStats
 {
@@ -26,9 +35,19 @@ struct CCoinsStats
 
     //! The number of coins contained.
     uint64_t coins_count{0};
+
+    //! Whether the statistics were read from the coinstats index
+    bool index_used{false};
 };
 
 //! Calculate statistics about the unspent transaction output set
-bool GetUTXOStats(CCoinsView* view, CCoinsStats& stats);
+bool GetUTXOStats(CCoinsView* view, CCoinsStats& stats, CoinStatsHashType hash_type = CoinStatsHashType::HASH_SERIALIZED);
+
+//! Add a coin to, or remove it from, a MuHash3072 set hash of the UTXO set
+void ApplyCoinHash(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin);
+void RemoveCoinHash(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin);
+
+//! Size of a coin in the bogosize metric of gettxoutsetinfo
+uint64_t GetBogoSize(const Coin& coin);
 
 #endif // BITCOIN_NODE_COINSTATS_H
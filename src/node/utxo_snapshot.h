@@ -6,6 +6,10 @@
 #ifndef BITCOIN_NODE_UTXO_SNAPSHOT_H
 #define BITCOIN_NODE_UTXO_SNAPSHOT_H
 
+#include <amount.h>
+#include <coins.h>
+#include <hash.h>
+#include <primitives/transaction.h>
 #include <uint256.h>
 #include <serialize.h>
 
@@ -26,14 +30,26 @@ public:
     //! initial block download for the assumeutxo chainstate.
     unsigned int m_nchaintx = 0;
 
+    //! The number of SnapshotBlockStake records following the coins.
+    uint64_t m_stake_blocks_count = 0;
+
+    //! The stake modifier of the first block after the genesis block, which
+    //! seeds every later one. Each node picks its own, so the node loading
+    //! the snapshot takes this one to derive the same modifiers.
+    uint64_t m_first_stake_modifier = 0;
+
     SnapshotMetadata() { }
     SnapshotMetadata(
         const uint256& base_blockhash,
         uint64_t coins_count,
-        unsigned int nchaintx) :
+        unsigned int nchaintx,
+        uint64_t stake_blocks_count,
+        uint64_t first_stake_modifier) :
             m_base_blockhash(base_blockhash),
             m_coins_count(coins_count),
-            m_nchaintx(nchaintx) { }
+            m_nchaintx(nchaintx),
+            m_stake_blocks_count(stake_blocks_count),
+            m_first_stake_modifier(first_stake_modifier) { }
 
     ADD_SERIALIZE_METHODS;
 
@@ -43,8 +59,62 @@ public:
         READWRITE(m_base_blockhash);
         READWRITE(m_coins_count);
         READWRITE(m_nchaintx);
+        READWRITE(m_stake_blocks_count);
+        READWRITE(m_first_stake_modifier);
+    }
+
+};
+
+//! Proof-of-stake state of a block up to the snapshot base. A node loading
+//! the snapshot only has the headers of these blocks, from which it derives
+//! the stake modifiers but not the minted amount, the money supply or the
+//! stake of each block.
+class SnapshotBlockStake
+{
+public:
+    uint256 m_blockhash;
+    //! CBlockIndex::nFlags, checked against the flags derived from the header
+    unsigned int m_flags = 0;
+    //! Checked against the stake modifier derived from the headers and
+    //! SnapshotMetadata::m_first_stake_modifier
+    uint64_t m_stake_modifier = 0;
+    CAmount m_mint = 0;
+    CAmount m_money_supply = 0;
+    COutPoint m_prevout_stake;
+    unsigned int m_stake_time = 0;
+    uint256 m_hash_proof_of_stake;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(m_blockhash);
+        READWRITE(m_flags);
+        READWRITE(m_stake_modifier);
+        READWRITE(m_mint);
+        READWRITE(m_money_supply);
+        READWRITE(m_prevout_stake);
+        READWRITE(m_stake_time);
+        READWRITE(m_hash_proof_of_stake);
     }
+};
+
+//! The hash identifying a snapshot's contents, as recorded by
+//! CChainParams::Assumeutxo() and -assumeutxo. It commits to the base block
+//! hash and the first stake modifier, then to every coin and stake record in
+//! the order they are stored.
+class SnapshotHasher
+{
+    CHashWriter m_hasher{SER_GETHASH, 0};
+
+public:
+    SnapshotHasher(const uint256& base_blockhash, uint64_t first_stake_modifier) { m_hasher << base_blockhash << first_stake_modifier; }
+
+    void AddCoin(const COutPoint& outpoint, const Coin& coin) { m_hasher << outpoint << coin; }
+    void AddStakeBlock(const SnapshotBlockStake& stake) { m_hasher << stake; }
 
+    uint256 GetHash() { return m_hasher.GetHash(); }
 };
 
 #endif // BITCOIN_NODE_UTXO_SNAPSHOT_H
@@ -10,10 +10,18 @@
 #include <util/system.h>
 #include <validation.h>
 
-int cacheHit, cacheMiss, cacheLastCleared;
-std::unordered_map<unsigned int, uint64_t> cachedModifiers;
+#include <unordered_map>
 
-void InitSmartstakeCache()
+std::atomic<int> cacheHit{0};
+std::atomic<int> cacheMiss{0};
+
+// The kernel search may run on several threads at once, so the modifier
+// map is only touched under cs_modifier_cache.
+static Mutex cs_modifier_cache;
+static int cacheLastCleared GUARDED_BY(cs_modifier_cache) = 0;
+static std::unordered_map<unsigned int, uint64_t> cachedModifiers GUARDED_BY(cs_modifier_cache);
+
+static void ResetSmartstakeCache() EXCLUSIVE_LOCKS_REQUIRED(cs_modifier_cache)
 {
     cacheHit = 0;
     cacheMiss = 0;
@@ -21,12 +29,18 @@ void InitSmartstakeCache()
     cachedModifiers.clear();
 }
 
-void MaintainSmartstakeCache()
+void InitSmartstakeCache()
+{
+    LOCK(cs_modifier_cache);
+    ResetSmartstakeCache();
+}
+
+static void MaintainSmartstakeCache() EXCLUSIVE_LOCKS_REQUIRED(cs_modifier_cache)
 {
     int nowTime = GetAdjustedTime();
     if (cacheLastCleared + FLUSH_POLICY < nowTime) {
-        LogPrintf("%s : cleared cache records (%d hit %d miss of %d total)\n", __func__, cacheHit, cacheMiss, cachedModifiers.size());
-        InitSmartstakeCache();
+        LogPrintf("%s : cleared cache records (%d hit %d miss of %d total)\n", __func__, cacheHit.load(), cacheMiss.load(), cachedModifiers.size());
+        ResetSmartstakeCache();
     }
 }
 
@@ -45,27 +59,36 @@ bool GetSmartstakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int&
     const CBlockIndex* pindex = pindexFrom;
     CBlockIndex* pindexNext = ::ChainActive()[pindexFrom->nHeight + 1];
 
-    MaintainSmartstakeCache();
+    {
+        LOCK(cs_modifier_cache);
+        MaintainSmartstakeCache();
+        auto it = cachedModifiers.find(nTimeBlockFrom);
+        if (it != cachedModifiers.end()) {
+            nStakeModifier = it->second;
+            ++cacheHit;
+            return true;
+        }
+    }
 
-    if (cachedModifiers.find(nTimeBlockFrom) != cachedModifiers.end()) {
-        nStakeModifier = cachedModifiers[nTimeBlockFrom];
-        ++cacheHit;
-    } else {
-        while (nStakeModifierTime < nTimeBlockFrom + nStakeModifierSelectionInterval) {
-            if (!pindexNext && nStakeModifier)
+    while (nStakeModifierTime < nTimeBlockFrom + nStakeModifierSelectionInterval) {
+        if (!pindexNext) {
+            if (nStakeModifier)
                 return true;
-            pindex = pindexNext;
-            pindexNext = ::ChainActive()[pindexNext->nHeight + 1];
-            if (pindex->GeneratedStakeModifier()) {
-                nStakeModifierHeight = pindex->nHeight;
-                nStakeModifierTime = pindex->GetBlockTime();
-                nStakeModifier = pindex->nStakeModifier;
-            }
+            return error("GetSmartstakeModifier() : reached best block %s before a modifier was generated", pindex->GetBlockHash().ToString());
+        }
+        pindex = pindexNext;
+        pindexNext = ::ChainActive()[pindexNext->nHeight + 1];
+        if (pindex->GeneratedStakeModifier()) {
+            nStakeModifierHeight = pindex->nHeight;
+            nStakeModifierTime = pindex->GetBlockTime();
+            nStakeModifier = pindex->nStakeModifier;
         }
-        ++cacheMiss;
-        cachedModifiers.insert(std::make_pair(nTimeBlockFrom, nStakeModifier));
     }
 
+    ++cacheMiss;
+    LOCK(cs_modifier_cache);
+    cachedModifiers.insert(std::make_pair(nTimeBlockFrom, nStakeModifier));
+
     return true;
 }
 
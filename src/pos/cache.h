@@ -7,13 +7,15 @@
 
 #include <validation.h>
 
-#include <unordered_map>
+#include <atomic>
 
 class uint256;
 
 const int FLUSH_POLICY = 45;
 
-extern std::unordered_map<unsigned int, uint64_t> cachedModifiers;
+//! Modifier cache statistics since the last flush
+extern std::atomic<int> cacheHit;
+extern std::atomic<int> cacheMiss;
 
 void InitSmartstakeCache();
 bool GetSmartstakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime);
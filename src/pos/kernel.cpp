@@ -274,7 +274,11 @@ bool stakeTargetHit(uint256 hashProofOfStake, int64_t nValueIn, uint256 bnTarget
 
 bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTransactionRef txPrev, const COutPoint prevout, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake)
 {
-    int64_t nValueIn = txPrev->vout[prevout.n].nValue;
+    return CheckStakeKernelHash(nBits, blockFrom.GetBlockHeader(), txPrev->vout[prevout.n].nValue, prevout, nTimeTx, nHashDrift, fCheck, hashProofOfStake, fPrintProofOfStake);
+}
+
+bool CheckStakeKernelHash(unsigned int nBits, const CBlockHeader& blockFrom, CAmount nValueIn, const COutPoint prevout, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake)
+{
     unsigned int nTimeBlockFrom = blockFrom.GetBlockTime();
 
     if (nTimeTx < nTimeBlockFrom)
@@ -338,12 +342,10 @@ bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTra
         break;
     }
 
-    mapHashedBlocks.clear();
-    mapHashedBlocks[::ChainActive().Tip()->nHeight] = GetTime();
     return fSuccess;
 }
 
-bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake)
+bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake, const CCoinsViewCache& view)
 {
     const CTransactionRef tx = block.vtx[1];
 
@@ -353,11 +355,29 @@ bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake)
     // Kernel (input 0) must match the stake hash target per coin age (nBits)
     const CTxIn& txin = tx->vin[0];
 
+    unsigned int nInterval = 0;
+    unsigned int nTime = block.nTime;
+
     // Get transaction index for the previous transaction
     CDiskTxPos postx;
 
-    if (!pblocktree->ReadTxIndex(txin.prevout.hash, postx))
-        return error("CheckProofOfStake() : tx index not found"); // tx index not found
+    if (!pblocktree->ReadTxIndex(txin.prevout.hash, postx)) {
+        // The coin may come from a UTXO snapshot (see loadtxoutset), in which
+        // case neither its transaction nor its block is on disk. The coin
+        // itself has its value, and its block header is in the chain. Only
+        // blocks below a snapshot's base are assumed valid; any other coin
+        // must be found through the tx index.
+        const Coin& coin = view.AccessCoin(txin.prevout);
+        const CBlockIndex* pindexPrev = LookupBlockIndex(block.hashPrevBlock);
+        const CBlockIndex* pindexFrom = (!coin.IsSpent() && pindexPrev && (int)coin.nHeight <= pindexPrev->nHeight) ? pindexPrev->GetAncestor(coin.nHeight) : nullptr;
+        if (!pindexFrom || !(pindexFrom->nStatus & BLOCK_ASSUMED_VALID))
+            return error("CheckProofOfStake() : tx index not found"); // tx index not found
+
+        const CBlockHeader header = pindexFrom->GetBlockHeader();
+        if (!CheckStakeKernelHash(block.nBits, header, coin.out.nValue, txin.prevout, nTime, nInterval, true, hashProofOfStake))
+            return error("CheckProofOfStake() : INFO: check kernel failed on coinstake %s, hashProof=%s \n", tx->GetHash().ToString().c_str(), hashProofOfStake.ToString().c_str());
+        return true;
+    }
 
     // Read txPrev and header of its block
     CBlockHeader header;
@@ -377,9 +397,6 @@ bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake)
             return error("%s() : txid mismatch in CheckProofOfStake()", __PRETTY_FUNCTION__);
     }
 
-    unsigned int nInterval = 0;
-    unsigned int nTime = block.nTime;
-
     if (!CheckStakeKernelHash(block.nBits, header, txPrev, txin.prevout, nTime, nInterval, true, hashProofOfStake))
         return error("CheckProofOfStake() : INFO: check kernel failed on coinstake %s, hashProof=%s \n", tx->GetHash().ToString().c_str(), hashProofOfStake.ToString().c_str());
 
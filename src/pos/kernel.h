@@ -15,6 +15,7 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeMod
 uint256 stakeHash(unsigned int nTimeTx, CDataStream ss, unsigned int prevoutIndex, uint256 prevoutHash, unsigned int nTimeBlockFrom);
 bool stakeTargetHit(uint256 hashProofOfStake, int64_t nValueIn, uint256 bnTargetPerCoinDay);
 bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTransactionRef txPrev, const COutPoint prevout, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake = false);
-bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake);
+bool CheckStakeKernelHash(unsigned int nBits, const CBlockHeader& blockFrom, CAmount nValueIn, const COutPoint prevout, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake = false);
+bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake, const CCoinsViewCache& view) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
 #endif
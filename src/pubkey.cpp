@@ -8,10 +8,80 @@
 #include <secp256k1.h>
 #include <secp256k1_recovery.h>
 
+#include <map>
+#include <mutex>
+
 namespace
 {
 /* Global secp256k1_context object used for verification. */
 secp256k1_context* secp256k1_context_verify = nullptr;
+
+/**
+ * Parsed forms of recently verified public keys. Parsing a compressed key
+ * decompresses it, which is a sizeable part of a verification, and the same
+ * keys sign over and over again (stakers' coinstake keys, spork keys). The
+ * cache is split in shards so that script check threads rarely contend.
+ */
+class ParsedPubKeyCache
+{
+private:
+    static const size_t SHARDS = 16;
+
+    struct Entry {
+        secp256k1_pubkey pubkey;
+        //! Whether the key was used since the shard was last swept
+        bool fUsed;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::map<CPubKey, Entry> entries;
+    };
+
+    Shard m_shards[SHARDS];
+
+    Shard& GetShard(const CPubKey& key)
+    {
+        // The first byte only encodes the key type, the next ones are random
+        return m_shards[key[1] % SHARDS];
+    }
+
+public:
+    bool Get(const CPubKey& key, secp256k1_pubkey& pubkey)
+    {
+        Shard& shard = GetShard(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.entries.find(key);
+        if (it == shard.entries.end()) return false;
+        it->second.fUsed = true;
+        pubkey = it->second.pubkey;
+        return true;
+    }
+
+    void Put(const CPubKey& key, const secp256k1_pubkey& pubkey)
+    {
+        Shard& shard = GetShard(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (shard.entries.size() >= MAX_PARSED_PUBKEYS / SHARDS) {
+            // Keep the keys used since the last sweep, so that a stream of
+            // keys seen only once does not push out the hot ones.
+            for (auto it = shard.entries.begin(); it != shard.entries.end();) {
+                if (it->second.fUsed) {
+                    it->second.fUsed = false;
+                    ++it;
+                } else {
+                    it = shard.entries.erase(it);
+                }
+            }
+            if (shard.entries.size() >= MAX_PARSED_PUBKEYS / SHARDS) {
+                shard.entries.erase(shard.entries.begin());
+            }
+        }
+        shard.entries.emplace(key, Entry{pubkey, false});
+    }
+};
+
+ParsedPubKeyCache g_parsed_pubkeys;
 } // namespace
 
 /** This function is taken from the libsecp256k1 distribution and implements
@@ -172,8 +242,11 @@ bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchS
     secp256k1_pubkey pubkey;
     secp256k1_ecdsa_signature sig;
     assert(secp256k1_context_verify && "secp256k1_context_verify must be initialized to use CPubKey.");
-    if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &pubkey, vch, size())) {
-        return false;
+    if (!g_parsed_pubkeys.Get(*this, pubkey)) {
+        if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &pubkey, vch, size())) {
+            return false;
+        }
+        g_parsed_pubkeys.Put(*this, pubkey);
     }
     if (!ecdsa_signature_parse_der_lax(secp256k1_context_verify, &sig, vchSig.data(), vchSig.size())) {
         return false;
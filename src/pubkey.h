@@ -26,6 +26,9 @@ public:
 
 typedef uint256 ChainCode;
 
+/** Number of parsed public keys kept for CPubKey::Verify */
+static const size_t MAX_PARSED_PUBKEYS = 4096;
+
 /** An encapsulated public key. */
 class CPubKey
 {
@@ -7,6 +7,7 @@
 
 #include <amount.h>
 #include <blockfilter.h>
+#include <blockpipeline.h>
 #include <chain.h>
 #include <chainparams.h>
 #include <coins.h>
@@ -14,12 +15,15 @@
 #include <core_io.h>
 #include <hash.h>
 #include <index/blockfilterindex.h>
+#include <index/coinstatsindex.h>
+#include <net.h>
 #include <node/coinstats.h>
 #include <node/context.h>
 #include <node/utxo_snapshot.h>
 #include <policy/feerate.h>
 #include <policy/policy.h>
 #include <policy/rbf.h>
+#include <pos/kernel.h>
 #include <primitives/transaction.h>
 #include <rpc/server.h>
 #include <rpc/util.h>
@@ -39,6 +43,7 @@
 
 #include <univalue.h>
 
+#include <algorithm>
 #include <condition_variable>
 #include <memory>
 #include <mutex>
@@ -952,48 +957,122 @@ static UniValue pruneblockchain(const JSONRPCRequest& request)
     return uint64_t(block->nHeight);
 }
 
+//! Look up a block of the active chain by its hash or height, as given to an RPC
+static CBlockIndex* ParseHashOrHeight(const UniValue& param) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    if (param.isNum()) {
+        const int height = param.get_int();
+        const int current_tip = ::ChainActive().Height();
+        if (height < 0) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Target block height %d is negative", height));
+        }
+        if (height > current_tip) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Target block height %d after current tip %d", height, current_tip));
+        }
+
+        return ::ChainActive()[height];
+    } else {
+        const uint256 hash(ParseHashV(param, "hash_or_height"));
+        CBlockIndex* pindex = LookupBlockIndex(hash);
+        if (!pindex) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        }
+        if (!::ChainActive().Contains(pindex)) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Block is not in chain %s", Params().NetworkIDString()));
+        }
+        return pindex;
+    }
+}
+
+static CoinStatsHashType ParseHashType(const UniValue& param)
+{
+    const std::string hash_type = param.isNull() ? "hash_serialized_2" : param.get_str();
+    if (hash_type == "hash_serialized_2") return CoinStatsHashType::HASH_SERIALIZED;
+    if (hash_type == "muhash") return CoinStatsHashType::MUHASH;
+    if (hash_type == "none") return CoinStatsHashType::NONE;
+    throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("%s is not a valid hash_type", hash_type));
+}
+
 static UniValue gettxoutsetinfo(const JSONRPCRequest& request)
 {
             RPCHelpMan{"gettxoutsetinfo",
                 "\nReturns statistics about the unspent transaction output set.\n"
-                "Note this call may take some time.\n",
-                {},
+                "Note this call may take some time without -coinstatsindex.\n",
+                {
+                    {"hash_type", RPCArg::Type::STR, /* default */ "hash_serialized_2", "Which UTXO set hash should be calculated. Options: 'hash_serialized_2' (the legacy algorithm), 'muhash', 'none'."},
+                    {"hash_or_height", RPCArg::Type::NUM, /* default */ "the current best block", "The block hash or height of the target height (only available with -coinstatsindex).", "", {"", "string or numeric"}},
+                    {"use_index", RPCArg::Type::BOOL, /* default */ "true", "Use the coinstatsindex, if available."},
+                },
                 RPCResult{
                     RPCResult::Type::OBJ, "", "",
                     {
-                        {RPCResult::Type::NUM, "height", "The current block height (index)"},
-                        {RPCResult::Type::STR_HEX, "bestblock", "The hash of the block at the tip of the chain"},
-                        {RPCResult::Type::NUM, "transactions", "The number of transactions with unspent outputs"},
+                        {RPCResult::Type::NUM, "height", "The block height (index) of the returned statistics"},
+                        {RPCResult::Type::STR_HEX, "bestblock", "The hash of the block at which these statistics are calculated"},
+                        {RPCResult::Type::NUM, "transactions", "The number of transactions with unspent outputs (not available when coinstatsindex is used)"},
                         {RPCResult::Type::NUM, "txouts", "The number of unspent transaction outputs"},
                         {RPCResult::Type::NUM, "bogosize", "A meaningless metric for UTXO set size"},
-                        {RPCResult::Type::STR_HEX, "hash_serialized_2", "The serialized hash"},
-                        {RPCResult::Type::NUM, "disk_size", "The estimated size of the chainstate on disk"},
+                        {RPCResult::Type::STR_HEX, "hash_serialized_2", "The serialized hash (only present if 'hash_serialized_2' hash_type is chosen)"},
+                        {RPCResult::Type::STR_HEX, "muhash", "The MuHash3072 of the UTXO set (only present if 'muhash' hash_type is chosen)"},
+                        {RPCResult::Type::NUM, "disk_size", "The estimated size of the chainstate on disk (not available when coinstatsindex is used)"},
                         {RPCResult::Type::STR_AMOUNT, "total_amount", "The total amount"},
                     }},
                 RPCExamples{
                     HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "\"none\"")
+            + HelpExampleCli("gettxoutsetinfo", "\"muhash\" 1000")
             + HelpExampleRpc("gettxoutsetinfo", "")
+            + HelpExampleRpc("gettxoutsetinfo", "\"muhash\", 1000")
                 },
             }.Check(request);
 
     UniValue ret(UniValue::VOBJ);
 
     CCoinsStats stats;
-    ::ChainstateActive().ForceFlushStateToDisk();
+    const CoinStatsHashType hash_type = ParseHashType(request.params[0]);
+    const bool index_requested = request.params[2].isNull() || request.params[2].get_bool();
+
+    // The index serves any hash type but the legacy one, which depends on the
+    // order of the coins in the chainstate.
+    if (g_coin_stats_index && index_requested && hash_type != CoinStatsHashType::HASH_SERIALIZED) {
+        const CBlockIndex* pindex;
+        if (request.params[1].isNull()) {
+            g_coin_stats_index->BlockUntilSyncedToCurrentChain();
+            pindex = WITH_LOCK(cs_main, return ::ChainActive().Tip());
+        } else {
+            pindex = WITH_LOCK(cs_main, return ParseHashOrHeight(request.params[1]));
+        }
+        if (!g_coin_stats_index->LookUpStats(pindex, stats)) {
+            throw JSONRPCError(RPC_INTERNAL_ERROR, strprintf("Unable to read UTXO set statistics at block %s; coinstatsindex may still be syncing", pindex->GetBlockHash().GetHex()));
+        }
+    } else {
+        if (!request.params[1].isNull()) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Querying specific block heights requires coinstatsindex and a hash_type other than hash_serialized_2");
+        }
+
+        ::ChainstateActive().ForceFlushStateToDisk();
 
-    CCoinsView* coins_view = WITH_LOCK(cs_main, return &ChainstateActive().CoinsDB());
-    if (GetUTXOStats(coins_view, stats)) {
-        ret.pushKV("height", (int64_t)stats.nHeight);
-        ret.pushKV("bestblock", stats.hashBlock.GetHex());
+        CCoinsView* coins_view = WITH_LOCK(cs_main, return &ChainstateActive().CoinsDB());
+        if (!GetUTXOStats(coins_view, stats, hash_type)) {
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+        }
+    }
+
+    ret.pushKV("height", (int64_t)stats.nHeight);
+    ret.pushKV("bestblock", stats.hashBlock.GetHex());
+    if (!stats.index_used) {
         ret.pushKV("transactions", (int64_t)stats.nTransactions);
-        ret.pushKV("txouts", (int64_t)stats.nTransactionOutputs);
-        ret.pushKV("bogosize", (int64_t)stats.nBogoSize);
+    }
+    ret.pushKV("txouts", (int64_t)stats.nTransactionOutputs);
+    ret.pushKV("bogosize", (int64_t)stats.nBogoSize);
+    if (hash_type == CoinStatsHashType::HASH_SERIALIZED) {
         ret.pushKV("hash_serialized_2", stats.hashSerialized.GetHex());
+    } else if (hash_type == CoinStatsHashType::MUHASH) {
+        ret.pushKV("muhash", stats.hashSerialized.GetHex());
+    }
+    if (!stats.index_used) {
         ret.pushKV("disk_size", stats.nDiskSize);
-        ret.pushKV("total_amount", ValueFromAmount(stats.nTotalAmount));
-    } else {
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
     }
+    ret.pushKV("total_amount", ValueFromAmount(stats.nTotalAmount));
     return ret;
 }
 
@@ -1213,6 +1292,19 @@ UniValue getblockchaininfo(const JSONRPCRequest& request)
                                 {RPCResult::Type::BOOL, "active", "true if the rules are enforced for the mempool and the next block"},
                             }},
                         }},
+                        {RPCResult::Type::OBJ, "blockpipeline", "state of the initial block download pipeline (only present if -blockcheckthreads is not 0)",
+                        {
+                            {RPCResult::Type::NUM, "checkthreads", "the number of block check threads"},
+                            {RPCResult::Type::NUM, "checkqueue", "the number of blocks waiting for a check thread"},
+                            {RPCResult::Type::NUM, "checking", "the number of blocks being checked"},
+                            {RPCResult::Type::NUM, "connectqueue", "the number of checked blocks waiting to be connected"},
+                            {RPCResult::Type::BOOL, "connecting", "whether a block is being connected"},
+                            {RPCResult::Type::NUM, "checked", "the number of blocks checked since startup"},
+                            {RPCResult::Type::NUM, "connected", "the number of blocks connected through the pipeline since startup"},
+                            {RPCResult::Type::NUM, "checkoccupancy", "the fraction of time the check threads were busy [0..1]"},
+                            {RPCResult::Type::NUM, "connectoccupancy", "the fraction of time the connect thread was busy [0..1]"},
+                            {RPCResult::Type::NUM, "connectstall", "the fraction of time the connect thread waited for a block's checks [0..1]"},
+                        }},
                         {RPCResult::Type::STR, "warnings", "any network and blockchain warnings"},
                     }},
                 RPCExamples{
@@ -1263,6 +1355,23 @@ UniValue getblockchaininfo(const JSONRPCRequest& request)
     BIP9SoftForkDescPushBack(softforks, "testdummy", consensusParams, Consensus::DEPLOYMENT_TESTDUMMY);
     obj.pushKV("softforks",             softforks);
 
+    if (g_block_pipeline) {
+        const CBlockPipelineStats stats = g_block_pipeline->GetStats();
+        const double uptime = std::max<int64_t>(stats.nUptimeMicros, 1);
+        UniValue pipeline(UniValue::VOBJ);
+        pipeline.pushKV("checkthreads", stats.nCheckThreads);
+        pipeline.pushKV("checkqueue", (uint64_t)stats.nCheckQueued);
+        pipeline.pushKV("checking", (uint64_t)stats.nChecking);
+        pipeline.pushKV("connectqueue", (uint64_t)stats.nConnectQueued);
+        pipeline.pushKV("connecting", stats.fConnecting);
+        pipeline.pushKV("checked", stats.nBlocksChecked);
+        pipeline.pushKV("connected", stats.nBlocksConnected);
+        pipeline.pushKV("checkoccupancy", stats.nCheckMicros / (uptime * stats.nCheckThreads));
+        pipeline.pushKV("connectoccupancy", stats.nConnectMicros / uptime);
+        pipeline.pushKV("connectstall", stats.nConnectStallMicros / uptime);
+        obj.pushKV("blockpipeline", pipeline);
+    }
+
     obj.pushKV("warnings", GetWarnings(false));
     return obj;
 }
@@ -1768,29 +1877,7 @@ static UniValue getblockstats(const JSONRPCRequest& request)
 
     LOCK(cs_main);
 
-    CBlockIndex* pindex;
-    if (request.params[0].isNum()) {
-        const int height = request.params[0].get_int();
-        const int current_tip = ::ChainActive().Height();
-        if (height < 0) {
-            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Target block height %d is negative", height));
-        }
-        if (height > current_tip) {
-            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Target block height %d after current tip %d", height, current_tip));
-        }
-
-        pindex = ::ChainActive()[height];
-    } else {
-        const uint256 hash(ParseHashV(request.params[0], "hash_or_height"));
-        pindex = LookupBlockIndex(hash);
-        if (!pindex) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
-        }
-        if (!::ChainActive().Contains(pindex)) {
-            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Block is not in chain %s", Params().NetworkIDString()));
-        }
-    }
-
+    CBlockIndex* pindex = ParseHashOrHeight(request.params[0]);
     CHECK_NONFATAL(pindex != nullptr);
 
     std::set<std::string> stats;
@@ -2298,6 +2385,7 @@ UniValue dumptxoutset(const JSONRPCRequest& request)
                     {RPCResult::Type::STR_HEX, "base_hash", "the hash of the base of the snapshot"},
                     {RPCResult::Type::NUM, "base_height", "the height of the base of the snapshot"},
                     {RPCResult::Type::STR, "path", "the absolute path that the snapshot was written to"},
+                    {RPCResult::Type::STR_HEX, "snapshot_hash", "the hash of the snapshot contents, to be given with -assumeutxo"},
                 }
         },
         RPCExamples{
@@ -2322,6 +2410,8 @@ UniValue dumptxoutset(const JSONRPCRequest& request)
     std::unique_ptr<CCoinsViewCursor> pcursor;
     CCoinsStats stats;
     CBlockIndex* tip;
+    std::vector<SnapshotBlockStake> stakes;
+    uint64_t first_stake_modifier{0};
 
     {
         // We need to lock cs_main to ensure that the coinsdb isn't written to
@@ -2347,9 +2437,28 @@ UniValue dumptxoutset(const JSONRPCRequest& request)
         pcursor = std::unique_ptr<CCoinsViewCursor>(::ChainstateActive().CoinsDB().Cursor());
         tip = LookupBlockIndex(stats.hashBlock);
         CHECK_NONFATAL(tip);
+
+        // The stake state of the blocks a new coinstake may draw its stake
+        // modifier from, oldest first
+        const int64_t stake_time = tip->GetBlockTime() - 2 * GetStakeModifierSelectionInterval();
+        for (const CBlockIndex* pindex = tip; pindex && (pindex == tip || pindex->GetBlockTime() >= stake_time); pindex = pindex->pprev) {
+            SnapshotBlockStake stake;
+            stake.m_blockhash = pindex->GetBlockHash();
+            stake.m_flags = pindex->nFlags;
+            stake.m_stake_modifier = pindex->nStakeModifier;
+            stake.m_mint = pindex->nMint;
+            stake.m_money_supply = pindex->nMoneySupply;
+            stake.m_prevout_stake = pindex->prevoutStake;
+            stake.m_stake_time = pindex->nStakeTime;
+            stake.m_hash_proof_of_stake = pindex->hashProofOfStake;
+            stakes.push_back(stake);
+        }
+        std::reverse(stakes.begin(), stakes.end());
+        if (tip->nHeight > 0) first_stake_modifier = tip->GetAncestor(1)->nStakeModifier;
     }
 
-    SnapshotMetadata metadata{tip->GetBlockHash(), stats.coins_count, tip->nChainTx};
+    SnapshotMetadata metadata{tip->GetBlockHash(), stats.coins_count, tip->nChainTx, stakes.size(), first_stake_modifier};
+    SnapshotHasher hasher{tip->GetBlockHash(), first_stake_modifier};
 
     afile << metadata;
 
@@ -2365,10 +2474,15 @@ UniValue dumptxoutset(const JSONRPCRequest& request)
         if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
             afile << key;
             afile << coin;
+            hasher.AddCoin(key, coin);
         }
 
         pcursor->Next();
     }
+    for (const SnapshotBlockStake& stake : stakes) {
+        afile << stake;
+        hasher.AddStakeBlock(stake);
+    }
 
     afile.fclose();
     fs::rename(temppath, path);
@@ -2378,6 +2492,90 @@ UniValue dumptxoutset(const JSONRPCRequest& request)
     result.pushKV("base_hash", tip->GetBlockHash().ToString());
     result.pushKV("base_height", tip->nHeight);
     result.pushKV("path", path.string());
+    result.pushKV("snapshot_hash", hasher.GetHash().ToString());
+    return result;
+}
+
+/**
+ * Load a UTXO set written by dumptxoutset in place of the blocks below its base.
+ *
+ * @see CChainState::LoadSnapshot
+ */
+UniValue loadtxoutset(const JSONRPCRequest& request)
+{
+    RPCHelpMan{
+        "loadtxoutset",
+        "\nLoad a serialized UTXO set written by dumptxoutset, instead of downloading and validating the blocks up to its base.\n"
+        "The node must have the headers up to the base, and no blocks past the genesis block. The hash of the snapshot must be known\n"
+        "for the height of its base (see -assumeutxo). The blocks up to the base are then neither downloaded nor validated, and the\n"
+        "node stops offering NODE_NETWORK to its peers.\n",
+        {
+            {"path",
+                RPCArg::Type::STR,
+                RPCArg::Optional::NO,
+                /* default_val */ "",
+                "path to the snapshot file. If relative, will be prefixed by datadir."},
+        },
+        RPCResult{
+            RPCResult::Type::OBJ, "", "",
+                {
+                    {RPCResult::Type::NUM, "coins_loaded", "the number of coins loaded from the snapshot"},
+                    {RPCResult::Type::STR_HEX, "base_hash", "the hash of the base of the snapshot"},
+                    {RPCResult::Type::NUM, "base_height", "the height of the base of the snapshot"},
+                    {RPCResult::Type::STR, "path", "the absolute path that the snapshot was loaded from"},
+                }
+        },
+        RPCExamples{
+            HelpExampleCli("loadtxoutset", "utxo.dat")
+        }
+    }.Check(request);
+
+    // These indexes chain each entry to the one of the previous block, and
+    // can't skip the blocks below the base
+    bool fFilterIndex = false;
+    ForEachBlockFilterIndex([&fFilterIndex](BlockFilterIndex&) { fFilterIndex = true; });
+    if (g_coin_stats_index || fFilterIndex) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Loading a UTXO set snapshot is incompatible with -coinstatsindex and -blockfilterindex");
+    }
+
+    fs::path path = fs::absolute(request.params[0].get_str(), GetDataDir());
+    FILE* file{fsbridge::fopen(path, "rb")};
+    CAutoFile afile{file, SER_DISK, CLIENT_VERSION};
+    if (afile.IsNull()) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Couldn't open file " + path.string() + " for reading.");
+    }
+
+    SnapshotMetadata metadata;
+    try {
+        afile >> metadata;
+    } catch (const std::exception& e) {
+        throw JSONRPCError(RPC_DESERIALIZATION_ERROR, strprintf("Unable to parse snapshot metadata: %s", e.what()));
+    }
+
+    std::string error;
+    if (!::ChainstateActive().LoadSnapshot(afile, metadata, Params(), error)) {
+        throw JSONRPCError(RPC_MISC_ERROR, error);
+    }
+    // The blocks below the base can't be served. Peers already connected keep
+    // the services they were offered. The tip moved without an UpdatedBlockTip
+    // notification, which would announce those blocks.
+    if (g_rpc_node && g_rpc_node->connman) {
+        g_rpc_node->connman->RemoveLocalServices(NODE_NETWORK);
+        g_rpc_node->connman->SetBestHeight(WITH_LOCK(::cs_main, return ::ChainActive().Height()));
+    }
+
+    // Connect any blocks already received past the base
+    BlockValidationState state;
+    if (!ActivateBestChain(state, Params())) {
+        throw JSONRPCError(RPC_DATABASE_ERROR, state.ToString());
+    }
+
+    const CBlockIndex* base = WITH_LOCK(::cs_main, return LookupBlockIndex(metadata.m_base_blockhash));
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("coins_loaded", metadata.m_coins_count);
+    result.pushKV("base_hash", metadata.m_base_blockhash.ToString());
+    result.pushKV("base_height", base->nHeight);
+    result.pushKV("path", path.string());
     return result;
 }
 
@@ -2403,7 +2601,7 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         {} },
     { "blockchain",         "getrawmempool",          &getrawmempool,          {"verbose"} },
     { "blockchain",         "gettxout",               &gettxout,               {"txid","n","include_mempool"} },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {} },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {"hash_type", "hash_or_height", "use_index"} },
     { "blockchain",         "pruneblockchain",        &pruneblockchain,        {"height"} },
     { "blockchain",         "savemempool",            &savemempool,            {} },
     { "blockchain",         "verifychain",            &verifychain,            {"checklevel","nblocks"} },
@@ -2420,6 +2618,7 @@ static const CRPCCommand commands[] =
     { "hidden",             "waitforblockheight",     &waitforblockheight,     {"height","timeout"} },
     { "hidden",             "syncwithvalidationinterfacequeue", &syncwithvalidationinterfacequeue, {} },
     { "hidden",             "dumptxoutset",           &dumptxoutset,           {"path"} },
+    { "hidden",             "loadtxoutset",           &loadtxoutset,           {"path"} },
 };
 // clang-format on
 
@@ -4,9 +4,11 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <dbwrapper.h>
 #include <httpserver.h>
 #include <key_io.h>
 #include <miner.h>
+#include <net.h>
 #include <node/context.h>
 #include <outputtype.h>
 #include <pos/kernel.h>
@@ -15,10 +17,12 @@
 #include <rpc/util.h>
 #include <scheduler.h>
 #include <script/descriptor.h>
+#include <script/sigcache.h>
 #include <util/check.h>
 #include <util/message.h> // For MessageSign(), MessageVerify()
 #include <util/strencodings.h>
 #include <util/system.h>
+#include <validation.h>
 #include <wallet/coincontrol.h>
 #include <wallet/stake.h>
 #include <wallet/wallet.h>
@@ -498,6 +502,30 @@ static UniValue RPCLockedMemoryInfo()
     return obj;
 }
 
+static UniValue RPCReceiveBufferInfo()
+{
+    CRecvBufferPool::Stats stats = g_recv_buffer_pool.GetStats();
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("hits", stats.nHits);
+    obj.pushKV("misses", stats.nMisses);
+    obj.pushKV("dropped", stats.nDropped);
+    obj.pushKV("buffers", uint64_t(stats.nBuffers));
+    obj.pushKV("bytes", uint64_t(stats.nBytes));
+    return obj;
+}
+
+static UniValue RPCShardedCacheInfo(const ShardedCacheStats& stats)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("hits", stats.nHits);
+    obj.pushKV("misses", stats.nMisses);
+    obj.pushKV("inserts", stats.nInserts);
+    obj.pushKV("contended", stats.nContended);
+    obj.pushKV("shards", uint64_t(stats.nShards));
+    obj.pushKV("elements", uint64_t(stats.nElements));
+    return obj;
+}
+
 #ifdef HAVE_MALLOC_INFO
 static std::string RPCMallocInfo()
 {
@@ -542,6 +570,27 @@ static UniValue getmemoryinfo(const JSONRPCRequest& request)
                                 {RPCResult::Type::NUM, "chunks_used", "Number allocated chunks"},
                                 {RPCResult::Type::NUM, "chunks_free", "Number unused chunks"},
                             }},
+                            {RPCResult::Type::OBJ, "receivebuffers", "Information about reused network message receive buffers",
+                            {
+                                {RPCResult::Type::NUM, "hits", "Number of messages received into a reused buffer that was large enough"},
+                                {RPCResult::Type::NUM, "misses", "Number of messages that needed a new or larger buffer"},
+                                {RPCResult::Type::NUM, "dropped", "Number of buffers freed because enough were kept already"},
+                                {RPCResult::Type::NUM, "buffers", "Number of buffers kept for reuse"},
+                                {RPCResult::Type::NUM, "bytes", "Total capacity of the buffers kept for reuse"},
+                            }},
+                            {RPCResult::Type::OBJ, "signaturecache", "Information about the signature cache",
+                            {
+                                {RPCResult::Type::NUM, "hits", "Number of lookups that found the signature"},
+                                {RPCResult::Type::NUM, "misses", "Number of lookups that did not"},
+                                {RPCResult::Type::NUM, "inserts", "Number of signatures added"},
+                                {RPCResult::Type::NUM, "contended", "Number of lookups and inserts that waited for another thread"},
+                                {RPCResult::Type::NUM, "shards", "Number of independently locked parts of the cache"},
+                                {RPCResult::Type::NUM, "elements", "Number of entries the cache can hold"},
+                            }},
+                            {RPCResult::Type::OBJ, "scriptexeccache", "Information about the script execution cache, with the same fields as signaturecache",
+                            {
+                                {RPCResult::Type::ELISION, "", ""},
+                            }},
                         }
                     },
                     RPCResult{"mode \"mallocinfo\"",
@@ -558,6 +607,9 @@ static UniValue getmemoryinfo(const JSONRPCRequest& request)
     if (mode == "stats") {
         UniValue obj(UniValue::VOBJ);
         obj.pushKV("locked", RPCLockedMemoryInfo());
+        obj.pushKV("receivebuffers", RPCReceiveBufferInfo());
+        obj.pushKV("signaturecache", RPCShardedCacheInfo(GetSignatureCacheStats()));
+        obj.pushKV("scriptexeccache", RPCShardedCacheInfo(GetScriptExecutionCacheStats()));
         return obj;
     } else if (mode == "mallocinfo") {
 #ifdef HAVE_MALLOC_INFO
@@ -570,6 +622,75 @@ static UniValue getmemoryinfo(const JSONRPCRequest& request)
     }
 }
 
+static UniValue getleveldbstats(const JSONRPCRequest& request)
+{
+            RPCHelpMan{"getleveldbstats",
+                "Returns the settings and internal statistics of each open LevelDB database.\n",
+                {},
+                RPCResult{
+                    RPCResult::Type::ARR, "", "",
+                    {
+                        {RPCResult::Type::OBJ, "", "",
+                        {
+                            {RPCResult::Type::STR, "path", "Location of the database"},
+                            {RPCResult::Type::STR, "profile", "Name of the settings the database was opened with"},
+                            {RPCResult::Type::NUM, "cachesize", "Memory given to the database, in bytes"},
+                            {RPCResult::Type::NUM, "blockcachepercent", "Share of that memory used as block cache; the rest is for write buffers"},
+                            {RPCResult::Type::NUM, "blocksize", "Size of the data blocks in table files, in bytes"},
+                            {RPCResult::Type::NUM, "bloombits", "Bits per key of the bloom filter, 0 for none"},
+                            {RPCResult::Type::NUM, "maxfilesize", "Size of the table files, in bytes"},
+                            {RPCResult::Type::NUM, "memoryusage", "Approximate memory used by the block cache and write buffers, in bytes (leveldb.approximate-memory-usage)"},
+                            {RPCResult::Type::ARR, "levels", "",
+                            {
+                                {RPCResult::Type::OBJ, "", "",
+                                {
+                                    {RPCResult::Type::NUM, "level", "Level number"},
+                                    {RPCResult::Type::NUM, "files", "Number of table files"},
+                                    {RPCResult::Type::NUM, "size_mb", "Size of the table files, in MiB"},
+                                    {RPCResult::Type::NUM, "compaction_seconds", "Time spent compacting into this level since the database was opened"},
+                                    {RPCResult::Type::NUM, "compaction_read_mb", "MiB read by those compactions"},
+                                    {RPCResult::Type::NUM, "compaction_written_mb", "MiB written by those compactions"},
+                                }},
+                            }},
+                            {RPCResult::Type::STR, "stats", "The leveldb.stats table"},
+                        }},
+                    }
+                },
+                RPCExamples{
+                    HelpExampleCli("getleveldbstats", "")
+            + HelpExampleRpc("getleveldbstats", "")
+                },
+            }.Check(request);
+
+    UniValue ret(UniValue::VARR);
+    for (const LevelDBStats& stats : GetLevelDBStats()) {
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("path", stats.path);
+        obj.pushKV("profile", stats.profile.name);
+        obj.pushKV("cachesize", (uint64_t)stats.cache_size);
+        obj.pushKV("blockcachepercent", stats.profile.block_cache_percent);
+        obj.pushKV("blocksize", (uint64_t)stats.profile.block_size);
+        obj.pushKV("bloombits", stats.profile.bloom_bits);
+        obj.pushKV("maxfilesize", (uint64_t)stats.profile.max_file_size);
+        obj.pushKV("memoryusage", (uint64_t)stats.memory_usage);
+        UniValue levels(UniValue::VARR);
+        for (const LevelDBLevelStats& level : stats.levels) {
+            UniValue level_obj(UniValue::VOBJ);
+            level_obj.pushKV("level", level.level);
+            level_obj.pushKV("files", level.files);
+            level_obj.pushKV("size_mb", level.size_mb);
+            level_obj.pushKV("compaction_seconds", level.compaction_seconds);
+            level_obj.pushKV("compaction_read_mb", level.compaction_read_mb);
+            level_obj.pushKV("compaction_written_mb", level.compaction_written_mb);
+            levels.push_back(level_obj);
+        }
+        obj.pushKV("levels", levels);
+        obj.pushKV("stats", stats.stats);
+        ret.push_back(obj);
+    }
+    return ret;
+}
+
 static void EnableOrDisableLogCategories(UniValue cats, bool enable) {
     cats = cats.get_array();
     for (unsigned int i = 0; i < cats.size(); ++i) {
@@ -683,6 +804,7 @@ static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         argNames
   //  --------------------- ------------------------  -----------------------  ----------
     { "control",            "getmemoryinfo",          &getmemoryinfo,          {"mode"} },
+    { "control",            "getleveldbstats",        &getleveldbstats,        {} },
     { "control",            "logging",                &logging,                {"include", "exclude"}},
     { "util",               "validateaddress",        &validateaddress,        {"address"} },
     { "util",               "createmultisig",         &createmultisig,         {"nrequired","keys","address_type"} },
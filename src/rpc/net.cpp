@@ -457,6 +457,31 @@ static UniValue GetNetworksInfo()
     return networks;
 }
 
+static UniValue GetMessageHandlersInfo(CConnman& connman)
+{
+    static const char* LATENCY_BUCKET_NAMES[] = {"100us", "1ms", "10ms", "100ms", "1s", "slower"};
+    static_assert(ARRAYLEN(LATENCY_BUCKET_NAMES) == MESSAGE_HANDLER_LATENCY_BUCKETS, "latency bucket names out of sync");
+
+    std::vector<CMessageHandlerStats> vstats;
+    connman.GetMessageHandlerStats(vstats);
+    UniValue handlers(UniValue::VARR);
+    for (const CMessageHandlerStats& stats : vstats) {
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("peers", stats.nPeers);
+        obj.pushKV("queuedmessages", (uint64_t)stats.nQueuedMessages);
+        obj.pushKV("queuedbytes", (uint64_t)stats.nQueuedBytes);
+        obj.pushKV("turns", stats.nTurns);
+        obj.pushKV("busytime", stats.nBusyMicros / 1000000.0);
+        UniValue latency(UniValue::VOBJ);
+        for (size_t i = 0; i < stats.vLatency.size(); i++) {
+            latency.pushKV(LATENCY_BUCKET_NAMES[i], stats.vLatency[i]);
+        }
+        obj.pushKV("latency", latency);
+        handlers.push_back(obj);
+    }
+    return handlers;
+}
+
 static UniValue getnetworkinfo(const JSONRPCRequest& request)
 {
             RPCHelpMan{"getnetworkinfo",
@@ -488,6 +513,26 @@ static UniValue getnetworkinfo(const JSONRPCRequest& request)
                                 {RPCResult::Type::BOOL, "proxy_randomize_credentials", "Whether randomized credentials are used"},
                             }},
                         }},
+                        {RPCResult::Type::ARR, "messagehandlers", "information per message handler thread (see -msghandthreads)",
+                        {
+                            {RPCResult::Type::OBJ, "", "",
+                            {
+                                {RPCResult::Type::NUM, "peers", "the number of peers assigned to this thread"},
+                                {RPCResult::Type::NUM, "queuedmessages", "the number of received messages waiting to be processed"},
+                                {RPCResult::Type::NUM, "queuedbytes", "the size of the received messages waiting to be processed"},
+                                {RPCResult::Type::NUM, "turns", "the number of times a peer was processed"},
+                                {RPCResult::Type::NUM, "busytime", "the total time spent processing peers, in seconds"},
+                                {RPCResult::Type::OBJ, "latency", "the number of turns by how long they took",
+                                {
+                                    {RPCResult::Type::NUM, "100us", "turns shorter than 100 microseconds"},
+                                    {RPCResult::Type::NUM, "1ms", "turns between 100 microseconds and 1 millisecond"},
+                                    {RPCResult::Type::NUM, "10ms", "turns between 1 and 10 milliseconds"},
+                                    {RPCResult::Type::NUM, "100ms", "turns between 10 and 100 milliseconds"},
+                                    {RPCResult::Type::NUM, "1s", "turns between 100 milliseconds and 1 second"},
+                                    {RPCResult::Type::NUM, "slower", "turns of 1 second or more"},
+                                }},
+                            }},
+                        }},
                         {RPCResult::Type::NUM, "relayfee", "minimum relay fee for transactions in " + CURRENCY_UNIT + "/kB"},
                         {RPCResult::Type::NUM, "incrementalfee", "minimum fee increment for mempool limiting or BIP 125 replacement in " + CURRENCY_UNIT + "/kB"},
                         {RPCResult::Type::ARR, "localaddresses", "list of local addresses",
@@ -525,6 +570,9 @@ static UniValue getnetworkinfo(const JSONRPCRequest& request)
         obj.pushKV("connections",   (int)g_rpc_node->connman->GetNodeCount(CConnman::CONNECTIONS_ALL));
     }
     obj.pushKV("networks",      GetNetworksInfo());
+    if (g_rpc_node->connman) {
+        obj.pushKV("messagehandlers", GetMessageHandlersInfo(*g_rpc_node->connman));
+    }
     obj.pushKV("relayfee",      ValueFromAmount(::minRelayTxFee.GetFeePerK()));
     obj.pushKV("incrementalfee", ValueFromAmount(::incrementalRelayFee.GetFeePerK()));
     UniValue localAddresses(UniValue::VARR);
@@ -10,9 +10,67 @@
 #include <uint256.h>
 #include <util/system.h>
 
-#include <cuckoocache.h>
 #include <boost/thread.hpp>
 
+ShardedCuckooCache::ShardedCuckooCache(size_t nShards)
+{
+    assert(nShards >= 1 && nShards <= 256);
+    for (size_t i = 0; i < nShards; ++i) {
+        m_shards.emplace_back(new Shard);
+    }
+}
+
+size_t ShardedCuckooCache::setup_bytes(size_t nBytes)
+{
+    m_elements = 0;
+    for (const auto& shard : m_shards) {
+        boost::unique_lock<boost::shared_mutex> lock(shard->mutex);
+        m_elements += shard->cache.setup_bytes(nBytes / m_shards.size());
+    }
+    return m_elements;
+}
+
+bool ShardedCuckooCache::contains(const uint256& entry, bool erase)
+{
+    Shard& shard = GetShard(entry);
+    // Lookups, even erasing ones, only need a shared lock: erasing merely
+    // flags the entry in the cuckoo cache.
+    boost::shared_lock<boost::shared_mutex> lock(shard.mutex, boost::try_to_lock);
+    if (!lock.owns_lock()) {
+        shard.nContended.fetch_add(1, std::memory_order_relaxed);
+        lock.lock();
+    }
+    const bool fFound = shard.cache.contains(entry, erase);
+    (fFound ? shard.nHits : shard.nMisses).fetch_add(1, std::memory_order_relaxed);
+    return fFound;
+}
+
+void ShardedCuckooCache::insert(uint256 entry)
+{
+    Shard& shard = GetShard(entry);
+    boost::unique_lock<boost::shared_mutex> lock(shard.mutex, boost::try_to_lock);
+    if (!lock.owns_lock()) {
+        shard.nContended.fetch_add(1, std::memory_order_relaxed);
+        lock.lock();
+    }
+    shard.cache.insert(std::move(entry));
+    shard.nInserts.fetch_add(1, std::memory_order_relaxed);
+}
+
+ShardedCacheStats ShardedCuckooCache::GetStats() const
+{
+    ShardedCacheStats stats;
+    for (const auto& shard : m_shards) {
+        stats.nHits += shard->nHits;
+        stats.nMisses += shard->nMisses;
+        stats.nInserts += shard->nInserts;
+        stats.nContended += shard->nContended;
+    }
+    stats.nShards = m_shards.size();
+    stats.nElements = m_elements;
+    return stats;
+}
+
 namespace {
 /**
  * Valid signature cache, to avoid doing expensive ECDSA signature checking
@@ -24,12 +82,10 @@ class CSignatureCache
 private:
      //! Entries are SHA256(nonce || signature hash || public key || signature):
     uint256 nonce;
-    typedef CuckooCache::cache<uint256, SignatureCacheHasher> map_type;
-    map_type setValid;
-    boost::shared_mutex cs_sigcache;
+    ShardedCuckooCache setValid;
 
 public:
-    CSignatureCache()
+    CSignatureCache() : setValid(SIG_CACHE_SHARDS)
     {
         GetRandBytes(nonce.begin(), 32);
     }
@@ -43,19 +99,21 @@ public:
     bool
     Get(const uint256& entry, const bool erase)
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
         return setValid.contains(entry, erase);
     }
 
     void Set(uint256& entry)
     {
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
         setValid.insert(entry);
     }
-    uint32_t setup_bytes(size_t n)
+    size_t setup_bytes(size_t n)
     {
         return setValid.setup_bytes(n);
     }
+    ShardedCacheStats GetStats() const
+    {
+        return setValid.GetStats();
+    }
 };
 
 /* In previous versions of this code, signatureCache was a local static variable
@@ -79,6 +137,11 @@ void InitSignatureCache()
             (nElems*sizeof(uint256)) >>20, (nMaxCacheSize*2)>>20, nElems);
 }
 
+ShardedCacheStats GetSignatureCacheStats()
+{
+    return signatureCache.GetStats();
+}
+
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
     uint256 entry;
@@ -91,3 +154,27 @@ bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsig
         signatureCache.Set(entry);
     return true;
 }
+
+bool CachingVerifySignature(const CPubKey& pubkey, const uint256& hash, const std::vector<unsigned char>& vchSig, bool store)
+{
+    if (vchSig.empty() || !pubkey.IsValid())
+        return false;
+    uint256 entry;
+    signatureCache.ComputeEntry(entry, hash, vchSig, pubkey);
+    if (signatureCache.Get(entry, !store))
+        return true;
+    if (!pubkey.Verify(hash, vchSig))
+        return false;
+    if (store)
+        signatureCache.Set(entry);
+    return true;
+}
+
+void AddToSignatureCache(const CPubKey& pubkey, const uint256& hash, const std::vector<unsigned char>& vchSig)
+{
+    if (vchSig.empty() || !pubkey.IsValid())
+        return;
+    uint256 entry;
+    signatureCache.ComputeEntry(entry, hash, vchSig, pubkey);
+    signatureCache.Set(entry);
+}
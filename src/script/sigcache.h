@@ -6,16 +6,23 @@
 #ifndef BITCOIN_SCRIPT_SIGCACHE_H
 #define BITCOIN_SCRIPT_SIGCACHE_H
 
+#include <cuckoocache.h>
 #include <script/interpreter.h>
 
+#include <atomic>
+#include <memory>
 #include <vector>
 
+#include <boost/thread/shared_mutex.hpp>
+
 // DoS prevention: limit cache size to 32MB (over 1000000 entries on 64-bit
 // systems). Due to how we count cache size, actual memory usage is slightly
 // more (~32.25 MB)
 static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 32;
 // Maximum sig cache size allowed
 static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
+// Number of independently locked parts of the signature and script execution caches
+static const size_t SIG_CACHE_SHARDS = 16;
 
 class CPubKey;
 
@@ -40,6 +47,50 @@ public:
     }
 };
 
+struct ShardedCacheStats {
+    uint64_t nHits = 0;
+    uint64_t nMisses = 0;
+    uint64_t nInserts = 0;
+    //! Lookups and inserts that had to wait for another thread's lock on their shard
+    uint64_t nContended = 0;
+    size_t nShards = 0;
+    size_t nElements = 0;
+};
+
+/**
+ * A cache of nonced hashes (signature or script execution cache entries),
+ * split over independent cuckoo caches each behind its own lock, so that
+ * script check threads and mempool acceptance rarely wait on each other. The
+ * shard of an entry is picked by its first byte, which the cuckoo hashes of
+ * the shard barely depend on.
+ */
+class ShardedCuckooCache
+{
+private:
+    struct Shard {
+        CuckooCache::cache<uint256, SignatureCacheHasher> cache;
+        boost::shared_mutex mutex;
+        std::atomic<uint64_t> nHits{0};
+        std::atomic<uint64_t> nMisses{0};
+        std::atomic<uint64_t> nInserts{0};
+        std::atomic<uint64_t> nContended{0};
+    };
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    size_t m_elements{0};
+
+    Shard& GetShard(const uint256& entry) const { return *m_shards[*entry.begin() % m_shards.size()]; }
+
+public:
+    //! nShards must be between 1 and 256
+    explicit ShardedCuckooCache(size_t nShards);
+
+    //! Size the cache to use at most nBytes in total. Returns the number of elements it can hold.
+    size_t setup_bytes(size_t nBytes);
+    bool contains(const uint256& entry, bool erase);
+    void insert(uint256 entry);
+    ShardedCacheStats GetStats() const;
+};
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
@@ -51,6 +102,16 @@ public:
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const override;
 };
 
+/**
+ * Check an ECDSA signature over an arbitrary hash (such as a proof-of-stake
+ * block signature) against the signature cache before verifying it. With
+ * store set, a signature that verifies is added to the cache.
+ */
+bool CachingVerifySignature(const CPubKey& pubkey, const uint256& hash, const std::vector<unsigned char>& vchSig, bool store);
+/** Add a signature known to be valid, e.g. one this node just produced, to the signature cache. */
+void AddToSignatureCache(const CPubKey& pubkey, const uint256& hash, const std::vector<unsigned char>& vchSig);
+
 void InitSignatureCache();
+ShardedCacheStats GetSignatureCacheStats();
 
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
@@ -239,6 +239,11 @@ public:
         Init(nTypeIn, nVersionIn);
     }
 
+    CDataStream(vector_type&& vchIn, int nTypeIn, int nVersionIn) : vch(std::move(vchIn))
+    {
+        Init(nTypeIn, nVersionIn);
+    }
+
     CDataStream(const std::vector<char>& vchIn, int nTypeIn, int nVersionIn) : vch(vchIn.begin(), vchIn.end())
     {
         Init(nTypeIn, nVersionIn);
@@ -296,6 +301,9 @@ public:
     const_reference operator[](size_type pos) const  { return vch[pos + nReadPos]; }
     reference operator[](size_type pos)              { return vch[pos + nReadPos]; }
     void clear()                                     { vch.clear(); nReadPos = 0; }
+    size_type capacity() const                       { return vch.capacity(); }
+    //! Take the underlying buffer, including data that was already read, leaving the stream empty
+    vector_type release()                            { vector_type ret; ret.swap(vch); nReadPos = 0; return ret; }
     iterator insert(iterator it, const char x=char()) { return vch.insert(it, x); }
     void insert(iterator it, size_type n, const char x) { vch.insert(it, n, x); }
     value_type* data()                               { return vch.data() + nReadPos; }
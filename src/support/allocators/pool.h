@@ -0,0 +1,212 @@
+// Copyright (c) 2020 The Merge Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/**
+ * A memory resource for node based containers, which allocate and free many
+ * equally sized small objects.
+ *
+ * Memory is taken from the system in chunks of a fixed size and handed out in
+ * blocks of up to MAX_BLOCK_SIZE_BYTES, rounded up to a multiple of the
+ * alignment. Freed blocks go on a free list for their size and are reused by
+ * the next allocation of that size. Memory is only returned to the system when
+ * the resource is destroyed. Larger or more strictly aligned requests are
+ * passed on to operator new.
+ *
+ * Compared with a malloc per node, this saves the allocator's per-block
+ * overhead and keeps nodes allocated together close in memory. It also makes
+ * the memory used by a container exact: it is the number of chunks times the
+ * chunk size, plus the few allocations not served by the pool.
+ *
+ * The resource is not thread safe, and must outlive every container using it.
+ */
+template <std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+class PoolResource
+{
+    static_assert(ALIGN_BYTES > 0 && (ALIGN_BYTES & (ALIGN_BYTES - 1)) == 0, "ALIGN_BYTES must be a power of two");
+    static_assert(ALIGN_BYTES <= alignof(std::max_align_t), "chunks from operator new are only aligned to max_align_t");
+
+    //! Free blocks are linked through their first bytes
+    struct ListNode {
+        ListNode* m_next;
+        explicit ListNode(ListNode* next) : m_next(next) {}
+    };
+
+    //! Blocks are sized in multiples of this, and are large enough to hold a ListNode
+    static constexpr std::size_t ELEM_ALIGN_BYTES = ALIGN_BYTES > alignof(ListNode) ? ALIGN_BYTES : alignof(ListNode);
+    static_assert(ELEM_ALIGN_BYTES >= sizeof(ListNode), "block alignment must fit a free list node");
+    static_assert(MAX_BLOCK_SIZE_BYTES >= ELEM_ALIGN_BYTES, "MAX_BLOCK_SIZE_BYTES must fit at least one block");
+
+    const std::size_t m_chunk_size_bytes;
+    std::list<char*> m_allocated_chunks;
+    //! Free lists, indexed by block size in units of ELEM_ALIGN_BYTES
+    std::array<ListNode*, MAX_BLOCK_SIZE_BYTES / ELEM_ALIGN_BYTES + 1> m_free_lists;
+    //! Unused tail of the most recent chunk
+    char* m_available_memory_it = nullptr;
+    char* m_available_memory_end = nullptr;
+
+    static std::size_t NumElemAlignBytes(std::size_t bytes)
+    {
+        return (bytes + ELEM_ALIGN_BYTES - 1) / ELEM_ALIGN_BYTES + (bytes == 0);
+    }
+
+    static bool IsFreeListUsable(std::size_t bytes, std::size_t alignment)
+    {
+        return alignment <= ELEM_ALIGN_BYTES && bytes <= MAX_BLOCK_SIZE_BYTES;
+    }
+
+    void PlacementAddToList(void* p, ListNode*& node)
+    {
+        node = new (p) ListNode{node};
+    }
+
+    //! Hand the rest of the current chunk to the free lists, then allocate a new one
+    void AllocateChunk()
+    {
+        if (m_available_memory_it != m_available_memory_end) {
+            const std::size_t remaining_num_elem = (m_available_memory_end - m_available_memory_it) / ELEM_ALIGN_BYTES;
+            PlacementAddToList(m_available_memory_it, m_free_lists[remaining_num_elem]);
+        }
+        void* storage = ::operator new(m_chunk_size_bytes);
+        m_available_memory_it = static_cast<char*>(storage);
+        m_available_memory_end = m_available_memory_it + m_chunk_size_bytes;
+        m_allocated_chunks.push_back(m_available_memory_it);
+    }
+
+public:
+    static constexpr std::size_t DEFAULT_CHUNK_SIZE_BYTES = 256 << 10;
+
+    explicit PoolResource(std::size_t chunk_size_bytes)
+        : m_chunk_size_bytes(NumElemAlignBytes(chunk_size_bytes) * ELEM_ALIGN_BYTES)
+    {
+        assert(m_chunk_size_bytes >= MAX_BLOCK_SIZE_BYTES);
+        m_free_lists.fill(nullptr);
+        AllocateChunk();
+    }
+
+    PoolResource() : PoolResource(DEFAULT_CHUNK_SIZE_BYTES) {}
+
+    PoolResource(const PoolResource&) = delete;
+    PoolResource& operator=(const PoolResource&) = delete;
+
+    ~PoolResource()
+    {
+        for (char* chunk : m_allocated_chunks) {
+            ::operator delete(chunk);
+        }
+    }
+
+    void* Allocate(std::size_t bytes, std::size_t alignment)
+    {
+        if (IsFreeListUsable(bytes, alignment)) {
+            const std::size_t num_alignments = NumElemAlignBytes(bytes);
+            if (m_free_lists[num_alignments] != nullptr) {
+                // Reuse a freed block of this size
+                ListNode* node = m_free_lists[num_alignments];
+                m_free_lists[num_alignments] = node->m_next;
+                return node;
+            }
+            const std::size_t round_bytes = num_alignments * ELEM_ALIGN_BYTES;
+            if (round_bytes > static_cast<std::size_t>(m_available_memory_end - m_available_memory_it)) {
+                AllocateChunk();
+            }
+            char* p = m_available_memory_it;
+            m_available_memory_it += round_bytes;
+            return p;
+        }
+        return ::operator new(bytes);
+    }
+
+    void Deallocate(void* p, std::size_t bytes, std::size_t alignment) noexcept
+    {
+        if (IsFreeListUsable(bytes, alignment)) {
+            PlacementAddToList(p, m_free_lists[NumElemAlignBytes(bytes)]);
+        } else {
+            ::operator delete(p);
+        }
+    }
+
+    std::size_t NumAllocatedChunks() const { return m_allocated_chunks.size(); }
+    std::size_t ChunkSizeBytes() const { return m_chunk_size_bytes; }
+};
+
+template <std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+constexpr std::size_t PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>::ELEM_ALIGN_BYTES;
+template <std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+constexpr std::size_t PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>::DEFAULT_CHUNK_SIZE_BYTES;
+
+/**
+ * Allocator for node based containers that takes single objects from a
+ * PoolResource. Arrays, such as a hash table's buckets, bypass the pool.
+ */
+template <class T, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES = alignof(T)>
+class PoolAllocator
+{
+    PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>* m_resource;
+
+public:
+    typedef T value_type;
+    typedef PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> ResourceType;
+
+    PoolAllocator(ResourceType* resource) noexcept : m_resource(resource) {}
+
+    PoolAllocator(const PoolAllocator& other) noexcept = default;
+    PoolAllocator& operator=(const PoolAllocator& other) noexcept = default;
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& other) noexcept : m_resource(other.resource())
+    {
+    }
+
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> other;
+    };
+
+    T* allocate(std::size_t n)
+    {
+        if (n == 1) {
+            return static_cast<T*>(m_resource->Allocate(sizeof(T), alignof(T)));
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        if (n == 1) {
+            m_resource->Deallocate(p, sizeof(T), alignof(T));
+        } else {
+            ::operator delete(p);
+        }
+    }
+
+    ResourceType* resource() const noexcept { return m_resource; }
+};
+
+template <class T1, class T2, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator==(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a,
+                const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return a.resource() == b.resource();
+}
+
+template <class T1, class T2, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator!=(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a,
+                const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return !(a == b);
+}
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_POOL_H
@@ -300,6 +300,61 @@ BOOST_AUTO_TEST_CASE(EmptyBlockRoundTripTest)
     }
 }
 
+BOOST_AUTO_TEST_CASE(ProofOfStakeRoundTripTest)
+{
+    CTxMemPool pool;
+    CBlock block(BuildBlockTestCase());
+
+    // Turn the block into a proof-of-stake one: empty coinbase, coinstake at vtx[1]
+    CMutableTransaction coinbase(*block.vtx[0]);
+    coinbase.vout[0].SetEmpty();
+    block.vtx[0] = MakeTransactionRef(coinbase);
+    CMutableTransaction coinstake(*block.vtx[1]);
+    coinstake.vout.resize(2);
+    coinstake.vout[0].SetEmpty();
+    coinstake.vout[1].nValue = 42;
+    block.vtx[1] = MakeTransactionRef(coinstake);
+    bool mutated;
+    block.hashMerkleRoot = BlockMerkleRoot(block, &mutated);
+    assert(!mutated);
+    block.vchBlockSig = {0x30, 0x06, 0x02, 0x01, 0x01, 0x02, 0x01, 0x01};
+    BOOST_CHECK(block.IsProofOfStake());
+
+    LOCK2(cs_main, pool.cs);
+    CBlockHeaderAndShortTxIDs shortIDs(block, true);
+
+    // The signature-carrying encoding rebuilds the signed block without a round trip for the coinstake
+    {
+        CDataStream stream(SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_CMPCTBLOCK_BLOCKSIG);
+        stream << shortIDs;
+        CBlockHeaderAndShortTxIDs shortIDs2;
+        stream >> shortIDs2;
+
+        PartiallyDownloadedBlock partialBlock(&pool);
+        BOOST_CHECK(partialBlock.InitData(shortIDs2, extra_txn) == READ_STATUS_OK);
+        BOOST_CHECK( partialBlock.IsTxAvailable(0));
+        BOOST_CHECK( partialBlock.IsTxAvailable(1));
+        BOOST_CHECK(!partialBlock.IsTxAvailable(2));
+
+        CBlock block2;
+        BOOST_CHECK(partialBlock.FillBlock(block2, {block.vtx[2]}) == READ_STATUS_OK);
+        BOOST_CHECK_EQUAL(block.GetHash().ToString(), block2.GetHash().ToString());
+        BOOST_CHECK(block.vchBlockSig == block2.vchBlockSig);
+    }
+
+    // Without the signature the block cannot be used, so the full block is requested straight away
+    {
+        CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+        stream << shortIDs;
+        CBlockHeaderAndShortTxIDs shortIDs2;
+        stream >> shortIDs2;
+        BOOST_CHECK(stream.empty());
+
+        PartiallyDownloadedBlock partialBlock(&pool);
+        BOOST_CHECK(partialBlock.InitData(shortIDs2, extra_txn) == READ_STATUS_FAILED);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(TransactionsRequestSerializationTest) {
     BlockTransactionsRequest req1;
     req1.blockhash = InsecureRand256();
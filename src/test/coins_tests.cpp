@@ -8,6 +8,7 @@
 #include <script/standard.h>
 #include <streams.h>
 #include <test/util/setup_common.h>
+#include <txdb.h>
 #include <uint256.h>
 #include <undo.h>
 #include <util/strencodings.h>
@@ -531,6 +532,83 @@ BOOST_AUTO_TEST_CASE(ccoins_serialization)
     }
 }
 
+BOOST_AUTO_TEST_CASE(coin_db_serialization)
+{
+    const uint160 keyhash(ParseHex("816115944e077fe7c803cfa57f29b36bf87c1d35"));
+    const Coin coin(CTxOut(COIN, GetScriptForDestination(WitnessV0KeyHash(keyhash))), 100, false, true);
+
+    // The coinstake flag shares the header code, and the script is stored as its key hash
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << Using<CoinDBFormatter>(coin);
+    BOOST_CHECK_EQUAL(HexStr(ss.begin(), ss.end()), "82120906816115944e077fe7c803cfa57f29b36bf87c1d35");
+
+    CDataStream ss_base(SER_DISK, CLIENT_VERSION);
+    ss_base << coin;
+    BOOST_CHECK_EQUAL(ss_base.size(), ss.size() + 3);
+
+    Coin coin2;
+    ss >> Using<CoinDBFormatter>(coin2);
+    BOOST_CHECK(coin2.out == coin.out);
+    BOOST_CHECK_EQUAL(coin2.nHeight, 100U);
+    BOOST_CHECK_EQUAL(coin2.fCoinBase, false);
+    BOOST_CHECK_EQUAL(coin2.fCoinStake, true);
+
+    // Heights up to the largest a Coin holds survive the wider header code
+    const uint256 scripthash(ParseHex("6d8a4a1d0c2f3c5b9e7f8a1b2c3d4e5f60718293a4b5c6d7e8f901a2b3c4d5e6"));
+    const Coin coin3(CTxOut(1, GetScriptForDestination(WitnessV0ScriptHash(scripthash))), 0x7fffffff, true, false);
+    ss << Using<CoinDBFormatter>(coin3);
+    BOOST_CHECK_EQUAL(ss.size(), 5U + 1 + 1 + 32);
+    Coin coin4;
+    ss >> Using<CoinDBFormatter>(coin4);
+    BOOST_CHECK(coin4.out == coin3.out);
+    BOOST_CHECK_EQUAL(coin4.nHeight, 0x7fffffffU);
+    BOOST_CHECK_EQUAL(coin4.fCoinBase, true);
+    BOOST_CHECK_EQUAL(coin4.fCoinStake, false);
+}
+
+BOOST_AUTO_TEST_CASE(coins_db_version)
+{
+    const fs::path path = GetDataDir() / "coins_db_version";
+    const COutPoint outpoint(uint256S("0x1234"), 0);
+    const Coin coin(CTxOut(COIN, CScript() << OP_TRUE), 100, false, true);
+
+    // A new database starts at the current format
+    {
+        CCoinsViewDB coins_db(path, 1 << 20, false, true);
+        BOOST_CHECK_EQUAL(coins_db.GetVersion(), CHAINSTATE_VERSION);
+        BOOST_CHECK(coins_db.Upgrade());
+    }
+
+    // A database from before the version record is upgraded and marked
+    {
+        CDBWrapper db(path, 1 << 20, false, true, true);
+        // Coin's own serialization under the old key prefix; an output index of 0 is a one byte VARINT
+        db.Write(std::make_pair('C', std::make_pair(outpoint.hash, (unsigned char)0)), coin);
+        db.Write('B', uint256S("0x01"));
+    }
+    {
+        CCoinsViewDB coins_db(path, 1 << 20, false, false);
+        BOOST_CHECK_EQUAL(coins_db.GetVersion(), 0);
+        BOOST_CHECK(coins_db.Upgrade());
+        BOOST_CHECK_EQUAL(coins_db.GetVersion(), CHAINSTATE_VERSION);
+        Coin coin2;
+        BOOST_CHECK(coins_db.GetCoin(outpoint, coin2));
+        BOOST_CHECK(coin2.out == coin.out);
+        BOOST_CHECK(coin2.fCoinStake);
+    }
+
+    // A database in a format from a later version is refused
+    {
+        CDBWrapper db(path, 1 << 20, false, false, true);
+        db.Write('V', CHAINSTATE_VERSION + 1);
+    }
+    {
+        CCoinsViewDB coins_db(path, 1 << 20, false, false);
+        BOOST_CHECK_EQUAL(coins_db.GetVersion(), CHAINSTATE_VERSION + 1);
+        BOOST_CHECK(!coins_db.Upgrade());
+    }
+}
+
 const static COutPoint OUTPOINT;
 const static CAmount PRUNED = -1;
 const static CAmount ABSENT = -2;
@@ -592,7 +670,8 @@ void GetCoinsMapEntry(const CCoinsMap& map, CAmount& value, char& flags)
 
 void WriteCoinsViewEntry(CCoinsView& view, CAmount value, char flags)
 {
-    CCoinsMap map;
+    CCoinsMapMemoryResource resource;
+    CCoinsMap map(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &resource);
     InsertCoinsMapEntry(map, value, flags);
     BOOST_CHECK(view.BatchWrite(map, {}));
 }
@@ -861,4 +940,66 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+BOOST_AUTO_TEST_CASE(ccoins_background_flush)
+{
+    CCoinsViewDB db(GetDataDir() / "bgflush_chainstate", 1 << 20, true, false);
+    CCoinsViewBackgroundFlush flushview(&db, db);
+    CCoinsViewCache cache(&flushview);
+
+    // Start from a database holding a coin that the next flush spends
+    const COutPoint spent(InsecureRand256(), 0);
+    const COutPoint added(InsecureRand256(), 1);
+    Coin coin;
+    coin.out.nValue = 1;
+    coin.nHeight = 1;
+    cache.AddCoin(spent, Coin(coin), false);
+    cache.SetBestBlock(InsecureRand256());
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(db.HaveCoin(spent));
+
+    flushview.SetBackground(true);
+    cache.AddCoin(added, Coin(coin), false);
+    BOOST_CHECK(cache.SpendCoin(spent));
+    const uint256 best_block = InsecureRand256();
+    cache.SetBestBlock(best_block);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+
+    // Whether or not the write has completed, the view below the cache
+    // already has the effects of the flush
+    BOOST_CHECK(flushview.HaveCoin(added));
+    BOOST_CHECK(!flushview.HaveCoin(spent));
+    BOOST_CHECK(flushview.GetBestBlock() == best_block);
+    BOOST_CHECK(cache.HaveCoin(added));
+    BOOST_CHECK(!cache.HaveCoin(spent));
+
+    BOOST_CHECK(flushview.Wait());
+    BOOST_CHECK(!flushview.IsWriting());
+    BOOST_CHECK(db.HaveCoin(added));
+    BOOST_CHECK(!db.HaveCoin(spent));
+    BOOST_CHECK(db.GetBestBlock() == best_block);
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_unspent_outpoints)
+{
+    CCoinsView base;
+    CCoinsViewCache cache(&base);
+
+    const COutPoint kept(InsecureRand256(), 0);
+    const COutPoint spent(InsecureRand256(), 1);
+    Coin coin;
+    coin.out.nValue = 1;
+    coin.nHeight = 1;
+    cache.AddCoin(kept, Coin(coin), false);
+    cache.AddCoin(spent, Coin(coin), false);
+    BOOST_CHECK(cache.SpendCoin(spent));
+
+    // Spent entries are left out, and the outpoints are appended
+    std::vector<COutPoint> outpoints{spent};
+    cache.GetUnspentOutpoints(outpoints);
+    BOOST_CHECK_EQUAL(outpoints.size(), 2U);
+    BOOST_CHECK(outpoints[0] == spent);
+    BOOST_CHECK(outpoints[1] == kept);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,64 @@
+// Copyright (c) 2020 The Merge Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <index/coinstatsindex.h>
+#include <node/coinstats.h>
+#include <test/util/setup_common.h>
+#include <util/time.h>
+#include <validation.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(coinstatsindex_tests)
+
+BOOST_FIXTURE_TEST_CASE(coinstatsindex_initial_sync, TestingSetup)
+{
+    CoinStatsIndex coin_stats_index(1 << 20, true);
+
+    CCoinsStats coin_stats;
+    const CBlockIndex* tip = WITH_LOCK(cs_main, return ::ChainActive().Tip());
+
+    // Statistics should not be found in the index before it is started.
+    BOOST_CHECK(!coin_stats_index.LookUpStats(tip, coin_stats));
+
+    // BlockUntilSyncedToCurrentChain should return false before the index is started.
+    BOOST_CHECK(!coin_stats_index.BlockUntilSyncedToCurrentChain());
+
+    coin_stats_index.Start();
+
+    // Allow the index to catch up with the block index.
+    constexpr int64_t timeout_ms = 10 * 1000;
+    int64_t time_start = GetTimeMillis();
+    while (!coin_stats_index.BlockUntilSyncedToCurrentChain()) {
+        BOOST_REQUIRE(time_start + timeout_ms > GetTimeMillis());
+        UninterruptibleSleep(std::chrono::milliseconds{100});
+    }
+
+    // The statistics of the index match those of a scan of the chainstate.
+    ::ChainstateActive().ForceFlushStateToDisk();
+    CCoinsStats expected;
+    CCoinsView* coins_view = WITH_LOCK(cs_main, return &::ChainstateActive().CoinsDB());
+    BOOST_REQUIRE(GetUTXOStats(coins_view, expected, CoinStatsHashType::MUHASH));
+
+    BOOST_REQUIRE(coin_stats_index.LookUpStats(tip, coin_stats));
+    BOOST_CHECK(coin_stats.index_used);
+    BOOST_CHECK_EQUAL(coin_stats.nHeight, expected.nHeight);
+    BOOST_CHECK(coin_stats.hashBlock == expected.hashBlock);
+    BOOST_CHECK(coin_stats.hashSerialized == expected.hashSerialized);
+    BOOST_CHECK_EQUAL(coin_stats.nTransactionOutputs, expected.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(coin_stats.nBogoSize, expected.nBogoSize);
+    BOOST_CHECK_EQUAL(coin_stats.nTotalAmount, expected.nTotalAmount);
+
+    // shutdown sequence (c.f. Shutdown() in init.cpp)
+    coin_stats_index.Stop();
+
+    // The index job may be scheduled, so stop scheduler before destructing
+    m_node.scheduler->stop();
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+
+    // Rest of shutdown sequence and destructors happen in ~TestingSetup()
+}
+
+BOOST_AUTO_TEST_SUITE_END()
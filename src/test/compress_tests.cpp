@@ -134,4 +134,44 @@ BOOST_AUTO_TEST_CASE(compress_script_to_uncompressed_pubkey_id)
     BOOST_CHECK_EQUAL(out[0], 0x04 | (script[65] & 0x01)); // least significant bit (lsb) of last char of pubkey is mapped into out[0]
 }
 
+BOOST_AUTO_TEST_CASE(compress_script_to_witness_keyhash)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CScript script = GetScriptForDestination(WitnessV0KeyHash(key.GetPubKey().GetID()));
+    BOOST_CHECK_EQUAL(script.size(), 22);
+
+    // Only the encoding with witness templates has a special case for it
+    std::vector<unsigned char> out;
+    BOOST_CHECK(!CompressScript(script, out));
+    BOOST_CHECK(CompressScript(script, out, SPECIAL_SCRIPTS_WITNESS));
+
+    BOOST_CHECK_EQUAL(out.size(), 21);
+    BOOST_CHECK_EQUAL(out[0], 0x06);
+    BOOST_CHECK_EQUAL(memcmp(&out[1], &script[2], 20), 0);
+
+    CScript decompressed;
+    BOOST_CHECK(DecompressScript(decompressed, out[0], std::vector<unsigned char>(out.begin() + 1, out.end())));
+    BOOST_CHECK(decompressed == script);
+}
+
+BOOST_AUTO_TEST_CASE(compress_script_to_witness_scripthash)
+{
+    CScript redeemScript = CScript() << OP_TRUE;
+    CScript script = GetScriptForDestination(WitnessV0ScriptHash(redeemScript));
+    BOOST_CHECK_EQUAL(script.size(), 34);
+
+    std::vector<unsigned char> out;
+    BOOST_CHECK(!CompressScript(script, out));
+    BOOST_CHECK(CompressScript(script, out, SPECIAL_SCRIPTS_WITNESS));
+
+    BOOST_CHECK_EQUAL(out.size(), 33);
+    BOOST_CHECK_EQUAL(out[0], 0x07);
+    BOOST_CHECK_EQUAL(memcmp(&out[1], &script[2], 32), 0);
+
+    CScript decompressed;
+    BOOST_CHECK(DecompressScript(decompressed, out[0], std::vector<unsigned char>(out.begin() + 1, out.end())));
+    BOOST_CHECK(decompressed == script);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
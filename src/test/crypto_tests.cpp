@@ -9,11 +9,13 @@
 #include <crypto/hkdf_sha256_32.h>
 #include <crypto/hmac_sha256.h>
 #include <crypto/hmac_sha512.h>
+#include <crypto/muhash.h>
 #include <crypto/ripemd160.h>
 #include <crypto/sha1.h>
 #include <crypto/sha256.h>
 #include <crypto/sha512.h>
 #include <random.h>
+#include <streams.h>
 #include <util/strencodings.h>
 #include <test/util/setup_common.h>
 
@@ -750,4 +752,110 @@ BOOST_AUTO_TEST_CASE(sha256d64)
     }
 }
 
+static Num3072 FromSmall(uint64_t n)
+{
+    unsigned char data[Num3072::BYTE_SIZE] = {0};
+    WriteLE64(data, n);
+    return Num3072(data);
+}
+
+static bool Num3072Equal(const Num3072& a, const Num3072& b)
+{
+    unsigned char a_bytes[Num3072::BYTE_SIZE], b_bytes[Num3072::BYTE_SIZE];
+    a.ToBytes(a_bytes);
+    b.ToBytes(b_bytes);
+    return memcmp(a_bytes, b_bytes, Num3072::BYTE_SIZE) == 0;
+}
+
+static Span<const unsigned char> ElementSpan(const uint256& element)
+{
+    return Span<const unsigned char>(element.begin(), element.size());
+}
+
+static uint256 MuHashOf(std::vector<uint256> elements, std::vector<uint256> removed = {})
+{
+    MuHash3072 muhash;
+    for (const uint256& element : elements) muhash.Insert(ElementSpan(element));
+    for (const uint256& element : removed) muhash.Remove(ElementSpan(element));
+    uint256 out;
+    muhash.Finalize(out);
+    return out;
+}
+
+BOOST_AUTO_TEST_CASE(num3072_arithmetic)
+{
+    // 2^3072 - 1 is p + 1103716, so multiplying it by one reduces it
+    unsigned char max[Num3072::BYTE_SIZE];
+    memset(max, 0xff, sizeof(max));
+    Num3072 x(max);
+    x.Multiply(FromSmall(1));
+    BOOST_CHECK(Num3072Equal(x, FromSmall(1103716)));
+
+    // (p - 1)^2 = 1
+    unsigned char minus_one_bytes[Num3072::BYTE_SIZE];
+    memset(minus_one_bytes, 0xff, sizeof(minus_one_bytes));
+    WriteLE64(minus_one_bytes, std::numeric_limits<uint64_t>::max() - 1103717);
+    Num3072 square(minus_one_bytes);
+    square.Multiply(Num3072(minus_one_bytes));
+    BOOST_CHECK(Num3072Equal(square, FromSmall(1)));
+
+    for (int i = 0; i < 4; ++i) {
+        unsigned char data[Num3072::BYTE_SIZE];
+        for (unsigned char& byte : data) byte = InsecureRandBits(8);
+        Num3072 a(data);
+        Num3072 b = a.GetInverse();
+        b.Multiply(a);
+        BOOST_CHECK(Num3072Equal(b, FromSmall(1)));
+
+        Num3072 c = FromSmall(InsecureRand32() + 1);
+        Num3072 d = a;
+        d.Multiply(c);
+        d.Divide(c);
+        a.Multiply(FromSmall(1));
+        BOOST_CHECK(Num3072Equal(d, a));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(muhash_tests)
+{
+    const uint256 a = InsecureRand256();
+    const uint256 b = InsecureRand256();
+    const uint256 c = InsecureRand256();
+
+    // The empty set hashes to the SHA256 of the number one
+    unsigned char one[Num3072::BYTE_SIZE] = {1};
+    uint256 empty;
+    CSHA256().Write(one, sizeof(one)).Finalize(empty.begin());
+    BOOST_CHECK(MuHashOf({}) == empty);
+
+    // The order of insertions and removals does not matter
+    BOOST_CHECK(MuHashOf({a, b, c}) == MuHashOf({c, a, b}));
+    BOOST_CHECK(MuHashOf({a, b, c}, {b}) == MuHashOf({a, c}));
+    BOOST_CHECK(MuHashOf({a}, {a}) == empty);
+    BOOST_CHECK(MuHashOf({a, b}) != MuHashOf({a, c}));
+    BOOST_CHECK(MuHashOf({a, a}) != MuHashOf({a}));
+
+    // Sets can be combined
+    MuHash3072 set1, set2;
+    set1.Insert(ElementSpan(a)).Insert(ElementSpan(b));
+    set2.Insert(ElementSpan(c)).Remove(ElementSpan(b));
+    MuHash3072 combined = set1;
+    combined *= set2;
+    uint256 out;
+    combined.Finalize(out);
+    BOOST_CHECK(out == MuHashOf({a, c}));
+    combined /= set2;
+    combined.Finalize(out);
+    BOOST_CHECK(out == MuHashOf({a, b}));
+
+    // The state survives serialization
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << set2;
+    MuHash3072 set3;
+    ss >> set3;
+    set3.Insert(ElementSpan(a));
+    set3.Finalize(out);
+    BOOST_CHECK(out == MuHashOf({a, c}, {b}));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -42,6 +42,30 @@ BOOST_AUTO_TEST_CASE(dbwrapper)
     }
 }
 
+BOOST_AUTO_TEST_CASE(dbwrapper_profile_stats)
+{
+    fs::path ph = GetDataDir() / "dbwrapper_profile";
+    CDBWrapper dbw(ph, (1 << 20), true, false, false, DB_PROFILE_BLOCK_FILTER_INDEX);
+    for (int i = 0; i < 1000; ++i) {
+        BOOST_CHECK(dbw.Write(i, InsecureRand256()));
+    }
+
+    LevelDBStats stats = dbw.GetStats();
+    BOOST_CHECK_EQUAL(stats.path, ph.string());
+    BOOST_CHECK_EQUAL(stats.profile.name, DB_PROFILE_BLOCK_FILTER_INDEX.name);
+    BOOST_CHECK_EQUAL(stats.cache_size, 1U << 20);
+    BOOST_CHECK(stats.memory_usage > 0);
+    BOOST_CHECK(!stats.levels.empty());
+    BOOST_CHECK(!stats.stats.empty());
+
+    // The database is listed among the open ones until it is closed
+    bool found = false;
+    for (const LevelDBStats& open_stats : GetLevelDBStats()) {
+        found |= open_stats.path == ph.string();
+    }
+    BOOST_CHECK(found);
+}
+
 BOOST_AUTO_TEST_CASE(dbwrapper_basic_data)
 {
     // Perform tests both obfuscated and non-obfuscated.
@@ -37,10 +37,10 @@ void test_one_input(const std::vector<uint8_t>& buffer)
     const CScript script{*script_opt};
 
     std::vector<unsigned char> compressed;
-    if (CompressScript(script, compressed)) {
+    if (CompressScript(script, compressed, SPECIAL_SCRIPTS_WITNESS)) {
         const unsigned int size = compressed[0];
         compressed.erase(compressed.begin());
-        assert(size >= 0 && size <= 5);
+        assert(size >= 0 && size <= 7);
         CScript decompressed_script;
         const bool ok = DecompressScript(decompressed_script, size, compressed);
         assert(ok);
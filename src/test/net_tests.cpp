@@ -319,4 +319,43 @@ BOOST_AUTO_TEST_CASE(PoissonNextSend)
     g_mock_deterministic_tests = false;
 }
 
+BOOST_AUTO_TEST_CASE(recv_buffer_pool)
+{
+    CRecvBufferPool pool(2, 3000);
+
+    // Nothing pooled yet
+    CSerializeData buf = pool.Get(100);
+    BOOST_CHECK_EQUAL(buf.capacity(), 0U);
+    BOOST_CHECK_EQUAL(pool.GetStats().nMisses, 1U);
+
+    CSerializeData small, large;
+    small.resize(500);
+    large.resize(2000);
+    const size_t nSmall = small.capacity();
+    const size_t nLarge = large.capacity();
+    pool.Put(std::move(large));
+    pool.Put(std::move(small));
+    BOOST_CHECK_EQUAL(pool.GetStats().nBuffers, 2U);
+    BOOST_CHECK_EQUAL(pool.GetStats().nBytes, nSmall + nLarge);
+
+    // The pool is full
+    CSerializeData extra;
+    extra.resize(10);
+    pool.Put(std::move(extra));
+    BOOST_CHECK_EQUAL(pool.GetStats().nDropped, 1U);
+
+    // Smallest buffer that fits, emptied
+    buf = pool.Get(400);
+    BOOST_CHECK_EQUAL(buf.capacity(), nSmall);
+    BOOST_CHECK(buf.empty());
+    BOOST_CHECK_EQUAL(pool.GetStats().nHits, 1U);
+
+    // Largest buffer if none fits
+    buf = pool.Get(5000);
+    BOOST_CHECK_EQUAL(buf.capacity(), nLarge);
+    BOOST_CHECK_EQUAL(pool.GetStats().nMisses, 2U);
+    BOOST_CHECK_EQUAL(pool.GetStats().nBuffers, 0U);
+    BOOST_CHECK_EQUAL(pool.GetStats().nBytes, 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,114 @@
+// Copyright (c) 2020 The Merge Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <memusage.h>
+#include <support/allocators/pool.h>
+
+#include <test/util/setup_common.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+BOOST_FIXTURE_TEST_SUITE(pool_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(pool_resource_reuse)
+{
+    PoolResource<64, 8> resource(1024);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+    BOOST_CHECK_EQUAL(resource.ChunkSizeBytes(), 1024U);
+
+    // Blocks are carved from the chunk back to back
+    void* a = resource.Allocate(8, 8);
+    void* b = resource.Allocate(8, 8);
+    BOOST_CHECK_EQUAL(static_cast<char*>(b) - static_cast<char*>(a), 8);
+
+    // A freed block is handed out again for the same size, but not another one
+    resource.Deallocate(a, 8, 8);
+    void* c = resource.Allocate(16, 8);
+    BOOST_CHECK(c != a);
+    void* d = resource.Allocate(8, 8);
+    BOOST_CHECK(d == a);
+
+    // Sizes are rounded up to the alignment
+    resource.Deallocate(b, 8, 8);
+    void* e = resource.Allocate(5, 8);
+    BOOST_CHECK(e == b);
+
+    resource.Deallocate(c, 16, 8);
+    resource.Deallocate(d, 8, 8);
+    resource.Deallocate(e, 5, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(pool_resource_chunks)
+{
+    PoolResource<64, 8> resource(256);
+    std::vector<void*> blocks;
+    for (int i = 0; i < 32; ++i) {
+        blocks.push_back(resource.Allocate(64, 8));
+    }
+    // Four 64 byte blocks fit in each chunk
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 8U);
+
+    // A new chunk starts when a block does not fit in the current one
+    void* first = resource.Allocate(40, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 9U);
+    for (int i = 0; i < 3; ++i) {
+        blocks.push_back(resource.Allocate(64, 8));
+    }
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 9U);
+    blocks.push_back(resource.Allocate(64, 8));
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 10U);
+
+    // and the 24 bytes left over in the previous chunk serve a later request
+    void* leftover = resource.Allocate(24, 8);
+    BOOST_CHECK(leftover == static_cast<char*>(first) + 40 + 3 * 64);
+    resource.Deallocate(first, 40, 8);
+    resource.Deallocate(leftover, 24, 8);
+
+    // Requests larger than a block, or more aligned, bypass the pool
+    void* large = resource.Allocate(128, 8);
+    void* aligned = resource.Allocate(8, 16);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 10U);
+    resource.Deallocate(large, 128, 8);
+    resource.Deallocate(aligned, 8, 16);
+
+    for (void* block : blocks) {
+        resource.Deallocate(block, 64, 8);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(pool_allocator_unordered_map)
+{
+    typedef PoolAllocator<std::pair<const uint64_t, uint64_t>, sizeof(std::pair<const uint64_t, uint64_t>) + sizeof(void*) * 4, alignof(void*)> Allocator;
+    typedef std::unordered_map<uint64_t, uint64_t, std::hash<uint64_t>, std::equal_to<uint64_t>, Allocator> Map;
+
+    Allocator::ResourceType resource;
+    Map map(0, std::hash<uint64_t>(), std::equal_to<uint64_t>(), &resource);
+    for (uint64_t i = 0; i < 100000; ++i) {
+        map[i] = i * 2;
+    }
+    for (uint64_t i = 0; i < 100000; i += 2) {
+        map.erase(i);
+    }
+    BOOST_CHECK_EQUAL(map.size(), 50000U);
+    for (uint64_t i = 1; i < 100000; i += 2) {
+        BOOST_CHECK_EQUAL(map.at(i), i * 2);
+    }
+
+    // Erased nodes stay in the pool, so refilling the map takes no new chunks
+    const size_t chunks = resource.NumAllocatedChunks();
+    const size_t usage = memusage::DynamicUsage(map);
+    for (uint64_t i = 0; i < 100000; i += 2) {
+        map[i] = i;
+    }
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), chunks);
+    BOOST_CHECK(memusage::DynamicUsage(map) >= usage);
+    BOOST_CHECK(memusage::DynamicUsage(map) >= chunks * resource.ChunkSizeBytes());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
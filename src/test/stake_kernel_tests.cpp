@@ -0,0 +1,107 @@
+// Copyright (c) 2020 The Merge Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chain.h>
+#include <coins.h>
+#include <index/txindex.h>
+#include <pos/cache.h>
+#include <pos/kernel.h>
+#include <primitives/block.h>
+#include <streams.h>
+#include <test/util/setup_common.h>
+#include <txdb.h>
+#include <validation.h>
+
+#include <memory>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+//! Against this target a coin of 200 satoshis misses about one proof hash in 2^23.
+static const unsigned int EASY_STAKE_BITS = 0x207fffff;
+static const CAmount STAKE_VALUE = 200;
+
+BOOST_FIXTURE_TEST_SUITE(stake_kernel_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(check_proof_of_stake_snapshot_coin)
+{
+    LOCK(cs_main);
+    CBlockIndex* genesis = ::ChainActive().Tip();
+
+    // A chain of headers in which every block generates a stake modifier
+    const int chain_length = 200;
+    const int from_height = 20;
+    std::vector<std::unique_ptr<CBlockIndex>> index;
+    CBlockIndex* pprev = genesis;
+    for (int i = 1; i <= chain_length; ++i) {
+        CBlock block;
+        block.nVersion = 4;
+        block.hashPrevBlock = pprev->GetBlockHash();
+        block.nTime = genesis->nTime + i * MODIFIER_INTERVAL;
+        block.nBits = EASY_STAKE_BITS;
+        block.nNonce = i;
+        index.emplace_back(new CBlockIndex(block));
+        CBlockIndex* pindex = index.back().get();
+        pindex->phashBlock = &::BlockIndex().emplace(block.GetHash(), pindex).first->first;
+        pindex->pprev = pprev;
+        pindex->nHeight = i;
+        pindex->BuildSkip();
+        pindex->SetStakeModifier(i, true);
+        pprev = pindex;
+    }
+    ::ChainActive().SetTip(pprev);
+    CBlockIndex* pindex_from = ::ChainActive()[from_height];
+    InitSmartstakeCache();
+
+    // A coinstake spending a coin created at from_height
+    CMutableTransaction tx_prev;
+    tx_prev.vin.emplace_back(COutPoint(uint256S("0x01"), 0));
+    tx_prev.vout.emplace_back(STAKE_VALUE, CScript() << OP_TRUE);
+    const CTransactionRef tx_prev_ref = MakeTransactionRef(std::move(tx_prev));
+    const COutPoint prevout(tx_prev_ref->GetHash(), 0);
+    CMutableTransaction coinstake;
+    coinstake.vin.emplace_back(prevout);
+    coinstake.vout.resize(2);
+    coinstake.vout[0].SetEmpty();
+    coinstake.vout[1] = CTxOut(STAKE_VALUE, CScript() << OP_TRUE);
+    CBlock block;
+    block.nVersion = 4;
+    block.hashPrevBlock = pprev->GetBlockHash();
+    block.nTime = pprev->nTime + MODIFIER_INTERVAL;
+    block.nBits = EASY_STAKE_BITS;
+    block.vtx.push_back(MakeTransactionRef(CMutableTransaction()));
+    block.vtx.push_back(MakeTransactionRef(std::move(coinstake)));
+
+    CCoinsViewCache view(&::ChainstateActive().CoinsTip());
+    view.AddCoin(prevout, Coin(tx_prev_ref->vout[0], from_height, false, false), false);
+
+    // Without the tx index, only a coin from a block below a snapshot's base
+    // is checked against the coin and the header of its block
+    uint256 hash_snapshot;
+    BOOST_CHECK(!CheckProofOfStake(block, hash_snapshot, view));
+    pindex_from->nStatus |= BLOCK_ASSUMED_VALID;
+    BOOST_CHECK(CheckProofOfStake(block, hash_snapshot, view));
+
+    // The tx index path reads the transaction and its block header from disk,
+    // and finds the same proof hash
+    const FlatFilePos pos(0, 0);
+    {
+        CAutoFile file(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
+        file << pindex_from->GetBlockHeader() << tx_prev_ref;
+    }
+    BOOST_CHECK(pblocktree->WriteTxIndex({{tx_prev_ref->GetHash(), CDiskTxPos(pos, 0)}}));
+    pindex_from->nStatus &= ~BLOCK_ASSUMED_VALID;
+    uint256 hash_txindex;
+    BOOST_CHECK(CheckProofOfStake(block, hash_txindex, view));
+    BOOST_CHECK(!hash_txindex.IsNull());
+    BOOST_CHECK(hash_txindex == hash_snapshot);
+
+    InitSmartstakeCache();
+    ::ChainActive().SetTip(genesis);
+    for (const auto& pindex : index) {
+        ::BlockIndex().erase(pindex->GetBlockHash());
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
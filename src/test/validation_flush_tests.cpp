@@ -52,7 +52,16 @@ BOOST_AUTO_TEST_CASE(getcoinscachesizestate)
         BOOST_TEST_MESSAGE("CCoinsViewCache memory usage: " << view.DynamicMemoryUsage());
     };
 
-    constexpr size_t MAX_COINS_CACHE_BYTES = 1024;
+    // The entries of cacheCoins are carved from the chunks of a pool, which
+    // holds one chunk even while the cache is empty. The chunk and its list
+    // node are accounted for as in memusage::DynamicUsage().
+    const size_t POOL_USAGE =
+        memusage::MallocUsage(CCoinsMapMemoryResource::DEFAULT_CHUNK_SIZE_BYTES) + memusage::MallocUsage(sizeof(void*) * 3);
+
+    // The limits leave room for a few hundred coins past the pool, with a
+    // LARGE band wider than the bucket array grows in one rehash.
+    const size_t MAX_COINS_CACHE_BYTES = POOL_USAGE + (64 << 10);
+    constexpr size_t MAX_MEMPOOL_BYTES = 128 << 10;
 
     // Without any coins in the cache, we shouldn't need to flush.
     BOOST_CHECK_EQUAL(
@@ -62,7 +71,7 @@ BOOST_AUTO_TEST_CASE(getcoinscachesizestate)
     // If the initial memory allocations of cacheCoins don't match these common
     // cases, we can't really continue to make assertions about memory usage.
     // End the test early.
-    if (view.DynamicMemoryUsage() != 32 && view.DynamicMemoryUsage() != 16) {
+    if (view.DynamicMemoryUsage() != POOL_USAGE + 32 && view.DynamicMemoryUsage() != POOL_USAGE + 16) {
         // Add a bunch of coins to see that we at least flip over to CRITICAL.
 
         for (int i{0}; i < 1000; ++i) {
@@ -79,64 +88,44 @@ BOOST_AUTO_TEST_CASE(getcoinscachesizestate)
     }
 
     print_view_mem_usage(view);
-    BOOST_CHECK_EQUAL(view.DynamicMemoryUsage(), is_64_bit ? 32 : 16);
+    BOOST_CHECK_EQUAL(view.DynamicMemoryUsage(), POOL_USAGE + (is_64_bit ? 32 : 16));
 
-    // We should be able to add COINS_UNTIL_CRITICAL coins to the cache before going CRITICAL.
-    // This is contingent not only on the dynamic memory usage of the Coins
-    // that we're adding (COIN_SIZE bytes per), but also on how much memory the
-    // cacheCoins (unordered_map) preallocates.
-    constexpr int COINS_UNTIL_CRITICAL{3};
+    // Fill the cache up to CRITICAL, first without and then with mempool
+    // headroom, which lets the cache go back to OK. The cache must be LARGE
+    // once it uses more than 90% of the total space, and CRITICAL past it.
+    for (size_t max_mempool_size_bytes : {size_t{0}, MAX_MEMPOOL_BYTES}) {
+        const size_t total_space = MAX_COINS_CACHE_BYTES + max_mempool_size_bytes;
+        const size_t large_threshold = total_space * 9 / 10;
 
-    for (int i{0}; i < COINS_UNTIL_CRITICAL; ++i) {
-        COutPoint res = add_coin(view);
-        print_view_mem_usage(view);
-        BOOST_CHECK_EQUAL(view.AccessCoin(res).DynamicMemoryUsage(), COIN_SIZE);
         BOOST_CHECK_EQUAL(
-            chainstate.GetCoinsCacheSizeState(tx_pool, MAX_COINS_CACHE_BYTES, /*max_mempool_size_bytes*/ 0),
+            chainstate.GetCoinsCacheSizeState(tx_pool, MAX_COINS_CACHE_BYTES, max_mempool_size_bytes),
             CoinsCacheSizeState::OK);
-    }
 
-    // Adding some additional coins will push us over the edge to CRITICAL.
-    for (int i{0}; i < 4; ++i) {
-        add_coin(view);
-        print_view_mem_usage(view);
-        if (chainstate.GetCoinsCacheSizeState(tx_pool, MAX_COINS_CACHE_BYTES, /*max_mempool_size_bytes*/ 0) ==
-            CoinsCacheSizeState::CRITICAL) {
-            break;
+        int coins_ok{0};
+        int coins_large{0};
+        while (view.DynamicMemoryUsage() <= total_space) {
+            if (view.DynamicMemoryUsage() <= large_threshold) {
+                BOOST_CHECK_EQUAL(
+                    chainstate.GetCoinsCacheSizeState(tx_pool, MAX_COINS_CACHE_BYTES, max_mempool_size_bytes),
+                    CoinsCacheSizeState::OK);
+                ++coins_ok;
+            } else {
+                BOOST_CHECK_EQUAL(
+                    chainstate.GetCoinsCacheSizeState(tx_pool, MAX_COINS_CACHE_BYTES, max_mempool_size_bytes),
+                    CoinsCacheSizeState::LARGE);
+                ++coins_large;
+            }
+            COutPoint res = add_coin(view);
+            BOOST_CHECK_EQUAL(view.AccessCoin(res).DynamicMemoryUsage(), COIN_SIZE);
         }
-    }
-
-    BOOST_CHECK_EQUAL(
-        chainstate.GetCoinsCacheSizeState(tx_pool, MAX_COINS_CACHE_BYTES, /*max_mempool_size_bytes*/ 0),
-        CoinsCacheSizeState::CRITICAL);
-
-    // Passing non-zero max mempool usage should allow us more headroom.
-    BOOST_CHECK_EQUAL(
-        chainstate.GetCoinsCacheSizeState(tx_pool, MAX_COINS_CACHE_BYTES, /*max_mempool_size_bytes*/ 1 << 10),
-        CoinsCacheSizeState::OK);
-
-    for (int i{0}; i < 3; ++i) {
-        add_coin(view);
         print_view_mem_usage(view);
-        BOOST_CHECK_EQUAL(
-            chainstate.GetCoinsCacheSizeState(tx_pool, MAX_COINS_CACHE_BYTES, /*max_mempool_size_bytes*/ 1 << 10),
-            CoinsCacheSizeState::OK);
-    }
+        BOOST_TEST_MESSAGE("Coins added while OK: " << coins_ok << ", while LARGE: " << coins_large);
+        BOOST_CHECK(coins_ok > 0);
+        BOOST_CHECK(coins_large > 0);
 
-    // Adding another coin with the additional mempool room will put us >90%
-    // but not yet critical.
-    add_coin(view);
-    print_view_mem_usage(view);
-
-    // Only perform these checks on 64 bit hosts; I haven't done the math for 32.
-    if (is_64_bit) {
-        float usage_percentage = (float)view.DynamicMemoryUsage() / (MAX_COINS_CACHE_BYTES + (1 << 10));
-        BOOST_TEST_MESSAGE("CoinsTip usage percentage: " << usage_percentage);
-        BOOST_CHECK(usage_percentage >= 0.9);
-        BOOST_CHECK(usage_percentage < 1);
         BOOST_CHECK_EQUAL(
-            chainstate.GetCoinsCacheSizeState(tx_pool, MAX_COINS_CACHE_BYTES, 1 << 10),
-            CoinsCacheSizeState::LARGE);
+            chainstate.GetCoinsCacheSizeState(tx_pool, MAX_COINS_CACHE_BYTES, max_mempool_size_bytes),
+            CoinsCacheSizeState::CRITICAL);
     }
 
     // Using the default max_* values permits way more coins to be added.
@@ -147,20 +136,20 @@ BOOST_AUTO_TEST_CASE(getcoinscachesizestate)
             CoinsCacheSizeState::OK);
     }
 
-    // Flushing the view doesn't take us back to OK because cacheCoins has
-    // preallocated memory that doesn't get reclaimed even after flush.
-
     BOOST_CHECK_EQUAL(
         chainstate.GetCoinsCacheSizeState(tx_pool, MAX_COINS_CACHE_BYTES, 0),
         CoinsCacheSizeState::CRITICAL);
 
+    // Flushing the view gives the pool and the bucket array back, so the
+    // cache is as small as an empty one again.
     view.SetBestBlock(InsecureRand256());
     BOOST_CHECK(view.Flush());
     print_view_mem_usage(view);
 
+    BOOST_CHECK_EQUAL(view.DynamicMemoryUsage(), POOL_USAGE + (is_64_bit ? 32 : 16));
     BOOST_CHECK_EQUAL(
         chainstate.GetCoinsCacheSizeState(tx_pool, MAX_COINS_CACHE_BYTES, 0),
-        CoinsCacheSizeState::CRITICAL);
+        CoinsCacheSizeState::OK);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
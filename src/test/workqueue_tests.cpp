@@ -0,0 +1,67 @@
+// Copyright (c) 2020 The Merge Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <util/workqueue.h>
+
+#include <test/util/setup_common.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include <atomic>
+#include <chrono>
+
+BOOST_FIXTURE_TEST_SUITE(workqueue_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(workqueue_order)
+{
+    std::atomic<int> processed{0};
+    OrderedWorkQueue<std::pair<int, int>> queue("test", 4, [&processed](std::pair<int, int>& item) {
+        // Later items finish first, but are still handed back in order
+        std::this_thread::sleep_for(std::chrono::microseconds((100 - item.first % 100) * 10));
+        item.second = item.first * 2;
+        ++processed;
+    });
+
+    std::pair<int, int> item;
+    BOOST_CHECK(!queue.Pop(item));
+
+    for (int i = 0; i < 1000; ++i) {
+        queue.Push(std::make_pair(i, 0));
+        // Keep a bounded number of items queued, as the users of the queue do
+        if (queue.Size() > 16) {
+            BOOST_CHECK(queue.Pop(item));
+            BOOST_CHECK_EQUAL(item.second, item.first * 2);
+        }
+    }
+    int expected = 1000 - queue.Size();
+    while (queue.Pop(item)) {
+        BOOST_CHECK_EQUAL(item.first, expected);
+        BOOST_CHECK_EQUAL(item.second, expected * 2);
+        ++expected;
+    }
+    BOOST_CHECK_EQUAL(expected, 1000);
+    BOOST_CHECK_EQUAL(processed.load(), 1000);
+}
+
+BOOST_AUTO_TEST_CASE(workqueue_destroy)
+{
+    // Items not handed back are dropped when the queue is destroyed
+    std::atomic<int> processed{0};
+    {
+        OrderedWorkQueue<int> queue("test", 2, [&processed](int& item) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            ++processed;
+        });
+        for (int i = 0; i < 100; ++i) {
+            queue.Push(i);
+        }
+        int item;
+        BOOST_CHECK(queue.Pop(item));
+        BOOST_CHECK_EQUAL(item, 0);
+    }
+    BOOST_CHECK(processed.load() >= 1);
+    BOOST_CHECK(processed.load() <= 100);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
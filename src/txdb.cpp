@@ -10,7 +10,9 @@
 #include <shutdown.h>
 #include <ui_interface.h>
 #include <uint256.h>
+#include <util/memory.h>
 #include <util/system.h>
+#include <util/time.h>
 #include <util/translation.h>
 #include <util/vector.h>
 
@@ -18,7 +20,8 @@
 
 #include <boost/thread.hpp>
 
-static const char DB_COIN = 'C';
+static const char DB_COIN = 'U';
+static const char DB_COIN_BASE = 'C';
 static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_BLOCK_INDEX = 'b';
@@ -28,13 +31,14 @@ static const char DB_HEAD_BLOCKS = 'H';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_COINS_VERSION = 'V';
 
 namespace {
 
 struct CoinEntry {
     COutPoint* outpoint;
     char key;
-    explicit CoinEntry(const COutPoint* ptr) : outpoint(const_cast<COutPoint*>(ptr)), key(DB_COIN)  {}
+    explicit CoinEntry(const COutPoint* ptr, char key_in = DB_COIN) : outpoint(const_cast<COutPoint*>(ptr)), key(key_in)  {}
 
     template<typename Stream>
     void Serialize(Stream &s) const {
@@ -53,12 +57,25 @@ struct CoinEntry {
 
 }
 
-CCoinsViewDB::CCoinsViewDB(fs::path ldb_path, size_t nCacheSize, bool fMemory, bool fWipe) : db(ldb_path, nCacheSize, fMemory, fWipe, true)
+CCoinsViewDB::CCoinsViewDB(fs::path ldb_path, size_t nCacheSize, bool fMemory, bool fWipe) : db(ldb_path, nCacheSize, fMemory, fWipe, true, DB_PROFILE_CHAINSTATE)
 {
+    // A database without a best block holds no coins yet, so it starts at the
+    // current format. Older databases with coins are marked by Upgrade().
+    if (!db.Exists(DB_COINS_VERSION) && !db.Exists(DB_BEST_BLOCK)) {
+        db.Write(DB_COINS_VERSION, CHAINSTATE_VERSION);
+    }
+}
+
+int CCoinsViewDB::GetVersion() const {
+    // Databases written before the version key was introduced hold no record.
+    int version = 0;
+    db.Read(DB_COINS_VERSION, version);
+    return version;
 }
 
 bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
-    return db.Read(CoinEntry(&outpoint), coin);
+    auto value = Using<CoinDBFormatter>(coin);
+    return db.Read(CoinEntry(&outpoint), value);
 }
 
 bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
@@ -81,6 +98,15 @@ std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
 }
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    return WriteBatchCoins(mapCoins, hashBlock, true);
+}
+
+bool CCoinsViewDB::WriteCoins(const CCoinsMap& mapCoins, const uint256& hashBlock) {
+    // Nothing is erased from the map without fErase
+    return WriteBatchCoins(const_cast<CCoinsMap&>(mapCoins), hashBlock, false);
+}
+
+bool CCoinsViewDB::WriteBatchCoins(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
@@ -111,12 +137,16 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
             if (it->second.coin.IsSpent())
                 batch.Erase(entry);
             else
-                batch.Write(entry, it->second.coin);
+                batch.Write(entry, Using<CoinDBFormatter>(it->second.coin));
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        if (fErase) {
+            CCoinsMap::iterator itOld = it++;
+            mapCoins.erase(itOld);
+        } else {
+            ++it;
+        }
         if (batch.SizeEstimate() > batch_size) {
             LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
             db.WriteBatch(batch);
@@ -146,7 +176,130 @@ size_t CCoinsViewDB::EstimateSize() const
     return db.EstimateSize(DB_COIN, (char)(DB_COIN+1));
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+CCoinsViewBackgroundFlush::CCoinsViewBackgroundFlush(CCoinsView* viewIn, CCoinsViewDB& db)
+    : CCoinsViewBacked(viewIn), m_db(db), m_background(false), m_writing(false), m_failed(false) {}
+
+CCoinsViewBackgroundFlush::~CCoinsViewBackgroundFlush()
+{
+    Wait();
+}
+
+bool CCoinsViewBackgroundFlush::GetCoin(const COutPoint& outpoint, Coin& coin) const
+{
+    {
+        LOCK(m_mutex);
+        if (m_snapshot) {
+            CCoinsMap::const_iterator it = m_snapshot->find(outpoint);
+            if (it != m_snapshot->end()) {
+                coin = it->second.coin;
+                return !coin.IsSpent();
+            }
+        }
+    }
+    return base->GetCoin(outpoint, coin);
+}
+
+bool CCoinsViewBackgroundFlush::HaveCoin(const COutPoint& outpoint) const
+{
+    {
+        LOCK(m_mutex);
+        if (m_snapshot) {
+            CCoinsMap::const_iterator it = m_snapshot->find(outpoint);
+            if (it != m_snapshot->end()) {
+                return !it->second.coin.IsSpent();
+            }
+        }
+    }
+    return base->HaveCoin(outpoint);
+}
+
+uint256 CCoinsViewBackgroundFlush::GetBestBlock() const
+{
+    {
+        LOCK(m_mutex);
+        // The database is between blocks while the snapshot is written
+        if (m_snapshot) return m_snapshot_block;
+    }
+    return base->GetBestBlock();
+}
+
+bool CCoinsViewBackgroundFlush::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+{
+    if (!Wait()) return false;
+    if (!m_background) {
+        return base->BatchWrite(mapCoins, hashBlock);
+    }
+
+    std::unique_ptr<CCoinsMapMemoryResource> resource = MakeUnique<CCoinsMapMemoryResource>();
+    std::unique_ptr<CCoinsMap> snapshot = MakeUnique<CCoinsMap>(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), resource.get());
+    snapshot->reserve(mapCoins.size());
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it = mapCoins.erase(it)) {
+        // Entries that are not dirty are already in the database
+        if (!(it->second.flags & CCoinsCacheEntry::DIRTY)) continue;
+        CCoinsCacheEntry& entry = (*snapshot)[it->first];
+        entry.coin = std::move(it->second.coin);
+        entry.flags = CCoinsCacheEntry::DIRTY;
+    }
+
+    LOCK(m_mutex);
+    m_snapshot_resource = std::move(resource);
+    m_snapshot = std::move(snapshot);
+    m_snapshot_block = hashBlock;
+    m_writing = true;
+    m_thread = std::thread(&TraceThread<std::function<void()> >, "coinsflush", std::function<void()>(std::bind(&CCoinsViewBackgroundFlush::ThreadWrite, this)));
+    return true;
+}
+
+void CCoinsViewBackgroundFlush::ThreadWrite()
+{
+    const CCoinsMap* snapshot;
+    uint256 hashBlock;
+    {
+        LOCK(m_mutex);
+        snapshot = m_snapshot.get();
+        hashBlock = m_snapshot_block;
+    }
+
+    // The snapshot is not modified until the write is over, so it can be
+    // read without the lock, both here and by GetCoin.
+    const int64_t nTimeStart = GetTimeMicros();
+    bool fOk = false;
+    try {
+        fOk = m_db.WriteCoins(*snapshot, hashBlock);
+    } catch (const std::exception& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+    LogPrint(BCLog::BENCH, "Background write of %u coins to the coin database: %.2fms\n", snapshot->size(), (GetTimeMicros() - nTimeStart) * 0.001);
+
+    LOCK(m_mutex);
+    m_writing = false;
+    if (fOk) {
+        m_snapshot.reset();
+        m_snapshot_resource.reset();
+    } else {
+        m_failed = true;
+    }
+}
+
+bool CCoinsViewBackgroundFlush::Wait()
+{
+    if (m_thread.joinable()) m_thread.join();
+    return !HasFailed();
+}
+
+bool CCoinsViewBackgroundFlush::IsWriting() const
+{
+    LOCK(m_mutex);
+    return m_writing;
+}
+
+bool CCoinsViewBackgroundFlush::HasFailed() const
+{
+    LOCK(m_mutex);
+    return m_failed;
+}
+
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe, false, DB_PROFILE_BLOCK_INDEX) {
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -198,7 +351,8 @@ bool CCoinsViewDBCursor::GetKey(COutPoint &key) const
 
 bool CCoinsViewDBCursor::GetValue(Coin &coin) const
 {
-    return pcursor->GetValue(coin);
+    auto value = Using<CoinDBFormatter>(coin);
+    return pcursor->GetValue(value);
 }
 
 unsigned int CCoinsViewDBCursor::GetValueSize() const
@@ -367,9 +521,24 @@ public:
 
 /** Upgrade the database from older formats.
  *
- * Currently implemented: from the per-tx utxo model (0.8..0.14.x) to per-txout.
+ * Currently implemented: from the per-tx utxo model (0.8..0.14.x) to per-txout,
+ * and from per-txout coins in Coin's own serialization to CoinDBFormatter.
  */
 bool CCoinsViewDB::Upgrade() {
+    const int version = GetVersion();
+    if (version > CHAINSTATE_VERSION) {
+        return error("%s: chainstate database format too new (version %d, this version supports %d)", __func__, version, CHAINSTATE_VERSION);
+    }
+    if (version == CHAINSTATE_VERSION) {
+        return true;
+    }
+    if (!UpgradePerTxOut() || !UpgradeCoinEncoding()) {
+        return false;
+    }
+    return db.Write(DB_COINS_VERSION, CHAINSTATE_VERSION, true);
+}
+
+bool CCoinsViewDB::UpgradePerTxOut() {
     std::unique_ptr<CDBIterator> pcursor(db.NewIterator());
     pcursor->Seek(std::make_pair(DB_COINS, uint256()));
     if (!pcursor->Valid()) {
@@ -411,7 +580,7 @@ bool CCoinsViewDB::Upgrade() {
                     Coin newcoin(std::move(old_coins.vout[i]), old_coins.nHeight, old_coins.fCoinBase, old_coins.fCoinStake);
                     outpoint.n = i;
                     CoinEntry entry(&outpoint);
-                    batch.Write(entry, newcoin);
+                    batch.Write(entry, Using<CoinDBFormatter>(newcoin));
                 }
             }
             batch.Erase(key);
@@ -432,3 +601,65 @@ bool CCoinsViewDB::Upgrade() {
     LogPrintf("[%s].\n", ShutdownRequested() ? "CANCELLED" : "DONE");
     return !ShutdownRequested();
 }
+
+bool CCoinsViewDB::UpgradeCoinEncoding() {
+    std::unique_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(DB_COIN_BASE);
+    COutPoint outpoint;
+    CoinEntry entry(&outpoint, DB_COIN_BASE);
+    if (!pcursor->Valid() || !pcursor->GetKey(entry) || entry.key != DB_COIN_BASE) {
+        return true;
+    }
+
+    const size_t old_size = db.EstimateSize(DB_COIN_BASE, (char)(DB_COIN_BASE+1));
+    int64_t count = 0;
+    LogPrintf("Upgrading utxo-set database to the compact coin encoding...\n");
+    LogPrintf("[0%%]..."); /* Continued */
+    uiInterface.ShowProgress(_("Upgrading UTXO database").translated, 0, true);
+    size_t batch_size = 1 << 24;
+    CDBBatch batch(db);
+    int reportDone = 0;
+    std::pair<char, uint256> prev_key = {DB_COIN_BASE, uint256()};
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested()) {
+            break;
+        }
+        if (pcursor->GetKey(entry) && entry.key == DB_COIN_BASE) {
+            if (count++ % 256 == 0) {
+                uint32_t high = 0x100 * *outpoint.hash.begin() + *(outpoint.hash.begin() + 1);
+                int percentageDone = (int)(high * 100.0 / 65536.0 + 0.5);
+                uiInterface.ShowProgress(_("Upgrading UTXO database").translated, percentageDone, true);
+                if (reportDone < percentageDone/10) {
+                    // report max. every 10% step
+                    LogPrintf("[%d%%]...", percentageDone); /* Continued */
+                    reportDone = percentageDone/10;
+                }
+            }
+            Coin coin;
+            if (!pcursor->GetValue(coin)) {
+                return error("%s: cannot parse coin record", __func__);
+            }
+            batch.Write(CoinEntry(&outpoint), Using<CoinDBFormatter>(coin));
+            batch.Erase(entry);
+            if (batch.SizeEstimate() > batch_size) {
+                db.WriteBatch(batch);
+                batch.Clear();
+                std::pair<char, uint256> key = {DB_COIN_BASE, outpoint.hash};
+                db.CompactRange(prev_key, key);
+                prev_key = key;
+            }
+            pcursor->Next();
+        } else {
+            break;
+        }
+    }
+    db.WriteBatch(batch);
+    db.CompactRange(prev_key, std::make_pair((char)(DB_COIN_BASE+1), uint256()));
+    uiInterface.ShowProgress("", 100, false);
+    LogPrintf("[%s].\n", ShutdownRequested() ? "CANCELLED" : "DONE");
+    if (ShutdownRequested()) return false;
+    LogPrintf("Upgraded %d coins, estimated size on disk %d MiB, before the upgrade %d MiB\n",
+        count, EstimateSize() >> 20, old_size >> 20);
+    return true;
+}
@@ -11,9 +11,11 @@
 #include <dbwrapper.h>
 #include <chain.h>
 #include <primitives/block.h>
+#include <sync.h>
 
 #include <memory>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -40,6 +42,11 @@ static const int64_t nMaxTxIndexCache = 1024;
 static const int64_t max_filter_index_cache = 1024;
 //! Max memory allocated to coin DB specific cache (MiB)
 static const int64_t nMaxCoinsDBCache = 8;
+/**
+ * Format of the coins in the chainstate database. 0 is Coin's own serialization
+ * (databases from before the version record), 1 is CoinDBFormatter.
+ */
+static const int CHAINSTATE_VERSION = 1;
 
 /** CCoinsView backed by the coin database (chainstate/) */
 class CCoinsViewDB final : public CCoinsView
@@ -59,9 +66,23 @@ public:
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
     CCoinsViewCursor *Cursor() const override;
 
+    //! Write the dirty entries of mapCoins like BatchWrite, but leave the map unchanged, so it can be read concurrently.
+    bool WriteCoins(const CCoinsMap& mapCoins, const uint256& hashBlock);
+
+    //! Format version recorded in the database, 0 if there is none.
+    int GetVersion() const;
+
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
     size_t EstimateSize() const override;
+
+private:
+    //! Write the dirty entries of mapCoins, erasing each entry from it once written if fErase is set
+    bool WriteBatchCoins(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase);
+
+    //! Steps of Upgrade(), each a no-op once done
+    bool UpgradePerTxOut();
+    bool UpgradeCoinEncoding();
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -86,6 +107,60 @@ private:
     friend class CCoinsViewDB;
 };
 
+/**
+ * CCoinsView between the coins cache and the coin database that can write a
+ * flush to the database on a background thread.
+ *
+ * In the background mode, BatchWrite takes the dirty entries out of the
+ * flushed map into a snapshot and returns once a thread writing the snapshot
+ * to the database has been started, so the cache above can go on with an
+ * empty map. Until the write completes, reads are answered from the snapshot
+ * first, so the view is the same as if the write had already happened. The
+ * database write marks itself as in progress with the head blocks, as every
+ * flush does, so a crash while writing is recovered by ReplayBlocks.
+ *
+ * Only one write is in progress at a time: the next BatchWrite waits for it.
+ */
+class CCoinsViewBackgroundFlush : public CCoinsViewBacked
+{
+public:
+    CCoinsViewBackgroundFlush(CCoinsView* viewIn, CCoinsViewDB& db);
+    ~CCoinsViewBackgroundFlush();
+
+    CCoinsViewBackgroundFlush(const CCoinsViewBackgroundFlush&) = delete;
+    CCoinsViewBackgroundFlush& operator=(const CCoinsViewBackgroundFlush&) = delete;
+
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const override;
+    bool HaveCoin(const COutPoint& outpoint) const override;
+    uint256 GetBestBlock() const override;
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) override;
+
+    //! Whether the next BatchWrite writes in the background rather than before returning
+    void SetBackground(bool fBackground) { m_background = fBackground; }
+    //! Wait for a background write to complete. Returns false if it failed.
+    bool Wait();
+    //! Whether a background write is in progress
+    bool IsWriting() const;
+    //! Whether a background write has failed. The snapshot it was writing stays readable.
+    bool HasFailed() const;
+
+private:
+    void ThreadWrite();
+
+    CCoinsViewDB& m_db;
+    bool m_background;
+
+    mutable Mutex m_mutex;
+    //! The entries being written, with the memory they are allocated from
+    std::unique_ptr<CCoinsMapMemoryResource> m_snapshot_resource GUARDED_BY(m_mutex);
+    std::unique_ptr<CCoinsMap> m_snapshot GUARDED_BY(m_mutex);
+    uint256 m_snapshot_block GUARDED_BY(m_mutex);
+    bool m_writing GUARDED_BY(m_mutex);
+    bool m_failed GUARDED_BY(m_mutex);
+
+    std::thread m_thread;
+};
+
 /** Access to the block database (blocks/index/) */
 class CBlockTreeDB : public CDBWrapper
 {
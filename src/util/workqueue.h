@@ -0,0 +1,130 @@
+// Copyright (c) 2020 The Merge Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_UTIL_WORKQUEUE_H
+#define BITCOIN_UTIL_WORKQUEUE_H
+
+#include <sync.h>
+#include <util/system.h>
+
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Runs a function on each queued item on a pool of worker threads, and hands
+ * the items back in the order they were queued.
+ *
+ * This is for work where processing items is independent and can run in
+ * parallel, but their results must be consumed in sequence, such as reading
+ * and preparing blocks that are then written to an index one after another.
+ * The caller bounds the memory used by keeping the queue short: Push() never
+ * waits.
+ */
+template <typename T>
+class OrderedWorkQueue
+{
+public:
+    typedef std::function<void(T& item)> Work;
+
+    OrderedWorkQueue(const std::string& name, int threads, Work work)
+        : m_name(name), m_work(std::move(work))
+    {
+        assert(threads > 0);
+        for (int i = 0; i < threads; ++i) {
+            m_threads.emplace_back(&TraceThread<std::function<void()> >, m_name.c_str(), std::function<void()>(std::bind(&OrderedWorkQueue::ThreadWork, this)));
+        }
+    }
+
+    OrderedWorkQueue(const OrderedWorkQueue&) = delete;
+    OrderedWorkQueue& operator=(const OrderedWorkQueue&) = delete;
+
+    /** Items not yet handed back are dropped. Waits for items being processed. */
+    ~OrderedWorkQueue()
+    {
+        {
+            LOCK(m_mutex);
+            m_interrupt = true;
+            m_cond.notify_all();
+        }
+        for (std::thread& thread : m_threads) {
+            if (thread.joinable()) thread.join();
+        }
+    }
+
+    void Push(T item)
+    {
+        std::shared_ptr<Slot> slot = std::make_shared<Slot>(std::move(item));
+        LOCK(m_mutex);
+        m_items.push_back(slot);
+        m_to_do.push_back(slot);
+        m_cond.notify_all();
+    }
+
+    /** Wait for the oldest item to be processed and take it. Returns false if the queue is empty. */
+    bool Pop(T& item)
+    {
+        WAIT_LOCK(m_mutex, lock);
+        if (m_items.empty()) return false;
+        m_cond.wait(lock, [this]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return m_items.front()->done; });
+        item = std::move(m_items.front()->item);
+        m_items.pop_front();
+        return true;
+    }
+
+    /** Number of items queued and not yet handed back */
+    size_t Size() const
+    {
+        LOCK(m_mutex);
+        return m_items.size();
+    }
+
+private:
+    struct Slot {
+        T item;
+        //! Set once the work function returned, guarded by m_mutex
+        bool done{false};
+        explicit Slot(T&& item_in) : item(std::move(item_in)) {}
+    };
+
+    void ThreadWork()
+    {
+        while (true) {
+            std::shared_ptr<Slot> slot;
+            {
+                WAIT_LOCK(m_mutex, lock);
+                m_cond.wait(lock, [this]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return m_interrupt || !m_to_do.empty(); });
+                if (m_interrupt) return;
+                slot = m_to_do.front();
+                m_to_do.pop_front();
+            }
+
+            m_work(slot->item);
+
+            LOCK(m_mutex);
+            slot->done = true;
+            m_cond.notify_all();
+        }
+    }
+
+    const std::string m_name;
+    const Work m_work;
+
+    mutable Mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_interrupt GUARDED_BY(m_mutex){false};
+    //! All items not yet handed back, in queue order
+    std::deque<std::shared_ptr<Slot>> m_items GUARDED_BY(m_mutex);
+    //! Items waiting for a worker thread
+    std::deque<std::shared_ptr<Slot>> m_to_do GUARDED_BY(m_mutex);
+
+    std::vector<std::thread> m_threads;
+};
+
+#endif // BITCOIN_UTIL_WORKQUEUE_H
@@ -23,6 +23,7 @@
 #include <index/txindex.h>
 #include <logging.h>
 #include <logging/timer.h>
+#include <node/utxo_snapshot.h>
 #include <policy/fees.h>
 #include <policy/policy.h>
 #include <policy/settings.h>
@@ -46,6 +47,7 @@
 #include <util/strencodings.h>
 #include <util/system.h>
 #include <util/translation.h>
+#include <util/workqueue.h>
 #include <validationinterface.h>
 #include <wallet/stake.h>
 #include <warnings.h>
@@ -53,9 +55,12 @@
 #include <masternode/masternodeman.h>
 #include <masternode/masternode-payments.h>
 #include <masternode/spork.h>
+#include <pos/cache.h>
 #include <pos/kernel.h>
 
+#include <deque>
 #include <string>
+#include <tuple>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/thread.hpp>
@@ -67,10 +72,13 @@
 #define MICRO 0.000001
 #define MILLI 0.001
 
-std::map<uint256, uint256> mapProofOfStake;
-std::map<unsigned int, unsigned int> mapHashedBlocks;
 std::set<std::pair<uint256, unsigned int> > setStakeSeen;
 
+/** Kernel hashes of proof-of-stake blocks minted by this node, see AddLocalStakeProof(). */
+static const size_t MAX_LOCAL_STAKE_PROOFS = 8;
+static Mutex cs_local_stake_proofs;
+static std::map<uint256, uint256> g_local_stake_proofs GUARDED_BY(cs_local_stake_proofs);
+
 bool CBlockIndexWorkComparator::operator()(const CBlockIndex *pa, const CBlockIndex *pb) const {
     // First sort by most total work, ...
     if (pa->nChainWork > pb->nChainWork) return false;
@@ -123,6 +131,8 @@ Mutex g_best_block_mutex;
 std::condition_variable g_best_block_cv;
 uint256 g_best_block;
 bool g_parallel_script_checks{false};
+int g_script_check_window{DEFAULT_SCRIPT_CHECK_WINDOW};
+int g_reindex_threads{DEFAULT_REINDEX_THREADS};
 std::atomic_bool fImporting(false);
 std::atomic_bool fReindex(false);
 bool fHavePruned = false;
@@ -198,6 +208,9 @@ static FILE* OpenUndoFile(const FlatFilePos &pos, bool fReadOnly = false);
 static FlatFileSeq BlockFileSeq();
 static FlatFileSeq UndoFileSeq();
 
+/** Reads blocks and undo data, keeping the files open between reads */
+static FlatFileReader g_block_file_reader(MAX_BLOCK_READER_FILES);
+
 bool GetUTXOCoin(const COutPoint& outpoint, Coin& coin)
 {
     LOCK(cs_main);
@@ -1179,18 +1192,50 @@ static bool WriteBlockToDisk(const CBlock& block, FlatFilePos& pos, const CMessa
     return true;
 }
 
+/**
+ * Read a block or undo record from a file of seq. Records are stored after
+ * the network magic and their size, and may be followed by trailer_size bytes
+ * that are read with them.
+ */
+template <typename Data>
+static bool ReadRecordFromDisk(Data& data, const FlatFileSeq& seq, const FlatFilePos& pos, size_t trailer_size,
+                               const CMessageHeader::MessageStartChars* message_start)
+{
+    if (pos.IsNull() || pos.nPos < 8) {
+        return error("%s: Invalid position %s", __func__, pos.ToString());
+    }
+    unsigned char header[8];
+    if (!g_block_file_reader.Read(seq, FlatFilePos(pos.nFile, pos.nPos - 8), header, sizeof(header))) {
+        return error("%s: Read of record header failed for %s", __func__, pos.ToString());
+    }
+    if (message_start && memcmp(header, *message_start, CMessageHeader::MESSAGE_START_SIZE)) {
+        return error("%s: Block magic mismatch for %s: %s versus expected %s", __func__, pos.ToString(),
+                HexStr(header, header + CMessageHeader::MESSAGE_START_SIZE),
+                HexStr(*message_start, *message_start + CMessageHeader::MESSAGE_START_SIZE));
+    }
+    const uint32_t size = ReadLE32(header + CMessageHeader::MESSAGE_START_SIZE);
+    if (size > MAX_SIZE) {
+        return error("%s: Data is larger than maximum deserialization size for %s: %s versus %s", __func__, pos.ToString(),
+                size, MAX_SIZE);
+    }
+    data.resize(size + trailer_size);
+    if (!g_block_file_reader.Read(seq, pos, data.data(), data.size())) {
+        return error("%s: Read failed for %s", __func__, pos.ToString());
+    }
+    return true;
+}
+
 bool ReadBlockFromDisk(CBlock& block, const FlatFilePos& pos, const Consensus::Params& consensusParams)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+    CDataStream data(SER_DISK, CLIENT_VERSION);
+    if (!ReadRecordFromDisk(data, BlockFileSeq(), pos, 0, nullptr))
+        return error("ReadBlockFromDisk: Read failed for %s", pos.ToString());
 
     // Read block
     try {
-        filein >> block;
+        data >> block;
     }
     catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
@@ -1221,37 +1266,7 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
 
 bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const FlatFilePos& pos, const CMessageHeader::MessageStartChars& message_start)
 {
-    FlatFilePos hpos = pos;
-    hpos.nPos -= 8; // Seek back 8 bytes for meta header
-    CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull()) {
-        return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
-    }
-
-    try {
-        CMessageHeader::MessageStartChars blk_start;
-        unsigned int blk_size;
-
-        filein >> blk_start >> blk_size;
-
-        if (memcmp(blk_start, message_start, CMessageHeader::MESSAGE_START_SIZE)) {
-            return error("%s: Block magic mismatch for %s: %s versus expected %s", __func__, pos.ToString(),
-                    HexStr(blk_start, blk_start + CMessageHeader::MESSAGE_START_SIZE),
-                    HexStr(message_start, message_start + CMessageHeader::MESSAGE_START_SIZE));
-        }
-
-        if (blk_size > MAX_SIZE) {
-            return error("%s: Block data is larger than maximum deserialization size for %s: %s versus %s", __func__, pos.ToString(),
-                    blk_size, MAX_SIZE);
-        }
-
-        block.resize(blk_size); // Zeroing of memory is intentional here
-        filein.read((char*)block.data(), blk_size);
-    } catch(const std::exception& e) {
-        return error("%s: Read from block file failed: %s for %s", __func__, e.what(), pos.ToString());
-    }
-
-    return true;
+    return ReadRecordFromDisk(block, BlockFileSeq(), pos, 0, &message_start);
 }
 
 bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start)
@@ -1415,11 +1430,12 @@ CoinsViews::CoinsViews(
     bool in_memory,
     bool should_wipe) : m_dbview(
                             GetDataDir() / ldb_name, cache_size_bytes, in_memory, should_wipe),
-                        m_catcherview(&m_dbview) {}
+                        m_catcherview(&m_dbview),
+                        m_flushview(&m_catcherview, m_dbview) {}
 
 void CoinsViews::InitCache()
 {
-    m_cacheview = MakeUnique<CCoinsViewCache>(&m_catcherview);
+    m_cacheview = MakeUnique<CCoinsViewCache>(&m_flushview);
 }
 
 // NOTE: for now m_blockman is set to a global, but this will be changed
@@ -1638,7 +1654,7 @@ int GetSpendHeight(const CCoinsViewCache& inputs)
 }
 
 
-static CuckooCache::cache<uint256, SignatureCacheHasher> scriptExecutionCache;
+static ShardedCuckooCache scriptExecutionCache(SIG_CACHE_SHARDS);
 static uint256 scriptExecutionCacheNonce(GetRandHash());
 
 void InitScriptExecutionCache() {
@@ -1650,6 +1666,11 @@ void InitScriptExecutionCache() {
             (nElems*sizeof(uint256)) >>20, (nMaxCacheSize*2)>>20, nElems);
 }
 
+ShardedCacheStats GetScriptExecutionCacheStats()
+{
+    return scriptExecutionCache.GetStats();
+}
+
 /**
  * Check whether all of this transaction's input scripts succeed.
  *
@@ -1779,30 +1800,49 @@ bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex)
         return error("%s: no undo data available", __func__);
     }
 
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("%s: OpenUndoFile failed", __func__);
-
-    // Read block
+    // The undo data is followed by its checksum
     uint256 hashChecksum;
-    CHashVerifier<CAutoFile> verifier(&filein); // We need a CHashVerifier as reserializing may lose data
+    CDataStream data(SER_DISK, CLIENT_VERSION);
+    if (!ReadRecordFromDisk(data, UndoFileSeq(), pos, hashChecksum.size(), nullptr))
+        return error("%s: Read failed", __func__);
+    const size_t undo_size = data.size() - hashChecksum.size();
+    memcpy(hashChecksum.begin(), data.data() + undo_size, hashChecksum.size());
+
+    // Verify checksum over the bytes read, as reserializing may lose data
+    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+    hasher << pindex->pprev->GetBlockHash();
+    hasher.write(data.data(), undo_size);
+    if (hashChecksum != hasher.GetHash())
+        return error("%s: Checksum mismatch", __func__);
+
+    // Read undo data
     try {
-        verifier << pindex->pprev->GetBlockHash();
-        verifier >> blockundo;
-        filein >> hashChecksum;
+        data >> blockundo;
     }
     catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s", __func__, e.what());
     }
 
-    // Verify checksum
-    if (hashChecksum != verifier.GetHash())
-        return error("%s: Checksum mismatch", __func__);
-
     return true;
 }
 
+void ReadAheadBlockFromDisk(const CBlockIndex* pindex)
+{
+    FlatFilePos block_pos, undo_pos;
+    {
+        LOCK(cs_main);
+        block_pos = pindex->GetBlockPos();
+        undo_pos = pindex->GetUndoPos();
+    }
+    if (!block_pos.IsNull()) {
+        g_block_file_reader.ReadAhead(BlockFileSeq(), block_pos, BLOCK_READ_AHEAD_SIZE);
+    }
+    if (!undo_pos.IsNull()) {
+        // Undo data of a block is around a tenth of its size
+        g_block_file_reader.ReadAhead(UndoFileSeq(), undo_pos, BLOCK_READ_AHEAD_SIZE / 8);
+    }
+}
+
 /** Abort with a message */
 static bool AbortNode(const std::string& strMessage, const std::string& userMessage = "", unsigned int prefix = 0)
 {
@@ -1979,6 +2019,83 @@ void ThreadScriptCheck(int worker_num) {
     scriptcheckqueue.Thread();
 }
 
+/**
+ * Consecutive blocks connected during IBD whose script checks are joined
+ * once for the whole window, so the script check threads are not left idle
+ * while the last checks of each block finish. The coins changes of the
+ * window are kept apart from CoinsTip() until its scripts are verified, so
+ * that the window can be discarded if any of them fail.
+ */
+class ScriptCheckWindow
+{
+public:
+    CCoinsViewCache view;
+    //! The last block whose scripts are known to be valid
+    CBlockIndex* const pindexVerified;
+    //! Number of blocks in the connect trace before the window
+    const size_t nTraceStart;
+    std::vector<CBlockIndex*> vpindex;
+    //! The blocks connected in the window, whose BlockChecked notification
+    //! and mempool removal wait until their scripts are verified
+    std::vector<std::pair<CBlockIndex*, std::shared_ptr<const CBlock>>> vconnected;
+    //! The blocks and precomputed data the pending script checks refer to
+    std::vector<std::shared_ptr<const CBlock>> vblocks;
+    std::deque<std::vector<PrecomputedTransactionData>> txdata;
+    //! Declared last, so that it is destroyed first and waits for the
+    //! pending checks while the data they refer to is still alive
+    CCheckQueueControl<CScriptCheck> control;
+
+    ScriptCheckWindow(CCoinsView* tip, CBlockIndex* pindexVerifiedIn, size_t nTraceStartIn)
+        : view(tip), pindexVerified(pindexVerifiedIn), nTraceStart(nTraceStartIn), control(&scriptcheckqueue) {}
+};
+
+namespace {
+
+/**
+ * Read one coin from the view below the coins cache, so that the UTXO lookups
+ * of a block can be spread over the coins prefetch threads. That view answers
+ * from a flush still being written to the coins database before reading the
+ * database itself. Other failures are ignored: the coin is then simply fetched
+ * again, and any error reported, by ConnectBlock itself.
+ */
+class CCoinsPrefetch
+{
+private:
+    const CCoinsView* m_db;
+    const COutPoint* m_outpoint;
+    Coin* m_coin;
+
+public:
+    CCoinsPrefetch() : m_db(nullptr), m_outpoint(nullptr), m_coin(nullptr) {}
+    CCoinsPrefetch(const CCoinsView& db, const COutPoint& outpoint, Coin& coin) : m_db(&db), m_outpoint(&outpoint), m_coin(&coin) {}
+
+    bool operator()()
+    {
+        try {
+            m_db->GetCoin(*m_outpoint, *m_coin);
+        } catch (const std::exception&) {
+            m_coin->Clear();
+        }
+        return true;
+    }
+
+    void swap(CCoinsPrefetch& check)
+    {
+        std::swap(m_db, check.m_db);
+        std::swap(m_outpoint, check.m_outpoint);
+        std::swap(m_coin, check.m_coin);
+    }
+};
+
+} // namespace
+
+static CCheckQueue<CCoinsPrefetch> coinsprefetchqueue(128);
+
+void ThreadCoinsPrefetch(int worker_num) {
+    util::ThreadRename(strprintf("prefetch.%i", worker_num));
+    coinsprefetchqueue.Thread();
+}
+
 VersionBitsCache versionbitscache GUARDED_BY(cs_main);
 
 int32_t ComputeBlockVersion(const CBlockIndex* pindexPrev, const Consensus::Params& params)
@@ -2082,6 +2199,7 @@ static unsigned int GetBlockScriptFlags(const CBlockIndex* pindex, const Consens
 
 static int64_t nTimeCheck = 0;
 static int64_t nTimeForks = 0;
+static int64_t nTimePrefetch = 0;
 static int64_t nTimeVerify = 0;
 static int64_t nTimeConnect = 0;
 static int64_t nTimeIndex = 0;
@@ -2089,11 +2207,62 @@ static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 static int64_t nBlocksTotal = 0;
 
+/** Fetch the kernel hash recorded by AddLocalStakeProof() for a block minted by this node. */
+static bool LookupLocalStakeProof(const uint256& hashBlock, uint256& hashProofOfStake, bool fErase)
+{
+    LOCK(cs_local_stake_proofs);
+    auto it = g_local_stake_proofs.find(hashBlock);
+    if (it == g_local_stake_proofs.end())
+        return false;
+    hashProofOfStake = it->second;
+    if (fErase)
+        g_local_stake_proofs.erase(it);
+    return true;
+}
+
+size_t CChainState::PrefetchInputCoins(const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    if (!g_parallel_script_checks) return 0;
+
+    // Inputs that are created in this block, or already cached, need no read
+    std::set<uint256> setBlockTxids;
+    std::vector<COutPoint> vOutPoints;
+    for (const auto& tx : block.vtx) {
+        setBlockTxids.insert(tx->GetHash());
+    }
+    for (const auto& tx : block.vtx) {
+        if (tx->IsCoinBase()) continue;
+        for (const CTxIn& txin : tx->vin) {
+            if (setBlockTxids.count(txin.prevout.hash) || CoinsTip().HaveCoinInCache(txin.prevout)) continue;
+            vOutPoints.push_back(txin.prevout);
+        }
+    }
+    if (vOutPoints.size() < MIN_PREFETCH_COINS) return 0;
+
+    std::vector<Coin> vCoins(vOutPoints.size());
+    std::vector<CCoinsPrefetch> vChecks;
+    vChecks.reserve(vOutPoints.size());
+    for (size_t i = 0; i < vOutPoints.size(); i++) {
+        vChecks.emplace_back(CoinsFlushView(), vOutPoints[i], vCoins[i]);
+    }
+    CCheckQueueControl<CCoinsPrefetch> control(&coinsprefetchqueue);
+    control.Add(vChecks);
+    control.Wait();
+
+    for (size_t i = 0; i < vOutPoints.size(); i++) {
+        if (!vCoins[i].IsSpent()) {
+            CoinsTip().AddFetchedCoin(vOutPoints[i], std::move(vCoins[i]));
+        }
+    }
+    return vOutPoints.size();
+}
+
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins.
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
  *  can fail if those validity checks fail (among other reasons). */
 bool CChainState::ConnectBlock(const CBlock& block, BlockValidationState& state, CBlockIndex* pindex,
-                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck)
+                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck, ScriptCheckWindow* script_window)
 {
     AssertLockHeld(cs_main);
     assert(pindex);
@@ -2145,12 +2314,37 @@ bool CChainState::ConnectBlock(const CBlock& block, BlockValidationState& state,
         return state.Invalid(BlockValidationResult::BLOCK_CONSENSUS, "ConnectBlock(): PoW period ended",
                              "pow-ended");
 
+    // On a chain loaded from a snapshot, the headers above its base may have
+    // been accepted before the modifiers below the base were derived from the
+    // snapshot's first modifier (see LoadSnapshot). Derive the block's own
+    // modifier again from its connected parent.
+    if (!fJustCheck && pindex->nHeight > 1 && (pindex->GetAncestor(1)->nStatus & BLOCK_ASSUMED_VALID)) {
+        uint64_t nStakeModifier = 0;
+        bool fGeneratedStakeModifier = false;
+        if (!ComputeNextStakeModifier(pindex->pprev, nStakeModifier, fGeneratedStakeModifier))
+            return error("%s: ComputeNextStakeModifier() failed for block %s", __func__, pindex->GetBlockHash().ToString());
+        if (pindex->nStakeModifier != nStakeModifier || pindex->GeneratedStakeModifier() != fGeneratedStakeModifier) {
+            pindex->SetStakeModifier(nStakeModifier, fGeneratedStakeModifier);
+            setDirtyBlockIndex.insert(pindex);
+        }
+    }
+
     uint256 hashProofOfStake = uint256();
     if (block.IsProofOfStake()) {
-        if (!CheckProofOfStake(block, hashProofOfStake))
+        // Only a TestBlockValidity pass on a block minted by this node may use
+        // the kernel hash the miner found; connecting a block always checks it.
+        const bool fLocalProof = LookupLocalStakeProof(pindex->GetBlockHash(), hashProofOfStake, !fJustCheck);
+        if (!(fJustCheck && fLocalProof) && !CheckProofOfStake(block, hashProofOfStake, view))
             return false;
         else
             LogPrint(BCLog::POS, "hashProof %s\n", hashProofOfStake.ToString().c_str());
+
+        // Record the kernel hash on the index entry itself, so it follows the
+        // block through reorgs and is persisted with the rest of the index.
+        if (!fJustCheck && pindex->hashProofOfStake != hashProofOfStake) {
+            pindex->SetProofOfStakeHash(hashProofOfStake);
+            setDirtyBlockIndex.insert(pindex);
+        }
     }
 
     bool fScriptChecks = true;
@@ -2288,9 +2482,20 @@ bool CChainState::ConnectBlock(const CBlock& block, BlockValidationState& state,
     int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTime1;
     LogPrint(BCLog::BENCH, "    - Fork checks: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime2 - nTime1), nTimeForks * MICRO, nTimeForks * MILLI / nBlocksTotal);
 
+    // Pull the block's inputs into the coins cache in parallel, instead of
+    // stalling on one database read at a time below.
+    const size_t nPrefetched = PrefetchInputCoins(block);
+    if (nPrefetched > 0) {
+        int64_t nTimePrefetched = GetTimeMicros(); nTimePrefetch += nTimePrefetched - nTime2;
+        LogPrint(BCLog::BENCH, "    - Prefetch %u inputs: %.2fms [%.2fs (%.2fms/blk)]\n", (unsigned)nPrefetched, MILLI * (nTimePrefetched - nTime2), nTimePrefetch * MICRO, nTimePrefetch * MILLI / nBlocksTotal);
+        nTime2 = nTimePrefetched;
+    }
+
     CBlockUndo blockundo;
 
-    CCheckQueueControl<CScriptCheck> control(fScriptChecks && g_parallel_script_checks ? &scriptcheckqueue : nullptr);
+    // The script checks of a block in a window are only joined with the
+    // rest of the window, see FinishScriptCheckWindow.
+    CCheckQueueControl<CScriptCheck> control(fScriptChecks && g_parallel_script_checks && !script_window ? &scriptcheckqueue : nullptr);
 
     std::vector<int> prevheights;
     CAmount nFees = 0;
@@ -2299,7 +2504,9 @@ bool CChainState::ConnectBlock(const CBlock& block, BlockValidationState& state,
     CAmount nValueOut = 0;
     int64_t nSigOpsCost = 0;
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
-    std::vector<PrecomputedTransactionData> txdata;
+    std::vector<PrecomputedTransactionData> txdata_block;
+    if (script_window) script_window->txdata.emplace_back();
+    std::vector<PrecomputedTransactionData>& txdata = script_window ? script_window->txdata.back() : txdata_block;
     txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
@@ -2365,7 +2572,11 @@ bool CChainState::ConnectBlock(const CBlock& block, BlockValidationState& state,
                 return error("ConnectBlock(): CheckInputScripts on %s failed with %s",
                     tx.GetHash().ToString(), state.ToString());
             }
-            control.Add(vChecks);
+            if (!script_window) {
+                control.Add(vChecks);
+            } else if (!isExceptionBlock(hashPrevBlock)) {
+                script_window->control.Add(vChecks);
+            }
         }
 
         CTxUndo undoDummy;
@@ -2413,7 +2624,9 @@ bool CChainState::ConnectBlock(const CBlock& block, BlockValidationState& state,
     if (!WriteUndoDataForBlock(blockundo, state, pindex, chainparams))
         return false;
 
-    if (!pindex->IsValid(BLOCK_VALID_SCRIPTS)) {
+    if (script_window) {
+        script_window->vpindex.push_back(pindex);
+    } else if (!pindex->IsValid(BLOCK_VALID_SCRIPTS)) {
         pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
         setDirtyBlockIndex.insert(pindex);
     }
@@ -2483,6 +2696,9 @@ bool CChainState::FlushStateToDisk(
     const size_t coins_mem_usage = CoinsTip().DynamicMemoryUsage();
 
     try {
+    if (CoinsFlushView().HasFailed()) {
+        return AbortNode(state, "Failed to write to coin database");
+    }
     {
         bool fFlushForPrune = false;
         bool fDoFullFlush = false;
@@ -2568,8 +2784,13 @@ bool CChainState::FlushStateToDisk(
         }
         // Flush best chain related state. This can only be done if the blocks / block index write was also done.
         if (fDoFullFlush && !CoinsTip().GetBestBlock().IsNull()) {
-            LOG_TIME_SECONDS(strprintf("write coins cache to disk (%d coins, %.2fkB)",
-                coins_count, coins_mem_usage / 1000));
+            // Routine flushes are written in the background, while the cache
+            // starts over. Callers asking for everything to be on disk get a
+            // synchronous write, and so does a flush for pruning, as the
+            // blocks needed to replay an interrupted write may be pruned.
+            const bool fBackground = mode != FlushStateMode::ALWAYS && !fFlushForPrune;
+            LOG_TIME_SECONDS(strprintf("%s coins cache to disk (%d coins, %.2fkB)",
+                fBackground ? "start writing" : "write", coins_count, coins_mem_usage / 1000));
 
             // Typical Coin structures on disk are around 48 bytes in size.
             // Pushing a new one to the database can cause it to be written
@@ -2580,6 +2801,7 @@ bool CChainState::FlushStateToDisk(
                 return AbortNode(state, "Disk space is too low!", _("Error: Disk space is too low!").translated, CClientUIInterface::MSG_NOPREFIX);
             }
             // Flush the chainstate (which may refer to block index entries).
+            CoinsFlushView().SetBackground(fBackground);
             if (!CoinsTip().Flush())
                 return AbortNode(state, "Failed to write to coin database");
             nLastFlush = nNow;
@@ -2774,6 +2996,15 @@ public:
         blocksConnected.emplace_back();
     }
 
+    size_t Size() const { return blocksConnected.size() - 1; }
+
+    //! Forget all but the first nBlocks connected blocks, as they were disconnected again.
+    void Truncate(size_t nBlocks) {
+        assert(nBlocks <= Size());
+        blocksConnected.resize(nBlocks);
+        blocksConnected.emplace_back();
+    }
+
     std::vector<PerBlockConnectTrace>& GetBlocksConnected() {
         // We always keep one extra block at the end of our list because
         // blocks are added after all the conflicted transactions have
@@ -2792,13 +3023,15 @@ public:
  *
  * The block is added to connectTrace if connection succeeds.
  */
-bool CChainState::ConnectTip(BlockValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool)
+bool CChainState::ConnectTip(BlockValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool, ScriptCheckWindow* script_window)
 {
     assert(pindexNew->pprev == m_chain.Tip());
     // Read block from disk.
     int64_t nTime1 = GetTimeMicros();
     std::shared_ptr<const CBlock> pthisBlock;
     if (!pblock) {
+        // Blocks connected from disk, as by -reindex-chainstate, are read in order
+        ReadAheadBlockFromDisk(pindexNew);
         std::shared_ptr<CBlock> pblockNew = std::make_shared<CBlock>();
         if (!ReadBlockFromDisk(*pblockNew, pindexNew, chainparams.GetConsensus()))
             return AbortNode(state, "Failed to read block");
@@ -2812,9 +3045,12 @@ bool CChainState::ConnectTip(BlockValidationState& state, const CChainParams& ch
     int64_t nTime3;
     LogPrint(BCLog::BENCH, "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * MILLI, nTimeReadFromDisk * MICRO);
     {
-        CCoinsViewCache view(&CoinsTip());
-        bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams);
-        GetMainSignals().BlockChecked(blockConnecting, state);
+        CCoinsViewCache view(script_window ? &script_window->view : &CoinsTip());
+        // Pending script checks refer to the block's transactions, even if it fails
+        if (script_window) script_window->vblocks.push_back(pthisBlock);
+        bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams, false, script_window);
+        // A block of a window is only reported valid once its scripts are, see FinishScriptCheckWindow
+        if (!rv || !script_window) GetMainSignals().BlockChecked(blockConnecting, state);
         if (!rv) {
             if (state.IsInvalid())
                 InvalidBlockFound(pindexNew, state);
@@ -2828,13 +3064,20 @@ bool CChainState::ConnectTip(BlockValidationState& state, const CChainParams& ch
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
     LogPrint(BCLog::BENCH, "  - Flush: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime4 - nTime3) * MILLI, nTimeFlush * MICRO, nTimeFlush * MILLI / nBlocksTotal);
-    // Write the chain state to disk, if necessary.
-    if (!FlushStateToDisk(chainparams, state, FlushStateMode::IF_NEEDED))
+    // Write the chain state to disk, if necessary. A window is only written
+    // once its scripts are verified.
+    if (!script_window && !FlushStateToDisk(chainparams, state, FlushStateMode::IF_NEEDED))
         return false;
     int64_t nTime5 = GetTimeMicros(); nTimeChainState += nTime5 - nTime4;
     LogPrint(BCLog::BENCH, "  - Writing chainstate: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime5 - nTime4) * MILLI, nTimeChainState * MICRO, nTimeChainState * MILLI / nBlocksTotal);
-    // Remove conflicting transactions from the mempool.;
-    mempool.removeForBlock(blockConnecting.vtx, pindexNew->nHeight);
+    // Remove conflicting transactions from the mempool. For a block of a
+    // window this waits until its scripts are verified. No window is opened
+    // after blocks were disconnected, so disconnectpool is empty then.
+    if (script_window) {
+        script_window->vconnected.emplace_back(pindexNew, pthisBlock);
+    } else {
+        mempool.removeForBlock(blockConnecting.vtx, pindexNew->nHeight);
+    }
     disconnectpool.removeForBlock(blockConnecting.vtx);
     // Update m_chain & related variables.
     m_chain.SetTip(pindexNew);
@@ -2848,6 +3091,49 @@ bool CChainState::ConnectTip(BlockValidationState& state, const CChainParams& ch
     return true;
 }
 
+/**
+ * Join the script checks of a window. If they all passed, its coins are
+ * moved to CoinsTip(), its blocks are marked as script-verified and their
+ * deferred mempool removals and BlockChecked notifications happen. Otherwise
+ * the tip is rolled back to the last verified block, so that the window's
+ * blocks can be connected again one at a time to find the invalid one.
+ *
+ * @returns whether the scripts of the window were valid
+ */
+bool CChainState::FinishScriptCheckWindow(const CChainParams& chainparams, ScriptCheckWindow& script_window, ConnectTrace& connectTrace)
+{
+    int64_t nTimeStart = GetTimeMicros();
+    bool fValid = script_window.control.Wait();
+    LogPrint(BCLog::BENCH, "- Verify window of %u blocks: %.2fms\n", (unsigned)script_window.vpindex.size(), (GetTimeMicros() - nTimeStart) * MILLI);
+    if (fValid) {
+        bool flushed = script_window.view.Flush();
+        assert(flushed);
+        for (CBlockIndex* pindex : script_window.vpindex) {
+            if (!pindex->IsValid(BLOCK_VALID_SCRIPTS)) {
+                pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
+                setDirtyBlockIndex.insert(pindex);
+            }
+        }
+        for (const auto& connected : script_window.vconnected) {
+            mempool.removeForBlock(connected.second->vtx, connected.first->nHeight);
+            GetMainSignals().BlockChecked(*connected.second, BlockValidationState());
+        }
+        return true;
+    }
+
+    LogPrintf("%s: script checks failed in the blocks after %s, connecting them again one at a time\n", __func__,
+        script_window.pindexVerified->GetBlockHash().ToString());
+    connectTrace.Truncate(script_window.nTraceStart);
+    m_chain.SetTip(script_window.pindexVerified);
+    UpdateTip(script_window.pindexVerified, chainparams);
+    // The blocks may have been pruned from the candidates as the tip moved past them
+    setBlockIndexCandidates.insert(script_window.pindexVerified);
+    for (CBlockIndex* pindex : script_window.vpindex) {
+        setBlockIndexCandidates.insert(pindex);
+    }
+    return false;
+}
+
 /**
  * Return the tip of the chain with the most work in it, that isn't
  * known to be invalid (it's however far from certain to be valid).
@@ -2950,6 +3236,12 @@ bool CChainState::ActivateBestChainStep(BlockValidationState& state, const CChai
         fBlocksDisconnected = true;
     }
 
+    // During IBD, the script checks of several blocks may be joined together
+    bool fScriptCheckWindow = g_script_check_window > 1 && g_parallel_script_checks && !fBlocksDisconnected && IsInitialBlockDownload();
+    std::unique_ptr<ScriptCheckWindow> script_window;
+    //! Blocks of a failed window still to be connected again before returning
+    size_t nReconnect = 0;
+
     // Build list of new blocks to connect.
     std::vector<CBlockIndex*> vpindexToConnect;
     bool fContinue = true;
@@ -2969,7 +3261,32 @@ bool CChainState::ActivateBestChainStep(BlockValidationState& state, const CChai
 
         // Connect new blocks.
         for (CBlockIndex *pindexConnect : reverse_iterate(vpindexToConnect)) {
-            if (!ConnectTip(state, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(), connectTrace, disconnectpool)) {
+            if (fScriptCheckWindow && !script_window) {
+                script_window = MakeUnique<ScriptCheckWindow>(&CoinsTip(), m_chain.Tip(), connectTrace.Size());
+            }
+            const bool fConnected = ConnectTip(state, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(), connectTrace, disconnectpool, script_window.get());
+            if (script_window && (!fConnected || script_window->vpindex.size() >= (size_t)g_script_check_window || pindexConnect == pindexMostWork)) {
+                const bool fVerified = FinishScriptCheckWindow(chainparams, *script_window, connectTrace);
+                nReconnect = fVerified ? 0 : script_window->vpindex.size();
+                script_window.reset();
+                if (!fVerified) {
+                    if (!fConnected && !state.IsInvalid()) {
+                        UpdateMempoolForReorg(disconnectpool, false);
+                        return false;
+                    }
+                    // Connect the window's blocks again without joining their
+                    // script checks, which finds the invalid block.
+                    state = BlockValidationState();
+                    fScriptCheckWindow = false;
+                    nHeight = m_chain.Height();
+                    break;
+                }
+                if (fConnected && !FlushStateToDisk(chainparams, state, FlushStateMode::IF_NEEDED)) {
+                    UpdateMempoolForReorg(disconnectpool, false);
+                    return false;
+                }
+            }
+            if (!fConnected) {
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
                     if (state.GetResult() != BlockValidationResult::BLOCK_MUTATED) {
@@ -2988,7 +3305,8 @@ bool CChainState::ActivateBestChainStep(BlockValidationState& state, const CChai
                 }
             } else {
                 PruneBlockIndexCandidates();
-                if (!pindexOldTip || m_chain.Tip()->nChainWork > pindexOldTip->nChainWork) {
+                if (nReconnect > 0) --nReconnect;
+                if (!script_window && nReconnect == 0 && (!pindexOldTip || m_chain.Tip()->nChainWork > pindexOldTip->nChainWork)) {
                     // We're in a better position than we were. Return temporarily to release the lock.
                     fContinue = false;
                     break;
@@ -2996,6 +3314,7 @@ bool CChainState::ActivateBestChainStep(BlockValidationState& state, const CChai
             }
         }
     }
+    assert(!script_window);
 
     if (fBlocksDisconnected) {
         // If any blocks were disconnected, disconnectpool may be non empty.  Add
@@ -3368,7 +3687,7 @@ CBlockIndex* BlockManager::AddToBlockIndex(const CBlockHeader& block)
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
+    CBlockIndex* pindexNew = NewBlockIndex(block);
 
     // Get block type
     bool isPoS = block.nNonce == 0;
@@ -4108,6 +4427,16 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
     return true;
 }
 
+void AddLocalStakeProof(const uint256& hashBlock, const uint256& hashProofOfStake)
+{
+    LOCK(cs_local_stake_proofs);
+    // Entries are normally consumed when the block connects; stale ones are
+    // simply dropped once the bound is reached.
+    if (g_local_stake_proofs.size() >= MAX_LOCAL_STAKE_PROOFS)
+        g_local_stake_proofs.clear();
+    g_local_stake_proofs[hashBlock] = hashProofOfStake;
+}
+
 bool TestBlockValidity(BlockValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW, bool fCheckMerkleRoot)
 {
     AssertLockHeld(cs_main);
@@ -4188,6 +4517,8 @@ void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune)
 {
     for (std::set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         FlatFilePos pos(*it, 0);
+        g_block_file_reader.Close(BlockFileSeq(), pos);
+        g_block_file_reader.Close(UndoFileSeq(), pos);
         fs::remove(BlockFileSeq().FileName(pos));
         fs::remove(UndoFileSeq().FileName(pos));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -4335,7 +4666,7 @@ CBlockIndex * BlockManager::InsertBlockIndex(const uint256& hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
+    CBlockIndex* pindexNew = NewBlockIndex();
     mi = m_block_index.insert(std::make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
 
@@ -4397,15 +4728,15 @@ bool BlockManager::LoadBlockIndex(
     return true;
 }
 
+// Entries in the arena are released without running their destructor
+static_assert(std::is_trivially_destructible<CBlockIndex>::value, "CBlockIndex must be trivially destructible");
+
 void BlockManager::Unload() {
     m_failed_blocks.clear();
     m_blocks_unlinked.clear();
 
-    for (const BlockMap::value_type& entry : m_block_index) {
-        delete entry.second;
-    }
-
     m_block_index.clear();
+    m_block_index_arena = MakeUnique<BlockIndexArena>(BLOCK_INDEX_ARENA_CHUNK_BYTES);
 }
 
 bool static LoadBlockIndexDB(const CChainParams& chainparams) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
@@ -4490,6 +4821,287 @@ bool CChainState::LoadChainTip(const CChainParams& chainparams)
     return true;
 }
 
+/**
+ * Read the coins and stake records of a snapshot and hash them. coin_fn, if
+ * set, is handed each coin once it passed the checks; it returns false to stop.
+ */
+static bool ReadSnapshotContents(CAutoFile& coins_file, const SnapshotMetadata& metadata, int base_height,
+                                 const std::function<bool(const COutPoint&, Coin&&)>& coin_fn,
+                                 std::vector<SnapshotBlockStake>& stakes, uint256& hash, std::string& error)
+{
+    SnapshotHasher hasher(metadata.m_base_blockhash, metadata.m_first_stake_modifier);
+    stakes.clear();
+    if (metadata.m_stake_blocks_count > (unsigned int)base_height + 1) {
+        error = "The snapshot has more stake records than blocks";
+        return false;
+    }
+    try {
+        COutPoint outpoint;
+        for (uint64_t i = 0; i < metadata.m_coins_count; ++i) {
+            if (i % 100000 == 0 && ShutdownRequested()) {
+                error = "Shutdown requested";
+                return false;
+            }
+            Coin coin;
+            coins_file >> outpoint;
+            coins_file >> coin;
+            if (coin.nHeight > (uint32_t)base_height || !MoneyRange(coin.out.nValue)) {
+                error = strprintf("Bad coin %s in the snapshot", outpoint.ToString());
+                return false;
+            }
+            hasher.AddCoin(outpoint, coin);
+            if (coin_fn && !coin_fn(outpoint, std::move(coin))) return false;
+        }
+        stakes.resize(metadata.m_stake_blocks_count);
+        for (SnapshotBlockStake& stake : stakes) {
+            coins_file >> stake;
+            hasher.AddStakeBlock(stake);
+        }
+    } catch (const std::exception& e) {
+        error = strprintf("Failed to read the snapshot: %s", e.what());
+        return false;
+    }
+    hash = hasher.GetHash();
+    return true;
+}
+
+//! Stake modifiers of block index entries, as they were before ReseedStakeModifiers
+using StakeModifierBackup = std::vector<std::tuple<CBlockIndex*, uint64_t, bool>>;
+
+static void RestoreStakeModifiers(const StakeModifierBackup& backup) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    for (const std::tuple<CBlockIndex*, uint64_t, bool>& entry : backup) {
+        std::get<0>(entry)->SetStakeModifier(std::get<1>(entry), std::get<2>(entry));
+    }
+    InitSmartstakeCache();
+}
+
+/**
+ * Derive the stake modifiers of pindexBase and its ancestors again, starting
+ * from first_stake_modifier instead of the one this node picked, as the node
+ * that wrote a snapshot did. Headers above the base get theirs when they are
+ * connected. The previous modifiers are kept in backup; if one of the new
+ * modifiers can't be derived, they are put back.
+ */
+static bool ReseedStakeModifiers(CBlockIndex* pindexBase, uint64_t first_stake_modifier, StakeModifierBackup& backup, std::string& error) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    std::vector<CBlockIndex*> headers;
+    for (CBlockIndex* pindex = pindexBase; pindex->pprev; pindex = pindex->pprev) {
+        headers.push_back(pindex);
+    }
+    backup.clear();
+    for (CBlockIndex* pindex : reverse_iterate(headers)) {
+        backup.emplace_back(pindex, pindex->nStakeModifier, pindex->GeneratedStakeModifier());
+        uint64_t nStakeModifier = first_stake_modifier;
+        bool fGeneratedStakeModifier = true;
+        if (pindex->nHeight > 1 && !ComputeNextStakeModifier(pindex->pprev, nStakeModifier, fGeneratedStakeModifier)) {
+            RestoreStakeModifiers(backup);
+            error = strprintf("Failed to derive the stake modifier of block %s from the snapshot", pindex->GetBlockHash().ToString());
+            return false;
+        }
+        pindex->SetStakeModifier(nStakeModifier, fGeneratedStakeModifier);
+    }
+    InitSmartstakeCache();
+    return true;
+}
+
+bool CChainState::LoadSnapshot(CAutoFile& coins_file, const SnapshotMetadata& metadata, const CChainParams& chainparams, std::string& error)
+{
+    const uint256& base_blockhash = metadata.m_base_blockhash;
+    int base_height;
+    {
+        LOCK(cs_main);
+        const CBlockIndex* pindexBase = LookupBlockIndex(base_blockhash);
+        if (!pindexBase) {
+            error = strprintf("The base block %s of the snapshot is not in the headers chain, wait for the headers to sync", base_blockhash.ToString());
+            return false;
+        }
+        base_height = pindexBase->nHeight;
+    }
+    const MapAssumeutxo& assumeutxo = chainparams.Assumeutxo();
+    const MapAssumeutxo::const_iterator expected = assumeutxo.find(base_height);
+    if (expected == assumeutxo.end()) {
+        error = strprintf("No snapshot hash is known for height %d, see -assumeutxo", base_height);
+        return false;
+    }
+    // Every block has a coinbase, and the count includes the genesis block.
+    if (metadata.m_nchaintx <= (unsigned int)base_height) {
+        error = strprintf("The snapshot claims %u transactions up to height %d, fewer than there are blocks", metadata.m_nchaintx, base_height);
+        return false;
+    }
+
+    // Check the whole snapshot before touching the chainstate, so that a bad
+    // or truncated file leaves it as it was.
+    FILE* file = coins_file.Get();
+    const long start_pos = ftell(file);
+    std::vector<SnapshotBlockStake> stakes;
+    uint256 hash;
+    LogPrintf("[snapshot] checking the snapshot at height %d\n", base_height);
+    if (start_pos < 0 || !ReadSnapshotContents(coins_file, metadata, base_height, nullptr, stakes, hash, error)) {
+        if (error.empty()) error = "Failed to read the snapshot";
+        return false;
+    }
+    if (hash != expected->second) {
+        error = strprintf("The snapshot hash %s does not match the expected hash %s", hash.ToString(), expected->second.ToString());
+        return false;
+    }
+    if (fseek(file, start_pos, SEEK_SET) != 0) {
+        error = "Failed to rewind the snapshot";
+        return false;
+    }
+
+    LOCK(cs_main);
+    CBlockIndex* pindexBase = LookupBlockIndex(base_blockhash);
+    if (m_chain.Height() != 0 || fImporting || fReindex) {
+        error = "A snapshot can only be loaded while the chain has no blocks past the genesis block";
+        return false;
+    }
+    if (pindexBase->nStatus & BLOCK_FAILED_MASK) {
+        error = "The base block of the snapshot is invalid";
+        return false;
+    }
+    if (!pindexBestHeader || pindexBestHeader->GetAncestor(base_height) != pindexBase) {
+        error = "The base block of the snapshot is not in the best headers chain";
+        return false;
+    }
+
+    // The stake state of the most recent blocks is needed to check new
+    // coinstakes. Stake modifiers follow from the headers and the first
+    // modifier, so derive them as the snapshot's node did and compare them
+    // before taking the rest of the records.
+    StakeModifierBackup stake_modifier_backup;
+    const CBlockIndex* pindexFirst = pindexBase->GetAncestor(1);
+    if (pindexFirst && pindexFirst->nStakeModifier != metadata.m_first_stake_modifier) {
+        LogPrintf("[snapshot] deriving the stake modifiers from the snapshot's first modifier\n");
+        if (!ReseedStakeModifiers(pindexBase, metadata.m_first_stake_modifier, stake_modifier_backup, error)) {
+            return false;
+        }
+    }
+    bool have_base_stake = false;
+    for (const SnapshotBlockStake& stake : stakes) {
+        const CBlockIndex* pindex = LookupBlockIndex(stake.m_blockhash);
+        if (!pindex || pindexBase->GetAncestor(pindex->nHeight) != pindex) {
+            error = strprintf("The snapshot has stake records for block %s, which is not below its base", stake.m_blockhash.ToString());
+            RestoreStakeModifiers(stake_modifier_backup);
+            return false;
+        }
+        const unsigned int header_flags = CBlockIndex::BLOCK_PROOF_OF_STAKE | CBlockIndex::BLOCK_STAKE_ENTROPY | CBlockIndex::BLOCK_STAKE_MODIFIER;
+        if ((pindex->nFlags & header_flags) != (stake.m_flags & header_flags) || pindex->nStakeModifier != stake.m_stake_modifier) {
+            error = strprintf("The stake modifier of block %s does not match the snapshot", stake.m_blockhash.ToString());
+            RestoreStakeModifiers(stake_modifier_backup);
+            return false;
+        }
+        if (pindex == pindexBase) have_base_stake = true;
+    }
+    if (!have_base_stake) {
+        error = "The snapshot has no stake records for its base block";
+        RestoreStakeModifiers(stake_modifier_backup);
+        return false;
+    }
+
+    // Persist the derived modifiers with the rest of the block index.
+    for (const std::tuple<CBlockIndex*, uint64_t, bool>& entry : stake_modifier_backup) {
+        setDirtyBlockIndex.insert(std::get<0>(entry));
+    }
+
+    LogPrintf("[snapshot] loading %d coins at height %d\n", metadata.m_coins_count, base_height);
+    pblocktree->WriteFlag("loadingtxoutset", true);
+    CCoinsViewCache& coins_cache = CoinsTip();
+    auto add_coin = [&](const COutPoint& outpoint, Coin&& coin) {
+        coins_cache.AddCoin(outpoint, std::move(coin), true);
+        if (coins_cache.DynamicMemoryUsage() > nCoinCacheUsage) {
+            coins_cache.SetBestBlock(base_blockhash);
+            if (!coins_cache.Flush()) {
+                error = "Failed to write the coins database";
+                return false;
+            }
+        }
+        return true;
+    };
+    // The file was checked above, so failing now can only be a read error or
+    // a shutdown. The half loaded chainstate is then rejected at startup.
+    if (!ReadSnapshotContents(coins_file, metadata, base_height, add_coin, stakes, hash, error)) {
+        return false;
+    }
+    if (hash != expected->second) {
+        error = "The snapshot changed while it was loaded";
+        return false;
+    }
+    coins_cache.SetBestBlock(base_blockhash);
+
+    for (const SnapshotBlockStake& stake : stakes) {
+        CBlockIndex* pindex = LookupBlockIndex(stake.m_blockhash);
+        pindex->nMint = stake.m_mint;
+        pindex->nMoneySupply = stake.m_money_supply;
+        if (pindex->IsProofOfStake()) {
+            pindex->prevoutStake = stake.m_prevout_stake;
+            pindex->nStakeTime = stake.m_stake_time;
+        }
+        if (stake.m_flags & CBlockIndex::BLOCK_PROOF_HASH) {
+            pindex->SetProofOfStakeHash(stake.m_hash_proof_of_stake);
+        }
+        setDirtyBlockIndex.insert(pindex);
+    }
+
+    // The blocks up to the base are only assumed valid. They get a
+    // transaction count so that the chain can be built on them, but are not
+    // raised to BLOCK_VALID_SCRIPTS, and their history is never validated.
+    // Their counts are placeholders. The base's count makes up the rest of
+    // the snapshot's chain total, so that nChainTx at the base is right for
+    // progress estimates and chain statistics, also once it is summed up
+    // again at startup.
+    std::vector<CBlockIndex*> blocks;
+    for (CBlockIndex* pindex = pindexBase; pindex->pprev; pindex = pindex->pprev) {
+        blocks.push_back(pindex);
+    }
+    for (CBlockIndex* pindex : reverse_iterate(blocks)) {
+        if (pindex == pindexBase && metadata.m_nchaintx > pindex->pprev->nChainTx) {
+            pindex->nTx = metadata.m_nchaintx - pindex->pprev->nChainTx;
+        } else if (pindex->nTx == 0) {
+            pindex->nTx = 1;
+        }
+        pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
+        pindex->RaiseValidity(BLOCK_VALID_TRANSACTIONS);
+        pindex->nStatus |= BLOCK_ASSUMED_VALID;
+        setDirtyBlockIndex.insert(pindex);
+    }
+
+    m_chain.SetTip(pindexBase);
+    setBlockIndexCandidates.insert(pindexBase);
+    // Blocks already received above the base can now be connected.
+    std::deque<CBlockIndex*> queue;
+    for (const std::pair<CBlockIndex* const, CBlockIndex*>& unlinked : m_blockman.m_blocks_unlinked) {
+        if (unlinked.first->HaveTxsDownloaded()) queue.push_back(unlinked.first);
+    }
+    while (!queue.empty()) {
+        CBlockIndex* pindex = queue.front();
+        queue.pop_front();
+        std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = m_blockman.m_blocks_unlinked.equal_range(pindex);
+        while (range.first != range.second) {
+            std::multimap<CBlockIndex*, CBlockIndex*>::iterator it = range.first;
+            CBlockIndex* pindexChild = it->second;
+            range.first++;
+            m_blockman.m_blocks_unlinked.erase(it);
+            pindexChild->nChainTx = pindex->nChainTx + pindexChild->nTx;
+            {
+                LOCK(cs_nBlockSequenceId);
+                pindexChild->nSequenceId = nBlockSequenceId++;
+            }
+            if (!setBlockIndexCandidates.value_comp()(pindexChild, m_chain.Tip())) {
+                setBlockIndexCandidates.insert(pindexChild);
+            }
+            queue.push_back(pindexChild);
+        }
+    }
+    PruneBlockIndexCandidates();
+
+    ForceFlushStateToDisk();
+    pblocktree->WriteFlag("loadingtxoutset", false);
+    LogPrintf("[snapshot] loaded the UTXO set at height %d, new tip %s\n", base_height, base_blockhash.ToString());
+    CheckBlockIndex(chainparams.GetConsensus());
+    return true;
+}
+
 CVerifyDB::CVerifyDB()
 {
     uiInterface.ShowProgress(_("Verifying blocks...").translated, 0, false);
@@ -4529,9 +5141,9 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         uiInterface.ShowProgress(_("Verifying blocks...").translated, percentageDone, false);
         if (pindex->nHeight <= ::ChainActive().Height()-nCheckDepth)
             break;
-        if (fPruneMode && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
-            // If pruning, only go back as far as we have data.
-            LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
+        if ((fPruneMode || (pindex->nStatus & BLOCK_ASSUMED_VALID)) && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
+            // If pruning, or below a UTXO set snapshot, only go back as far as we have data.
+            LogPrintf("VerifyDB(): block verification stopping at height %d (no data)\n", pindex->nHeight);
             break;
         }
         CBlock block;
@@ -4749,7 +5361,8 @@ bool CChainState::RewindBlockIndex(const CChainParams& params)
             // Although SCRIPT_VERIFY_WITNESS is now generally enforced on all
             // blocks in ConnectBlock, we don't need to go back and
             // re-download/re-verify blocks from before segwit actually activated.
-            if (IsWitnessEnabled(m_chain[nHeight - 1], params.GetConsensus()) && !(m_chain[nHeight]->nStatus & BLOCK_OPT_WITNESS)) {
+            // Blocks below a UTXO set snapshot were never downloaded at all.
+            if (IsWitnessEnabled(m_chain[nHeight - 1], params.GetConsensus()) && !(m_chain[nHeight]->nStatus & (BLOCK_OPT_WITNESS | BLOCK_ASSUMED_VALID))) {
                 break;
             }
             nHeight++;
@@ -4920,120 +5533,143 @@ bool LoadGenesisBlock(const CChainParams& chainparams)
     return ::ChainstateActive().LoadGenesisBlock(chainparams);
 }
 
-bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, FlatFilePos *dbp)
+/**
+ * Find the blocks stored in a file and pass each to fn, in file order. When dbp
+ * is set, its nPos is updated to the position of each block before fn is called.
+ * Stops early when fn returns false. This takes over fileIn.
+ */
+static void ScanExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, FlatFilePos* dbp, const std::function<bool(const std::shared_ptr<CBlock>&)>& fn)
 {
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, FlatFilePos> mapBlocksUnknownParent;
-    int64_t nStart = GetTimeMillis();
+    // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
+    CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
+    uint64_t nRewind = blkdat.GetPos();
+    while (!blkdat.eof()) {
+        boost::this_thread::interruption_point();
 
-    int nLoaded = 0;
-    try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
-            boost::this_thread::interruption_point();
+        blkdat.SetPos(nRewind);
+        nRewind++; // start one byte further next time, in case of failure
+        blkdat.SetLimit(); // remove former limit
+        unsigned int nSize = 0;
+        try {
+            // locate a header
+            unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
+            blkdat.FindByte(chainparams.MessageStart()[0]);
+            nRewind = blkdat.GetPos()+1;
+            blkdat >> buf;
+            if (memcmp(buf, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
+                continue;
+            // read size
+            blkdat >> nSize;
+            if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
+                continue;
+        } catch (const std::exception&) {
+            // no valid block header found; don't complain
+            break;
+        }
+        std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+        try {
+            // read block
+            uint64_t nBlockPos = blkdat.GetPos();
+            if (dbp)
+                dbp->nPos = nBlockPos;
+            blkdat.SetLimit(nBlockPos + nSize);
+            blkdat.SetPos(nBlockPos);
+            blkdat >> *pblock;
+            nRewind = blkdat.GetPos();
+        } catch (const std::exception& e) {
+            LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+            continue;
+        }
+        if (!fn(pblock)) break;
+    }
+}
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
-                blkdat.FindByte(chainparams.MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> buf;
-                if (memcmp(buf, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
-            }
-            try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
+// Map of disk positions for blocks with unknown parent (only used for reindex)
+static std::multimap<uint256, FlatFilePos> mapBlocksUnknownParent;
+
+/** Accept a block read from a file, and any earlier blocks of the file waiting for it. Returns false on a fatal error. */
+static bool ProcessExternalBlock(const CChainParams& chainparams, const std::shared_ptr<CBlock>& pblock, const uint256& hash, FlatFilePos* dbp, int& nLoaded)
+{
+    try {
+        const CBlock& block = *pblock;
+        {
+            LOCK(cs_main);
+            // detect out of order blocks, and store them for later
+            if (hash != chainparams.GetConsensus().hashGenesisBlock && !LookupBlockIndex(block.hashPrevBlock)) {
+                LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                        block.hashPrevBlock.ToString());
                 if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
-                CBlock& block = *pblock;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
-
-                uint256 hash = block.GetHash();
-                {
-                    LOCK(cs_main);
-                    // detect out of order blocks, and store them for later
-                    if (hash != chainparams.GetConsensus().hashGenesisBlock && !LookupBlockIndex(block.hashPrevBlock)) {
-                        LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                                block.hashPrevBlock.ToString());
-                        if (dbp)
-                            mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                        continue;
-                    }
+                    mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+                return true;
+            }
 
-                    // process in case the block isn't known yet
-                    CBlockIndex* pindex = LookupBlockIndex(hash);
-                    if (!pindex || (pindex->nStatus & BLOCK_HAVE_DATA) == 0) {
-                      BlockValidationState state;
-                      if (::ChainstateActive().AcceptBlock(pblock, state, chainparams, nullptr, true, dbp, nullptr)) {
-                          nLoaded++;
-                      }
-                      if (state.IsError()) {
-                          break;
-                      }
-                    } else if (hash != chainparams.GetConsensus().hashGenesisBlock && pindex->nHeight % 1000 == 0) {
-                      LogPrint(BCLog::REINDEX, "Block Import: already had block %s at height %d\n", hash.ToString(), pindex->nHeight);
-                    }
-                }
+            // process in case the block isn't known yet
+            CBlockIndex* pindex = LookupBlockIndex(hash);
+            if (!pindex || (pindex->nStatus & BLOCK_HAVE_DATA) == 0) {
+              BlockValidationState state;
+              if (::ChainstateActive().AcceptBlock(pblock, state, chainparams, nullptr, true, dbp, nullptr)) {
+                  nLoaded++;
+              }
+              if (state.IsError()) {
+                  return false;
+              }
+            } else if (hash != chainparams.GetConsensus().hashGenesisBlock && pindex->nHeight % 1000 == 0) {
+              LogPrint(BCLog::REINDEX, "Block Import: already had block %s at height %d\n", hash.ToString(), pindex->nHeight);
+            }
+        }
 
-                // Activate the genesis block so normal node progress can continue
-                if (hash == chainparams.GetConsensus().hashGenesisBlock) {
-                    BlockValidationState state;
-                    if (!ActivateBestChain(state, chainparams)) {
-                        break;
-                    }
-                }
+        // Activate the genesis block so normal node progress can continue
+        if (hash == chainparams.GetConsensus().hashGenesisBlock) {
+            BlockValidationState state;
+            if (!ActivateBestChain(state, chainparams)) {
+                return false;
+            }
+        }
 
-                NotifyHeaderTip();
+        NotifyHeaderTip();
 
-                // Recursively process earlier encountered successors of this block
-                std::deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, FlatFilePos>::iterator, std::multimap<uint256, FlatFilePos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, FlatFilePos>::iterator it = range.first;
-                        std::shared_ptr<CBlock> pblockrecursive = std::make_shared<CBlock>();
-                        if (ReadBlockFromDisk(*pblockrecursive, it->second, chainparams.GetConsensus()))
-                        {
-                            LogPrint(BCLog::REINDEX, "%s: Processing out of order child %s of %s\n", __func__, pblockrecursive->GetHash().ToString(),
-                                    head.ToString());
-                            LOCK(cs_main);
-                            BlockValidationState dummy;
-                            if (::ChainstateActive().AcceptBlock(pblockrecursive, dummy, chainparams, nullptr, true, &it->second, nullptr))
-                            {
-                                nLoaded++;
-                                queue.push_back(pblockrecursive->GetHash());
-                            }
-                        }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
-                        NotifyHeaderTip();
+        // Recursively process earlier encountered successors of this block
+        std::deque<uint256> queue;
+        queue.push_back(hash);
+        while (!queue.empty()) {
+            uint256 head = queue.front();
+            queue.pop_front();
+            std::pair<std::multimap<uint256, FlatFilePos>::iterator, std::multimap<uint256, FlatFilePos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+            while (range.first != range.second) {
+                std::multimap<uint256, FlatFilePos>::iterator it = range.first;
+                std::shared_ptr<CBlock> pblockrecursive = std::make_shared<CBlock>();
+                if (ReadBlockFromDisk(*pblockrecursive, it->second, chainparams.GetConsensus()))
+                {
+                    LogPrint(BCLog::REINDEX, "%s: Processing out of order child %s of %s\n", __func__, pblockrecursive->GetHash().ToString(),
+                            head.ToString());
+                    LOCK(cs_main);
+                    BlockValidationState dummy;
+                    if (::ChainstateActive().AcceptBlock(pblockrecursive, dummy, chainparams, nullptr, true, &it->second, nullptr))
+                    {
+                        nLoaded++;
+                        queue.push_back(pblockrecursive->GetHash());
                     }
                 }
-            } catch (const std::exception& e) {
-                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+                range.first++;
+                mapBlocksUnknownParent.erase(it);
+                NotifyHeaderTip();
             }
         }
+    } catch (const std::exception& e) {
+        LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+    }
+    return true;
+}
+
+bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, FlatFilePos *dbp)
+{
+    int64_t nStart = GetTimeMillis();
+
+    int nLoaded = 0;
+    try {
+        ScanExternalBlockFile(chainparams, fileIn, dbp, [&](const std::shared_ptr<CBlock>& pblock) {
+            return ProcessExternalBlock(chainparams, pblock, pblock->GetHash(), dbp, nLoaded);
+        });
     } catch (const std::runtime_error& e) {
         AbortNode(std::string("System error: ") + e.what());
     }
@@ -5042,6 +5678,88 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, FlatFi
     return nLoaded > 0;
 }
 
+namespace {
+/** The blocks of one blk?????.dat file, read by a worker thread during -reindex */
+struct BlockFileContents
+{
+    struct Block {
+        FlatFilePos pos;
+        std::shared_ptr<CBlock> pblock;
+        uint256 hash;
+    };
+
+    int nFile;
+    bool fFound{false};
+    std::vector<Block> blocks;
+    std::string error;
+
+    explicit BlockFileContents(int nFileIn = 0) : nFile(nFileIn) {}
+};
+} // namespace
+
+bool LoadBlockFiles(const CChainParams& chainparams)
+{
+    // Workers read and deserialize whole files, hash the blocks and run their
+    // context-free checks, which leaves AcceptBlock to this thread. Each file
+    // waiting to be accepted is held in memory, so only REINDEX_FILES_AHEAD
+    // are read ahead, and no more workers than that are needed.
+    const int threads = std::max(1, std::min(g_reindex_threads, REINDEX_FILES_AHEAD));
+    OrderedWorkQueue<BlockFileContents> queue("reindex", threads, [&chainparams](BlockFileContents& contents) {
+        // The workers are not interrupted with the import thread, so they
+        // stop reading on their own once a shutdown is requested.
+        if (ShutdownRequested())
+            return;
+        FlatFilePos pos(contents.nFile, 0);
+        if (!fs::exists(GetBlockPosFilename(pos)))
+            return; // No block files left to reindex
+        FILE *file = OpenBlockFile(pos, true);
+        if (!file)
+            return; // This error is logged in OpenBlockFile
+        contents.fFound = true;
+        try {
+            ScanExternalBlockFile(chainparams, file, &pos, [&](const std::shared_ptr<CBlock>& pblock) {
+                // Sets fChecked on success, so that AcceptBlock skips these checks
+                BlockValidationState state;
+                CheckBlock(*pblock, state, chainparams.GetConsensus());
+                contents.blocks.push_back({pos, pblock, pblock->GetHash()});
+                return !ShutdownRequested();
+            });
+        } catch (const std::runtime_error& e) {
+            contents.error = e.what();
+        }
+    });
+
+    int nFileQueued = 0;
+    while (true) {
+        while (queue.Size() <= (size_t)REINDEX_FILES_AHEAD) {
+            queue.Push(BlockFileContents(nFileQueued++));
+        }
+        BlockFileContents contents;
+        queue.Pop(contents);
+        // A file may have been cut short by the shutdown
+        if (ShutdownRequested())
+            return false;
+        if (!contents.fFound)
+            break;
+
+        LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)contents.nFile);
+        if (!contents.error.empty()) {
+            AbortNode(std::string("System error: ") + contents.error);
+            continue;
+        }
+        int64_t nStart = GetTimeMillis();
+        int nLoaded = 0;
+        for (BlockFileContents::Block& block : contents.blocks) {
+            boost::this_thread::interruption_point();
+            if (!ProcessExternalBlock(chainparams, block.pblock, block.hash, &block.pos, nLoaded))
+                break;
+        }
+        if (nLoaded > 0)
+            LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
+    }
+    return true;
+}
+
 void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
 {
     if (!fCheckBlockIndex) {
@@ -5086,12 +5804,14 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
     while (pindex != nullptr) {
         nNodes++;
         if (pindexFirstInvalid == nullptr && pindex->nStatus & BLOCK_FAILED_VALID) pindexFirstInvalid = pindex;
-        if (pindexFirstMissing == nullptr && !(pindex->nStatus & BLOCK_HAVE_DATA)) pindexFirstMissing = pindex;
+        // Blocks below a UTXO set snapshot are neither missing nor validated beyond BLOCK_VALID_TRANSACTIONS.
+        const bool fAssumedValid = pindex->nStatus & BLOCK_ASSUMED_VALID;
+        if (pindexFirstMissing == nullptr && !(pindex->nStatus & BLOCK_HAVE_DATA) && !fAssumedValid) pindexFirstMissing = pindex;
         if (pindexFirstNeverProcessed == nullptr && pindex->nTx == 0) pindexFirstNeverProcessed = pindex;
         if (pindex->pprev != nullptr && pindexFirstNotTreeValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TREE) pindexFirstNotTreeValid = pindex;
         if (pindex->pprev != nullptr && pindexFirstNotTransactionsValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TRANSACTIONS) pindexFirstNotTransactionsValid = pindex;
-        if (pindex->pprev != nullptr && pindexFirstNotChainValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_CHAIN) pindexFirstNotChainValid = pindex;
-        if (pindex->pprev != nullptr && pindexFirstNotScriptsValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_SCRIPTS) pindexFirstNotScriptsValid = pindex;
+        if (pindex->pprev != nullptr && pindexFirstNotChainValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_CHAIN && !fAssumedValid) pindexFirstNotChainValid = pindex;
+        if (pindex->pprev != nullptr && pindexFirstNotScriptsValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_SCRIPTS && !fAssumedValid) pindexFirstNotScriptsValid = pindex;
 
         // Begin: actual consistency checks.
         if (pindex->pprev == nullptr) {
@@ -5104,7 +5824,7 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
         // HAVE_DATA is only equivalent to nTx > 0 (or VALID_TRANSACTIONS) if no pruning has occurred.
         if (!fHavePruned) {
             // If we've never pruned, then HAVE_DATA should be equivalent to nTx > 0
-            assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
+            if (!fAssumedValid) assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
             assert(pindexFirstMissing == pindexFirstNeverProcessed);
         } else {
             // If we have pruned, then we can only say that HAVE_DATA implies nTx > 0
@@ -5388,6 +6108,140 @@ bool DumpMempool(const CTxMemPool& pool)
     return true;
 }
 
+static const uint64_t COINS_CACHE_DUMP_VERSION = 1;
+//! Number of coins read at a time while warming up the coins cache
+static const size_t COINS_CACHE_LOAD_BATCH = 1000;
+
+bool LoadCoinsCache(CChainState& chainstate)
+{
+    int64_t start = GetTimeMicros();
+    FILE* filestr = fsbridge::fopen(GetDataDir() / "coinscache.dat", "rb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open coins cache file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    CCoinsViewDB* coins_db;
+    {
+        LOCK(cs_main);
+        if (!chainstate.CanFlushToDisk()) return false;
+        coins_db = &chainstate.CoinsDB();
+    }
+    // Leave room for the blocks to come, so that the first of them does not
+    // trigger a flush, which would empty the cache again.
+    const size_t max_usage = nCoinCacheUsage / 4 * 3;
+
+    int64_t count = 0;
+    size_t usage = 0;
+    try {
+        uint64_t version;
+        file >> version;
+        if (version != COINS_CACHE_DUMP_VERSION) {
+            return false;
+        }
+        uint64_t num_txids;
+        file >> num_txids;
+        std::vector<COutPoint> batch;
+        while (num_txids > 0 && usage < max_usage) {
+            batch.clear();
+            while (num_txids > 0 && batch.size() < COINS_CACHE_LOAD_BATCH) {
+                uint256 txid;
+                uint64_t num_outputs;
+                file >> txid;
+                file >> VARINT(num_outputs);
+                while (num_outputs--) {
+                    uint32_t n;
+                    file >> VARINT(n);
+                    batch.emplace_back(txid, n);
+                }
+                --num_txids;
+            }
+
+            // Read the coins from the database first, without cs_main, so
+            // that it is only held while they are copied into the cache.
+            for (const COutPoint& outpoint : batch) {
+                coins_db->HaveCoin(outpoint);
+            }
+            {
+                LOCK(cs_main);
+                CCoinsViewCache& coins_cache = chainstate.CoinsTip();
+                for (const COutPoint& outpoint : batch) {
+                    if (coins_cache.HaveCoin(outpoint)) ++count;
+                }
+                usage = coins_cache.DynamicMemoryUsage();
+            }
+            if (ShutdownRequested())
+                return false;
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize coins cache data on disk: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+
+    LogPrintf("Loaded %i coins into the coins cache (%.1fMiB) in %gs\n", count, usage * (1.0 / (1 << 20)), (GetTimeMicros() - start) * MICRO);
+    return true;
+}
+
+bool DumpCoinsCache(CChainState& chainstate)
+{
+    int64_t start = GetTimeMicros();
+
+    std::vector<COutPoint> outpoints;
+    {
+        LOCK(cs_main);
+        if (!chainstate.CanFlushToDisk()) return false;
+        chainstate.CoinsTip().GetUnspentOutpoints(outpoints);
+    }
+    // Keep the previous dump rather than replace it with nothing, e.g. after
+    // a shutdown right after startup.
+    if (outpoints.empty()) return false;
+    // Sorted by txid, the coins are also read from the database in key order
+    std::sort(outpoints.begin(), outpoints.end());
+
+    int64_t mid = GetTimeMicros();
+
+    try {
+        FILE* filestr = fsbridge::fopen(GetDataDir() / "coinscache.dat.new", "wb");
+        if (!filestr) {
+            return false;
+        }
+
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+
+        uint64_t version = COINS_CACHE_DUMP_VERSION;
+        file << version;
+
+        // Each txid is written once, followed by the indexes of its outputs
+        uint64_t num_txids = 0;
+        for (size_t i = 0; i < outpoints.size(); ++i) {
+            if (i == 0 || outpoints[i].hash != outpoints[i - 1].hash) ++num_txids;
+        }
+        file << num_txids;
+        for (size_t i = 0; i < outpoints.size();) {
+            size_t end = i;
+            while (end < outpoints.size() && outpoints[end].hash == outpoints[i].hash) ++end;
+            uint64_t num_outputs = end - i;
+            file << outpoints[i].hash;
+            file << VARINT(num_outputs);
+            for (; i < end; ++i) {
+                file << VARINT(outpoints[i].n);
+            }
+        }
+
+        if (!FileCommit(file.Get()))
+            throw std::runtime_error("FileCommit failed");
+        file.fclose();
+        RenameOver(GetDataDir() / "coinscache.dat.new", GetDataDir() / "coinscache.dat");
+        int64_t last = GetTimeMicros();
+        LogPrintf("Dumped %u coins cache outpoints: %gs to copy, %gs to dump\n", outpoints.size(), (mid-start)*MICRO, (last-mid)*MICRO);
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to dump coins cache: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+    return true;
+}
+
 //! Guess how far we are in the verification process at the given block index
 //! require cs_main if pindex has not been validated yet (because nChainTx might be unset)
 double GuessVerificationProgress(const ChainTxData& data, const CBlockIndex *pindex) {
@@ -5406,17 +6260,3 @@ double GuessVerificationProgress(const ChainTxData& data, const CBlockIndex *pin
 
     return std::min<double>(pindex->nChainTx / fTxTotal, 1.0);
 }
-
-class CMainCleanup
-{
-public:
-    CMainCleanup() {}
-    ~CMainCleanup() {
-        // block headers
-        BlockMap::iterator it1 = g_blockman.m_block_index.begin();
-        for (; it1 != g_blockman.m_block_index.end(); it1++)
-            delete (*it1).second;
-        g_blockman.m_block_index.clear();
-    }
-};
-static CMainCleanup instance_of_cmaincleanup;
@@ -11,15 +11,18 @@
 #endif
 
 #include <amount.h>
+#include <chain.h>
 #include <coins.h>
 #include <crypto/common.h> // for ReadLE64
 #include <fs.h>
 #include <policy/feerate.h>
 #include <protocol.h> // For CMessageHeader::MessageStartChars
 #include <script/script_error.h>
+#include <support/allocators/pool.h>
 #include <sync.h>
 #include <txmempool.h> // For CTxMemPool::cs
 #include <txdb.h>
+#include <util/memory.h>
 #include <versionbits.h>
 #include <serialize.h>
 
@@ -33,6 +36,7 @@
 
 class CChainState;
 class BlockValidationState;
+class CAutoFile;
 class CBlockIndex;
 class CBlockTreeDB;
 class CBlockUndo;
@@ -44,9 +48,11 @@ class CBlockPolicyEstimator;
 class CTxMemPool;
 class TxValidationState;
 struct ChainTxData;
+class SnapshotMetadata;
 
 struct DisconnectedBlockTransactions;
 struct PrecomputedTransactionData;
+struct ShardedCacheStats;
 struct LockPoints;
 
 /** Default for -minrelaytxfee, minimum relay fee for transactions */
@@ -75,11 +81,27 @@ static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 /** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
+/** Maximum number of blk?????.dat and rev?????.dat files kept open for reading blocks and undo data */
+static const size_t MAX_BLOCK_READER_FILES = 64;
+/** Number of bytes of block data read ahead by ReadAheadBlockFromDisk */
+static const size_t BLOCK_READ_AHEAD_SIZE = 4 << 20; // 4 MiB
 
 /** Maximum number of dedicated script-checking threads allowed */
 static const int MAX_SCRIPTCHECK_THREADS = 15;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Default for -scriptcheckwindow, blocks whose script checks are joined together during IBD (0 = join every block) */
+static const int DEFAULT_SCRIPT_CHECK_WINDOW = 0;
+/** Maximum for -scriptcheckwindow */
+static const int MAX_SCRIPT_CHECK_WINDOW = 64;
+/** Minimum number of uncached block inputs for ConnectBlock to read them in parallel */
+static const size_t MIN_PREFETCH_COINS = 16;
+/** Default for -reindexthreads, threads reading block files during -reindex and preparing blocks for indexes catching up */
+static const int DEFAULT_REINDEX_THREADS = 4;
+/** Maximum for -reindexthreads */
+static const int MAX_REINDEX_THREADS = 16;
+/** Number of blk?????.dat files read ahead of the one being imported during -reindex, each held in memory */
+static const int REINDEX_FILES_AHEAD = 2;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -116,6 +138,8 @@ static const char* const DEFAULT_BLOCKFILTERINDEX = "0";
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 /** Default for -persistmempool */
 static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Default for -persistcoinscache */
+static const bool DEFAULT_PERSIST_COINS_CACHE = false;
 /** Default for using fee filter */
 static const bool DEFAULT_FEEFILTER = true;
 
@@ -140,7 +164,8 @@ extern RecursiveMutex cs_main;
 extern CBlockPolicyEstimator feeEstimator;
 extern CTxMemPool mempool;
 typedef std::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
-extern std::map<unsigned int, unsigned int> mapHashedBlocks;
+/** Size of the chunks the block index entries are allocated from */
+static const size_t BLOCK_INDEX_ARENA_CHUNK_BYTES = 1 << 20;
 extern Mutex g_best_block_mutex;
 extern std::condition_variable g_best_block_cv;
 extern uint256 g_best_block;
@@ -150,6 +175,10 @@ extern std::atomic_bool fReindex;
  * False indicates all script checking is done on the main threadMessageHandler thread.
  */
 extern bool g_parallel_script_checks;
+/** Number of consecutive blocks whose script checks are joined together during IBD, see -scriptcheckwindow */
+extern int g_script_check_window;
+/** Number of threads reading block files during -reindex, and reading and preparing blocks for each index catching up, see -reindexthreads */
+extern int g_reindex_threads;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
@@ -234,6 +263,8 @@ FILE* OpenBlockFile(const FlatFilePos &pos, bool fReadOnly = false);
 fs::path GetBlockPosFilename(const FlatFilePos &pos);
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, FlatFilePos *dbp = nullptr);
+/** Import blocks from the blk?????.dat files in order, reading and checking a few files ahead in parallel (-reindex). Returns false if interrupted by a shutdown. */
+bool LoadBlockFiles(const CChainParams& chainparams);
 /** Ensures we have a genesis block in the block tree, possibly writing one to disk. */
 bool LoadGenesisBlock(const CChainParams& chainparams);
 /** Load the block tree and coins database from disk,
@@ -243,6 +274,8 @@ bool LoadBlockIndex(const CChainParams& chainparams) EXCLUSIVE_LOCKS_REQUIRED(cs
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck(int worker_num);
+/** Run an instance of the coins prefetch thread */
+void ThreadCoinsPrefetch(int worker_num);
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
 bool GetTransaction(const uint256& hash, CTransactionRef& tx, const Consensus::Params& params, uint256& hashBlock, const CBlockIndex* const blockIndex = nullptr);
 /**
@@ -359,6 +392,8 @@ public:
 
 /** Initializes the script-execution cache */
 void InitScriptExecutionCache();
+/** Hit, miss and lock contention counters of the script-execution cache */
+ShardedCacheStats GetScriptExecutionCacheStats();
 
 
 /** Functions for disk access for blocks */
@@ -369,11 +404,26 @@ bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CBlockIndex* pindex
 
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex);
 
+/**
+ * Hint that the blocks stored from this one on, and their undo data, are read
+ * next, as by a scan over the chain. Reading the following BLOCK_READ_AHEAD_SIZE
+ * bytes from disk is started in the background.
+ */
+void ReadAheadBlockFromDisk(const CBlockIndex* pindex);
+
 /** Functions for validating blocks and updating the block tree */
 
 /** Context-independent validity checks */
 bool CheckBlock(const CBlock& block, BlockValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
 
+/**
+ * Remember the kernel hash of a proof-of-stake block minted by this node, so
+ * that TestBlockValidity on it does not have to look the stake input up on
+ * disk again. ConnectBlock still checks the proof of stake when the block is
+ * connected.
+ */
+void AddLocalStakeProof(const uint256& hashBlock, const uint256& hashProofOfStake);
+
 /** Check a block is completely valid from start to finish (only works on top of our current best block) */
 bool TestBlockValidity(BlockValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
@@ -414,6 +464,7 @@ enum DisconnectResult
 };
 
 class ConnectTrace;
+class ScriptCheckWindow;
 
 /** @see CChainState::FlushStateToDisk */
 enum class FlushStateMode {
@@ -436,6 +487,23 @@ struct CBlockIndexWorkComparator
  * candidate tips is not maintained here.
  */
 class BlockManager {
+    typedef PoolResource<sizeof(CBlockIndex), alignof(CBlockIndex)> BlockIndexArena;
+
+    /**
+     * Storage for the entries of m_block_index. Entries are only freed all at
+     * once by Unload(), so they are placed back to back in large chunks rather
+     * than allocated one by one. This saves the allocator's overhead on every
+     * entry and keeps entries loaded together close in memory.
+     */
+    std::unique_ptr<BlockIndexArena> m_block_index_arena GUARDED_BY(cs_main){MakeUnique<BlockIndexArena>(BLOCK_INDEX_ARENA_CHUNK_BYTES)};
+
+    /** Construct an entry in m_block_index_arena */
+    template <typename... Args>
+    CBlockIndex* NewBlockIndex(Args&&... args) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+    {
+        return new (m_block_index_arena->Allocate(sizeof(CBlockIndex), alignof(CBlockIndex))) CBlockIndex(std::forward<Args>(args)...);
+    }
+
 public:
     BlockMap m_block_index GUARDED_BY(cs_main);
 
@@ -483,7 +551,7 @@ public:
     void Unload() EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
     CBlockIndex* AddToBlockIndex(const CBlockHeader& block) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
-    /** Create a new block index entry for a given block hash */
+    /** Create a new block index entry for a given block hash. It lives until Unload(). */
     CBlockIndex* InsertBlockIndex(const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
     /**
@@ -516,11 +584,14 @@ public:
     //! This view wraps access to the leveldb instance and handles read errors gracefully.
     CCoinsViewErrorCatcher m_catcherview GUARDED_BY(cs_main);
 
+    //! This view holds the coins of a flush while they are written to the database in the background.
+    CCoinsViewBackgroundFlush m_flushview GUARDED_BY(cs_main);
+
     //! This is the top layer of the cache hierarchy - it keeps as many coins in memory as
     //! can fit per the dbcache setting.
     std::unique_ptr<CCoinsViewCache> m_cacheview GUARDED_BY(cs_main);
 
-    //! This constructor initializes CCoinsViewDB and CCoinsViewErrorCatcher instances, but it
+    //! This constructor initializes the CCoinsViewDB, CCoinsViewErrorCatcher and CCoinsViewBackgroundFlush instances, but it
     //! *does not* create a CCoinsViewCache instance by default. This is done separately because the
     //! presence of the cache has implications on whether or not we're allowed to flush the cache's
     //! state to disk, which should not be done until the health of the database is verified.
@@ -649,6 +720,13 @@ public:
         return m_coins_views->m_catcherview;
     }
 
+    //! @returns A reference to the view below the in-memory cache, which
+    //!     includes a flush that is still being written to the database.
+    CCoinsViewBackgroundFlush& CoinsFlushView() EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+    {
+        return m_coins_views->m_flushview;
+    }
+
     //! Destructs all objects related to accessing the UTXO set.
     void ResetCoinsViews() { m_coins_views.reset(); }
 
@@ -700,7 +778,7 @@ public:
     // Block (dis)connection on a given view:
     DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view);
     bool ConnectBlock(const CBlock& block, BlockValidationState& state, CBlockIndex* pindex,
-                      CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck = false) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+                      CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck = false, ScriptCheckWindow* script_window = nullptr) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
     // Apply the effects of a block disconnection on the UTXO set.
     bool DisconnectTip(BlockValidationState& state, const CChainParams& chainparams, DisconnectedBlockTransactions* disconnectpool) EXCLUSIVE_LOCKS_REQUIRED(cs_main, ::mempool.cs);
@@ -732,6 +810,20 @@ public:
     /** Update the chain tip based on database information, i.e. CoinsTip()'s best block. */
     bool LoadChainTip(const CChainParams& chainparams) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
+    /**
+     * Replace the UTXO set with the snapshot read from coins_file, whose
+     * metadata was already read, and make its base block the tip.
+     *
+     * Only possible while the chain has not advanced past the genesis block.
+     * The snapshot must match the hash known for its base height (see
+     * -assumeutxo). The blocks up to the base are then marked
+     * BLOCK_ASSUMED_VALID: they are neither downloaded nor verified, and can't
+     * be served to peers.
+     *
+     * @returns false and sets error if the snapshot can't be loaded
+     */
+    bool LoadSnapshot(CAutoFile& coins_file, const SnapshotMetadata& metadata, const CChainParams& chainparams, std::string& error) LOCKS_EXCLUDED(cs_main);
+
     //! Dictates whether we need to flush the cache to disk or not.
     //!
     //! @return the state of the size of the coins cache.
@@ -745,7 +837,8 @@ public:
 
 private:
     bool ActivateBestChainStep(BlockValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexMostWork, const std::shared_ptr<const CBlock>& pblock, bool& fInvalidFound, ConnectTrace& connectTrace) EXCLUSIVE_LOCKS_REQUIRED(cs_main, ::mempool.cs);
-    bool ConnectTip(BlockValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions& disconnectpool) EXCLUSIVE_LOCKS_REQUIRED(cs_main, ::mempool.cs);
+    bool ConnectTip(BlockValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions& disconnectpool, ScriptCheckWindow* script_window = nullptr) EXCLUSIVE_LOCKS_REQUIRED(cs_main, ::mempool.cs);
+    bool FinishScriptCheckWindow(const CChainParams& chainparams, ScriptCheckWindow& script_window, ConnectTrace& connectTrace) EXCLUSIVE_LOCKS_REQUIRED(cs_main, ::mempool.cs);
 
     void InvalidBlockFound(CBlockIndex *pindex, const BlockValidationState &state) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
     CBlockIndex* FindMostWorkChain() EXCLUSIVE_LOCKS_REQUIRED(cs_main);
@@ -753,6 +846,10 @@ private:
 
     bool RollforwardBlock(const CBlockIndex* pindex, CCoinsViewCache& inputs, const CChainParams& params) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
+    //! Read the uncached inputs of a block into CoinsTip() on the coins prefetch threads.
+    //! @return the number of inputs that were read.
+    size_t PrefetchInputCoins(const CBlock& block) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
     //! Mark a block as not having block data
     void EraseBlockData(CBlockIndex* index) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 };
@@ -810,6 +907,12 @@ bool DumpMempool(const CTxMemPool& pool);
 /** Load the mempool from disk. */
 bool LoadMempool(CTxMemPool& pool);
 
+/** Dump the outpoints of the coins in the cache to disk, to warm the cache up after a restart. */
+bool DumpCoinsCache(CChainState& chainstate);
+
+/** Load the coins dumped by DumpCoinsCache() into the cache, while it has room. */
+bool LoadCoinsCache(CChainState& chainstate);
+
 //! Check whether the block associated with this index entry is pruned or not.
 inline bool IsBlockPruned(const CBlockIndex* pblockindex)
 {
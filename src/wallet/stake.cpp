@@ -10,16 +10,39 @@
 #include <key_io.h>
 #include <masternode/masternode-payments.h>
 #include <policy/policy.h>
+#include <pos/cache.h>
 #include <pos/kernel.h>
 #include <wallet/coincontrol.h>
 
 CStake stake;
 
-//! performance indicators
-extern int cacheHit;
-extern int cacheMiss;
-
 typedef std::vector<unsigned char> valtype;
+
+//! Copy the key that spends a kernel output into the wallet's staking key store
+static bool CacheStakingKey(CWallet& wallet, const CScript& scriptPubKey)
+{
+    std::vector<valtype> vSolutions;
+    CKeyID keyID;
+    txnouttype whichType = Solver(scriptPubKey, vSolutions);
+    if (whichType == TX_PUBKEY)
+        keyID = CPubKey(vSolutions[0]).GetID();
+    else if (whichType == TX_PUBKEYHASH || whichType == TX_WITNESS_V0_KEYHASH)
+        keyID = CKeyID(uint160(vSolutions[0]));
+    else
+        return false;
+
+    StakingKeyStore& staking_keys = wallet.GetStakingKeys();
+    if (staking_keys.HaveKey(keyID))
+        return true;
+
+    CKey key;
+    LegacyScriptPubKeyMan* spk_man = wallet.GetLegacyScriptPubKeyMan();
+    if (!spk_man || !spk_man->GetKey(keyID, key))
+        return false;
+    staking_keys.AddKey(key);
+    return true;
+}
+
 bool CStake::SelectStakeCoins(std::set<std::pair<const CWalletTx*, unsigned int>>& setCoins, CAmount nTargetAmount) const
 {
     auto m_wallet = GetMainWallet();
@@ -48,6 +71,10 @@ bool CStake::SelectStakeCoins(std::set<std::pair<const CWalletTx*, unsigned int>
         if (out.tx->tx->vout[out.i].nValue == Params().GetConsensus().nCollateralAmount)
             continue;
 
+        //make sure the staking signer can spend it
+        if (!CacheStakingKey(*m_wallet, out.tx->tx->vout[out.i].scriptPubKey))
+            continue;
+
         //add to our stake set
         setCoins.insert(std::make_pair(out.tx, out.i));
         nAmountSelected += out.tx->tx->vout[out.i].nValue;
@@ -101,7 +128,7 @@ uint256 CStake::ReturnBestStakeSeen()
 }
 
 typedef std::vector<unsigned char> valtype;
-bool CStake::CreateCoinStake(unsigned int nBits, CMutableTransaction& txNew, unsigned int& nTxNewTime)
+bool CStake::CreateCoinStake(unsigned int nBits, CMutableTransaction& txNew, unsigned int& nTxNewTime, uint256& hashProofOfStakeOut)
 {
     txNew.vin.clear();
     txNew.vout.clear();
@@ -116,17 +143,19 @@ bool CStake::CreateCoinStake(unsigned int nBits, CMutableTransaction& txNew, uns
     if (!m_wallet)
         return false;
 
-    CCoinControl coin_control;
-    CAmount nBalance = m_wallet->GetBalance(0, coin_control.m_avoid_address_reuse).m_mine_trusted;
-
-    if (nBalance <= 0)
-        return false;
-
     static std::set<std::pair<const CWalletTx*, unsigned int>> setStakeCoins;
     static int nLastStakeSetUpdate = 0;
+    static CAmount nBalance = 0;
 
-    if (GetTime() - nLastStakeSetUpdate > nStakeSetUpdateTime) {
+    // The stake set, its balance and the staking keys are refreshed together;
+    // in between, the kernel search and signing below do not touch cs_wallet.
+    const StakingKeyStore& staking_keys = m_wallet->GetStakingKeys();
+    if (GetTime() - nLastStakeSetUpdate > nStakeSetUpdateTime || staking_keys.IsEmpty()) {
         setStakeCoins.clear();
+        CCoinControl coin_control;
+        nBalance = m_wallet->GetBalance(0, coin_control.m_avoid_address_reuse).m_mine_trusted;
+        if (nBalance <= 0)
+            return false;
         if (!SelectStakeCoins(setStakeCoins, nBalance))
             return false;
 
@@ -136,13 +165,6 @@ bool CStake::CreateCoinStake(unsigned int nBits, CMutableTransaction& txNew, uns
     if (setStakeCoins.empty())
         return false;
 
-    //! required as cwallet isnt acceptable now..
-    LegacyScriptPubKeyMan* spk_man = m_wallet->GetLegacyScriptPubKeyMan();
-    if (!spk_man) {
-        LogPrint(BCLog::POS, "CreateCoinStake : failed to get signing provider\n");
-        return false;
-    }
-
     CAmount nCredit = 0;
     CScript scriptPubKeyKernel;
     std::unique_ptr<SigningProvider> provider;
@@ -151,6 +173,7 @@ bool CStake::CreateCoinStake(unsigned int nBits, CMutableTransaction& txNew, uns
     //! benchmarking variables
     unsigned int nTries = 0;
     auto s0 = GetTimeMillis();
+    const uint256 hashTip = ::ChainActive().Tip()->GetBlockHash();
 
     for (const auto& pcoin : setStakeCoins) {
         // Read block header
@@ -188,12 +211,12 @@ bool CStake::CreateCoinStake(unsigned int nBits, CMutableTransaction& txNew, uns
                 LogPrintf("CStake::CreateCoinStake(): parsed kernel type=%d\n", whichType);
 
                 if (whichType == TX_PUBKEYHASH || whichType == TX_WITNESS_V0_KEYHASH) {
-                    CKey key;
-                    if (!m_wallet->GetLegacyScriptPubKeyMan()->GetKey(CKeyID(uint160(vSolutions[0])), key)) {
+                    CPubKey pubkey;
+                    if (!staking_keys.GetPubKey(CKeyID(uint160(vSolutions[0])), pubkey)) {
                         LogPrint(BCLog::POS, "%s: failed to get key for kernel type=%d\n", __func__, whichType);
                         break;
                     }
-                    scriptPubKeyOut << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+                    scriptPubKeyOut << ToByteVector(pubkey) << OP_CHECKSIG;
                 } else {
                     scriptPubKeyOut = scriptPubKeyKernel;
                 }
@@ -213,6 +236,7 @@ bool CStake::CreateCoinStake(unsigned int nBits, CMutableTransaction& txNew, uns
                 if (gArgs.GetBoolArg("-printcoinstake", false))
                     LogPrintf("CreateCoinStake : added kernel type=%d\n", whichType);
 
+                hashProofOfStakeOut = hashProofOfStake;
                 fKernelFound = true;
                 break;
             }
@@ -223,7 +247,8 @@ bool CStake::CreateCoinStake(unsigned int nBits, CMutableTransaction& txNew, uns
 
     auto s1 = GetTimeMillis();
     auto timetaken = s1 - s0;
-    LogPrintf("%s - took %dms to iterate %d inputs (%d hit %d miss)\n", __func__, timetaken, nTries, cacheHit, cacheMiss);
+    LogPrintf("%s - took %dms to iterate %d inputs (%d hit %d miss)\n", __func__, timetaken, nTries, cacheHit.load(), cacheMiss.load());
+    m_wallet->MarkBlockHashed(hashTip, GetTime());
 
     if (nCredit == 0 || nCredit > nBalance)
         return false;
@@ -266,7 +291,7 @@ bool CStake::CreateCoinStake(unsigned int nBits, CMutableTransaction& txNew, uns
     // Sign the input coins
     int nIn = 0;
     for (const auto pcoin : vwtxPrev) {
-        if (!SignSignature(*spk_man, *pcoin.first->tx, txNew, nIn++, SIGHASH_ALL))
+        if (!SignSignature(staking_keys, *pcoin.first->tx, txNew, nIn++, SIGHASH_ALL))
             return error("CreateCoinStake : failed to sign coinstake");
     }
 
@@ -38,7 +38,7 @@ public:
 
     bool MintableCoins();
     bool SelectStakeCoins(std::set<std::pair<const CWalletTx*, unsigned int> >& setCoins, CAmount nTargetAmount) const;
-    bool CreateCoinStake(unsigned int nBits, CMutableTransaction& txNew, unsigned int& nTxNewTime);
+    bool CreateCoinStake(unsigned int nBits, CMutableTransaction& txNew, unsigned int& nTxNewTime, uint256& hashProofOfStakeOut);
     void BestStakeSeen(uint256& hash);
     void ResetBestStakeSeen();
     uint256 ReturnBestStakeSeen();
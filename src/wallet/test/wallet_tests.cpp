@@ -298,7 +298,11 @@ static int64_t AddTx(CWallet& wallet, uint32_t lockTime, int64_t mockTime, int64
     if (blockTime > 0) {
         auto locked_chain = wallet.chain().lock();
         LockAssertion lock(::cs_main);
-        auto inserted = ::BlockIndex().emplace(GetRandHash(), new CBlockIndex);
+        // Block index entries are otherwise allocated by the block manager,
+        // which does not free them one by one, so the test keeps this one.
+        static std::vector<std::unique_ptr<CBlockIndex>> test_blocks;
+        test_blocks.emplace_back(new CBlockIndex);
+        auto inserted = ::BlockIndex().emplace(GetRandHash(), test_blocks.back().get());
         assert(inserted.second);
         const uint256& hash = inserted.first->first;
         block = inserted.first->second;
@@ -304,6 +304,74 @@ void CWallet::setStakingFlag(bool status)
     LogPrintf("setStakingState %s\n", status ? "enabled" : "disabled");
 }
 
+void CWallet::MarkBlockHashed(const uint256& hashBlock, int64_t nTime)
+{
+    LOCK(cs_hashed_blocks);
+    m_hashed_blocks[hashBlock] = nTime;
+    while (m_hashed_blocks.size() > MAX_HASHED_BLOCKS) {
+        auto oldest = std::min_element(m_hashed_blocks.begin(), m_hashed_blocks.end(),
+            [](const std::pair<const uint256, int64_t>& a, const std::pair<const uint256, int64_t>& b) { return a.second < b.second; });
+        m_hashed_blocks.erase(oldest);
+    }
+}
+
+bool CWallet::GetBlockHashedTime(const uint256& hashBlock, int64_t& nTime) const
+{
+    LOCK(cs_hashed_blocks);
+    auto it = m_hashed_blocks.find(hashBlock);
+    if (it == m_hashed_blocks.end())
+        return false;
+    nTime = it->second;
+    return true;
+}
+
+bool StakingKeyStore::GetPubKey(const CKeyID& address, CPubKey& pubkey) const
+{
+    LOCK(cs_keys);
+    auto it = m_pubkeys.find(address);
+    if (it == m_pubkeys.end())
+        return false;
+    pubkey = it->second;
+    return true;
+}
+
+bool StakingKeyStore::GetKey(const CKeyID& address, CKey& key) const
+{
+    LOCK(cs_keys);
+    auto it = m_keys.find(address);
+    if (it == m_keys.end())
+        return false;
+    key = it->second;
+    return true;
+}
+
+bool StakingKeyStore::HaveKey(const CKeyID& address) const
+{
+    LOCK(cs_keys);
+    return m_keys.count(address) > 0;
+}
+
+void StakingKeyStore::AddKey(const CKey& key)
+{
+    const CPubKey pubkey = key.GetPubKey();
+    LOCK(cs_keys);
+    m_keys[pubkey.GetID()] = key;
+    m_pubkeys[pubkey.GetID()] = pubkey;
+}
+
+void StakingKeyStore::Clear()
+{
+    LOCK(cs_keys);
+    m_keys.clear();
+    m_pubkeys.clear();
+}
+
+bool StakingKeyStore::IsEmpty() const
+{
+    LOCK(cs_keys);
+    return m_keys.empty();
+}
+
 void CWallet::UpgradeKeyMetadata()
 {
     if (IsLocked() || IsWalletFlagSet(WALLET_FLAG_KEY_ORIGIN_METADATA)) {
@@ -4319,6 +4387,7 @@ bool CWallet::Lock()
         LOCK(cs_wallet);
         vMasterKey.clear();
     }
+    m_staking_keys.Clear();
 
     NotifyStatusChanged(this);
     return true;
@@ -96,6 +96,9 @@ constexpr CAmount HIGH_MAX_TX_FEE{100 * HIGH_TX_FEE_PER_KB};
 //! Pre-calculated constants for input size estimation in *virtual size*
 static constexpr size_t DUMMY_NESTED_P2WPKH_INPUT_SIZE = 91;
 
+//! Maximum number of chain tips remembered in the per-wallet kernel search bookkeeping
+static constexpr size_t MAX_HASHED_BLOCKS = 16;
+
 class CCoinControl;
 class COutput;
 class CScript;
@@ -664,6 +667,29 @@ struct CoinSelectionParams
     CoinSelectionParams() {}
 };
 
+/**
+ * Keys of the wallet's stakeable outputs, copied out of the key store while the
+ * wallet is unlocked so that coinstake and block signing need neither cs_wallet
+ * nor the key store lock. The secrets live in CKey's secure_allocator memory,
+ * i.e. in pages held by LockedPoolManager, and are dropped when the wallet locks.
+ */
+class StakingKeyStore : public SigningProvider
+{
+private:
+    mutable Mutex cs_keys;
+    std::map<CKeyID, CKey> m_keys GUARDED_BY(cs_keys);
+    std::map<CKeyID, CPubKey> m_pubkeys GUARDED_BY(cs_keys);
+
+public:
+    bool GetPubKey(const CKeyID& address, CPubKey& pubkey) const override;
+    bool GetKey(const CKeyID& address, CKey& key) const override;
+    bool HaveKey(const CKeyID& address) const override;
+
+    void AddKey(const CKey& key);
+    void Clear();
+    bool IsEmpty() const;
+};
+
 class WalletRescanReserver; //forward declarations for ScanForWalletTransactions/RescanFromTime
 /**
  * A CWallet maintains a set of transactions and balances, and provides the ability to create new transactions.
@@ -775,6 +801,17 @@ private:
     // ScriptPubKeyMan::GetID. In many cases it will be the hash of an internal structure
     std::map<uint256, std::unique_ptr<ScriptPubKeyMan>> m_spk_managers;
 
+    /**
+     * Staking bookkeeping: tips the kernel search has already covered, keyed by
+     * block hash so a competing tip at the same height is searched afresh.
+     * Bounded by MAX_HASHED_BLOCKS; has its own lock so the staker does not
+     * contend on cs_wallet.
+     */
+    mutable Mutex cs_hashed_blocks;
+    std::map<uint256, int64_t> m_hashed_blocks GUARDED_BY(cs_hashed_blocks);
+
+    StakingKeyStore m_staking_keys;
+
 public:
     /*
      * Main wallet lock.
@@ -1075,6 +1112,13 @@ public:
     int64_t m_last_coin_stake_search_time{0};
     int64_t m_last_coin_stake_search_interval{0};
 
+    /** Record that the kernel search has covered the tip with the given hash at nTime. */
+    void MarkBlockHashed(const uint256& hashBlock, int64_t nTime);
+    /** Last time the kernel search covered the tip with the given hash, if it ever did. */
+    bool GetBlockHashedTime(const uint256& hashBlock, int64_t& nTime) const;
+    /** Signer for coinstakes and staked blocks; filled by the stake coin selection. */
+    StakingKeyStore& GetStakingKeys() { return m_staking_keys; }
+
     size_t KeypoolCountExternalKeys() const EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
     bool TopUpKeyPool(unsigned int kpSize = 0);
 
@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+# Copyright (c) 2020 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test loading a UTXO set snapshot with `loadtxoutset`.
+
+node0 mines a chain and dumps its UTXO set. node1 starts without any blocks
+and loads the snapshot:
+
+    - before it has the headers up to the base, the snapshot is refused
+    - with the wrong hash for the base height in -assumeutxo, it is refused
+    - with the right hash, it is loaded and node1 has the same UTXO set as
+      node0, without having downloaded the blocks up to the base
+
+node1 then keeps the loaded chain across a restart, syncs the blocks past
+the base from node0, and stops offering NODE_NETWORK. Its chain transaction
+count at the base is the one from the snapshot, and once it has connected the
+blocks past the base, whose headers it had before the load, a snapshot dumped
+by either node is the same.
+"""
+from decimal import Decimal
+
+from test_framework.address import script_to_p2sh
+from test_framework.messages import (
+    CTransaction,
+    FromHex,
+    ToHex,
+)
+from test_framework.script import CScript, OP_TRUE
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    assert_raises_rpc_error,
+    connect_nodes,
+)
+
+from pathlib import Path
+
+WRONG_HASH = '00' * 31 + '01'
+COINBASE_MATURITY = 25
+# Witnesses are refused in legacy mode, so spend a P2SH output instead
+REDEEM_SCRIPT = CScript([OP_TRUE])
+ADDRESS_P2SH_OP_TRUE = script_to_p2sh(REDEEM_SCRIPT)
+
+
+def utxo_set_info(node):
+    info = node.gettxoutsetinfo()
+    # The size of the coins database depends on how it was written
+    del info['disk_size']
+    return info
+
+
+def spend_coinbase(node, blockhash):
+    """Spend the coinbase of a block mined to ADDRESS_P2SH_OP_TRUE."""
+    coinbase = node.getblock(blockhash)['tx'][0]
+    value = node.gettxout(coinbase, 0)['value']
+    tx = FromHex(CTransaction(), node.createrawtransaction(
+        [{'txid': coinbase, 'vout': 0}],
+        {ADDRESS_P2SH_OP_TRUE: value - Decimal("0.00001")}))
+    tx.vin[0].scriptSig = CScript([REDEEM_SCRIPT])
+    return node.sendrawtransaction(ToHex(tx))
+
+
+class AssumeutxoTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+
+    def setup_network(self):
+        # node1 must not sync any blocks before the snapshot is loaded
+        self.setup_nodes()
+
+    def run_test(self):
+        node0, node1 = self.nodes
+
+        self.log.info("Dump the UTXO set of node0")
+        # A block with more than a coinbase, so that the chain's transaction
+        # count differs from its block count
+        node0.generatetoaddress(COINBASE_MATURITY + 1, ADDRESS_P2SH_OP_TRUE)
+        spend_coinbase(node0, node0.getblockhash(1))
+        node0.generate(1)
+        base_height = node0.getblockcount()
+        base_hash = node0.getbestblockhash()
+        out = node0.dumptxoutset('utxo.dat')
+        snapshot_path = str(Path(node0.datadir) / self.chain / 'utxo.dat')
+        assert_equal(out['base_hash'], base_hash)
+        base_utxo_set_info = utxo_set_info(node0)
+        # Blocks past the base, whose headers node1 gets before the load
+        node0.generate(2)
+
+        self.restart_node(1, extra_args=['-assumeutxo={}:{}'.format(base_height, WRONG_HASH)])
+
+        self.log.info("Refuse a snapshot whose base is not in the headers chain")
+        assert_raises_rpc_error(
+            -1, 'The base block {} of the snapshot is not in the headers chain'.format(base_hash),
+            node1.loadtxoutset, snapshot_path)
+
+        for height in range(1, node0.getblockcount() + 1):
+            node1.submitheader(node0.getblockheader(node0.getblockhash(height), False))
+        assert_equal(node1.getblockcount(), 0)
+
+        self.log.info("Refuse a snapshot whose hash does not match -assumeutxo")
+        assert_raises_rpc_error(
+            -1, 'The snapshot hash {} does not match the expected hash {}'.format(out['snapshot_hash'], WRONG_HASH),
+            node1.loadtxoutset, snapshot_path)
+        assert_equal(node1.getblockcount(), 0)
+
+        self.log.info("Load the snapshot")
+        self.restart_node(1, extra_args=['-assumeutxo={}:{}'.format(base_height, out['snapshot_hash'])])
+        loaded = node1.loadtxoutset(snapshot_path)
+        assert_equal(loaded['coins_loaded'], out['coins_written'])
+        assert_equal(loaded['base_hash'], base_hash)
+        assert_equal(loaded['base_height'], base_height)
+        assert_equal(node1.getbestblockhash(), base_hash)
+        assert_equal(utxo_set_info(node1), base_utxo_set_info)
+        assert 'NETWORK' not in node1.getnetworkinfo()['localservicesnames']
+        assert_raises_rpc_error(-1, 'Block not found on disk', node1.getblock, base_hash)
+        base_txcount = node0.getchaintxstats(1, base_hash)['txcount']
+        assert_equal(node1.getchaintxstats(1, base_hash)['txcount'], base_txcount)
+
+        self.log.info("Keep the loaded chain across a restart")
+        self.restart_node(1, extra_args=['-assumeutxo={}:{}'.format(base_height, out['snapshot_hash'])])
+        assert_equal(node1.getbestblockhash(), base_hash)
+        assert 'NETWORK' not in node1.getnetworkinfo()['localservicesnames']
+        assert_equal(node1.getchaintxstats(1, base_hash)['txcount'], base_txcount)
+
+        self.log.info("Sync the blocks past the base")
+        connect_nodes(node1, 0)
+        node0.generate(2)
+        self.sync_blocks()
+        assert_equal(utxo_set_info(node1), utxo_set_info(node0))
+        assert_equal(node1.getchaintxstats()['txcount'], node0.getchaintxstats()['txcount'])
+
+        self.log.info("Derive the same stake modifiers past the base")
+        assert_equal(node1.dumptxoutset('utxo2.dat')['snapshot_hash'], node0.dumptxoutset('utxo2.dat')['snapshot_hash'])
+
+        self.log.info("Refuse to start indexes that can't skip the blocks below the base")
+        self.stop_node(1)
+        node1.assert_start_raises_init_error(
+            ['-coinstatsindex'],
+            'Error: A UTXO set snapshot was loaded, which is incompatible with -coinstatsindex and -blockfilterindex')
+
+
+if __name__ == '__main__':
+    AssumeutxoTest().main()
@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+# Copyright (c) 2020 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the UTXO set statistics of -coinstatsindex.
+
+The node keeps the index while it mines and spends coins, while blocks are
+disconnected and connected again through invalidateblock and
+reconsiderblock, and across a restart. At every step, gettxoutsetinfo gives
+the same statistics from the index as from the UTXO set.
+"""
+from decimal import Decimal
+
+from test_framework.address import script_to_p2sh
+from test_framework.authproxy import JSONRPCException
+from test_framework.messages import (
+    CTransaction,
+    FromHex,
+    ToHex,
+)
+from test_framework.script import CScript, OP_TRUE
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    wait_until,
+)
+
+COINBASE_MATURITY = 25
+# Witnesses are refused in legacy mode, so spend a P2SH output instead
+REDEEM_SCRIPT = CScript([OP_TRUE])
+ADDRESS_P2SH_OP_TRUE = script_to_p2sh(REDEEM_SCRIPT)
+# The fields that gettxoutsetinfo reports both from the index and from the UTXO set
+STATS_FIELDS = ['height', 'bestblock', 'txouts', 'bogosize', 'muhash', 'total_amount']
+
+
+def spend(node, txid, vout):
+    """Spend an output paying to ADDRESS_P2SH_OP_TRUE into a spendable and an unspendable output."""
+    value = node.gettxout(txid, vout)['value']
+    tx = FromHex(CTransaction(), node.createrawtransaction(
+        [{'txid': txid, 'vout': vout}],
+        [{ADDRESS_P2SH_OP_TRUE: value - Decimal("0.001")}, {'data': 'ff'}]))
+    tx.vin[0].scriptSig = CScript([REDEEM_SCRIPT])
+    return node.sendrawtransaction(ToHex(tx))
+
+
+class CoinStatsIndexTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 1
+        self.extra_args = [['-coinstatsindex']]
+
+    def index_stats(self):
+        """Wait for the index to have the statistics of the tip, and return them."""
+        node = self.nodes[0]
+        stats = {}
+
+        def tip_indexed():
+            try:
+                stats.update(node.gettxoutsetinfo('muhash'))
+            except JSONRPCException:
+                return False
+            return stats['bestblock'] == node.getbestblockhash()
+        wait_until(tip_indexed, timeout=30)
+        return {field: stats[field] for field in STATS_FIELDS}
+
+    def check_stats(self):
+        """Check that the index and the UTXO set give the same statistics for the tip."""
+        node = self.nodes[0]
+        stats = self.index_stats()
+        utxo_set_stats = node.gettxoutsetinfo('muhash', None, False)
+        assert_equal(stats, {field: utxo_set_stats[field] for field in STATS_FIELDS})
+        return stats
+
+    def run_test(self):
+        node = self.nodes[0]
+
+        self.log.info("Mine blocks")
+        node.generatetoaddress(COINBASE_MATURITY + 2, ADDRESS_P2SH_OP_TRUE)
+        self.check_stats()
+
+        self.log.info("Spend coinbase outputs")
+        coinbase = node.getblock(node.getblockhash(1))['tx'][0]
+        spend_txid = spend(node, coinbase, 0)
+        node.generate(1)
+        self.check_stats()
+
+        self.log.info("Spend coinbase and non-coinbase outputs in the same block")
+        coinbase = node.getblock(node.getblockhash(2))['tx'][0]
+        spend(node, coinbase, 0)
+        spend(node, spend_txid, 0)
+        node.generate(1)
+        spent_tip = node.getbestblockhash()
+        spent_stats = self.check_stats()
+
+        self.log.info("Disconnect the tip with invalidateblock")
+        node.invalidateblock(spent_tip)
+        self.check_stats()
+
+        self.log.info("Rewind the index to connect a block on another branch")
+        # A coinbase to another address, so that the branches' UTXO sets differ
+        node.generatetoaddress(1, ADDRESS_P2SH_OP_TRUE)
+        fork_tip = node.getbestblockhash()
+        fork_stats = self.check_stats()
+        assert fork_stats['muhash'] != spent_stats['muhash']
+
+        self.log.info("Reorganize back to the first branch with reconsiderblock")
+        node.invalidateblock(fork_tip)
+        node.reconsiderblock(spent_tip)
+        assert_equal(node.getbestblockhash(), spent_tip)
+        assert_equal(self.check_stats(), spent_stats)
+
+        self.log.info("Keep the index across a restart")
+        self.restart_node(0)
+        assert_equal(self.check_stats(), spent_stats)
+        node.generate(1)
+        self.check_stats()
+
+
+if __name__ == '__main__':
+    CoinStatsIndexTest().main()
@@ -53,7 +53,7 @@ class BlockchainTest(BitcoinTestFramework):
 
     def run_test(self):
         self.mine_chain()
-        self.restart_node(0, extra_args=['-stopatheight=207', '-prune=1'])  # Set extra args with pruning after rescan is complete
+        self.restart_node(0, extra_args=['-stopatheight=207', '-prune=1', '-blockcheckthreads=2'])  # Set extra args with pruning after rescan is complete
 
         self._test_getblockchaininfo()
         self._test_getchaintxstats()
@@ -79,6 +79,7 @@ class BlockchainTest(BitcoinTestFramework):
 
         keys = [
             'bestblockhash',
+            'blockpipeline',
             'blocks',
             'chain',
             'chainwork',
@@ -241,6 +242,19 @@ class BlockchainTest(BitcoinTestFramework):
         del res['disk_size'], res3['disk_size']
         assert_equal(res, res3)
 
+        self.log.info("Test the hash_type option of gettxoutsetinfo()")
+        res4 = node.gettxoutsetinfo(hash_type='muhash')
+        assert_equal(len(res4['muhash']), 64)
+        assert 'hash_serialized_2' not in res4
+        del res3['hash_serialized_2'], res4['muhash'], res4['disk_size']
+        assert_equal(res3, res4)
+
+        res5 = node.gettxoutsetinfo(hash_type='none')
+        assert 'muhash' not in res5 and 'hash_serialized_2' not in res5
+
+        assert_raises_rpc_error(-8, "foo is not a valid hash_type", node.gettxoutsetinfo, "foo")
+        assert_raises_rpc_error(-8, "Querying specific block heights requires coinstatsindex", node.gettxoutsetinfo, "muhash", 100)
+
     def _test_getblockheader(self):
         node = self.nodes[0]
 
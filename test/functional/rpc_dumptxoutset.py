@@ -7,7 +7,6 @@
 from test_framework.test_framework import BitcoinTestFramework
 from test_framework.util import assert_equal, assert_raises_rpc_error
 
-import hashlib
 from pathlib import Path
 
 
@@ -21,7 +20,7 @@ class DumptxoutsetTest(BitcoinTestFramework):
         node = self.nodes[0]
         mocktime = node.getblockheader(node.getblockhash(0))['time'] + 1
         node.setmocktime(mocktime)
-        node.generate(100)
+        node.generate(26)
 
         FILENAME = 'txoutset.dat'
         out = node.dumptxoutset(FILENAME)
@@ -29,19 +28,23 @@ class DumptxoutsetTest(BitcoinTestFramework):
 
         assert expected_path.is_file()
 
-        assert_equal(out['coins_written'], 100)
-        assert_equal(out['base_height'], 100)
+        assert_equal(out['coins_written'], 26)
+        assert_equal(out['base_height'], 26)
         assert_equal(out['path'], str(expected_path))
         # Blockhash should be deterministic based on mocked time.
         assert_equal(
             out['base_hash'],
-            '6fd417acba2a8738b06fee43330c50d58e6a725046c3d843c8dd7e51d46d1ed6')
-
-        with open(str(expected_path), 'rb') as f:
-            digest = hashlib.sha256(f.read()).hexdigest()
-            # UTXO snapshot hash should be deterministic based on mocked time.
-            assert_equal(
-                digest, 'be032e5f248264ba08e11099ac09dbd001f6f87ffc68bf0f87043d8146d50664')
+            '00001c0c3d7872b72ba93747d400875c909fc176e48af7022629339634c82d15')
+
+        # The file holds the node's first stake modifier, which is not the same
+        # from one run to the next, so its digest can't be pinned. Dumping the
+        # same chain again gives the same snapshot.
+        out2 = node.dumptxoutset('txoutset2.dat')
+        assert_equal(out2['coins_written'], out['coins_written'])
+        assert_equal(out2['base_hash'], out['base_hash'])
+        assert_equal(out2['snapshot_hash'], out['snapshot_hash'])
+        with open(str(expected_path), 'rb') as f, open(out2['path'], 'rb') as f2:
+            assert f.read() == f2.read()
 
         # Specifying a path to an existing file will fail.
         assert_raises_rpc_error(
@@ -54,6 +54,14 @@ class RpcMiscTest(BitcoinTestFramework):
 
         assert_raises_rpc_error(-8, "unknown mode foobar", node.getmemoryinfo, mode="foobar")
 
+        self.log.info("test getleveldbstats")
+        dbstats = node.getleveldbstats()
+        chainstate = [db for db in dbstats if db['profile'] == 'chainstate']
+        assert_equal(len(chainstate), 1)
+        assert_equal(chainstate[0]['blockcachepercent'], 25)
+        assert_greater_than(len(chainstate[0]['levels']), 0)
+        assert_equal(len([db for db in dbstats if db['profile'] == 'blockindex']), 1)
+
         self.log.info("test logging")
         assert_equal(node.logging()['qt'], True)
         node.logging(exclude=['qt'])